@@ -0,0 +1,109 @@
+/**
+ * Copyright (c) 2017 Melown Technologies SE
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * *  Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * *  Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <new>
+
+#include "arena.hpp"
+
+namespace roarchive {
+
+namespace {
+
+class NewDeleteResource : public MemoryResource {
+public:
+    virtual void* allocate(std::size_t bytes, std::size_t) {
+        return ::operator new(bytes);
+    }
+
+    virtual void deallocate(void *p, std::size_t, std::size_t) {
+        ::operator delete(p);
+    }
+};
+
+/** Upper limit of chunk growth.
+ */
+constexpr std::size_t MaxChunk(64 << 20);
+
+} // namespace
+
+MemoryResource::pointer MemoryResource::newDelete()
+{
+    static auto resource(std::make_shared<NewDeleteResource>());
+    return resource;
+}
+
+struct Arena::Chunk {
+    Chunk *prev;
+    std::size_t size;
+};
+
+Arena::Arena(const MemoryResource::pointer &upstream
+             , std::size_t initialChunk)
+    : upstream_(upstream ? upstream : MemoryResource::newDelete())
+    , head_(), ptr_(), end_(), next_(initialChunk)
+    , reserved_(), used_()
+{}
+
+Arena::~Arena()
+{
+    while (head_) {
+        auto *prev(head_->prev);
+        upstream_->deallocate(head_, head_->size
+                              , alignof(std::max_align_t));
+        head_ = prev;
+    }
+}
+
+void Arena::grow(std::size_t size)
+{
+    // room for header and worst-case alignment
+    size += sizeof(Chunk) + alignof(std::max_align_t);
+    const auto chunkSize(std::max(size, next_));
+
+    auto *chunk(static_cast<Chunk*>
+                (upstream_->allocate(chunkSize, alignof(std::max_align_t))));
+    chunk->prev = head_;
+    chunk->size = chunkSize;
+    head_ = chunk;
+
+    ptr_ = reinterpret_cast<char*>(chunk + 1);
+    end_ = reinterpret_cast<char*>(chunk) + chunkSize;
+    reserved_ += chunkSize;
+    next_ = std::min(2 * next_, MaxChunk);
+}
+
+void Arena::reserve(std::size_t size)
+{
+    if (ptr_ && ((ptr_ + size) <= end_)) { return; }
+    grow(size);
+}
+
+void* Arena::allocateSlow(std::size_t size, std::size_t alignment)
+{
+    grow(size + alignment);
+    return allocate(size, alignment);
+}
+
+} // namespace roarchive
@@ -0,0 +1,228 @@
+/**
+ * Copyright (c) 2017 Melown Technologies SE
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * *  Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * *  Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef roarchive_arena_hpp_included_
+#define roarchive_arena_hpp_included_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#include <boost/utility/string_ref.hpp>
+
+#include "memory.hpp"
+
+namespace roarchive {
+
+/** Internal: monotonic arena. Memory is taken from upstream resource in
+ *  geometrically growing chunks and released only when the arena is
+ *  destroyed. Individual deallocation is a no-op.
+ *
+ *  Not thread safe; arenas are filled during index build and read-only
+ *  afterwards.
+ */
+class Arena {
+public:
+    Arena(const MemoryResource::pointer &upstream = MemoryResource::pointer()
+          , std::size_t initialChunk = (64 << 10));
+    ~Arena();
+
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+
+    void* allocate(std::size_t size
+                   , std::size_t alignment = alignof(std::max_align_t))
+    {
+        auto *p(align(ptr_, alignment));
+        if (!p || ((p + size) > end_)) { return allocateSlow(size, alignment); }
+        ptr_ = p + size;
+        used_ += size;
+        return p;
+    }
+
+    /** Makes sure at least given number of bytes can be allocated without
+     *  asking upstream. Used when final size is known ahead.
+     */
+    void reserve(std::size_t size);
+
+    /** Copies string into arena.
+     */
+    boost::string_ref copy(boost::string_ref str) {
+        auto *data(static_cast<char*>(allocate(str.size(), 1)));
+        std::copy(str.begin(), str.end(), data);
+        return boost::string_ref(data, str.size());
+    }
+
+    /** Bytes obtained from upstream.
+     */
+    std::size_t reserved() const { return reserved_; }
+
+    /** Bytes handed out.
+     */
+    std::size_t used() const { return used_; }
+
+private:
+    static char* align(char *p, std::size_t alignment) {
+        if (!p) { return p; }
+        const auto value(reinterpret_cast<std::uintptr_t>(p));
+        return p + ((alignment - (value % alignment)) % alignment);
+    }
+
+    void* allocateSlow(std::size_t size, std::size_t alignment);
+
+    void grow(std::size_t size);
+
+    struct Chunk;
+
+    MemoryResource::pointer upstream_;
+    Chunk *head_;
+    char *ptr_;
+    char *end_;
+    std::size_t next_;
+    std::size_t reserved_;
+    std::size_t used_;
+};
+
+/** STL allocator on top of Arena.
+ */
+template <typename T>
+class ArenaAllocator {
+public:
+    typedef T value_type;
+
+    ArenaAllocator(Arena &arena) : arena_(&arena) {}
+
+    template <typename U>
+    ArenaAllocator(const ArenaAllocator<U> &o) : arena_(o.arena()) {}
+
+    T* allocate(std::size_t n) {
+        return static_cast<T*>(arena_->allocate(n * sizeof(T), alignof(T)));
+    }
+
+    void deallocate(T*, std::size_t) {}
+
+    Arena* arena() const { return arena_; }
+
+    template <typename U>
+    bool operator==(const ArenaAllocator<U> &o) const {
+        return arena_ == o.arena();
+    }
+
+    template <typename U>
+    bool operator!=(const ArenaAllocator<U> &o) const {
+        return arena_ != o.arena();
+    }
+
+private:
+    Arena *arena_;
+};
+
+/** Sorted path -> value index living entirely in its own arena. Keys are
+ *  copied into the arena, items are kept in a flat sorted array.
+ *
+ *  Usage: reserve(), add() all entries, finish(); then find().
+ *  Value must be trivially destructible.
+ */
+template <typename Value>
+class ArenaIndex {
+public:
+    struct Item {
+        boost::string_ref key;
+        Value value;
+
+        Item(boost::string_ref key, const Value &value)
+            : key(key), value(value) {}
+
+        bool operator<(const Item &o) const { return key < o.key; }
+    };
+
+    typedef std::vector<Item, ArenaAllocator<Item> > Items;
+    typedef typename Items::const_iterator const_iterator;
+
+    ArenaIndex(const MemoryResource::pointer &upstream)
+        : arena_(upstream), items_(ArenaAllocator<Item>(arena_))
+        , sorted_()
+    {}
+
+    /** Reserves space for given number of items with keys of given total
+     *  length.
+     */
+    void reserve(std::size_t count, std::size_t keys) {
+        arena_.reserve(count * sizeof(Item) + alignof(Item) + keys);
+        items_.reserve(count);
+    }
+
+    void add(boost::string_ref key, const Value &value) {
+        items_.emplace_back(arena_.copy(key), value);
+    }
+
+    /** Sorts items added since last finish() and merges them into already
+     *  sorted ones. First occurrence of duplicate key wins (earlier added
+     *  items win over later ones).
+     */
+    void finish() {
+        const auto middle(items_.begin() + sorted_);
+        std::stable_sort(middle, items_.end());
+        std::inplace_merge(items_.begin(), middle, items_.end());
+        items_.erase(std::unique(items_.begin(), items_.end()
+                                 , [](const Item &l, const Item &r) {
+                                     return l.key == r.key;
+                                 })
+                     , items_.end());
+        sorted_ = items_.size();
+    }
+
+    const Value* find(boost::string_ref key) const {
+        auto fitems(std::lower_bound
+                    (items_.begin(), items_.end(), key
+                     , [](const Item &item, boost::string_ref key) {
+                         return item.key < key;
+                     }));
+        if ((fitems == items_.end()) || (fitems->key != key)) {
+            return nullptr;
+        }
+        return &fitems->value;
+    }
+
+    const_iterator begin() const { return items_.begin(); }
+    const_iterator end() const { return items_.end(); }
+    std::size_t size() const { return items_.size(); }
+
+    const Arena& arena() const { return arena_; }
+
+private:
+    Arena arena_;
+    Items items_;
+
+    /** Number of sorted items (at the front).
+     */
+    std::size_t sorted_;
+};
+
+} // namespace roarchive
+
+#endif // roarchive_arena_hpp_included_
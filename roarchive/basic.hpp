@@ -0,0 +1,198 @@
+/**
+ * Copyright (c) 2017 Melown Technologies SE
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * *  Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * *  Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef roarchive_basic_hpp_included_
+#define roarchive_basic_hpp_included_
+
+#include <memory>
+
+#include "dbglog/dbglog.hpp"
+
+#include "roarchive.hpp"
+#include "error.hpp"
+#include "detail.hpp"
+#include "directory.hpp"
+#include "tarball.hpp"
+#include "zip.hpp"
+#ifdef ROARCHIVE_HAS_HTTP
+#  include "http.hpp"
+#endif
+
+namespace roarchive {
+
+/** Read-only archive with backend known at compile time.
+ *
+ *  Same interface as RoArchive but every call goes directly to the concrete
+ *  (final) backend class, without virtual dispatch, so lookup and stream
+ *  construction can be inlined into the caller.
+ *
+ *  Backend is one of Directory, Tarball, Zip and Http (if compiled in).
+ *  Obtain one either by opening a path directly or via RoArchive::visit().
+ */
+template <typename BackendType>
+class BasicRoArchive {
+public:
+    typedef BackendType backend_type;
+    typedef std::shared_ptr<BackendType> pointer;
+
+    /** Opens archive at given path. Unlike RoArchive, there is no format
+     *  detection and inline hint is not applied.
+     */
+    BasicRoArchive(const boost::filesystem::path &path
+                   , const OpenOptions &openOptions = OpenOptions())
+        : detail_(std::make_shared<BackendType>(path, openOptions))
+    {}
+
+    /** Wraps existing backend instance.
+     */
+    explicit BasicRoArchive(pointer detail)
+        : detail_(std::move(detail))
+    {}
+
+    bool exists(const boost::filesystem::path &path) const {
+        return detail_->exists(path);
+    }
+
+    boost::optional<boost::filesystem::path>
+    findFile(const std::string &filename) const {
+        return detail_->findFile(filename);
+    }
+
+    IStream::pointer istream(const boost::filesystem::path &path) const {
+        return openIStream(*detail_, path, {}, std::string());
+    }
+
+    IStream::pointer istream(const boost::filesystem::path &path
+                             , const IStream::FilterInit &filterInit) const
+    {
+        if (filterInit) { return openIStream(*detail_, path, filterInit); }
+        return openIStream(*detail_, path, filterInit, std::string());
+    }
+
+    IStream::pointer istream(const boost::filesystem::path &path
+                             , const IStream::FilterInit &filterInit
+                             , const std::string &filterKey) const
+    {
+        return openIStream(*detail_, path, filterInit, filterKey);
+    }
+
+    boost::optional<RawFile>
+    openRaw(const boost::filesystem::path &path) const {
+        auto raw(detail_->openRaw(path));
+        if (raw && !raw->holder) { raw->holder = detail_; }
+        return raw;
+    }
+
+    bool directio() const { return detail_->directio(); }
+
+    boost::filesystem::path path() const { return detail_->path(); }
+
+    boost::filesystem::path path(const boost::filesystem::path &path) const {
+        return path.is_absolute() ? path : (detail_->path() / path);
+    }
+
+    Files list() const { return detail_->list(); }
+
+    BasicRoArchive& applyHint(const FileHint &hint = FileHint()) {
+        detail_->applyHint(hint);
+        return *this;
+    }
+
+    DatasetRoots discover(const FileHint &hint) const {
+        return detail_->discover(hint);
+    }
+
+    bool changed() const { return detail_->changed(); }
+
+    bool refresh() { return detail_->refresh(); }
+
+    boost::optional<boost::filesystem::path> usedHint() const {
+        return detail_->usedHint();
+    }
+
+    bool handlesSchema(const std::string &schema) const {
+        return detail_->handlesSchema(schema);
+    }
+
+    Backend backend() const { return detail_->backend(); }
+
+    MemoryUsage memoryUsage() const { return detail_->memoryUsage(); }
+
+    /** Concrete backend.
+     */
+    const pointer& detail() const { return detail_; }
+
+private:
+    pointer detail_;
+};
+
+typedef BasicRoArchive<Directory> DirectoryArchive;
+typedef BasicRoArchive<Tarball> TarballArchive;
+typedef BasicRoArchive<Zip> ZipArchive;
+#ifdef ROARCHIVE_HAS_HTTP
+typedef BasicRoArchive<Http> HttpArchive;
+#endif
+
+template <typename Visitor>
+auto RoArchive::visit(Visitor &&visitor) const
+    -> decltype(visitor(std::declval<BasicRoArchive<Directory>&>()))
+{
+    switch (detail_->backend()) {
+    case Backend::directory: {
+        BasicRoArchive<Directory> archive
+            (std::static_pointer_cast<Directory>(detail_));
+        return visitor(archive);
+    }
+
+    case Backend::tarball: {
+        BasicRoArchive<Tarball> archive
+            (std::static_pointer_cast<Tarball>(detail_));
+        return visitor(archive);
+    }
+
+    case Backend::zip: {
+        BasicRoArchive<Zip> archive(std::static_pointer_cast<Zip>(detail_));
+        return visitor(archive);
+    }
+
+#ifdef ROARCHIVE_HAS_HTTP
+    case Backend::http: {
+        BasicRoArchive<Http> archive(std::static_pointer_cast<Http>(detail_));
+        return visitor(archive);
+    }
+#else
+    case Backend::http: break;
+#endif
+    }
+
+    LOGTHROW(err2, NotImplemented)
+        << "Backend <" << int(detail_->backend())
+        << "> not compiled in.";
+    throw;
+}
+
+} // namespace roarchive
+
+#endif // roarchive_basic_hpp_included_
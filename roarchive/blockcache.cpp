@@ -0,0 +1,299 @@
+/**
+ * Copyright (c) 2017 Melown Technologies SE
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * *  Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * *  Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <system_error>
+
+#include "dbglog/dbglog.hpp"
+
+#include "blockcache.hpp"
+#include "error.hpp"
+
+namespace fs = boost::filesystem;
+
+namespace roarchive {
+
+namespace {
+
+int openCacheFile(const fs::path &path)
+{
+    if (!path.empty()) {
+        const auto fd(::open(path.c_str()
+                             , O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC
+                             , 0600));
+        if (fd < 0) {
+            std::system_error e(errno, std::system_category());
+            LOGTHROW(err2, IOError)
+                << "Cannot create block cache file " << path
+                << ": <" << e.code() << ", " << e.what() << ">.";
+        }
+        return fd;
+    }
+
+    const char *tmp(std::getenv("TMPDIR"));
+    const fs::path dir((tmp && *tmp) ? tmp : "/tmp");
+    const auto fd(::open(dir.c_str(), O_RDWR | O_TMPFILE | O_CLOEXEC
+                         , 0600));
+    if (fd < 0) {
+        std::system_error e(errno, std::system_category());
+        LOGTHROW(err2, IOError)
+            << "Cannot create anonymous block cache file in " << dir
+            << ": <" << e.code() << ", " << e.what() << ">.";
+    }
+    return fd;
+}
+
+} // namespace
+
+BlockCache::BlockCache(const Config &config)
+    : blockSize_(std::max<std::size_t>(config.blockSize, 1))
+    , path_(config.file), fd_(openCacheFile(path_))
+    , slots_(std::max<std::uint64_t>(config.budget / blockSize_, 1))
+{
+    // sparse, disk space is allocated as blocks are written
+    if (::ftruncate(fd_, std::uint64_t(slots_.size()) * blockSize_) < 0) {
+        std::system_error e(errno, std::system_category());
+        ::close(fd_);
+        if (!path_.empty()) { ::unlink(path_.c_str()); }
+        LOGTHROW(err2, IOError)
+            << "Cannot size block cache file " << path_
+            << ": <" << e.code() << ", " << e.what() << ">.";
+    }
+
+    free_.reserve(slots_.size());
+    for (auto slot(slots_.size()); slot; --slot) {
+        free_.push_back(slot - 1);
+    }
+
+    stats_.budget = std::uint64_t(slots_.size()) * blockSize_;
+    stats_.blockSize = blockSize_;
+}
+
+BlockCache::~BlockCache()
+{
+    ::close(fd_);
+    if (!path_.empty()) { ::unlink(path_.c_str()); }
+}
+
+std::size_t BlockCache::read(const std::string &resource
+                             , std::uint64_t offset, char *buf
+                             , std::size_t size, const Fetch &fetch)
+{
+    std::size_t done(0);
+    while (done < size) {
+        const auto position(offset + done);
+        const auto skip(position % blockSize_);
+        const auto wanted(std::min<std::size_t>
+                          (size - done, blockSize_ - skip));
+
+        const auto got(block(resource, position / blockSize_, skip
+                             , buf + done, wanted, fetch));
+        done += got;
+
+        // end of resource
+        if (got < wanted) { break; }
+    }
+    return done;
+}
+
+std::size_t BlockCache::block(const std::string &resource
+                              , std::uint64_t index, std::size_t skip
+                              , char *buf, std::size_t size
+                              , const Fetch &fetch)
+{
+    const auto copySize([&](std::size_t length) -> std::size_t
+    {
+        return (length > skip) ? std::min(size, length - skip) : 0;
+    });
+
+    Key key{ resource, index };
+    std::unique_lock<std::mutex> lock(mutex_);
+
+    const auto fmap(map_.find(key));
+    if (fmap != map_.end()) {
+        // hit: pin and read outside lock
+        const auto cached(fmap->second);
+        auto &slot(slots_[cached]);
+        ++slot.refs;
+        lru_.splice(lru_.begin(), lru_, slot.lru);
+        ++stats_.hits;
+        const auto copy(copySize(slot.length));
+        lock.unlock();
+
+        std::exception_ptr error;
+        try {
+            pread(buf, copy, std::uint64_t(cached) * blockSize_ + skip);
+        } catch (...) {
+            error = std::current_exception();
+        }
+
+        lock.lock();
+        if (!--slot.refs && !slot.mapped) { free_.push_back(cached); }
+        if (error) { std::rethrow_exception(error); }
+        return copy;
+    }
+
+    // miss: reserve slot (if any) and fetch whole block outside lock
+    ++stats_.misses;
+    const auto slot(allocate());
+    if (slot >= 0) {
+        slots_[slot].refs = 1;
+    } else {
+        ++stats_.bypasses;
+    }
+    lock.unlock();
+
+    static thread_local std::vector<char> data;
+    data.resize(blockSize_);
+
+    std::size_t length(0);
+    try {
+        length = fetch(index * blockSize_, data.data(), blockSize_);
+        if ((slot >= 0) && length) {
+            pwrite(data.data(), length, std::uint64_t(slot) * blockSize_);
+        }
+    } catch (...) {
+        if (slot >= 0) {
+            lock.lock();
+            slots_[slot].refs = 0;
+            free_.push_back(slot);
+        }
+        throw;
+    }
+
+    const auto copy(copySize(length));
+    std::memcpy(buf, data.data() + std::min(skip, length), copy);
+
+    if (slot >= 0) {
+        lock.lock();
+        auto &s(slots_[slot]);
+        s.refs = 0;
+        if (!length || map_.count(key)) {
+            // nothing to cache or concurrent reader was faster
+            free_.push_back(slot);
+        } else {
+            s.length = length;
+            s.mapped = true;
+            lru_.push_front(slot);
+            s.lru = lru_.begin();
+            s.key = std::move(key);
+            map_.emplace(s.key, slot);
+            ++stats_.blocks;
+            stats_.bytes += length;
+        }
+    }
+
+    return copy;
+}
+
+long BlockCache::allocate()
+{
+    if (free_.empty()) {
+        // evict least recently used unpinned block
+        for (auto ilru(lru_.rbegin()); ilru != lru_.rend(); ++ilru) {
+            if (!slots_[*ilru].refs) {
+                unmap(*ilru);
+                ++stats_.evictions;
+                break;
+            }
+        }
+        if (free_.empty()) { return -1; }
+    }
+
+    const auto slot(free_.back());
+    free_.pop_back();
+    return slot;
+}
+
+void BlockCache::unmap(std::size_t index)
+{
+    auto &slot(slots_[index]);
+    map_.erase(slot.key);
+    lru_.erase(slot.lru);
+    slot.mapped = false;
+    --stats_.blocks;
+    stats_.bytes -= slot.length;
+    slot.length = 0;
+    if (!slot.refs) { free_.push_back(index); }
+}
+
+void BlockCache::invalidate(const std::string &resource)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto ilru(lru_.begin()); ilru != lru_.end(); ) {
+        const auto index(*ilru++);
+        if (slots_[index].key.resource == resource) { unmap(index); }
+    }
+}
+
+BlockCache::Stats BlockCache::stats() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return stats_;
+}
+
+void BlockCache::pread(char *buf, std::size_t size, std::uint64_t offset)
+    const
+{
+    while (size) {
+        const auto r(::pread(fd_, buf, size, offset));
+        if (r <= 0) {
+            if ((r < 0) && (errno == EINTR)) { continue; }
+            std::system_error e(r ? errno : EIO, std::system_category());
+            LOGTHROW(err2, IOError)
+                << "Cannot read from block cache file " << path_
+                << ": <" << e.code() << ", " << e.what() << ">.";
+        }
+        buf += r;
+        size -= r;
+        offset += r;
+    }
+}
+
+void BlockCache::pwrite(const char *buf, std::size_t size
+                        , std::uint64_t offset) const
+{
+    while (size) {
+        const auto r(::pwrite(fd_, buf, size, offset));
+        if (r < 0) {
+            if (errno == EINTR) { continue; }
+            std::system_error e(errno, std::system_category());
+            LOGTHROW(err2, IOError)
+                << "Cannot write to block cache file " << path_
+                << ": <" << e.code() << ", " << e.what() << ">.";
+        }
+        buf += r;
+        size -= r;
+        offset += r;
+    }
+}
+
+} // namespace roarchive
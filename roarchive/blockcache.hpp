@@ -0,0 +1,212 @@
+/**
+ * Copyright (c) 2017 Melown Technologies SE
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * *  Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * *  Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef roarchive_blockcache_hpp_included_
+#define roarchive_blockcache_hpp_included_
+
+#include <list>
+#include <mutex>
+#include <memory>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <functional>
+#include <unordered_map>
+
+#include <boost/filesystem/path.hpp>
+
+namespace roarchive {
+
+/** Local disk cache of remote byte ranges.
+ *
+ *  Resources are split into fixed-size aligned blocks. Blocks are stored
+ *  in slots of one sparse local file (sized to the budget, disk space is
+ *  allocated as slots are written); an extent map translates (resource,
+ *  block) to slot. Least recently used blocks are evicted when the budget
+ *  is exhausted, their slots are reused.
+ *
+ *  Resource identity is up to the caller; it should change when remote
+ *  content does (e.g. include size or entity tag).
+ */
+class BlockCache {
+public:
+    typedef std::shared_ptr<BlockCache> pointer;
+
+    struct Config {
+        /** Cache file, anonymous temporary file in TMPDIR if empty.
+         *  Existing content is discarded, file is removed when the cache is
+         *  destroyed.
+         */
+        boost::filesystem::path file;
+
+        /** Maximum size of cached data.
+         */
+        std::uint64_t budget;
+
+        /** Block size, also granularity of remote reads.
+         */
+        std::size_t blockSize;
+
+        Config() : budget(std::uint64_t(1) << 30), blockSize(1 << 20) {}
+
+        Config& setFile(boost::filesystem::path v) {
+            file = std::move(v); return *this;
+        }
+
+        Config& setBudget(std::uint64_t v) { budget = v; return *this; }
+
+        Config& setBlockSize(std::size_t v) { blockSize = v; return *this; }
+    };
+
+    BlockCache(const Config &config = Config());
+    ~BlockCache();
+
+    BlockCache(const BlockCache&) = delete;
+    BlockCache& operator=(const BlockCache&) = delete;
+
+    /** Fetches given range of remote resource into buffer, returns number
+     *  of bytes fetched (less than size only at end of resource).
+     */
+    typedef std::function<std::size_t(std::uint64_t offset, char *buf
+                                      , std::size_t size)> Fetch;
+
+    /** Reads range of given resource, missing blocks are fetched (whole)
+     *  and cached. Returns number of bytes read, less than size only at end
+     *  of resource. Safe to call from multiple threads.
+     */
+    std::size_t read(const std::string &resource, std::uint64_t offset
+                     , char *buf, std::size_t size, const Fetch &fetch);
+
+    /** Drops all blocks of given resource.
+     */
+    void invalidate(const std::string &resource);
+
+    struct Stats {
+        /** Blocks served from cache, fetched blocks and evicted blocks.
+         */
+        std::uint64_t hits;
+        std::uint64_t misses;
+        std::uint64_t evictions;
+
+        /** Blocks fetched without caching (all slots were being read).
+         */
+        std::uint64_t bypasses;
+
+        /** Cached blocks and their (valid) bytes.
+         */
+        std::size_t blocks;
+        std::uint64_t bytes;
+
+        std::uint64_t budget;
+        std::size_t blockSize;
+
+        Stats()
+            : hits(), misses(), evictions(), bypasses(), blocks(), bytes()
+            , budget(), blockSize()
+        {}
+    };
+
+    Stats stats() const;
+
+    std::size_t blockSize() const { return blockSize_; }
+
+private:
+    struct Key {
+        std::string resource;
+        std::uint64_t block;
+
+        bool operator==(const Key &o) const {
+            return (block == o.block) && (resource == o.resource);
+        }
+    };
+
+    struct KeyHash {
+        std::size_t operator()(const Key &key) const {
+            return (std::hash<std::string>()(key.resource)
+                    ^ (std::hash<std::uint64_t>()(key.block) * 31));
+        }
+    };
+
+    /** Cache file slot holding one block.
+     */
+    struct Slot {
+        Key key;
+
+        /** Valid bytes (last block of resource can be short).
+         */
+        std::size_t length;
+
+        /** Readers (or writer) of the slot, pinned slot is never reused.
+         */
+        unsigned int refs;
+
+        /** Slot is in map_ and lru_.
+         */
+        bool mapped;
+        std::list<std::size_t>::iterator lru;
+
+        Slot() : length(), refs(), mapped(false) {}
+    };
+
+    /** Obtains block from cache (pinned slot) or fetches it. Returns bytes
+     *  copied into buf.
+     */
+    std::size_t block(const std::string &resource, std::uint64_t block
+                      , std::size_t skip, char *buf, std::size_t size
+                      , const Fetch &fetch);
+
+    /** Finds slot for new block: free one or least recently used unpinned
+     *  one. Called locked, returns -1 if there is none.
+     */
+    long allocate();
+
+    /** Unmaps slot's block, slot is freed once unpinned. Called locked.
+     */
+    void unmap(std::size_t slot);
+
+    void pread(char *buf, std::size_t size, std::uint64_t offset) const;
+    void pwrite(const char *buf, std::size_t size, std::uint64_t offset)
+        const;
+
+    const std::size_t blockSize_;
+    const boost::filesystem::path path_;
+    int fd_;
+
+    mutable std::mutex mutex_;
+    std::vector<Slot> slots_;
+    std::vector<std::size_t> free_;
+
+    /** Mapped slots, most recently used first.
+     */
+    std::list<std::size_t> lru_;
+
+    std::unordered_map<Key, std::size_t, KeyHash> map_;
+
+    Stats stats_;
+};
+
+} // namespace roarchive
+
+#endif // roarchive_blockcache_hpp_included_
@@ -0,0 +1,443 @@
+/**
+ * Copyright (c) 2017 Melown Technologies SE
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * *  Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * *  Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <list>
+#include <mutex>
+#include <unordered_map>
+#include <algorithm>
+#include <cstring>
+
+#include <boost/optional.hpp>
+#include <boost/iostreams/device/array.hpp>
+
+#include "utility/cppversion.hpp"
+
+#include "cache.hpp"
+#include "hash.hpp"
+
+namespace fs = boost::filesystem;
+namespace bio = boost::iostreams;
+
+namespace roarchive {
+
+namespace {
+
+class CachedIStream : public IStream {
+public:
+    CachedIStream(const ContentCache::Content::pointer &content)
+        : IStream({}, content->size, true, content->timestamp)
+        , content_(content)
+    {
+        fis_.push(bio::array_source(content_->data, content_->size));
+        enableReadWhole();
+    }
+
+    virtual fs::path path() const { return content_->path; }
+    virtual fs::path index() const { return content_->index; }
+    virtual void close() {}
+
+private:
+    virtual std::vector<char> readWhole() {
+        return { content_->data, content_->data + content_->size };
+    }
+
+    ContentCache::Content::pointer content_;
+};
+
+/** Stream over already read prefix followed by the rest of the original
+ *  stream. Used for files found too big to be cached while being read.
+ */
+class PrefixedIStream : public IStream {
+public:
+    PrefixedIStream(std::vector<char> prefix, IStream::pointer is)
+        : IStream({}, boost::none, false, is->timestamp())
+        , path_(is->path()), index_(is->index())
+        , state_(std::make_shared<State>(std::move(prefix), std::move(is)))
+    {
+        fis_.push(Source(state_));
+    }
+
+    virtual fs::path path() const { return path_; }
+    virtual fs::path index() const { return index_; }
+    virtual void close() { state_->is->close(); }
+
+private:
+    struct State {
+        std::vector<char> prefix;
+        std::size_t served;
+        IStream::pointer is;
+
+        State(std::vector<char> prefix, IStream::pointer is)
+            : prefix(std::move(prefix)), served(), is(std::move(is))
+        {}
+    };
+
+    /** Devices are copied when pushed, state is shared.
+     */
+    class Source {
+    public:
+        typedef char char_type;
+        typedef bio::source_tag category;
+
+        Source(const std::shared_ptr<State> &state) : state_(state) {}
+
+        std::streamsize read(char *s, std::streamsize n) {
+            auto &state(*state_);
+            if (state.served < state.prefix.size()) {
+                const auto size(std::min<std::size_t>
+                                (n, state.prefix.size() - state.served));
+                std::copy(state.prefix.data() + state.served
+                          , state.prefix.data() + state.served + size, s);
+                state.served += size;
+                if (state.served == state.prefix.size()) {
+                    // prefix served, release memory
+                    std::vector<char>().swap(state.prefix);
+                    state.served = 0;
+                }
+                return size;
+            }
+
+            const auto got(state.is->get().rdbuf()->sgetn(s, n));
+            return got ? got : -1;
+        }
+
+    private:
+        std::shared_ptr<State> state_;
+    };
+
+    const fs::path path_;
+    const fs::path index_;
+    std::shared_ptr<State> state_;
+};
+
+/** Unknown size files are read in chunks of this size.
+ */
+constexpr std::size_t FillChunkSize(1 << 16);
+
+std::size_t charge(const ContentCache::Content &content)
+{
+    // data plus rough bookkeeping overhead
+    return content.size + 256;
+}
+
+} // namespace
+
+ContentCache::Content::pointer
+ContentCache::Content::make(std::vector<char> data, const fs::path &path
+                            , const fs::path &index, std::time_t timestamp)
+{
+    auto buffer(std::make_shared<std::vector<char>>(std::move(data)));
+    auto content(std::make_shared<Content>());
+    content->data = buffer->data();
+    content->size = buffer->size();
+    content->path = path;
+    content->index = index;
+    content->timestamp = timestamp;
+    content->storage = std::move(buffer);
+    return content;
+}
+
+std::string ContentCache::Key::flat() const
+{
+    // NUL cannot appear in paths
+    std::string flat;
+    flat.reserve(archive.size() + path.size() + filter.size() + 2);
+    flat.append(archive);
+    flat.push_back('\0');
+    flat.append(path);
+    flat.push_back('\0');
+    flat.append(filter);
+    return flat;
+}
+
+IStream::pointer ContentCache::fill(const Key &key, IStream::pointer is)
+{
+    const auto size(is->size());
+    if (size && (*size > maxEntry())) { return is; }
+
+    std::vector<char> data;
+    if (size) {
+        data = is->read();
+    } else {
+        // unknown size (e.g. filtered): stop as soon as it cannot fit
+        auto *sb(is->get().rdbuf());
+        for (;;) {
+            const auto used(data.size());
+            data.resize(used + FillChunkSize);
+            const auto got(sb->sgetn(data.data() + used, FillChunkSize));
+            data.resize(used + got);
+            if (data.size() > maxEntry()) {
+                auto prefixed(std::make_unique<PrefixedIStream>
+                              (std::move(data), std::move(is)));
+                prefixed->get().exceptions
+                    (std::ios::badbit | std::ios::failbit);
+                return prefixed;
+            }
+            if (std::size_t(got) < FillChunkSize) { break; }
+        }
+    }
+
+    auto content(Content::make(std::move(data), is->path(), is->index()
+                               , is->timestamp()));
+    is->close();
+
+    put(key, content);
+    return istream(content);
+}
+
+IStream::pointer ContentCache::istream(const Content::pointer &content)
+{
+    auto is(std::make_unique<CachedIStream>(content));
+    is->get().exceptions(std::ios::badbit | std::ios::failbit);
+    return is;
+}
+
+struct MemoryContentCache::Item {
+    std::string key;
+    Content::pointer content;
+
+    /** Digest of shared blob, unset if content is not shared.
+     */
+    boost::optional<hash::Digest> blob;
+};
+
+struct MemoryContentCache::Shard {
+    typedef std::list<Item> Lru;
+
+    std::mutex mutex;
+    Lru lru;
+    std::unordered_map<std::string, Lru::iterator> map;
+    Stats stats;
+};
+
+/** Unique payloads, each shared by all entries with the same content.
+ */
+struct MemoryContentCache::Blobs {
+    struct Blob {
+        const char *data;
+        std::size_t size;
+        std::shared_ptr<const void> storage;
+
+        /** Number of entries referencing this blob.
+         */
+        std::size_t refs;
+    };
+
+    std::mutex mutex;
+    std::unordered_map<hash::Digest, Blob> map;
+};
+
+MemoryContentCache::MemoryContentCache(std::size_t budget
+                                       , unsigned int shards
+                                       , std::size_t maxEntry)
+    : budget_(budget), shardCount_(std::max(shards, 1u))
+    , maxEntry_(maxEntry ? maxEntry : (budget / shardCount_ / 8))
+    , shards_(new Shard[shardCount_])
+    , blobs_(new Blobs), limit_(budget), charged_(0), cursor_(0)
+    , deduplicated_(0)
+{}
+
+MemoryContentCache::~MemoryContentCache() {}
+
+MemoryContentCache::Shard& MemoryContentCache::shard(const std::string &key)
+{
+    return shards_[std::hash<std::string>()(key) % shardCount_];
+}
+
+ContentCache::Content::pointer MemoryContentCache::get(const Key &key)
+{
+    const auto flat(key.flat());
+    auto &shard(this->shard(flat));
+
+    std::unique_lock<std::mutex> lock(shard.mutex);
+    auto fmap(shard.map.find(flat));
+    if (fmap == shard.map.end()) {
+        ++shard.stats.misses;
+        return {};
+    }
+
+    // move to front
+    shard.lru.splice(shard.lru.begin(), shard.lru, fmap->second);
+    ++shard.stats.hits;
+    return fmap->second->content;
+}
+
+void MemoryContentCache::share(Item &item, const hash::Digest &digest)
+{
+    auto &content(*item.content);
+
+    std::unique_lock<std::mutex> lock(blobs_->mutex);
+    auto fblobs(blobs_->map.find(digest));
+    if (fblobs == blobs_->map.end()) {
+        blobs_->map.insert(std::make_pair
+                           (digest, Blobs::Blob{ content.data, content.size
+                                                 , content.storage, 1 }));
+        item.blob = digest;
+        charged_ += charge(content);
+        return;
+    }
+
+    auto &blob(fblobs->second);
+    if ((blob.size != content.size)
+        || std::memcmp(blob.data, content.data, content.size))
+    {
+        // hash collision: keep this one private
+        charged_ += charge(content);
+        return;
+    }
+
+    // same payload: point to shared blob
+    auto shared(std::make_shared<Content>(content));
+    shared->data = blob.data;
+    shared->storage = blob.storage;
+    item.content = shared;
+    item.blob = digest;
+    ++blob.refs;
+    ++deduplicated_;
+    charged_ += charge(Content());
+}
+
+void MemoryContentCache::release(Item &item)
+{
+    if (!item.blob) {
+        charged_ -= charge(*item.content);
+        return;
+    }
+
+    std::shared_ptr<const void> storage;
+    {
+        std::unique_lock<std::mutex> lock(blobs_->mutex);
+        auto fblobs(blobs_->map.find(*item.blob));
+        if (!--fblobs->second.refs) {
+            // last reference, payload is gone
+            charged_ -= charge(*item.content);
+            storage = std::move(fblobs->second.storage);
+            blobs_->map.erase(fblobs);
+        } else {
+            charged_ -= charge(Content());
+        }
+    }
+    item.blob = boost::none;
+}
+
+void MemoryContentCache::put(const Key &key
+                             , const Content::pointer &content)
+{
+    if (!content || (content->size > maxEntry_)) { return; }
+
+    const auto flat(key.flat());
+    auto &shard(this->shard(flat));
+    const auto digest(hash::murmur3(content->data, content->size));
+
+    {
+        // dropped content is released outside the lock
+        Item dropped;
+
+        std::unique_lock<std::mutex> lock(shard.mutex);
+
+        auto fmap(shard.map.find(flat));
+        if (fmap != shard.map.end()) {
+            // replace
+            auto &item(*fmap->second);
+            release(item);
+            dropped.content = std::move(item.content);
+            item.content = content;
+            share(item, digest);
+            shard.lru.splice(shard.lru.begin(), shard.lru, fmap->second);
+        } else {
+            shard.lru.push_front(Item{ flat, content, boost::none });
+            share(shard.lru.front(), digest);
+            shard.map.insert(std::make_pair(flat, shard.lru.begin()));
+        }
+        ++shard.stats.insertions;
+    }
+
+    trim();
+}
+
+void MemoryContentCache::trim()
+{
+    // evict least recently used entries from shards in turn
+    for (unsigned int empty(0);
+         (charged_ > limit_) && (empty < shardCount_); )
+    {
+        auto &shard(shards_[cursor_++ % shardCount_]);
+
+        Item dropped;
+        std::unique_lock<std::mutex> lock(shard.mutex);
+        if (shard.lru.empty()) {
+            ++empty;
+            continue;
+        }
+        empty = 0;
+
+        auto &item(shard.lru.back());
+        release(item);
+        dropped.content = std::move(item.content);
+        shard.map.erase(item.key);
+        shard.lru.pop_back();
+        ++shard.stats.evictions;
+    }
+}
+
+void MemoryContentCache::scale(double factor)
+{
+    factor = std::min(std::max(factor, 0.0), 1.0);
+    limit_ = std::size_t(budget_ * factor);
+    trim();
+}
+
+void MemoryContentCache::clear()
+{
+    for (unsigned int i(0); i < shardCount_; ++i) {
+        auto &shard(shards_[i]);
+        Shard::Lru lru;
+        {
+            std::unique_lock<std::mutex> lock(shard.mutex);
+            for (auto &item : shard.lru) { release(item); }
+            lru.swap(shard.lru);
+            shard.map.clear();
+        }
+    }
+}
+
+ContentCache::Stats MemoryContentCache::stats() const
+{
+    Stats stats;
+    for (unsigned int i(0); i < shardCount_; ++i) {
+        auto &shard(shards_[i]);
+        std::unique_lock<std::mutex> lock(shard.mutex);
+        stats.hits += shard.stats.hits;
+        stats.misses += shard.stats.misses;
+        stats.insertions += shard.stats.insertions;
+        stats.evictions += shard.stats.evictions;
+        stats.entries += shard.lru.size();
+    }
+    stats.bytes = charged_;
+    stats.deduplicated = deduplicated_;
+    return stats;
+}
+
+} // namespace roarchive
@@ -0,0 +1,227 @@
+/**
+ * Copyright (c) 2017 Melown Technologies SE
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * *  Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * *  Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef roarchive_cache_hpp_included_
+#define roarchive_cache_hpp_included_
+
+#include <ctime>
+#include <memory>
+#include <atomic>
+#include <vector>
+#include <string>
+#include <cstdint>
+
+#include <boost/filesystem/path.hpp>
+
+#include "istream.hpp"
+#include "governor.hpp"
+
+namespace roarchive {
+
+namespace hash { struct Digest; }
+
+/** Cache of decoded file content.
+ *
+ *  Keyed by (archive identity, path, filter key), stores final
+ *  (decompressed, filtered) bytes; hits are served as memory-backed
+ *  seekable streams of exact size.
+ *
+ *  Archive identity is archive path plus its size, modification time and
+ *  inode so a replaced archive never hits stale content. Directory archives
+ *  add member file's own stat, HTTP content is never cached (there is no
+ *  cheap way to detect a change). Filter key is
+ *  provided by the caller and must identify what the FilterInit passed to
+ *  istream() does (e.g. "gunzip"); empty key means no filter.
+ *
+ *  Implementations: MemoryContentCache (in-process) and SharedContentCache
+ *  (shared memory, see shmcache.hpp). Pass to OpenOptions::setContentCache();
+ *  can be shared by any number of archives and threads.
+ */
+class ContentCache {
+public:
+    typedef std::shared_ptr<ContentCache> pointer;
+
+    /** Cached file.
+     */
+    struct Content {
+        typedef std::shared_ptr<const Content> pointer;
+
+        const char *data;
+        std::size_t size;
+        boost::filesystem::path path;
+        boost::filesystem::path index;
+        std::time_t timestamp;
+
+        /** Keeps data alive.
+         */
+        std::shared_ptr<const void> storage;
+
+        Content() : data(), size(), timestamp(-1) {}
+
+        /** Content owning given buffer.
+         */
+        static pointer make(std::vector<char> data
+                            , const boost::filesystem::path &path
+                            , const boost::filesystem::path &index
+                            , std::time_t timestamp);
+    };
+
+    struct Key {
+        std::string archive;
+        std::string path;
+        std::string filter;
+
+        Key(std::string archive, std::string path, std::string filter)
+            : archive(std::move(archive)), path(std::move(path))
+            , filter(std::move(filter))
+        {}
+
+        /** Single string key: parts separated by NUL.
+         */
+        std::string flat() const;
+    };
+
+    struct Stats {
+        std::uint64_t hits;
+        std::uint64_t misses;
+        std::uint64_t insertions;
+        std::uint64_t evictions;
+
+        /** Insertions whose payload was already cached under another key.
+         */
+        std::uint64_t deduplicated;
+
+        /** Cached bytes and number of entries.
+         */
+        std::size_t bytes;
+        std::size_t entries;
+
+        Stats()
+            : hits(), misses(), insertions(), evictions(), deduplicated()
+            , bytes(), entries()
+        {}
+    };
+
+    virtual ~ContentCache() {}
+
+    /** Looks up content, null if not cached.
+     */
+    virtual Content::pointer get(const Key &key) = 0;
+
+    /** Stores content, evicting other content if needed. Content bigger
+     *  than maxEntry() is ignored.
+     */
+    virtual void put(const Key &key, const Content::pointer &content) = 0;
+
+    /** Drops all content.
+     */
+    virtual void clear() = 0;
+
+    virtual Stats stats() const = 0;
+
+    /** Size of the biggest cacheable file.
+     */
+    virtual std::size_t maxEntry() const = 0;
+
+    /** Reads given (freshly opened) stream and caches its content if it
+     *  fits. Returns stream over read content or the original stream if
+     *  the file is too big to be cached. Stream of unknown size is read in
+     *  chunks until it exceeds maxEntry(); then the read prefix followed by
+     *  the rest of the original stream is returned.
+     */
+    IStream::pointer fill(const Key &key, IStream::pointer is);
+
+    /** Memory-backed stream over cached content.
+     */
+    static IStream::pointer istream(const Content::pointer &content);
+};
+
+/** In-process cache: sharded LRU with a byte budget. Can be registered
+ *  with MemoryGovernor.
+ *
+ *  Payloads are deduplicated by content (MurmurHash3 128-bit digest,
+ *  verified by comparison): byte-identical files under different paths or
+ *  archives are stored once and charged to the budget once.
+ */
+class MemoryContentCache : public ContentCache, public Shrinkable {
+public:
+    /** Creates cache with given byte budget. Files bigger than maxEntry
+     *  (defaults to 1/8 of budget per shard) are never cached.
+     */
+    MemoryContentCache(std::size_t budget, unsigned int shards = 16
+                       , std::size_t maxEntry = 0);
+    virtual ~MemoryContentCache();
+
+    virtual Content::pointer get(const Key &key);
+    virtual void put(const Key &key, const Content::pointer &content);
+    virtual void clear();
+    virtual Stats stats() const;
+    virtual std::size_t maxEntry() const { return maxEntry_; }
+
+    /** Scales budget (see MemoryGovernor).
+     */
+    virtual void scale(double factor);
+
+    std::size_t budget() const { return budget_; }
+
+    /** Current budget: budget scaled by last scale() factor.
+     */
+    std::size_t limit() const { return limit_; }
+
+    struct Item;
+    struct Shard;
+    struct Blobs;
+
+private:
+    Shard& shard(const std::string &key);
+
+    /** Links item's content to shared blob and charges it.
+     */
+    void share(Item &item, const hash::Digest &digest);
+
+    /** Unlinks item's content from shared blob and uncharges it.
+     */
+    void release(Item &item);
+
+    /** Evicts until under budget.
+     */
+    void trim();
+
+    const std::size_t budget_;
+    const unsigned int shardCount_;
+    const std::size_t maxEntry_;
+    std::unique_ptr<Shard[]> shards_;
+
+    std::unique_ptr<Blobs> blobs_;
+
+    std::atomic<std::size_t> limit_;
+    std::atomic<std::size_t> charged_;
+    std::atomic<unsigned int> cursor_;
+    std::atomic<std::uint64_t> deduplicated_;
+};
+
+} // namespace roarchive
+
+#endif // roarchive_cache_hpp_included_
@@ -0,0 +1,635 @@
+/**
+ * Copyright (c) 2017 Melown Technologies SE
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * *  Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * *  Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <zlib.h>
+
+#ifdef ROARCHIVE_HAS_ZSTD
+#  include <zstd.h>
+#endif
+
+#ifdef ROARCHIVE_HAS_LZMA
+#  include <lzma.h>
+#endif
+
+#include <cstdlib>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <string>
+#include <algorithm>
+
+#include <boost/iostreams/concepts.hpp>
+#include <boost/iostreams/operations.hpp>
+
+#include "dbglog/dbglog.hpp"
+
+#include "codec.hpp"
+#include "error.hpp"
+
+namespace fs = boost::filesystem;
+namespace bio = boost::iostreams;
+
+namespace roarchive { namespace codec {
+
+namespace {
+
+/** Pool of decoder contexts. Traits provide Context type and static
+ *  create()/destroy().
+ */
+template <typename Traits>
+class Pool {
+public:
+    typedef typename Traits::Context Context;
+
+    struct Release {
+        Pool *pool;
+        void operator()(Context *context) const { pool->release(context); }
+    };
+
+    typedef std::unique_ptr<Context, Release> Handle;
+
+    ~Pool() {
+        for (auto *context : idle_) { Traits::destroy(context); }
+    }
+
+    Handle acquire() {
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            if (!idle_.empty()) {
+                auto *context(idle_.back());
+                idle_.pop_back();
+                return Handle(context, Release{this});
+            }
+        }
+        return Handle(Traits::create(), Release{this});
+    }
+
+    static Pool& instance() {
+        static Pool pool;
+        return pool;
+    }
+
+private:
+    void release(Context *context) {
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            if (idle_.size() < MaxIdle) {
+                idle_.push_back(context);
+                return;
+            }
+        }
+        Traits::destroy(context);
+    }
+
+    /** Idle contexts kept around, enough for a busy server.
+     */
+    static constexpr std::size_t MaxIdle = 64;
+
+    std::mutex mutex_;
+    std::vector<Context*> idle_;
+};
+
+template <typename Traits> constexpr std::size_t Pool<Traits>::MaxIdle;
+
+/** Input and output buffers of one decoder step.
+ */
+struct Buffers {
+    const char *in;
+    std::size_t inLeft;
+    char *out;
+    std::size_t outLeft;
+};
+
+/** Streaming decompressor filter. Decoder provides decode(Buffers&)
+ *  and complete(); state is shared between filter copies.
+ */
+template <typename Decoder>
+class Decompressor {
+public:
+    typedef char char_type;
+    struct category : bio::multichar_input_filter_tag {};
+
+    template <typename ...Args>
+    Decompressor(const fs::path &path, Args &&...args)
+        : state_(std::make_shared<State>(path, std::forward<Args>(args)...))
+    {}
+
+    template <typename Source>
+    std::streamsize read(Source &src, char *s, std::streamsize n) {
+        auto &st(*state_);
+        Buffers b{ st.in, st.inLeft, s, std::size_t(n) };
+
+        while (b.outLeft && !st.finished) {
+            if (!b.inLeft && !st.eof) {
+                const auto r(bio::read(src, st.buffer.data()
+                                       , st.buffer.size()));
+                if (r < 0) {
+                    st.eof = true;
+                } else {
+                    b.in = st.buffer.data();
+                    b.inLeft = r;
+                }
+            }
+
+            const auto inLeft(b.inLeft), outLeft(b.outLeft);
+            st.decoder.decode(b, st.path);
+
+            if (st.eof && (inLeft == b.inLeft) && (outLeft == b.outLeft)) {
+                // no more input, no progress
+                if (!st.decoder.complete()) {
+                    LOGTHROW(err2, IOError)
+                        << "Truncated " << Decoder::name()
+                        << " data of " << st.path << ".";
+                }
+                st.finished = true;
+            }
+        }
+
+        st.in = b.in;
+        st.inLeft = b.inLeft;
+
+        const std::streamsize produced(n - b.outLeft);
+        return produced ? produced : -1;
+    }
+
+private:
+    struct State {
+        fs::path path;
+        Decoder decoder;
+        std::vector<char> buffer;
+        const char *in;
+        std::size_t inLeft;
+        bool eof;
+        bool finished;
+
+        template <typename ...Args>
+        State(const fs::path &path, Args &&...args)
+            : path(path), decoder(std::forward<Args>(args)...)
+            , buffer(1 << 16), in(), inLeft(), eof(false), finished(false)
+        {}
+    };
+
+    std::shared_ptr<State> state_;
+};
+
+[[noreturn]] void corrupted(const char *codec, const fs::path &path
+                            , const std::string &reason)
+{
+    LOGTHROW(err2, IOError)
+        << "Corrupted " << codec << " data of " << path << ": "
+        << reason << ".";
+    throw;
+}
+
+// deflate (raw)
+
+struct ZlibTraits {
+    typedef ::z_stream Context;
+
+    static Context* create() {
+        std::unique_ptr<Context> z(new Context());
+        if (::inflateInit2(z.get(), -MAX_WBITS) != Z_OK) {
+            throw std::bad_alloc();
+        }
+        return z.release();
+    }
+
+    static void destroy(Context *z) {
+        ::inflateEnd(z);
+        delete z;
+    }
+};
+
+typedef Pool<ZlibTraits> ZlibPool;
+
+/** Runs inflate on buffers, zlib counts are 32 bit only.
+ */
+int inflate(::z_stream &z, Buffers &b)
+{
+    const auto limit([](std::size_t size) {
+            return uInt(std::min<std::size_t>
+                        (size, std::numeric_limits<uInt>::max()));
+        });
+
+    z.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(b.in));
+    z.avail_in = limit(b.inLeft);
+    // zlib refuses null output even when there is nothing to produce (empty
+    // entry decoded into empty vector)
+    static Bytef dummy;
+    z.next_out = b.out ? reinterpret_cast<Bytef*>(b.out) : &dummy;
+    z.avail_out = limit(b.outLeft);
+    const auto inSize(z.avail_in), outSize(z.avail_out);
+
+    const auto res(::inflate(&z, Z_NO_FLUSH));
+
+    const std::size_t consumed(inSize - z.avail_in);
+    const std::size_t produced(outSize - z.avail_out);
+    b.in += consumed;
+    b.inLeft -= consumed;
+    b.out += produced;
+    b.outLeft -= produced;
+    return res;
+}
+
+class InflateDecoder {
+public:
+    InflateDecoder() : z_(ZlibPool::instance().acquire()), end_(false) {
+        ::inflateReset(z_.get());
+    }
+
+    void decode(Buffers &b, const fs::path &path) {
+        if (end_) { return; }
+        const auto res(inflate(*z_, b));
+        switch (res) {
+        case Z_OK: case Z_BUF_ERROR: break;
+        case Z_STREAM_END: end_ = true; break;
+        default:
+            corrupted(name(), path, z_->msg ? z_->msg : "unknown error");
+        }
+    }
+
+    bool complete() const { return end_; }
+
+    static const char* name() { return "deflate"; }
+
+private:
+    ZlibPool::Handle z_;
+    bool end_;
+};
+
+void decodeDeflate(const char *src, std::size_t srcSize
+                   , char *dst, std::size_t dstSize, const fs::path &path)
+{
+    auto z(ZlibPool::instance().acquire());
+    ::inflateReset(z.get());
+
+    Buffers b{ src, srcSize, dst, dstSize };
+    for (;;) {
+        const auto inLeft(b.inLeft), outLeft(b.outLeft);
+        const auto res(inflate(*z, b));
+        if (res == Z_STREAM_END) { break; }
+        if ((res != Z_OK) && (res != Z_BUF_ERROR)) {
+            corrupted("deflate", path, z->msg ? z->msg : "unknown error");
+        }
+        if ((inLeft == b.inLeft) && (outLeft == b.outLeft)) {
+            corrupted("deflate", path, "unexpected end of data");
+        }
+    }
+
+    if (b.outLeft) {
+        corrupted("deflate", path, "uncompressed size mismatch");
+    }
+}
+
+#ifdef ROARCHIVE_HAS_ZSTD
+
+struct ZstdTraits {
+    typedef ::ZSTD_DCtx Context;
+
+    static Context* create() {
+        auto *ctx(::ZSTD_createDCtx());
+        if (!ctx) { throw std::bad_alloc(); }
+        return ctx;
+    }
+
+    static void destroy(Context *ctx) { ::ZSTD_freeDCtx(ctx); }
+};
+
+typedef Pool<ZstdTraits> ZstdPool;
+
+class ZstdDecoder {
+public:
+    ZstdDecoder() : ctx_(ZstdPool::instance().acquire()), hint_(1) {
+        ::ZSTD_DCtx_reset(ctx_.get(), ZSTD_reset_session_only);
+    }
+
+    void decode(Buffers &b, const fs::path &path) {
+        ::ZSTD_inBuffer in{ b.in, b.inLeft, 0 };
+        ::ZSTD_outBuffer out{ b.out, b.outLeft, 0 };
+        const auto res(::ZSTD_decompressStream(ctx_.get(), &out, &in));
+        if (::ZSTD_isError(res)) {
+            corrupted(name(), path, ::ZSTD_getErrorName(res));
+        }
+        // call without progress just announces next frame, ignore
+        if (in.pos || out.pos) { hint_ = res; }
+
+        b.in += in.pos;
+        b.inLeft -= in.pos;
+        b.out += out.pos;
+        b.outLeft -= out.pos;
+    }
+
+    /** Zero hint means frame fully decoded and flushed.
+     */
+    bool complete() const { return !hint_; }
+
+    static const char* name() { return "zstd"; }
+
+private:
+    ZstdPool::Handle ctx_;
+    std::size_t hint_;
+};
+
+void decodeZstd(const char *src, std::size_t srcSize
+                , char *dst, std::size_t dstSize, const fs::path &path)
+{
+    auto ctx(ZstdPool::instance().acquire());
+    ::ZSTD_DCtx_reset(ctx.get(), ZSTD_reset_session_only);
+    const auto res(::ZSTD_decompressDCtx(ctx.get(), dst, dstSize
+                                         , src, srcSize));
+    if (::ZSTD_isError(res)) {
+        corrupted("zstd", path, ::ZSTD_getErrorName(res));
+    }
+    if (res != dstSize) {
+        corrupted("zstd", path, "uncompressed size mismatch");
+    }
+}
+
+#endif // ROARCHIVE_HAS_ZSTD
+
+#ifdef ROARCHIVE_HAS_LZMA
+
+struct LzmaTraits {
+    typedef ::lzma_stream Context;
+
+    static Context* create() {
+        const ::lzma_stream init = LZMA_STREAM_INIT;
+        return new Context(init);
+    }
+
+    static void destroy(Context *strm) {
+        ::lzma_end(strm);
+        delete strm;
+    }
+};
+
+typedef Pool<LzmaTraits> LzmaPool;
+
+/** Size of zip LZMA header: version (2), properties size (2).
+ */
+const std::size_t LzmaHeaderSize(4);
+
+/** Initializes raw LZMA1 decoder from zip LZMA properties.
+ */
+void lzmaInit(::lzma_stream &strm, const char *props, std::size_t size
+              , const fs::path &path)
+{
+    ::lzma_filter filters[2];
+    filters[0].id = LZMA_FILTER_LZMA1;
+    filters[0].options = nullptr;
+    filters[1].id = LZMA_VLI_UNKNOWN;
+    filters[1].options = nullptr;
+
+    if (::lzma_properties_decode
+        (&filters[0], nullptr, reinterpret_cast<const std::uint8_t*>(props)
+         , size) != LZMA_OK)
+    {
+        corrupted("lzma", path, "invalid properties");
+    }
+
+    const auto res(::lzma_raw_decoder(&strm, filters));
+    std::free(filters[0].options);
+    if (res != LZMA_OK) {
+        corrupted("lzma", path, "cannot initialize decoder");
+    }
+}
+
+/** Runs lzma_code on buffers.
+ */
+::lzma_ret lzmaCode(::lzma_stream &strm, Buffers &b)
+{
+    strm.next_in = reinterpret_cast<const std::uint8_t*>(b.in);
+    strm.avail_in = b.inLeft;
+    strm.next_out = reinterpret_cast<std::uint8_t*>(b.out);
+    strm.avail_out = b.outLeft;
+
+    const auto res(::lzma_code(&strm, LZMA_RUN));
+
+    const std::size_t consumed(b.inLeft - strm.avail_in);
+    const std::size_t produced(b.outLeft - strm.avail_out);
+    b.in += consumed;
+    b.inLeft -= consumed;
+    b.out += produced;
+    b.outLeft -= produced;
+    return res;
+}
+
+class LzmaDecoder {
+public:
+    LzmaDecoder(std::size_t size)
+        : strm_(LzmaPool::instance().acquire()), left_(size)
+        , initialized_(false), end_(false)
+    {}
+
+    void decode(Buffers &b, const fs::path &path) {
+        if (end_ || !left_) { return; }
+
+        if (!initialized_) {
+            // collect header and properties
+            while (b.inLeft && !headerComplete()) {
+                header_.push_back(*b.in++);
+                --b.inLeft;
+            }
+            if (!headerComplete()) { return; }
+            lzmaInit(*strm_, header_.data() + LzmaHeaderSize
+                     , header_.size() - LzmaHeaderSize, path);
+            initialized_ = true;
+        }
+
+        // never produce more than entry size: data may lack end marker
+        const auto outLeft(b.outLeft);
+        const auto limit(std::min<std::size_t>(outLeft, left_));
+        Buffers bounded{ b.in, b.inLeft, b.out, limit };
+        const auto res(lzmaCode(*strm_, bounded));
+
+        const std::size_t produced(limit - bounded.outLeft);
+        b.in = bounded.in;
+        b.inLeft = bounded.inLeft;
+        b.out = bounded.out;
+        b.outLeft = outLeft - produced;
+        left_ -= produced;
+
+        switch (res) {
+        case LZMA_OK: case LZMA_BUF_ERROR: break;
+        case LZMA_STREAM_END: end_ = true; break;
+        default: corrupted(name(), path, "decoder error");
+        }
+    }
+
+    bool complete() const { return end_ || !left_; }
+
+    static const char* name() { return "lzma"; }
+
+private:
+    bool headerComplete() const {
+        if (header_.size() < LzmaHeaderSize) { return false; }
+        const auto *u(reinterpret_cast<const unsigned char*>
+                      (header_.data()));
+        const std::size_t propsSize(u[2] | (u[3] << 8));
+        return header_.size() >= (LzmaHeaderSize + propsSize);
+    }
+
+    LzmaPool::Handle strm_;
+    std::size_t left_;
+    std::string header_;
+    bool initialized_;
+    bool end_;
+};
+
+void decodeLzma(const char *src, std::size_t srcSize
+                , char *dst, std::size_t dstSize, const fs::path &path)
+{
+    if (srcSize < LzmaHeaderSize) {
+        corrupted("lzma", path, "missing header");
+    }
+    const auto *u(reinterpret_cast<const unsigned char*>(src));
+    const std::size_t propsSize(u[2] | (u[3] << 8));
+    if (srcSize < (LzmaHeaderSize + propsSize)) {
+        corrupted("lzma", path, "missing properties");
+    }
+
+    auto strm(LzmaPool::instance().acquire());
+    lzmaInit(*strm, src + LzmaHeaderSize, propsSize, path);
+
+    const auto skip(LzmaHeaderSize + propsSize);
+    Buffers b{ src + skip, srcSize - skip, dst, dstSize };
+    while (b.outLeft) {
+        const auto inLeft(b.inLeft), outLeft(b.outLeft);
+        const auto res(lzmaCode(*strm, b));
+        if (res == LZMA_STREAM_END) { break; }
+        if ((res != LZMA_OK) && (res != LZMA_BUF_ERROR)) {
+            corrupted("lzma", path, "decoder error");
+        }
+        if ((inLeft == b.inLeft) && (outLeft == b.outLeft)) {
+            corrupted("lzma", path, "unexpected end of data");
+        }
+    }
+
+    if (b.outLeft) {
+        corrupted("lzma", path, "uncompressed size mismatch");
+    }
+}
+
+#endif // ROARCHIVE_HAS_LZMA
+
+[[noreturn]] void unsupported(std::uint16_t method, const fs::path &path)
+{
+    LOGTHROW(err2, NotImplemented)
+        << "Unsupported compression method <" << method << "> of "
+        << path << ".";
+    throw;
+}
+
+} // namespace
+
+bool supported(std::uint16_t method)
+{
+    switch (method) {
+    case Method::stored: case Method::deflate: return true;
+#ifdef ROARCHIVE_HAS_ZSTD
+    case Method::zstd: return true;
+#endif
+#ifdef ROARCHIVE_HAS_LZMA
+    case Method::lzma: return true;
+#endif
+    default: return false;
+    }
+}
+
+void decode(std::uint16_t method, const char *src, std::size_t srcSize
+            , char *dst, std::size_t dstSize, const fs::path &path)
+{
+    switch (method) {
+    case Method::stored:
+        if (srcSize != dstSize) {
+            corrupted("stored", path, "size mismatch");
+        }
+        std::copy(src, src + srcSize, dst);
+        return;
+
+    case Method::deflate:
+        return decodeDeflate(src, srcSize, dst, dstSize, path);
+
+#ifdef ROARCHIVE_HAS_ZSTD
+    case Method::zstd:
+        return decodeZstd(src, srcSize, dst, dstSize, path);
+#endif
+
+#ifdef ROARCHIVE_HAS_LZMA
+    case Method::lzma:
+        return decodeLzma(src, srcSize, dst, dstSize, path);
+#endif
+
+    default: break;
+    }
+
+    unsupported(method, path);
+}
+
+void push(std::uint16_t method, std::size_t uncompressedSize
+          , bio::filtering_istream &fis, const fs::path &path)
+{
+    (void) uncompressedSize;
+
+    switch (method) {
+    case Method::stored: return;
+
+    case Method::deflate:
+        fis.push(Decompressor<InflateDecoder>(path));
+        return;
+
+#ifdef ROARCHIVE_HAS_ZSTD
+    case Method::zstd:
+        fis.push(Decompressor<ZstdDecoder>(path));
+        return;
+#endif
+
+#ifdef ROARCHIVE_HAS_LZMA
+    case Method::lzma:
+        fis.push(Decompressor<LzmaDecoder>(path, uncompressedSize));
+        return;
+#endif
+
+    default: break;
+    }
+
+    unsupported(method, path);
+}
+
+void InflateRelease::operator()(::z_stream *z) const
+{
+    // pool's own handle puts it back
+    ZlibPool::Handle handle(z, ZlibPool::Release{ &ZlibPool::instance() });
+}
+
+InflateContext inflateContext()
+{
+    auto z(ZlibPool::instance().acquire());
+    ::inflateReset(z.get());
+    return InflateContext(z.release());
+}
+
+} } // namespace roarchive::codec
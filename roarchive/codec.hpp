@@ -0,0 +1,89 @@
+/**
+ * Copyright (c) 2017 Melown Technologies SE
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * *  Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * *  Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef roarchive_codec_hpp_included_
+#define roarchive_codec_hpp_included_
+
+#include <cstdint>
+#include <cstddef>
+#include <memory>
+
+#include <boost/filesystem/path.hpp>
+#include <boost/iostreams/filtering_stream.hpp>
+
+struct z_stream_s;
+
+namespace roarchive { namespace codec {
+
+/** Internal: zip entry decoders.
+ *
+ *  Both one-shot and streaming decoders take their contexts (z_stream,
+ *  ZSTD_DCtx, lzma_stream) from process-wide pools so that opening an
+ *  entry does not allocate decoder state.
+ */
+
+/** Zip compression methods.
+ */
+enum Method : std::uint16_t {
+    stored = 0
+    , deflate = 8
+    , lzma = 14
+    , zstd = 93
+};
+
+/** Whether given method is compiled in.
+ */
+bool supported(std::uint16_t method);
+
+/** Decodes whole compressed entry into caller's buffer. Uncompressed size
+ *  must be known and must exactly match. Throws IOError on corrupted data
+ *  and NotImplemented on unsupported method. Path is used in messages.
+ */
+void decode(std::uint16_t method, const char *src, std::size_t srcSize
+            , char *dst, std::size_t dstSize
+            , const boost::filesystem::path &path);
+
+/** Pushes streaming decoder for given method to the stream. Compressed
+ *  data source must be pushed afterwards. Does nothing for stored entries.
+ */
+void push(std::uint16_t method, std::size_t uncompressedSize
+          , boost::iostreams::filtering_istream &fis
+          , const boost::filesystem::path &path);
+
+/** Returns raw inflate context to the pool.
+ */
+struct InflateRelease {
+    void operator()(::z_stream_s *z) const;
+};
+
+typedef std::unique_ptr<::z_stream_s, InflateRelease> InflateContext;
+
+/** Raw inflate context from the pool, reset for a new stream.
+ */
+InflateContext inflateContext();
+
+} } // namespace roarchive::codec
+
+#endif // roarchive_codec_hpp_included_
@@ -0,0 +1,216 @@
+/**
+ * Copyright (c) 2017 Melown Technologies SE
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * *  Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * *  Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef roarchive_coro_hpp_included_
+#define roarchive_coro_hpp_included_
+
+/** C++20 coroutine interface. Empty unless compiled with coroutine
+ *  support.
+ */
+
+#if defined(__cpp_impl_coroutine) && defined(__has_include)
+#  if __has_include(<coroutine>)
+#    define ROARCHIVE_HAS_COROUTINES 1
+#  endif
+#endif
+
+#ifdef ROARCHIVE_HAS_COROUTINES
+
+#include <coroutine>
+#include <exception>
+#include <functional>
+#include <utility>
+#include <vector>
+
+#include <boost/optional.hpp>
+#include <boost/filesystem/path.hpp>
+
+#include "dbglog/dbglog.hpp"
+
+#include "roarchive.hpp"
+#include "error.hpp"
+
+namespace roarchive { namespace coro {
+
+/** Runs given work on some thread (e.g. posts it to an I/O thread pool).
+ *  Supplied by the user.
+ */
+typedef std::function<void(std::function<void()>)> Executor;
+
+/** Awaitable blocking operation: the operation is run by the executor and
+ *  the awaiting coroutine is resumed on the thread that completed it.
+ *  Exceptions thrown by the operation are rethrown from co_await.
+ */
+template <typename T>
+class Awaitable {
+public:
+    typedef std::function<T()> Operation;
+
+    Awaitable(Executor executor, Operation operation)
+        : executor_(std::move(executor)), operation_(std::move(operation))
+    {}
+
+    bool await_ready() const noexcept { return false; }
+
+    void await_suspend(std::coroutine_handle<> handle) {
+        // resumed coroutine destroys this awaitable (and its executor)
+        // possibly before the executor returns: call a copy and do not
+        // touch this after the job is handed off
+        auto executor(executor_);
+        executor([this, handle]() {
+                try {
+                    result_ = operation_();
+                } catch (...) {
+                    error_ = std::current_exception();
+                }
+                handle.resume();
+            });
+    }
+
+    T await_resume() {
+        if (error_) { std::rethrow_exception(error_); }
+        return std::move(*result_);
+    }
+
+private:
+    Executor executor_;
+    Operation operation_;
+    boost::optional<T> result_;
+    std::exception_ptr error_;
+};
+
+/** File metadata.
+ */
+struct Stat {
+    /** Full path inside the archive.
+     */
+    boost::filesystem::path path;
+
+    /** File size, if known without opening a stream.
+     */
+    boost::optional<std::size_t> size;
+};
+
+/** Archive with awaitable reads, e.g.:
+ *
+ *      coro::Archive archive(roarchive, executor);
+ *      const auto data(co_await archive.read("tiles/1-2-3.jpg"));
+ *
+ *  Operations are run by given executor; they go through RoArchive's
+ *  istream() and so use content cache, I/O scheduler etc. if configured.
+ */
+class Archive {
+public:
+    Archive(RoArchive archive, Executor executor)
+        : archive_(std::move(archive)), executor_(std::move(executor))
+    {}
+
+    /** Reads whole file.
+     */
+    Awaitable<std::vector<char>> read(boost::filesystem::path path) const {
+        auto archive(archive_);
+        return { executor_, [archive, path]() {
+                return archive.istream(path)->read();
+            } };
+    }
+
+    /** Reads at most size bytes at given offset. Result is shorter if the
+     *  range extends past the end of the file.
+     */
+    Awaitable<std::vector<char>> readRange(boost::filesystem::path path
+                                           , std::size_t offset
+                                           , std::size_t size) const
+    {
+        auto archive(archive_);
+        return { executor_, [archive, path, offset, size]() {
+                auto is(archive.istream(path));
+                auto &s(is->get());
+                // short read is not an error here
+                s.exceptions(std::ios::badbit);
+
+                // devices refuse to seek past the end
+                const auto fileSize(is->size());
+                if (fileSize && (offset >= *fileSize)) {
+                    is->close();
+                    return std::vector<char>();
+                }
+
+                if (is->seekable()) {
+                    s.seekg(offset);
+                } else {
+                    s.ignore(offset);
+                }
+
+                std::vector<char> data(size);
+                s.read(data.data(), data.size());
+                data.resize(s.gcount());
+                is->close();
+                return data;
+            } };
+    }
+
+    /** File metadata, without opening a stream (no download, no decoder
+     *  setup). Size is known for files openRaw() can expose. Throws
+     *  NoSuchFile when not found.
+     */
+    Awaitable<Stat> stat(boost::filesystem::path path) const {
+        auto archive(archive_);
+        return { executor_, [archive, path]() {
+                if (!archive.exists(path)) {
+                    LOGTHROW(err2, NoSuchFile)
+                        << "File " << path << " not found in archive "
+                        << archive.path() << ".";
+                }
+
+                Stat stat;
+                stat.path = archive.path(path);
+                if (const auto raw = archive.openRaw(path)) {
+                    stat.size = raw->length;
+                }
+                return stat;
+            } };
+    }
+
+    /** Checks file existence.
+     */
+    Awaitable<bool> exists(boost::filesystem::path path) const {
+        auto archive(archive_);
+        return { executor_, [archive, path]() {
+                return archive.exists(path);
+            } };
+    }
+
+    const RoArchive& archive() const { return archive_; }
+
+private:
+    RoArchive archive_;
+    Executor executor_;
+};
+
+} } // namespace roarchive::coro
+
+#endif // ROARCHIVE_HAS_COROUTINES
+
+#endif // roarchive_coro_hpp_included_
@@ -27,21 +27,46 @@
 #define roarchive_detail_hpp_included_
 
 #include <vector>
+#include <string>
+#include <unordered_map>
 
 #include <boost/optional.hpp>
+#include <boost/utility/string_ref.hpp>
 
 #include "utility/filesystem.hpp"
 
 #include "roarchive.hpp"
+#include "probe.hpp"
+#include "cache.hpp"
+#include "scheduler.hpp"
+#include "governor.hpp"
 
 namespace roarchive {
 
 class RoArchive::Detail {
 public:
-    Detail(const boost::filesystem::path &path, bool directio = false)
-        : path_(path), directio_(directio)
+    Detail(const boost::filesystem::path &path, Backend backend
+           , const OpenOptions &openOptions, bool directio = false)
+        : path_(path), directio_(directio), backend_(backend)
         , stat_(utility::FileStat::from(path, std::nothrow))
-    {}
+        , instrumentation_(Instrumentation::create(backend, path
+                                                   , openOptions))
+        , contentCache_(openOptions.contentCache)
+        , ioChannel_(openOptions.ioScheduler
+                     ? std::make_shared<IoScheduler::Channel>
+                     (openOptions.ioScheduler, path)
+                     : nullptr)
+    {
+        if (contentCache_) { identity_ = makeIdentity(); }
+
+        if (openOptions.memoryGovernor) {
+            if (const auto shrinkable = std::dynamic_pointer_cast<Shrinkable>
+                (contentCache_))
+            {
+                openOptions.memoryGovernor->add(shrinkable);
+            }
+        }
+    }
 
     virtual ~Detail() {}
 
@@ -55,6 +80,24 @@ public:
         return istream(path, {});
     }
 
+    /** Raw descriptor range of given file, see RoArchive::openRaw().
+     *  Descriptor borrowed from the backend has empty holder. Not available
+     *  by default.
+     */
+    virtual boost::optional<RawFile>
+    openRaw(const boost::filesystem::path&) const { return boost::none; }
+
+    /** Content cache identity of given file, appended to archive identity.
+     *  Needed where archive stat does not change with member content
+     *  (directory) and where paths are relative to hinted prefix (tarball,
+     *  zip). None means file content must not be cached. Archive identity
+     *  alone is enough by default.
+     */
+    virtual boost::optional<std::string>
+    cacheIdentity(const boost::filesystem::path&) const {
+        return std::string();
+    }
+
     /** Checks file existence.
      */
     virtual bool exists(const boost::filesystem::path &path) const = 0;
@@ -68,33 +111,212 @@ public:
 
     virtual void applyHint(const FileHint &hint) = 0;
 
+    /** Hint discovery over whole archive, see RoArchive::discover().
+     */
+    virtual DatasetRoots discover(const FileHint &hint) const = 0;
+
     bool changed() const;
 
+    /** Incremental update after underlying data change, see
+     *  RoArchive::refresh(). Nothing can be refreshed by default.
+     */
+    virtual bool refresh() { return !changed(); }
+
     bool directio() const { return directio_; }
 
     virtual bool handlesSchema(const std::string&) const { return false; }
 
     const boost::filesystem::path& path() const { return path_; }
 
+    Backend backend() const { return backend_; }
+
+    const Instrumentation::pointer& instrumentation() const {
+        return instrumentation_;
+    }
+
+    /** Tracer, if any.
+     */
+    Tracer* tracer() const {
+        return instrumentation_ ? instrumentation_->tracer.get() : nullptr;
+    }
+
     virtual const boost::optional<boost::filesystem::path>& usedHint() = 0;
 
+    /** Content cache, if any.
+     */
+    const ContentCache::pointer& contentCache() const {
+        return contentCache_;
+    }
+
+    /** I/O scheduler channel of this archive, if any.
+     */
+    const IoScheduler::Channel::pointer& ioChannel() const {
+        return ioChannel_;
+    }
+
+    /** Archive identity for content cache: path and file stat.
+     */
+    const std::string& identity() const { return identity_; }
+
+    /** Estimated memory usage. Backends add their components to the base
+     *  one.
+     */
+    virtual MemoryUsage memoryUsage() const;
+
 protected:
     boost::filesystem::path path_;
     bool directio_;
+    Backend backend_;
     utility::FileStat stat_;
+    Instrumentation::pointer instrumentation_;
+    ContentCache::pointer contentCache_;
+    IoScheduler::Channel::pointer ioChannel_;
+    std::string identity_;
+
+    /** Records new underlying file stat after refresh.
+     */
+    void updated(const utility::FileStat &stat) {
+        stat_ = stat;
+        if (contentCache_) { identity_ = makeIdentity(); }
+    }
+
+private:
+    std::string makeIdentity() const;
+};
+
+/** Common istream() implementation: instrumentation and stream exceptions.
+ *
+ *  Backend is either RoArchive::Detail (virtual dispatch) or a concrete
+ *  (final) backend class in which case the backend's istream() is called
+ *  directly.
+ */
+template <typename Backend>
+inline IStream::pointer
+openIStream(const Backend &backend, const boost::filesystem::path &path
+            , const IStream::FilterInit &filterInit)
+{
+    const auto &instrumentation(backend.instrumentation());
+    if (!instrumentation) {
+        auto is(backend.istream(path, filterInit));
+        // set exceptions
+        is->get().exceptions(std::ios::badbit | std::ios::failbit);
+        return is;
+    }
+
+    Span span(instrumentation->tracer, "istream", path);
+    Watch watch(instrumentation.get(), "istream", &path);
+
+    auto is([&]() -> IStream::pointer {
+            Probe probe(instrumentation, Operation::stream);
+            return backend.istream(path, filterInit);
+        }());
+
+    // set exceptions
+    is->get().exceptions(std::ios::badbit | std::ios::failbit);
+    Instrumentation::attach(*is, instrumentation);
+    watch.bytes(is->size());
+    return is;
+}
+
+/** Cached istream(): content is served from (and stored to) content cache,
+ *  if configured, under given filter key.
+ */
+template <typename Backend>
+inline IStream::pointer
+openIStream(const Backend &backend, const boost::filesystem::path &path
+            , const IStream::FilterInit &filterInit
+            , const std::string &filterKey)
+{
+    const auto &cache(backend.contentCache());
+    if (!cache) { return openIStream(backend, path, filterInit); }
+
+    const auto member(backend.cacheIdentity(path));
+    if (!member) { return openIStream(backend, path, filterInit); }
+
+    const ContentCache::Key key(backend.identity() + *member, path.string()
+                                , filterKey);
+    if (const auto content = cache->get(key)) {
+        return ContentCache::istream(content);
+    }
+    return cache->fill(key, openIStream(backend, path, filterInit));
+}
+
+/** Collects dataset roots from paths fed one by one.
+ */
+class Discovery {
+public:
+    Discovery(const FileHint &hint) : hint_(hint.hint) {}
+
+    /** Checks generic path of a file.
+     */
+    void operator()(boost::string_ref path);
+
+    /** Merges results of other discovery (same hint).
+     */
+    void merge(const Discovery &other);
+
+    /** Ranked result.
+     */
+    DatasetRoots roots() const;
+
+private:
+    const std::vector<std::string> hint_;
+
+    /** Directory -> best root.
+     */
+    std::unordered_map<std::string, DatasetRoot> roots_;
 };
 
 struct HintedPath {
     boost::filesystem::path path;
     boost::optional<boost::filesystem::path> usedHint;
 
+    /** Generic path with trailing slash, empty if there is no prefix.
+     */
+    std::string prefix;
+
     HintedPath(const boost::filesystem::path &path = boost::filesystem::path()
                , const boost::optional<boost::filesystem::path> &usedHint
                = boost::none)
         : path(path), usedHint(usedHint)
+        , prefix(path.empty() ? std::string() : path.generic_string() + "/")
     {}
 
     operator const boost::filesystem::path&() const { return path; }
+
+    /** Cuts prefix from generic member name in place. Returns false if the
+     *  member does not lie under the prefix.
+     */
+    bool cut(boost::string_ref &name) const {
+        if (!name.starts_with(prefix)) { return false; }
+        name.remove_prefix(prefix.size());
+        return true;
+    }
+};
+
+/** Hint matching over generic member names, no path is built per member.
+ *  Same semantics as sorting by depth and feeding FileHint::Matcher: best
+ *  hint wins, shallowest name wins among equally good matches.
+ */
+class HintNameMatcher {
+public:
+    HintNameMatcher(const FileHint &hint)
+        : hint_(hint.hint), bestIndex_(hint_.size()), bestDepth_()
+    {}
+
+    void operator()(boost::string_ref name);
+    operator bool() const { return bestIndex_ < hint_.size(); }
+    bool operator!() const { return bestIndex_ == hint_.size(); }
+
+    /** Best match split into prefix and used hint.
+     */
+    HintedPath match() const;
+
+private:
+    const std::vector<std::string> hint_;
+    std::size_t bestIndex_;
+    std::size_t bestDepth_;
+    std::string bestMatch_;
 };
 
 class FileHint::Matcher {
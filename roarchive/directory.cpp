@@ -23,62 +23,39 @@
  * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
  * POSSIBILITY OF SUCH DAMAGE.
  */
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
 
+#include <cerrno>
+#include <sstream>
 #include <queue>
-
-#include <boost/filesystem.hpp>
-#include <boost/iostreams/device/file.hpp>
+#include <thread>
+#include <atomic>
+#include <exception>
+#include <system_error>
 
 #include "dbglog/dbglog.hpp"
 
-#include "utility/cppversion.hpp"
 #include "utility/path.hpp"
 
-#include "detail.hpp"
+#include "directory.hpp"
 #include "io.hpp"
+#include "footprint.hpp"
 
 namespace fs = boost::filesystem;
-namespace bio = boost::iostreams;
 
 namespace roarchive {
 
 namespace {
 
-class FileIStream : public IStream {
-public:
-    FileIStream(const fs::path &path, const IStream::FilterInit &filterInit
-                , const fs::path &index)
-        : IStream(filterInit), path_(path), index_(index)
-    {
-        try {
-            auto source(bio::file_source(path.string()));
-            if (!source.is_open()) {
-                // TODO: really? distinguish
-                // should we use open(2)?
-                LOGTHROW(err2, NoSuchFile)
-                    << "Cannot open file file " << path << ".";
-            }
-
-            fis_.push(std::move(source));
-        } catch (const std::ios_base::failure &e) {
-            LOGTHROW(err2, Error)
-                << "Cannot open file file " << path << ": " << e.what() << ".";
-        }
-    }
-
-    virtual fs::path path() const { return path_; }
-    virtual fs::path index() const { return index_; }
-    virtual void close() {}
-
-private:
-    const fs::path path_;
-    const fs::path index_;
-};
-
-HintedPath applyHintToPath(const fs::path &path, const FileHint &hint)
+HintedPath applyHintToPath(const fs::path &path, const FileHint &hint
+                           , Tracer *tracer)
 {
     if (!hint) { return path; }
 
+    Phase phase(tracer, "hint", path);
+
     auto hintPath([&]() -> boost::optional<HintedPath>
     {
         // we need breadth-first search to find hint as close to root as
@@ -119,83 +96,183 @@ HintedPath applyHintToPath(const fs::path &path, const FileHint &hint)
     return *hintPath;
 }
 
-struct DirectoryBase {
-    DirectoryBase(const fs::path &path, const FileHint &hint)
-        : hintedPath_(applyHintToPath(path, hint))
-    {}
+/** Closes owned descriptor.
+ */
+struct Descriptor {
+    int fd;
+
+    Descriptor(int fd) : fd(fd) {}
+    ~Descriptor() { ::close(fd); }
 
-    HintedPath hintedPath_;
+    Descriptor(const Descriptor&) = delete;
+    Descriptor& operator=(const Descriptor&) = delete;
 };
 
-class Directory
-    : private DirectoryBase
-    , public RoArchive::Detail
+} // namespace
+
+DirectoryBase::DirectoryBase(const fs::path &path
+                             , const OpenOptions &openOptions)
+    : hintedPath_(applyHintToPath(path, openOptions.hint
+                                  , openOptions.tracer.get()))
+{}
+
+boost::optional<std::string>
+Directory::cacheIdentity(const fs::path &path) const
 {
-public:
-    Directory(const fs::path &path, const FileHint &hint)
-        : DirectoryBase(path, hint)
-        , Detail(hintedPath_.path, true)
-        , originalPath_(path)
-    {}
-
-    /** Get (wrapped) input stream for given file.
-     *  Throws when not found.
-     */
-    virtual IStream::pointer istream(const fs::path &path
-                                     , const IStream::FilterInit &filterInit)
-        const
-    {
-        if (path.is_absolute()) {
-            return std::make_unique<FileIStream>(path, filterInit, path);
+    const auto full(path.is_absolute() ? path : (path_ / path));
+
+    // uncacheable if cannot be stat'd, istream() reports the error
+    struct ::stat st;
+    if (::stat(full.c_str(), &st) < 0) { return boost::none; }
+
+    std::ostringstream os;
+    os << '/' << st.st_size << ':' << st.st_mtim.tv_sec << '.'
+       << st.st_mtim.tv_nsec << ':' << st.st_ino;
+    return os.str();
+}
+
+boost::optional<RawFile> Directory::openRaw(const fs::path &path) const
+{
+    const auto full(path.is_absolute() ? path : (path_ / path));
+
+    const auto fd(::open(full.c_str(), O_RDONLY | O_CLOEXEC));
+    if (fd < 0) {
+        if ((errno == ENOENT) || (errno == ENOTDIR)) {
+            LOGTHROW(err2, NoSuchFile)
+                << "Cannot open file " << full << ".";
         }
-        return std::make_unique<FileIStream>(path_ / path, filterInit, path);
+        std::system_error e(errno, std::system_category());
+        LOGTHROW(err2, IOError)
+            << "Cannot open file " << full
+            << ": <" << e.code() << ", " << e.what() << ">.";
+    }
+    auto holder(std::make_shared<Descriptor>(fd));
+
+    struct ::stat st;
+    if (::fstat(fd, &st) < 0) {
+        std::system_error e(errno, std::system_category());
+        LOGTHROW(err2, IOError)
+            << "Cannot stat file " << full
+            << ": <" << e.code() << ", " << e.what() << ">.";
     }
+    if (!S_ISREG(st.st_mode)) { return boost::none; }
 
-    virtual bool exists(const fs::path &path) const {
-        if (path.is_absolute()) {
-            return fs::exists(path);
-        }
-        return fs::exists(path_ / path);
+    return RawFile(fd, 0, st.st_size, std::move(holder));
+}
+
+Files Directory::list() const
+{
+    if (live_) { return live_->list(); }
+
+    Files list;
+    for (fs::recursive_directory_iterator i(path_), e; i != e; ++i) {
+        list.push_back(utility::cutPathPrefix(i->path(), path_));
     }
+    return list;
+}
 
-    virtual Files list() const {
-        Files list;
-        for (fs::recursive_directory_iterator i(path_), e; i != e; ++i) {
-            list.push_back(utility::cutPathPrefix(i->path(), path_));
+boost::optional<fs::path> Directory::findFile(const std::string &filename)
+    const
+{
+    if (live_) {
+        if (const auto path = live_->findFile(filename)) {
+            return path_ / *path;
         }
-        return list;
+        return boost::none;
+    }
+
+    for (fs::recursive_directory_iterator i(path_), e; i != e; ++i) {
+        if (i->path().filename() == filename) { return i->path(); }
     }
+    return boost::none;
+}
+
+void Directory::applyHint(const FileHint &hint)
+{
+    hintedPath_ = applyHintToPath(originalPath_, hint, tracer());
+    path_ = hintedPath_.path;
 
-    virtual boost::optional<fs::path> findFile(const std::string &filename)
-        const
+    if (live_) {
+        // stop watching old tree first
+        live_.reset();
+        live_ = std::make_unique<LiveDirectoryIndex>(path_);
+    }
+}
+
+DatasetRoots Directory::discover(const FileHint &hint) const
+{
+    const auto relative([this](const fs::path &path) -> std::string
     {
-        for (fs::recursive_directory_iterator i(path_), e; i != e; ++i) {
-            if (i->path().filename() == filename) { return i->path(); }
+        return utility::cutPathPrefix(path, originalPath_).generic_string();
+    });
+
+    // files at the top level are checked here, subtrees in parallel
+    Discovery discovery(hint);
+    std::vector<fs::path> subtrees;
+    for (fs::directory_iterator i(originalPath_), e; i != e; ++i) {
+        if (fs::is_directory(i->status())) {
+            subtrees.push_back(i->path());
+        } else {
+            discovery(relative(i->path()));
         }
-        return boost::none;
     }
 
-    virtual void applyHint(const FileHint &hint) {
-        hintedPath_ = applyHintToPath(originalPath_, hint);
-        path_ = hintedPath_.path;
-    }
+    const auto threads(std::min<std::size_t>
+                       (std::max(std::thread::hardware_concurrency(), 1u)
+                        , subtrees.size()));
+
+    std::vector<Discovery> partial(threads, Discovery(hint));
+    std::vector<std::exception_ptr> errors(threads);
+    std::atomic<std::size_t> next(0);
 
-    virtual const boost::optional<boost::filesystem::path>& usedHint() {
-        return hintedPath_.usedHint;
+    const auto walk([&](std::size_t thread)
+    {
+        try {
+            for (std::size_t s; (s = next++) < subtrees.size(); ) {
+                for (fs::recursive_directory_iterator i(subtrees[s]), e;
+                     i != e; ++i)
+                {
+                    if (!fs::is_directory(i->status())) {
+                        partial[thread](relative(i->path()));
+                    }
+                }
+            }
+        } catch (...) {
+            errors[thread] = std::current_exception();
+        }
+    });
+
+    std::vector<std::thread> workers;
+    for (std::size_t t(1); t < threads; ++t) { workers.emplace_back(walk, t); }
+    if (threads) { walk(0); }
+    for (auto &worker : workers) { worker.join(); }
+
+    for (std::size_t t(0); t < threads; ++t) {
+        if (errors[t]) { std::rethrow_exception(errors[t]); }
+        discovery.merge(partial[t]);
     }
 
-private:
-    const fs::path originalPath_;
-};
+    return discovery.roots();
+}
 
-} // namespace
+MemoryUsage Directory::memoryUsage() const
+{
+    auto mu(Detail::memoryUsage());
+    mu.add("object", footprint::allocated(sizeof(*this)));
+    mu.add("paths", (footprint::heap(originalPath_)
+                     + footprint::heap(hintedPath_.path)));
+    if (live_) {
+        mu.add("index", (footprint::allocated(sizeof(LiveDirectoryIndex))
+                         + live_->memory()));
+    }
+    return mu;
+}
 
 RoArchive::dpointer
 RoArchive::directory(const fs::path &path, const OpenOptions &openOptions)
 {
     // do not apply any limit
-    return std::make_shared<Directory>(path, openOptions.hint);
+    return std::make_shared<Directory>(path, openOptions);
 }
 
 } // namespace roarchive
-
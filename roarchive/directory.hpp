@@ -0,0 +1,160 @@
+/**
+ * Copyright (c) 2017 Melown Technologies SE
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * *  Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * *  Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef roarchive_directory_hpp_included_
+#define roarchive_directory_hpp_included_
+
+#include <boost/filesystem.hpp>
+#include <boost/iostreams/device/file.hpp>
+
+#include "dbglog/dbglog.hpp"
+
+#include "utility/cppversion.hpp"
+
+#include "detail.hpp"
+#include "throttle.hpp"
+#include "dirindex.hpp"
+
+namespace roarchive {
+
+class FileIStream : public IStream {
+public:
+    FileIStream(const boost::filesystem::path &path
+                , const IStream::FilterInit &filterInit
+                , const boost::filesystem::path &index
+                , const IoScheduler::Channel::pointer &ioChannel)
+        : IStream(filterInit), path_(path), index_(index)
+    {
+        try {
+            auto source(boost::iostreams::file_source(path.string()));
+            if (!source.is_open()) {
+                // TODO: really? distinguish
+                // should we use open(2)?
+                LOGTHROW(err2, NoSuchFile)
+                    << "Cannot open file file " << path << ".";
+            }
+
+            push(fis_, std::move(source), ioChannel);
+        } catch (const std::ios_base::failure &e) {
+            LOGTHROW(err2, Error)
+                << "Cannot open file file " << path << ": " << e.what() << ".";
+        }
+    }
+
+    virtual boost::filesystem::path path() const { return path_; }
+    virtual boost::filesystem::path index() const { return index_; }
+    virtual void close() {}
+
+private:
+    const boost::filesystem::path path_;
+    const boost::filesystem::path index_;
+};
+
+struct DirectoryBase {
+    DirectoryBase(const boost::filesystem::path &path
+                  , const OpenOptions &openOptions);
+
+    HintedPath hintedPath_;
+};
+
+/** Plain directory backend.
+ */
+class Directory final
+    : private DirectoryBase
+    , public RoArchive::Detail
+{
+public:
+    Directory(const boost::filesystem::path &path
+              , const OpenOptions &openOptions)
+        : DirectoryBase(path, openOptions)
+        , Detail(hintedPath_.path, Backend::directory, openOptions, true)
+        , originalPath_(path)
+        , live_(openOptions.liveDirectoryIndex
+                ? std::make_unique<LiveDirectoryIndex>(path_)
+                : nullptr)
+    {}
+
+    /** Get (wrapped) input stream for given file.
+     *  Throws when not found.
+     */
+    virtual IStream::pointer istream(const boost::filesystem::path &path
+                                     , const IStream::FilterInit &filterInit)
+        const
+    {
+        if (path.is_absolute()) {
+            return std::make_unique<FileIStream>
+                (path, filterInit, path, ioChannel_);
+        }
+        return std::make_unique<FileIStream>
+            (path_ / path, filterInit, path, ioChannel_);
+    }
+
+    using Detail::istream;
+
+    /** Whole regular file, own descriptor.
+     */
+    virtual boost::optional<RawFile>
+    openRaw(const boost::filesystem::path &path) const;
+
+    /** Member file's own stat: editing file in place does not change the
+     *  root directory.
+     */
+    virtual boost::optional<std::string>
+    cacheIdentity(const boost::filesystem::path &path) const;
+
+    virtual bool exists(const boost::filesystem::path &path) const {
+        if (path.is_absolute()) {
+            return boost::filesystem::exists(path);
+        }
+        if (live_) { return live_->exists(path.generic_string()); }
+        return boost::filesystem::exists(path_ / path);
+    }
+
+    virtual Files list() const;
+
+    virtual boost::optional<boost::filesystem::path>
+    findFile(const std::string &filename) const;
+
+    virtual void applyHint(const FileHint &hint);
+
+    virtual DatasetRoots discover(const FileHint &hint) const;
+
+    virtual const boost::optional<boost::filesystem::path>& usedHint() {
+        return hintedPath_.usedHint;
+    }
+
+    virtual MemoryUsage memoryUsage() const;
+
+private:
+    const boost::filesystem::path originalPath_;
+
+    /** Live index of path_, see OpenOptions::liveDirectoryIndex.
+     */
+    std::unique_ptr<LiveDirectoryIndex> live_;
+};
+
+} // namespace roarchive
+
+#endif // roarchive_directory_hpp_included_
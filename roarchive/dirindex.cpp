@@ -0,0 +1,416 @@
+/**
+ * Copyright (c) 2017 Melown Technologies SE
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * *  Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * *  Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <sys/inotify.h>
+#include <sys/eventfd.h>
+#include <poll.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+#include <exception>
+#include <system_error>
+
+#include <boost/filesystem.hpp>
+
+#include "dbglog/dbglog.hpp"
+
+#include "dirindex.hpp"
+#include "error.hpp"
+#include "footprint.hpp"
+
+namespace fs = boost::filesystem;
+
+namespace roarchive {
+
+namespace {
+
+const std::uint32_t Mask(IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO
+                         | IN_ONLYDIR);
+
+inline std::string join(const std::string &dir, const std::string &name)
+{
+    return dir.empty() ? name : (dir + "/" + name);
+}
+
+/** Lexically normalized relative path (no empty or "." components), none
+ *  if it contains ".." (its meaning depends on symlinks) or ends with a
+ *  slash (must be a directory, index does not know).
+ */
+boost::optional<std::string> normalize(const std::string &path)
+{
+    if (!path.empty() && (path.back() == '/')) { return boost::none; }
+
+    std::string normalized;
+    normalized.reserve(path.size());
+
+    for (std::size_t start(0); start <= path.size(); ) {
+        auto end(path.find('/', start));
+        if (end == std::string::npos) { end = path.size(); }
+
+        const auto length(end - start);
+        if ((length == 2) && !path.compare(start, 2, "..")) {
+            return boost::none;
+        }
+        if (length && !((length == 1) && (path[start] == '.'))) {
+            if (!normalized.empty()) { normalized.push_back('/'); }
+            normalized.append(path, start, length);
+        }
+        start = end + 1;
+    }
+    return normalized;
+}
+
+/** Watches directory and lists its content. Returns false if the
+ *  directory has vanished meanwhile.
+ */
+bool watchAndList(int inotify, const fs::path &root, const std::string &dir
+                  , LiveDirectoryIndex::Found &found
+                  , std::vector<std::string> &dirs
+                  , LiveDirectoryIndex::Watches &watches)
+{
+    const auto full(dir.empty() ? root : (root / dir));
+
+    // watch first, anything created while listing is reported
+    const auto wd(::inotify_add_watch(inotify, full.c_str(), Mask));
+    if (wd < 0) {
+        if ((errno == ENOENT) || (errno == ENOTDIR)) { return false; }
+        std::system_error e(errno, std::system_category());
+        LOGTHROW(err2, IOError)
+            << "Cannot watch directory " << full
+            << ": <" << e.code() << ", " << e.what() << ">.";
+    }
+    watches[wd] = dir;
+
+    boost::system::error_code ec;
+    for (fs::directory_iterator i(full, ec), e; !ec && (i != e);
+         i.increment(ec))
+    {
+        auto path(join(dir, i->path().filename().string()));
+        const auto status(i->symlink_status());
+        if (fs::is_directory(status)) {
+            dirs.push_back(path);
+        } else if (fs::is_symlink(status)) {
+            found.links.push_back(path);
+        }
+        found.entries.push_back(std::move(path));
+    }
+    return true;
+}
+
+} // namespace
+
+LiveDirectoryIndex::LiveDirectoryIndex(const fs::path &root)
+    : root_(root)
+    , inotify_(::inotify_init1(IN_CLOEXEC | IN_NONBLOCK))
+    , wakeup_(-1), rescans_(0)
+{
+    if (inotify_ < 0) {
+        std::system_error e(errno, std::system_category());
+        LOGTHROW(err2, IOError)
+            << "Cannot initialize inotify for " << root
+            << ": <" << e.code() << ", " << e.what() << ">.";
+    }
+
+    try {
+        wakeup_ = ::eventfd(0, EFD_CLOEXEC);
+        if (wakeup_ < 0) {
+            std::system_error e(errno, std::system_category());
+            LOGTHROW(err2, IOError)
+                << "Cannot create eventfd: <" << e.code() << ", "
+                << e.what() << ">.";
+        }
+
+        build(entries_, links_, watches_);
+    } catch (...) {
+        if (wakeup_ >= 0) { ::close(wakeup_); }
+        ::close(inotify_);
+        throw;
+    }
+
+    LOG(info1) << "Indexed " << entries_.size() << " entries in "
+               << watches_.size() << " directories under " << root_ << ".";
+
+    watcher_ = std::thread(&LiveDirectoryIndex::run, this);
+}
+
+LiveDirectoryIndex::~LiveDirectoryIndex()
+{
+    const std::uint64_t one(1);
+    if (::write(wakeup_, &one, sizeof(one)) < 0) {
+        LOG(warn2) << "Cannot wake up directory watcher of " << root_ << ".";
+    }
+    if (watcher_.joinable()) { watcher_.join(); }
+
+    ::close(wakeup_);
+    ::close(inotify_);
+}
+
+void LiveDirectoryIndex::build(Entries &entries, Entries &links
+                               , Watches &watches) const
+{
+    // top level here, subtrees in parallel
+    Found top;
+    std::vector<std::string> subtrees;
+    if (!watchAndList(inotify_, root_, {}, top, subtrees, watches)) {
+        LOGTHROW(err2, IOError)
+            << "Directory " << root_ << " has vanished.";
+    }
+    entries.insert(top.entries.begin(), top.entries.end());
+    links.insert(top.links.begin(), top.links.end());
+
+    const auto threads(std::min<std::size_t>
+                       (std::max(std::thread::hardware_concurrency(), 1u)
+                        , subtrees.size()));
+
+    struct Partial {
+        Found found;
+        Watches watches;
+        std::exception_ptr error;
+    };
+    std::vector<Partial> partial(threads);
+    std::atomic<std::size_t> next(0);
+
+    const auto worker([&](std::size_t thread)
+    {
+        auto &p(partial[thread]);
+        try {
+            for (std::size_t s; (s = next++) < subtrees.size(); ) {
+                walk(subtrees[s], p.found, p.watches);
+            }
+        } catch (...) {
+            p.error = std::current_exception();
+        }
+    });
+
+    std::vector<std::thread> workers;
+    for (std::size_t t(1); t < threads; ++t) {
+        workers.emplace_back(worker, t);
+    }
+    if (threads) { worker(0); }
+    for (auto &thread : workers) { thread.join(); }
+
+    for (auto &p : partial) {
+        if (p.error) { std::rethrow_exception(p.error); }
+        entries.insert(p.found.entries.begin(), p.found.entries.end());
+        links.insert(p.found.links.begin(), p.found.links.end());
+        watches.insert(p.watches.begin(), p.watches.end());
+    }
+}
+
+void LiveDirectoryIndex::walk(const std::string &dir, Found &found
+                              , Watches &watches) const
+{
+    std::vector<std::string> dirs{dir};
+    while (!dirs.empty()) {
+        const auto current(std::move(dirs.back()));
+        dirs.pop_back();
+        watchAndList(inotify_, root_, current, found, dirs, watches);
+    }
+}
+
+void LiveDirectoryIndex::run()
+{
+    dbglog::thread_id("dir-index");
+
+    alignas(struct ::inotify_event) char buffer[1 << 16];
+
+    for (;;) {
+        ::pollfd fds[2] = { { inotify_, POLLIN, 0 }, { wakeup_, POLLIN, 0 } };
+        if (::poll(fds, 2, -1) < 0) {
+            if (errno == EINTR) { continue; }
+            std::system_error e(errno, std::system_category());
+            LOG(err2) << "Cannot poll inotify of " << root_
+                      << ": <" << e.code() << ", " << e.what()
+                      << ">; index is not updated anymore.";
+            return;
+        }
+        if (fds[1].revents) { return; }
+
+        const auto r(::read(inotify_, buffer, sizeof(buffer)));
+        if (r < 0) {
+            if ((errno == EINTR) || (errno == EAGAIN)) { continue; }
+            std::system_error e(errno, std::system_category());
+            LOG(err2) << "Cannot read inotify events of " << root_
+                      << ": <" << e.code() << ", " << e.what()
+                      << ">; index is not updated anymore.";
+            return;
+        }
+
+        try {
+            apply(buffer, r);
+        } catch (const std::exception &e) {
+            LOG(err2) << "Failed to update index of " << root_
+                      << ": " << e.what();
+        }
+    }
+}
+
+void LiveDirectoryIndex::apply(const char *data, std::size_t size)
+{
+    for (const char *p(data), *end(data + size); p < end; ) {
+        const auto &event(*reinterpret_cast<const ::inotify_event*>(p));
+        p += sizeof(::inotify_event) + event.len;
+
+        if (event.mask & IN_Q_OVERFLOW) {
+            // events are lost, rest of the batch is of no use
+            rescan();
+            return;
+        }
+
+        if (event.mask & IN_IGNORED) {
+            watches_.erase(event.wd);
+            continue;
+        }
+
+        const auto fwatches(watches_.find(event.wd));
+        if ((fwatches == watches_.end()) || !event.len) { continue; }
+
+        const auto path(join(fwatches->second, event.name));
+        const bool directory(event.mask & IN_ISDIR);
+
+        if (event.mask & (IN_DELETE | IN_MOVED_FROM)) {
+            drop(path, directory);
+        } else if (event.mask & (IN_CREATE | IN_MOVED_TO)) {
+            Found added;
+            added.entries.push_back(path);
+            if (directory) {
+                walk(path, added, watches_);
+            } else if (fs::is_symlink(fs::symlink_status(root_ / path))) {
+                added.links.push_back(path);
+            }
+
+            std::lock_guard<std::mutex> lock(mutex_);
+            entries_.insert(added.entries.begin(), added.entries.end());
+            links_.insert(added.links.begin(), added.links.end());
+        }
+    }
+}
+
+void LiveDirectoryIndex::drop(const std::string &path, bool directory)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        entries_.erase(path);
+        links_.erase(path);
+        if (directory) {
+            // '0' follows '/'
+            entries_.erase(entries_.lower_bound(path + "/")
+                           , entries_.lower_bound(path + "0"));
+            links_.erase(links_.lower_bound(path + "/")
+                         , links_.lower_bound(path + "0"));
+        }
+    }
+
+    if (!directory) { return; }
+
+    const auto prefix(path + "/");
+    for (auto iwatches(watches_.begin()); iwatches != watches_.end(); ) {
+        const auto &dir(iwatches->second);
+        if ((dir == path) || !dir.compare(0, prefix.size(), prefix)) {
+            ::inotify_rm_watch(inotify_, iwatches->first);
+            iwatches = watches_.erase(iwatches);
+        } else {
+            ++iwatches;
+        }
+    }
+}
+
+void LiveDirectoryIndex::rescan()
+{
+    LOG(warn2) << "Inotify queue of " << root_
+               << " has overflown, rescanning.";
+
+    for (const auto &watch : watches_) {
+        ::inotify_rm_watch(inotify_, watch.first);
+    }
+    watches_.clear();
+
+    Entries entries, links;
+    build(entries, links, watches_);
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        entries_.swap(entries);
+        links_.swap(links);
+    }
+    ++rescans_;
+}
+
+bool LiveDirectoryIndex::linked(const std::string &path) const
+{
+    if (links_.empty()) { return false; }
+    if (links_.count(path)) { return true; }
+    for (auto slash(path.find('/')); slash != std::string::npos;
+         slash = path.find('/', slash + 1))
+    {
+        if (links_.count(path.substr(0, slash))) { return true; }
+    }
+    return false;
+}
+
+bool LiveDirectoryIndex::exists(const std::string &path) const
+{
+    if (const auto normalized = normalize(path)) {
+        if (normalized->empty()) { return true; }
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!linked(*normalized)) { return entries_.count(*normalized); }
+    }
+
+    // symlink targets are not indexed
+    return fs::exists(root_ / path);
+}
+
+std::vector<fs::path> LiveDirectoryIndex::list() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return { entries_.begin(), entries_.end() };
+}
+
+boost::optional<fs::path>
+LiveDirectoryIndex::findFile(const std::string &filename) const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (const auto &entry : entries_) {
+        const auto slash(entry.rfind('/'));
+        if (!entry.compare((slash == std::string::npos) ? 0 : (slash + 1)
+                           , std::string::npos, filename))
+        {
+            return fs::path(entry);
+        }
+    }
+    return boost::none;
+}
+
+std::size_t LiveDirectoryIndex::memory() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::size_t memory(footprint::heap(entries_) + footprint::heap(links_));
+    for (const auto &entry : entries_) { memory += footprint::heap(entry); }
+    for (const auto &link : links_) { memory += footprint::heap(link); }
+    return memory;
+}
+
+} // namespace roarchive
@@ -0,0 +1,147 @@
+/**
+ * Copyright (c) 2017 Melown Technologies SE
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * *  Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * *  Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef roarchive_dirindex_hpp_included_
+#define roarchive_dirindex_hpp_included_
+
+#include <set>
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <unordered_map>
+
+#include <boost/optional.hpp>
+#include <boost/filesystem/path.hpp>
+
+namespace roarchive {
+
+/** Internal: in-memory index of a directory tree kept current from inotify
+ *  events.
+ *
+ *  Tree is walked once (top-level subtrees in parallel), every directory
+ *  gets its own watch before it is listed so nothing created meanwhile is
+ *  missed. Events are applied by a background thread; created or moved-in
+ *  directories are walked, deleted or moved-out ones are dropped with
+ *  their whole subtree. Event queue overflow triggers full rescan.
+ *
+ *  Symlinks are indexed as entries, never followed (same as
+ *  recursive_directory_iterator); existence of paths through them is
+ *  checked in the filesystem.
+ */
+class LiveDirectoryIndex {
+public:
+    /** Indexes tree at given root and starts watching it. Throws IOError
+     *  when inotify is unavailable or out of watches.
+     */
+    LiveDirectoryIndex(const boost::filesystem::path &root);
+    ~LiveDirectoryIndex();
+
+    LiveDirectoryIndex(const LiveDirectoryIndex&) = delete;
+    LiveDirectoryIndex& operator=(const LiveDirectoryIndex&) = delete;
+
+    /** Checks existence of given path (relative to root, generic format),
+     *  same as boost::filesystem::exists(root / path). Answered from the
+     *  index unless the path goes through a symlink, contains ".." or ends
+     *  with a slash.
+     */
+    bool exists(const std::string &path) const;
+
+    /** All entries (files and directories), relative to root.
+     */
+    std::vector<boost::filesystem::path> list() const;
+
+    /** First entry (in path order) with given filename, relative to root.
+     */
+    boost::optional<boost::filesystem::path>
+    findFile(const std::string &filename) const;
+
+    /** Number of full rescans due to event queue overflow.
+     */
+    std::size_t rescans() const { return rescans_; }
+
+    /** Estimated memory held by the index.
+     */
+    std::size_t memory() const;
+
+    typedef std::set<std::string> Entries;
+    typedef std::unordered_map<int, std::string> Watches;
+
+    /** Entries found while walking; links are symlinks among them.
+     */
+    struct Found {
+        std::vector<std::string> entries;
+        std::vector<std::string> links;
+    };
+
+private:
+    /** Walks whole tree, watches are (re)added.
+     */
+    void build(Entries &entries, Entries &links, Watches &watches) const;
+
+    /** Walks subtree of given directory (relative, directory itself is not
+     *  recorded).
+     */
+    void walk(const std::string &dir, Found &found, Watches &watches) const;
+
+    /** Checks whether path or any of its parents is a symlink. Must be
+     *  called under lock.
+     */
+    bool linked(const std::string &path) const;
+
+    void run();
+
+    /** Applies events in given buffer.
+     */
+    void apply(const char *data, std::size_t size);
+
+    /** Drops entry at given path, directory with its whole subtree and its
+     *  watches.
+     */
+    void drop(const std::string &path, bool directory);
+
+    void rescan();
+
+    const boost::filesystem::path root_;
+    int inotify_;
+    int wakeup_;
+
+    /** Watched directories, touched by the event thread only (after
+     *  construction).
+     */
+    Watches watches_;
+
+    mutable std::mutex mutex_;
+    Entries entries_;
+    Entries links_;
+
+    std::atomic<std::size_t> rescans_;
+    std::thread watcher_;
+};
+
+} // namespace roarchive
+
+#endif // roarchive_dirindex_hpp_included_
@@ -0,0 +1,195 @@
+/**
+ * Copyright (c) 2017 Melown Technologies SE
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * *  Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * *  Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#include <cerrno>
+#include <system_error>
+
+#include "dbglog/dbglog.hpp"
+
+#include "fdmanager.hpp"
+#include "error.hpp"
+
+namespace fs = boost::filesystem;
+
+namespace roarchive {
+
+namespace {
+
+int openFile(const fs::path &path)
+{
+    const auto fd(::open(path.c_str(), O_RDONLY | O_CLOEXEC));
+    if (fd < 0) {
+        std::system_error e(errno, std::system_category());
+        LOGTHROW(err2, IOError)
+            << "Cannot open " << path
+            << ": <" << e.code() << ", " << e.what() << ">.";
+    }
+    return fd;
+}
+
+struct ::stat statFile(const fs::path &path, int fd)
+{
+    struct ::stat st;
+    if (::fstat(fd, &st) < 0) {
+        std::system_error e(errno, std::system_category());
+        ::close(fd);
+        LOGTHROW(err2, IOError)
+            << "Cannot stat " << path
+            << ": <" << e.code() << ", " << e.what() << ">.";
+    }
+    return st;
+}
+
+} // namespace
+
+FdManager::FdManager(std::size_t budget)
+    : budget_(std::max<std::size_t>(budget, 1))
+{
+    stats_.budget = budget_;
+}
+
+FdManager::~FdManager() {}
+
+FdManager::File::pointer FdManager::open(const fs::path &path)
+{
+    return adopt(path, openFile(path));
+}
+
+FdManager::File::pointer FdManager::adopt(const fs::path &path, int fd)
+{
+    return std::make_shared<File>(shared_from_this(), path, fd);
+}
+
+void FdManager::trim()
+{
+    while ((stats_.open > budget_) && !lru_.empty()) {
+        lru_.back()->close();
+        ++stats_.closes;
+    }
+}
+
+FdManager::Stats FdManager::stats() const
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    return stats_;
+}
+
+FdManager::File::File(const FdManager::pointer &manager, const fs::path &path
+                      , int fd)
+    : manager_(manager), path_(path), fd_(fd), leases_(), inLru_(false)
+{
+    const auto st(statFile(path, fd));
+    dev_ = st.st_dev;
+    ino_ = st.st_ino;
+
+    std::unique_lock<std::mutex> lock(manager_->mutex_);
+    ++manager_->stats_.files;
+    ++manager_->stats_.open;
+    manager_->lru_.push_front(this);
+    lru_ = manager_->lru_.begin();
+    inLru_ = true;
+    manager_->trim();
+}
+
+FdManager::File::~File()
+{
+    std::unique_lock<std::mutex> lock(manager_->mutex_);
+    close();
+    --manager_->stats_.files;
+}
+
+void FdManager::File::close()
+{
+    if (fd_ < 0) { return; }
+    if (inLru_) {
+        manager_->lru_.erase(lru_);
+        inLru_ = false;
+    }
+    ::close(fd_);
+    fd_ = -1;
+    --manager_->stats_.open;
+}
+
+FdManager::Lease FdManager::File::lease()
+{
+    auto &manager(*manager_);
+    {
+        std::unique_lock<std::mutex> lock(manager.mutex_);
+        if (fd_ >= 0) {
+            ++manager.stats_.hits;
+            if (!leases_++ && inLru_) {
+                manager.lru_.erase(lru_);
+                inLru_ = false;
+            }
+            return Lease(shared_from_this());
+        }
+    }
+
+    // reopen outside the lock
+    const auto fd(openFile(path_));
+    const auto st(statFile(path_, fd));
+    if ((st.st_dev != dev_) || (st.st_ino != ino_)) {
+        ::close(fd);
+        LOGTHROW(err2, IOError)
+            << "File " << path_ << " has been replaced since it was opened.";
+    }
+
+    std::unique_lock<std::mutex> lock(manager.mutex_);
+    if (fd_ >= 0) {
+        // reopened meanwhile by another thread
+        ::close(fd);
+        ++manager.stats_.hits;
+        if (!leases_++ && inLru_) {
+            manager.lru_.erase(lru_);
+            inLru_ = false;
+        }
+        return Lease(shared_from_this());
+    }
+
+    fd_ = fd;
+    ++leases_;
+    ++manager.stats_.open;
+    ++manager.stats_.reopens;
+    manager.trim();
+    return Lease(shared_from_this());
+}
+
+void FdManager::File::release()
+{
+    auto &manager(*manager_);
+    std::unique_lock<std::mutex> lock(manager.mutex_);
+    if (--leases_ || (fd_ < 0)) { return; }
+
+    manager.lru_.push_front(this);
+    lru_ = manager.lru_.begin();
+    inLru_ = true;
+    manager.trim();
+}
+
+} // namespace roarchive
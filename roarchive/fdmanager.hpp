@@ -0,0 +1,198 @@
+/**
+ * Copyright (c) 2017 Melown Technologies SE
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * *  Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * *  Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef roarchive_fdmanager_hpp_included_
+#define roarchive_fdmanager_hpp_included_
+
+#include <list>
+#include <mutex>
+#include <memory>
+#include <cstdint>
+
+#include <sys/types.h>
+
+#include <boost/filesystem/path.hpp>
+
+namespace roarchive {
+
+/** Process-wide file descriptor budget.
+ *
+ *  Archives opened with a manager (OpenOptions::setFdManager()) do not keep
+ *  their files open: descriptors are leased for the duration of a read
+ *  (or the lifetime of a stream). Unleased descriptors are kept open and
+ *  the least recently used ones are closed when there are more than the
+ *  budget allows. Closed files are transparently reopened on next lease;
+ *  reopened file must be the same one (device and inode) otherwise lease
+ *  fails.
+ *
+ *  Leased descriptors are never closed, budget can be exceeded when more
+ *  files are leased at once.
+ */
+class FdManager : public std::enable_shared_from_this<FdManager> {
+public:
+    typedef std::shared_ptr<FdManager> pointer;
+
+    FdManager(std::size_t budget);
+    ~FdManager();
+
+    FdManager(const FdManager&) = delete;
+    FdManager& operator=(const FdManager&) = delete;
+
+    class File;
+    class Lease;
+
+    /** Opens file under management.
+     */
+    std::shared_ptr<File> open(const boost::filesystem::path &path);
+
+    /** Takes already open descriptor under management.
+     */
+    std::shared_ptr<File> adopt(const boost::filesystem::path &path
+                                , int fd);
+
+    struct Stats {
+        /** Leases served by open descriptor, leases that needed to reopen
+         *  the file and descriptors closed to fit into budget.
+         */
+        std::uint64_t hits;
+        std::uint64_t reopens;
+        std::uint64_t closes;
+
+        /** Currently open descriptors and managed files.
+         */
+        std::size_t open;
+        std::size_t files;
+        std::size_t budget;
+
+        Stats() : hits(), reopens(), closes(), open(), files(), budget() {}
+
+        double hitRate() const {
+            const auto total(hits + reopens);
+            return total ? (double(hits) / total) : 1.0;
+        }
+    };
+
+    Stats stats() const;
+
+    std::size_t budget() const { return budget_; }
+
+private:
+    friend class File;
+
+    /** Closes least recently used descriptors over budget. Called locked.
+     */
+    void trim();
+
+    const std::size_t budget_;
+
+    mutable std::mutex mutex_;
+
+    /** Open, not leased files, most recently used first.
+     */
+    std::list<File*> lru_;
+
+    Stats stats_;
+};
+
+/** Descriptor lent by the manager. Empty lease has fd -1.
+ *
+ *  Lease keeps its file (and thus the descriptor) alive, it can safely
+ *  outlive the archive it was taken from.
+ */
+class FdManager::Lease {
+public:
+    Lease() : file_() {}
+    Lease(Lease &&o) : file_(std::move(o.file_)) { o.file_.reset(); }
+    ~Lease();
+
+    Lease& operator=(Lease &&o) {
+        std::swap(file_, o.file_); return *this;
+    }
+
+    Lease(const Lease&) = delete;
+    Lease& operator=(const Lease&) = delete;
+
+    int fd() const;
+
+    explicit operator bool() const { return file_ != nullptr; }
+
+private:
+    friend class File;
+    Lease(std::shared_ptr<File> file) : file_(std::move(file)) {}
+
+    std::shared_ptr<File> file_;
+};
+
+/** Managed file. Always held by shared pointer (see FdManager::open()), its
+ *  leases share ownership.
+ */
+class FdManager::File : public std::enable_shared_from_this<File> {
+public:
+    typedef std::shared_ptr<File> pointer;
+
+    File(const FdManager::pointer &manager
+         , const boost::filesystem::path &path, int fd);
+    ~File();
+
+    File(const File&) = delete;
+    File& operator=(const File&) = delete;
+
+    /** Lends descriptor, reopening the file if needed.
+     */
+    Lease lease();
+
+    const boost::filesystem::path& path() const { return path_; }
+
+private:
+    friend class FdManager;
+    friend class Lease;
+
+    void release();
+
+    /** Closes descriptor. Called locked.
+     */
+    void close();
+
+    FdManager::pointer manager_;
+    const boost::filesystem::path path_;
+    ::dev_t dev_;
+    ::ino_t ino_;
+
+    int fd_;
+    unsigned int leases_;
+
+    /** Position in manager's LRU if open and not leased.
+     */
+    std::list<File*>::iterator lru_;
+    bool inLru_;
+};
+
+inline FdManager::Lease::~Lease() { if (file_) { file_->release(); } }
+
+inline int FdManager::Lease::fd() const { return file_ ? file_->fd_ : -1; }
+
+} // namespace roarchive
+
+#endif // roarchive_fdmanager_hpp_included_
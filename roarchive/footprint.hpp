@@ -0,0 +1,95 @@
+/**
+ * Copyright (c) 2017 Melown Technologies SE
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * *  Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * *  Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef roarchive_footprint_hpp_included_
+#define roarchive_footprint_hpp_included_
+
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+
+#include <boost/filesystem/path.hpp>
+
+namespace roarchive { namespace footprint {
+
+/** Internal: heap footprint estimation helpers. Estimates assume glibc-like
+ *  malloc (8 byte chunk header, 16 byte granularity, 32 byte minimum) and
+ *  red-black tree nodes with 4 pointer-sized header words.
+ */
+
+/** Bytes really consumed by allocation of given size.
+ */
+inline std::size_t allocated(std::size_t size)
+{
+    if (!size) { return 0; }
+    const std::size_t chunk((size + 8 + 15) & ~std::size_t(15));
+    return (chunk < 32) ? 32 : chunk;
+}
+
+/** Heap bytes owned by given string, zero when stored inline (SSO).
+ */
+inline std::size_t heap(const std::string &str)
+{
+    const auto *data(str.data());
+    const auto *self(reinterpret_cast<const char*>(&str));
+    if ((data >= self) && (data < (self + sizeof(str)))) { return 0; }
+    return allocated(str.capacity() + 1);
+}
+
+inline std::size_t heap(const boost::filesystem::path &path)
+{
+    return heap(path.native());
+}
+
+/** Heap bytes owned by vector's buffer (not by its elements).
+ */
+template <typename T, typename Allocator>
+inline std::size_t heap(const std::vector<T, Allocator> &vector)
+{
+    return allocated(vector.capacity() * sizeof(T));
+}
+
+/** Heap bytes owned by map's nodes (not by its keys and values).
+ */
+template <typename K, typename V, typename C, typename A>
+inline std::size_t heap(const std::map<K, V, C, A> &map)
+{
+    return (map.size()
+            * allocated(4 * sizeof(void*)
+                        + sizeof(typename std::map<K, V, C, A>::value_type)));
+}
+
+/** Heap bytes owned by set's nodes (not by its keys).
+ */
+template <typename K, typename C, typename A>
+inline std::size_t heap(const std::set<K, C, A> &set)
+{
+    return set.size() * allocated(4 * sizeof(void*) + sizeof(K));
+}
+
+} } // namespace roarchive::footprint
+
+#endif // roarchive_footprint_hpp_included_
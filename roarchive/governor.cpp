@@ -0,0 +1,224 @@
+/**
+ * Copyright (c) 2017 Melown Technologies SE
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * *  Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * *  Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+
+#include <boost/filesystem.hpp>
+
+#include "dbglog/dbglog.hpp"
+
+#include "governor.hpp"
+
+namespace fs = boost::filesystem;
+
+namespace roarchive {
+
+namespace {
+
+/** Parses "avg10" value out of PSI line ("some avg10=1.23 avg60=...").
+ */
+double avg10(const std::string &line)
+{
+    std::istringstream is(line);
+    std::string token;
+    while (is >> token) {
+        if (!token.compare(0, 6, "avg10=")) {
+            return std::atof(token.c_str() + 6);
+        }
+    }
+    return 0.0;
+}
+
+} // namespace
+
+MemoryGovernor::MemoryGovernor(const Config &config)
+    : config_(config)
+    , cgroup_(config.cgroup.empty()
+              ? cgroup() : boost::optional<fs::path>(config.cgroup))
+    , running_(true)
+{
+    if (!cgroup_) {
+        LOG(warn2) << "No cgroup v2 found, memory governor is idle.";
+    }
+
+    if (cgroup_ && (config_.interval.count() > 0)) {
+        poller_ = std::thread(&MemoryGovernor::run, this);
+    }
+}
+
+MemoryGovernor::~MemoryGovernor()
+{
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        running_ = false;
+    }
+    cv_.notify_all();
+    if (poller_.joinable()) { poller_.join(); }
+}
+
+void MemoryGovernor::run()
+{
+    dbglog::thread_id("memory-governor");
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (running_) {
+        cv_.wait_for(lock, config_.interval);
+        if (!running_) { break; }
+
+        lock.unlock();
+        try {
+            poll();
+        } catch (const std::exception &e) {
+            LOG(warn2) << "Memory governor poll failed: " << e.what() << ".";
+        }
+        lock.lock();
+    }
+}
+
+void MemoryGovernor::add(const std::shared_ptr<Shrinkable> &cache)
+{
+    double factor;
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        // shared caches are registered by every archive using them
+        for (const auto &weak : caches_) {
+            if (weak.lock() == cache) { return; }
+        }
+        caches_.push_back(cache);
+        factor = stats_.factor;
+    }
+    cache->scale(factor);
+}
+
+void MemoryGovernor::poll()
+{
+    if (!cgroup_) { return; }
+    if (const auto pressure = sample(*cgroup_)) { update(*pressure); }
+}
+
+void MemoryGovernor::update(const Pressure &pressure)
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+
+    // limit hit since last sample?
+    const auto &last(stats_.pressure);
+    const bool limited(last && ((pressure.high > last->high)
+                                || (pressure.max > last->max)
+                                || (pressure.oom > last->oom)));
+    stats_.pressure = pressure;
+
+    const auto factor(stats_.factor);
+    if (limited || (pressure.someAvg10 > config_.high)) {
+        stats_.factor = std::max(config_.minFactor
+                                 , factor * config_.shrinkStep);
+        if (stats_.factor == factor) { return; }
+        ++stats_.shrinks;
+        LOG(info3)
+            << "Memory pressure (some avg10=" << pressure.someAvg10
+            << (limited ? ", cgroup limit hit" : "")
+            << "): shrinking caches to " << stats_.factor << ".";
+    } else if (pressure.someAvg10 < config_.low) {
+        stats_.factor = std::min(1.0, factor + config_.growStep);
+        if (stats_.factor == factor) { return; }
+        ++stats_.grows;
+        LOG(info2)
+            << "Memory pressure cleared: growing caches to "
+            << stats_.factor << ".";
+    } else {
+        return;
+    }
+
+    apply();
+}
+
+void MemoryGovernor::apply()
+{
+    caches_.erase(std::remove_if(caches_.begin(), caches_.end()
+                                 , [](const std::weak_ptr<Shrinkable> &c)
+                                 {
+                                     return c.expired();
+                                 })
+                  , caches_.end());
+
+    for (const auto &weak : caches_) {
+        if (const auto cache = weak.lock()) { cache->scale(stats_.factor); }
+    }
+}
+
+MemoryGovernor::Stats MemoryGovernor::stats() const
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    auto stats(stats_);
+    stats.caches = caches_.size();
+    return stats;
+}
+
+boost::optional<MemoryGovernor::Pressure>
+MemoryGovernor::sample(const fs::path &cgroup)
+{
+    Pressure pressure;
+
+    std::ifstream psi((cgroup / "memory.pressure").string());
+    if (!psi) { return boost::none; }
+    for (std::string line; std::getline(psi, line); ) {
+        if (!line.compare(0, 5, "some ")) {
+            pressure.someAvg10 = avg10(line);
+        } else if (!line.compare(0, 5, "full ")) {
+            pressure.fullAvg10 = avg10(line);
+        }
+    }
+
+    std::ifstream events((cgroup / "memory.events").string());
+    std::string key;
+    std::uint64_t value;
+    while (events >> key >> value) {
+        if (key == "high") {
+            pressure.high = value;
+        } else if (key == "max") {
+            pressure.max = value;
+        } else if (key == "oom") {
+            pressure.oom = value;
+        }
+    }
+
+    return pressure;
+}
+
+boost::optional<fs::path> MemoryGovernor::cgroup()
+{
+    // cgroup v2 has single "0::/path" line
+    std::ifstream f("/proc/self/cgroup");
+    for (std::string line; std::getline(f, line); ) {
+        if (line.compare(0, 3, "0::")) { continue; }
+        const fs::path path(fs::path("/sys/fs/cgroup") / line.substr(3));
+        if (fs::exists(path / "memory.pressure")) { return path; }
+    }
+    return boost::none;
+}
+
+} // namespace roarchive
@@ -0,0 +1,182 @@
+/**
+ * Copyright (c) 2017 Melown Technologies SE
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * *  Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * *  Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef roarchive_governor_hpp_included_
+#define roarchive_governor_hpp_included_
+
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <memory>
+#include <vector>
+#include <string>
+#include <cstdint>
+
+#include <boost/optional.hpp>
+#include <boost/filesystem/path.hpp>
+
+namespace roarchive {
+
+/** Cache whose size can be scaled by MemoryGovernor.
+ */
+class Shrinkable {
+public:
+    virtual ~Shrinkable() {}
+
+    /** Scales cache's budget to given fraction (0, 1] of its configured
+     *  budget, evicting content if needed.
+     */
+    virtual void scale(double factor) = 0;
+};
+
+/** Scales registered caches according to memory pressure of the cgroup
+ *  (v2) the process runs in.
+ *
+ *  Polls cgroup's memory.pressure (PSI) and memory.events. When the
+ *  "some" 10s pressure average exceeds the high threshold or the cgroup
+ *  hit its memory.high/memory.max limit since last poll, all caches are
+ *  shrunk by shrinkStep (down to minFactor). When pressure falls under the
+ *  low threshold, they grow back by growStep per poll.
+ *
+ *  Caches are held weakly; register each with add().
+ */
+class MemoryGovernor {
+public:
+    typedef std::shared_ptr<MemoryGovernor> pointer;
+
+    struct Config {
+        /** Cgroup directory, detected from /proc/self/cgroup if empty.
+         */
+        boost::filesystem::path cgroup;
+
+        std::chrono::milliseconds interval;
+
+        /** Pressure ("some avg10", percent) thresholds.
+         */
+        double high;
+        double low;
+
+        double shrinkStep;
+        double growStep;
+        double minFactor;
+
+        Config()
+            : interval(1000), high(10.0), low(1.0)
+            , shrinkStep(0.75), growStep(0.1), minFactor(0.1)
+        {}
+    };
+
+    /** Sample of cgroup memory state.
+     */
+    struct Pressure {
+        /** PSI averages over 10 seconds, percent.
+         */
+        double someAvg10;
+        double fullAvg10;
+
+        /** memory.events counters.
+         */
+        std::uint64_t high;
+        std::uint64_t max;
+        std::uint64_t oom;
+
+        Pressure() : someAvg10(), fullAvg10(), high(), max(), oom() {}
+    };
+
+    struct Stats {
+        /** Current scale factor applied to all caches.
+         */
+        double factor;
+
+        /** Number of shrink and grow decisions.
+         */
+        std::uint64_t shrinks;
+        std::uint64_t grows;
+
+        /** Last sample, if any.
+         */
+        boost::optional<Pressure> pressure;
+
+        std::size_t caches;
+
+        Stats() : factor(1.0), shrinks(), grows(), caches() {}
+    };
+
+    /** Starts polling thread unless interval is zero (then poll() must be
+     *  called by the user) or there is no cgroup.
+     */
+    MemoryGovernor(const Config &config = Config());
+    ~MemoryGovernor();
+
+    MemoryGovernor(const MemoryGovernor&) = delete;
+    MemoryGovernor& operator=(const MemoryGovernor&) = delete;
+
+    /** Registers cache. It is immediately scaled to current factor.
+     *  Registering the same cache again does nothing.
+     */
+    void add(const std::shared_ptr<Shrinkable> &cache);
+
+    /** Reads cgroup state and updates caches.
+     */
+    void poll();
+
+    /** Updates caches based on given sample.
+     */
+    void update(const Pressure &pressure);
+
+    Stats stats() const;
+
+    /** Reads cgroup memory state, none if not available.
+     */
+    static boost::optional<Pressure>
+    sample(const boost::filesystem::path &cgroup);
+
+    /** Cgroup v2 directory of this process, none if not found.
+     */
+    static boost::optional<boost::filesystem::path> cgroup();
+
+private:
+    void run();
+
+    /** Applies factor to live caches, drops dead ones. Called locked.
+     */
+    void apply();
+
+    const Config config_;
+    boost::optional<boost::filesystem::path> cgroup_;
+
+    mutable std::mutex mutex_;
+    std::condition_variable cv_;
+    bool running_;
+    std::vector<std::weak_ptr<Shrinkable>> caches_;
+    Stats stats_;
+
+    std::thread poller_;
+};
+
+} // namespace roarchive
+
+#endif // roarchive_governor_hpp_included_
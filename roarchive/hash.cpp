@@ -0,0 +1,128 @@
+/**
+ * Copyright (c) 2017 Melown Technologies SE
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * *  Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * *  Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <cstring>
+
+#include "hash.hpp"
+
+namespace roarchive { namespace hash {
+
+namespace {
+
+inline std::uint64_t rotl(std::uint64_t x, int r)
+{
+    return (x << r) | (x >> (64 - r));
+}
+
+inline std::uint64_t fmix(std::uint64_t k)
+{
+    k ^= k >> 33;
+    k *= 0xff51afd7ed558ccdull;
+    k ^= k >> 33;
+    k *= 0xc4ceb9fe1a85ec53ull;
+    k ^= k >> 33;
+    return k;
+}
+
+inline std::uint64_t block(const unsigned char *p)
+{
+    // unaligned little-endian load
+    std::uint64_t v;
+    std::memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+const std::uint64_t c1(0x87c37b91114253d5ull);
+const std::uint64_t c2(0x4cf5ad432745937full);
+
+} // namespace
+
+Digest murmur3(const void *data, std::size_t size, std::uint32_t seed)
+{
+    const auto *p(static_cast<const unsigned char*>(data));
+    const auto blocks(size / 16);
+
+    std::uint64_t h1(seed);
+    std::uint64_t h2(seed);
+
+    for (std::size_t i(0); i < blocks; ++i, p += 16) {
+        auto k1(block(p));
+        auto k2(block(p + 8));
+
+        k1 *= c1; k1 = rotl(k1, 31); k1 *= c2; h1 ^= k1;
+        h1 = rotl(h1, 27); h1 += h2; h1 = h1 * 5 + 0x52dce729;
+
+        k2 *= c2; k2 = rotl(k2, 33); k2 *= c1; h2 ^= k2;
+        h2 = rotl(h2, 31); h2 += h1; h2 = h2 * 5 + 0x38495ab5;
+    }
+
+    // tail
+    std::uint64_t k1(0);
+    std::uint64_t k2(0);
+
+    switch (size & 15) {
+    case 15: k2 ^= std::uint64_t(p[14]) << 48; // fall through
+    case 14: k2 ^= std::uint64_t(p[13]) << 40; // fall through
+    case 13: k2 ^= std::uint64_t(p[12]) << 32; // fall through
+    case 12: k2 ^= std::uint64_t(p[11]) << 24; // fall through
+    case 11: k2 ^= std::uint64_t(p[10]) << 16; // fall through
+    case 10: k2 ^= std::uint64_t(p[9]) << 8; // fall through
+    case 9:
+        k2 ^= std::uint64_t(p[8]);
+        k2 *= c2; k2 = rotl(k2, 33); k2 *= c1; h2 ^= k2;
+        // fall through
+
+    case 8: k1 ^= std::uint64_t(p[7]) << 56; // fall through
+    case 7: k1 ^= std::uint64_t(p[6]) << 48; // fall through
+    case 6: k1 ^= std::uint64_t(p[5]) << 40; // fall through
+    case 5: k1 ^= std::uint64_t(p[4]) << 32; // fall through
+    case 4: k1 ^= std::uint64_t(p[3]) << 24; // fall through
+    case 3: k1 ^= std::uint64_t(p[2]) << 16; // fall through
+    case 2: k1 ^= std::uint64_t(p[1]) << 8; // fall through
+    case 1:
+        k1 ^= std::uint64_t(p[0]);
+        k1 *= c1; k1 = rotl(k1, 31); k1 *= c2; h1 ^= k1;
+    }
+
+    // finalization
+    h1 ^= size;
+    h2 ^= size;
+
+    h1 += h2;
+    h2 += h1;
+
+    h1 = fmix(h1);
+    h2 = fmix(h2);
+
+    h1 += h2;
+    h2 += h1;
+
+    Digest digest;
+    digest.h1 = h1;
+    digest.h2 = h2;
+    return digest;
+}
+
+} } // namespace roarchive::hash
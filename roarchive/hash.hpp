@@ -0,0 +1,66 @@
+/**
+ * Copyright (c) 2017 Melown Technologies SE
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * *  Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * *  Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef roarchive_hash_hpp_included_
+#define roarchive_hash_hpp_included_
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+
+namespace roarchive { namespace hash {
+
+/** 128-bit digest.
+ */
+struct Digest {
+    std::uint64_t h1;
+    std::uint64_t h2;
+
+    Digest() : h1(), h2() {}
+
+    bool operator==(const Digest &o) const {
+        return (h1 == o.h1) && (h2 == o.h2);
+    }
+    bool operator!=(const Digest &o) const { return !operator==(o); }
+};
+
+/** MurmurHash3 x64_128 (Austin Appleby, public domain). Not
+ *  cryptographic, fast enough to be computed over every cached file.
+ */
+Digest murmur3(const void *data, std::size_t size, std::uint32_t seed = 0);
+
+} } // namespace roarchive::hash
+
+namespace std {
+
+template<> struct hash<roarchive::hash::Digest> {
+    std::size_t operator()(const roarchive::hash::Digest &d) const {
+        return d.h1;
+    }
+};
+
+} // namespace std
+
+#endif // roarchive_hash_hpp_included_
@@ -24,21 +24,24 @@
  * POSSIBILITY OF SUCH DAMAGE.
  */
 
-#include <queue>
+#include <list>
+#include <vector>
+#include <cstring>
+#include <algorithm>
 
-#include <boost/filesystem.hpp>
 #include <boost/iostreams/device/array.hpp>
+#include <boost/iostreams/categories.hpp>
+#include <boost/iostreams/positioning.hpp>
 
 #include "dbglog/dbglog.hpp"
 
-#include "utility/cppversion.hpp"
-#include "utility/uri.hpp"
-
 #include "http/ondemandclient.hpp"
 #include "http/error.hpp"
 
-#include "detail.hpp"
+#include "http.hpp"
+#include "httprange.hpp"
 #include "io.hpp"
+#include "footprint.hpp"
 
 namespace fs = boost::filesystem;
 namespace bio = boost::iostreams;
@@ -49,54 +52,6 @@ namespace {
 
 http::OnDemandClient client(4);
 
-class HttpIStream : public IStream {
-public:
-    HttpIStream(const fs::path &path, const IStream::FilterInit &filterInit
-                , const fs::path &index)
-        : IStream(filterInit), path_(path), index_(index)
-    {
-        // TODO: make more robust
-        const auto &fetcher(client.fetcher());
-
-        auto q(fetcher.perform
-               (utility::ResourceFetcher::Query(path.string())));
-
-        if (q.ec()) {
-            if (q.check(make_error_code(utility::HttpCode::NotFound))) {
-                LOGTHROW(err2, NoSuchFile)
-                    << "File at URL <" << path << "> doesn't exist.";
-            }
-
-            LOGTHROW(err1, IOError)
-                << "Failed to download tile data from <"
-                << path << ">: Unexpected HTTP status code: <"
-                << q.ec() << ">.";
-        }
-
-        try {
-            body_ = std::move(q.moveOut());
-            const auto &data(body_.data);
-            auto source(bio::array_source
-                        (data.data(), data.data() + data.size()));
-            fis_.push(std::move(source));
-        } catch (const http::Error &e) {
-            LOGTHROW(err1, IOError)
-                << "Failed to download tile data from <"
-                << path << ">: Unexpected error code <"
-                << e.what() << ">.";
-        }
-    }
-
-    virtual fs::path path() const { return path_; }
-    virtual fs::path index() const { return index_; }
-    virtual void close() {}
-
-private:
-    const fs::path path_;
-    const fs::path index_;
-    utility::ResourceFetcher::Query::Body body_;
-};
-
 HintedPath applyHintToPath(const fs::path &path, const FileHint &hint)
 {
     if (!hint) { return path; }
@@ -113,86 +68,457 @@ HintedPath applyHintToPath(const fs::path &path, const FileHint &hint)
     return path;
 }
 
-struct HttpBase {
-    HttpBase(const fs::path &path, const FileHint &hint)
-        : hintedPath_(applyHintToPath(path, hint))
-    {}
+/** Block cache identity: content changes with size, entity tag or last
+ *  modification. Empty if the server sends neither validator, such
+ *  resource could be replaced unnoticed and must not be cached.
+ */
+std::string cacheResource(const std::string &url, std::uint64_t size
+                          , const httprange::Head &head)
+{
+    if (head.etag.empty() && head.lastModified.empty()) { return {}; }
+    return (url + '#' + std::to_string(size) + '#' + head.etag
+            + '#' + head.lastModified);
+}
 
-    HintedPath hintedPath_;
-};
+/** Fetches whole resource block by block through block cache. Returns
+ *  false if resource cannot be fetched this way (HEAD not allowed, size
+ *  unknown, no validator, resource keeps changing) and plain download
+ *  should be used.
+ */
+bool fetchBlocks(const std::string &url, BlockCache &blockCache
+                 , std::string &data, const Instrumentation *instrumentation
+                 , const IoScheduler::Channel::pointer &ioChannel)
+{
+    // second attempt only after the resource changed under our hands
+    for (int attempt(0); attempt < 2; ++attempt) {
+        httprange::Head head;
+        try {
+            Probe probe(instrumentation, Operation::fetch);
+            head = httprange::head(url);
+        } catch (const NoSuchFile&) {
+            throw;
+        } catch (const IOError &e) {
+            LOG(info2) << "HEAD of <" << url << "> failed (" << e.what()
+                       << "); falling back to plain download.";
+            return false;
+        }
+        if (!head.size) { return false; }
 
-class Http
-    : private HttpBase
-    , public RoArchive::Detail
+        const auto resource(cacheResource(url, *head.size, head));
+        if (resource.empty()) { return false; }
+
+        try {
+            data.resize(*head.size);
+            const auto got
+                (blockCache.read
+                 (resource, 0, &data[0], data.size()
+                  , [&](std::uint64_t offset, char *buf, std::size_t size)
+                  {
+                      IoScheduler::Grant grant;
+                      if (ioChannel) { grant = ioChannel->acquire(0); }
+
+                      Probe probe(instrumentation, Operation::fetch);
+                      const auto got(httprange::fetch(url, offset, buf, size
+                                                      , nullptr, head.etag));
+                      if (ioChannel) { ioChannel->charge(got); }
+                      return got;
+                  }));
+            data.resize(got);
+            return true;
+        } catch (const httprange::Changed&) {
+            // blocks of the old version must not be mixed with the new one
+            blockCache.invalidate(resource);
+        }
+    }
+
+    return false;
+}
+
+} // namespace
+
+HttpIStream::HttpIStream(const fs::path &path
+                         , const IStream::FilterInit &filterInit
+                         , const fs::path &index
+                         , const Instrumentation *instrumentation
+                         , const IoScheduler::Channel::pointer &ioChannel
+                         , const BlockCache::pointer &blockCache)
+    : IStream(filterInit), path_(path), index_(index)
 {
-public:
-    Http(const fs::path &path, const FileHint &hint)
-        : HttpBase(path, hint)
-        , Detail(hintedPath_.path, false)
-        , originalPath_(path)
-        , base_(path_.string())
-    {}
+    if (blockCache && fetchBlocks(path.string(), *blockCache, body_.data
+                                  , instrumentation, ioChannel))
+    {
+        const auto &data(body_.data);
+        fis_.push(bio::array_source(data.data(), data.data() + data.size()));
+        return;
+    }
+
+    // TODO: make more robust
+    const auto &fetcher(client.fetcher());
+
+    auto q([&]() {
+            // body size is unknown up front, charged afterwards
+            IoScheduler::Grant grant;
+            if (ioChannel) { grant = ioChannel->acquire(0); }
+
+            Probe probe(instrumentation, Operation::fetch);
+            return fetcher.perform
+                (utility::ResourceFetcher::Query(path.string()));
+        }());
+
+    if (q.ec()) {
+        if (q.check(make_error_code(utility::HttpCode::NotFound))) {
+            LOGTHROW(err2, NoSuchFile)
+                << "File at URL <" << path << "> doesn't exist.";
+        }
+
+        LOGTHROW(err1, IOError)
+            << "Failed to download tile data from <"
+            << path << ">: Unexpected HTTP status code: <"
+            << q.ec() << ">.";
+    }
+
+    try {
+        body_ = std::move(q.moveOut());
+        const auto &data(body_.data);
+        if (ioChannel) { ioChannel->charge(data.size()); }
+        auto source(bio::array_source
+                    (data.data(), data.data() + data.size()));
+        fis_.push(std::move(source));
+    } catch (const http::Error &e) {
+        LOGTHROW(err1, IOError)
+            << "Failed to download tile data from <"
+            << path << ">: Unexpected error code <"
+            << e.what() << ">.";
+    }
+}
+
+/** Shared state of lazy stream's device.
+ */
+struct LazyHttpIStream::Source {
+    const std::string url;
+    const std::size_t window;
+    const Instrumentation *instrumentation;
+    const IoScheduler::Channel::pointer ioChannel;
+    const BlockCache::pointer blockCache;
 
-    /** Get (wrapped) input stream for given file.
-     *  Throws when not found.
+    std::uint64_t size;
+
+    /** Entity tag every range read must match (empty if server sends
+     *  none).
      */
-    virtual IStream::pointer istream(const fs::path &path
-                                     , const IStream::FilterInit &filterInit)
-        const
+    std::string etag;
+
+    /** Last modification (empty if server sends none).
+     */
+    std::string lastModified;
+
+    /** Block cache identity, empty if the resource must not be cached
+     *  (see cacheResource()).
+     */
+    std::string resource;
+
+    /** One fetched range covering windows [first, first + count).
+     */
+    struct Span {
+        std::uint64_t first;
+        std::uint64_t count;
+        std::vector<char> data;
+    };
+
+    /** Fetched spans, most recently used first, and number of windows they
+     *  cover.
+     */
+    std::list<Span> spans;
+    std::size_t windows;
+
+    /** Window following the last fetched one and current read-ahead (in
+     *  windows).
+     */
+    std::uint64_t next;
+    std::size_t ahead;
+
+    std::uint64_t position;
+
+    static constexpr std::size_t MaxAhead = 8;
+    static constexpr std::size_t MaxWindows = 2 * MaxAhead;
+
+    Source(const std::string &url, std::size_t window
+           , const Instrumentation *instrumentation
+           , const IoScheduler::Channel::pointer &ioChannel
+           , const BlockCache::pointer &blockCache)
+        : url(url), window(window), instrumentation(instrumentation)
+        , ioChannel(ioChannel), blockCache(blockCache), size()
+        , windows(), next(), ahead(1), position()
     {
-        utility::Uri uri(path.string());
-        if (uri.absolute()) {
-            return std::make_unique<HttpIStream>(path, filterInit, path);
+        boost::optional<httprange::Head> head;
+        try {
+            Probe probe(instrumentation, Operation::fetch);
+            head = httprange::head(url);
+        } catch (const NoSuchFile&) {
+            throw;
+        } catch (const IOError &e) {
+            LOG(info2) << "HEAD of <" << url << "> failed (" << e.what()
+                       << "); probing with range request.";
         }
-        return std::make_unique<HttpIStream>
-            (str(base_.resolve(utility::Uri(uri))), filterInit, path);
-    }
 
-    virtual bool exists(const fs::path &path) const {
-        (void) path;
-        return true;
+        if (head) {
+            etag = head->etag;
+            lastModified = head->lastModified;
+        }
+
+        if (head && head->size) {
+            size = *head->size;
+        } else {
+            // no HEAD or no size in it, learn it from the first window;
+            // empty resource is fine
+            httprange::Head info;
+            std::vector<char> data(window);
+            data.resize(direct(0, data.data(), data.size(), &info));
+            if (!info.size) {
+                LOGTHROW(err1, IOError)
+                    << "Cannot determine size of resource at <" << url
+                    << ">.";
+            }
+            size = *info.size;
+            if (etag.empty()) { etag = info.etag; }
+            if (lastModified.empty()) { lastModified = info.lastModified; }
+            if (!data.empty()) {
+                spans.push_front({ 0, 1, std::move(data) });
+                windows = 1;
+                next = 1;
+            }
+        }
+
+        httprange::Head validators;
+        validators.etag = etag;
+        validators.lastModified = lastModified;
+        resource = cacheResource(url, size, validators);
     }
 
-    virtual Files list() const {
-        LOGTHROW(err2, NotImplemented)
-            << "HTTP list not implemented.";
-        throw;
+    std::size_t direct(std::uint64_t offset, char *buf, std::size_t size
+                       , httprange::Head *info = nullptr) const
+    {
+        // the range may be cut at end of resource, charged afterwards
+        IoScheduler::Grant grant;
+        if (ioChannel) { grant = ioChannel->acquire(0); }
+
+        Probe probe(instrumentation, Operation::fetch);
+        const auto got(httprange::fetch(url, offset, buf, size, info, etag));
+        if (ioChannel) { ioChannel->charge(got); }
+        return got;
     }
 
-    virtual boost::optional<fs::path> findFile(const std::string&)
+    /** Fetches range, through block cache if any. Throws
+     *  httprange::Changed once the resource no longer matches what was
+     *  already read; the stream fails rather than mixing two versions.
+     */
+    std::size_t fetch(std::uint64_t offset, char *buf, std::size_t size)
         const
     {
-        LOGTHROW(err2, NotImplemented)
-            << "HTTP find not implemented.";;
+        if (!blockCache || resource.empty()) {
+            return direct(offset, buf, size);
+        }
+        try {
+            return blockCache->read
+                (resource, offset, buf, size
+                 , [this](std::uint64_t offset, char *buf, std::size_t size)
+                 {
+                     return direct(offset, buf, size);
+                 });
+        } catch (const httprange::Changed&) {
+            blockCache->invalidate(resource);
+            throw;
+        }
+    }
+
+    /** Span containing given window, fetched if needed.
+     */
+    const Span& get(std::uint64_t index);
+
+    std::streamsize read(char *s, std::streamsize n);
+
+    std::streampos seek(bio::stream_offset off, std::ios_base::seekdir way);
+};
+
+constexpr std::size_t LazyHttpIStream::Source::MaxAhead;
+constexpr std::size_t LazyHttpIStream::Source::MaxWindows;
+
+const LazyHttpIStream::Source::Span&
+LazyHttpIStream::Source::get(std::uint64_t index)
+{
+    for (auto ispans(spans.begin()); ispans != spans.end(); ++ispans) {
+        if ((index >= ispans->first)
+            && (index < (ispans->first + ispans->count)))
+        {
+            spans.splice(spans.begin(), spans, ispans);
+            return spans.front();
+        }
+    }
+
+    // sequential access reads further and further ahead
+    ahead = (index == next) ? std::min(2 * ahead, MaxAhead) : 1;
+
+    const auto offset(index * window);
+    const auto count(std::min<std::uint64_t>
+                     (ahead, (size - offset + window - 1) / window));
+    const auto length(std::min<std::uint64_t>(count * window
+                                               , size - offset));
+
+    // fetched range is kept as is, windows are indexed inside it
+    std::vector<char> data(length);
+    data.resize(fetch(offset, data.data(), data.size()));
+    spans.push_front({ index, count, std::move(data) });
+    windows += count;
+    next = index + count;
+
+    // drop least recently used spans, keep the fresh one
+    while ((windows > MaxWindows) && (spans.size() > 1)) {
+        windows -= spans.back().count;
+        spans.pop_back();
+    }
+    return spans.front();
+}
+
+std::streamsize LazyHttpIStream::Source::read(char *s, std::streamsize n)
+{
+    std::streamsize done(0);
+    while ((done < n) && (position < size)) {
+        const auto &span(get(position / window));
+        const auto skip(position - span.first * window);
+        if (skip >= span.data.size()) {
+            // resource is shorter than announced
+            break;
+        }
+
+        const auto copy(std::min<std::uint64_t>(n - done
+                                                , span.data.size() - skip));
+        std::memcpy(s + done, span.data.data() + skip, copy);
+        position += copy;
+        done += copy;
+    }
+    return done ? done : -1;
+}
+
+std::streampos LazyHttpIStream::Source::seek(bio::stream_offset off
+                                             , std::ios_base::seekdir way)
+{
+    bio::stream_offset pos;
+    switch (way) {
+    case std::ios_base::beg: pos = off; break;
+    case std::ios_base::cur: pos = position + off; break;
+    case std::ios_base::end: pos = size + off; break;
+    default:
+        LOGTHROW(err2, std::logic_error) << "Invalid seek direction.";
         throw;
     }
 
-    virtual void applyHint(const FileHint &hint) {
-        hintedPath_ = applyHintToPath(originalPath_, hint);
-        path_ = hintedPath_.path;
-        base_ = utility::Uri(path_.string());
+    if (pos < 0) {
+        LOGTHROW(err2, IOError) << "Seek before start of <" << url << ">.";
     }
 
-    virtual const boost::optional<boost::filesystem::path>& usedHint() {
-        return hintedPath_.usedHint;
+    position = std::min<std::uint64_t>(pos, size);
+    return position;
+}
+
+namespace {
+
+/** Seekable device over lazy source.
+ */
+class RangeDevice {
+public:
+    typedef char char_type;
+    struct category : bio::device_tag, bio::input_seekable {};
+
+    RangeDevice(const std::shared_ptr<LazyHttpIStream::Source> &source)
+        : source_(source)
+    {}
+
+    std::streamsize read(char *s, std::streamsize n) {
+        return source_->read(s, n);
     }
 
-    virtual bool handlesSchema(const std::string &schema) const {
-        return ((schema == "http") || (schema == "https"));
+    std::streampos seek(bio::stream_offset off, std::ios_base::seekdir way)
+    {
+        return source_->seek(off, way);
     }
 
 private:
-    const fs::path originalPath_;
-    utility::Uri base_;
+    std::shared_ptr<LazyHttpIStream::Source> source_;
 };
 
 } // namespace
 
+LazyHttpIStream::LazyHttpIStream(const fs::path &path
+                                 , const IStream::FilterInit &filterInit
+                                 , const fs::path &index
+                                 , std::size_t window
+                                 , const Instrumentation *instrumentation
+                                 , const IoScheduler::Channel::pointer
+                                 &ioChannel
+                                 , const BlockCache::pointer &blockCache)
+    : IStream(filterInit), path_(path), index_(index)
+    , source_(std::make_shared<Source>(path.string(), window
+                                       , instrumentation, ioChannel
+                                       , blockCache))
+{
+    fis_.push(RangeDevice(source_));
+    update(std::size_t(source_->size), true);
+    enableReadWhole();
+}
+
+std::vector<char> LazyHttpIStream::readWhole()
+{
+    std::vector<char> data(source_->size);
+    data.resize(source_->fetch(0, data.data(), data.size()));
+    return data;
+}
+
+HttpBase::HttpBase(const fs::path &path, const FileHint &hint)
+    : hintedPath_(applyHintToPath(path, hint))
+{}
+
+Files Http::list() const
+{
+    LOGTHROW(err2, NotImplemented)
+        << "HTTP list not implemented.";
+    throw;
+}
+
+DatasetRoots Http::discover(const FileHint&) const
+{
+    LOGTHROW(err2, NotImplemented)
+        << "HTTP discover not implemented.";
+    throw;
+}
+
+boost::optional<fs::path> Http::findFile(const std::string&) const
+{
+    LOGTHROW(err2, NotImplemented)
+        << "HTTP find not implemented.";;
+    throw;
+}
+
+void Http::applyHint(const FileHint &hint)
+{
+    hintedPath_ = applyHintToPath(originalPath_, hint);
+    path_ = hintedPath_.path;
+    base_ = utility::Uri(path_.string());
+}
+
+MemoryUsage Http::memoryUsage() const
+{
+    auto mu(Detail::memoryUsage());
+    mu.add("object", footprint::allocated(sizeof(*this)));
+    mu.add("paths", (footprint::heap(originalPath_)
+                     + footprint::heap(hintedPath_.path)));
+    return mu;
+}
+
 RoArchive::dpointer
 RoArchive::http(const fs::path &path, const OpenOptions &openOptions)
 {
     // do not apply any limit
-    return std::make_shared<Http>(path, openOptions.hint);
+    return std::make_shared<Http>(path, openOptions);
 }
 
 } // namespace roarchive
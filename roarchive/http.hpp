@@ -0,0 +1,186 @@
+/**
+ * Copyright (c) 2017 Melown Technologies SE
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * *  Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * *  Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef roarchive_http_hpp_included_
+#define roarchive_http_hpp_included_
+
+#include "dbglog/dbglog.hpp"
+
+#include "utility/cppversion.hpp"
+#include "utility/uri.hpp"
+#include "utility/resourcefetcher.hpp"
+
+#include "detail.hpp"
+#include "blockcache.hpp"
+
+namespace roarchive {
+
+class HttpIStream : public IStream {
+public:
+    HttpIStream(const boost::filesystem::path &path
+                , const IStream::FilterInit &filterInit
+                , const boost::filesystem::path &index
+                , const Instrumentation *instrumentation
+                , const IoScheduler::Channel::pointer &ioChannel
+                , const BlockCache::pointer &blockCache = nullptr);
+
+    virtual boost::filesystem::path path() const { return path_; }
+    virtual boost::filesystem::path index() const { return index_; }
+    virtual void close() {}
+
+private:
+    const boost::filesystem::path path_;
+    const boost::filesystem::path index_;
+    utility::ResourceFetcher::Query::Body body_;
+};
+
+/** Stream over remote resource fetching only what is actually read.
+ *
+ *  Size is learnt up front (HEAD, or first range response if the server
+ *  does not report it), data are then fetched by range requests in
+ *  fixed-size windows. Sequential reads fetch increasingly more windows
+ *  ahead; recently fetched windows are kept in memory. Goes through block
+ *  cache if configured. Stream is seekable and has known size.
+ *
+ *  Requests are made by httprange (libcurl, with connect and stall
+ *  timeouts); a request that times out fails the read with IOError.
+ */
+class LazyHttpIStream : public IStream {
+public:
+    LazyHttpIStream(const boost::filesystem::path &path
+                    , const IStream::FilterInit &filterInit
+                    , const boost::filesystem::path &index
+                    , std::size_t window
+                    , const Instrumentation *instrumentation
+                    , const IoScheduler::Channel::pointer &ioChannel
+                    , const BlockCache::pointer &blockCache);
+
+    virtual boost::filesystem::path path() const { return path_; }
+    virtual boost::filesystem::path index() const { return index_; }
+    virtual void close() {}
+
+    struct Source;
+
+private:
+    /** Fetches whole resource in one request.
+     */
+    virtual std::vector<char> readWhole();
+
+    const boost::filesystem::path path_;
+    const boost::filesystem::path index_;
+    std::shared_ptr<Source> source_;
+};
+
+struct HttpBase {
+    HttpBase(const boost::filesystem::path &path, const FileHint &hint);
+
+    HintedPath hintedPath_;
+};
+
+/** Remote HTTP(S) "archive" backend.
+ */
+class Http final
+    : private HttpBase
+    , public RoArchive::Detail
+{
+public:
+    Http(const boost::filesystem::path &path
+         , const OpenOptions &openOptions)
+        : HttpBase(path, openOptions.hint)
+        , Detail(hintedPath_.path, Backend::http, openOptions, false)
+        , originalPath_(path)
+        , base_(path_.string())
+        , blockCache_(openOptions.blockCache)
+        , rangeWindow_(openOptions.httpRangeWindow)
+    {}
+
+    /** Get (wrapped) input stream for given file.
+     *  Throws when not found.
+     */
+    virtual IStream::pointer istream(const boost::filesystem::path &path
+                                     , const IStream::FilterInit &filterInit)
+        const
+    {
+        utility::Uri uri(path.string());
+        if (rangeWindow_) {
+            return std::make_unique<LazyHttpIStream>
+                ((uri.absolute()
+                  ? path.string() : str(base_.resolve(utility::Uri(uri))))
+                 , filterInit, path, rangeWindow_
+                 , instrumentation_.get(), ioChannel_, blockCache_);
+        }
+        if (uri.absolute()) {
+            return std::make_unique<HttpIStream>
+                (path, filterInit, path, instrumentation_.get()
+                 , ioChannel_, blockCache_);
+        }
+        return std::make_unique<HttpIStream>
+            (str(base_.resolve(utility::Uri(uri))), filterInit, path
+             , instrumentation_.get(), ioChannel_, blockCache_);
+    }
+
+    using Detail::istream;
+
+    /** Remote content can change under the same URL: never cached.
+     */
+    virtual boost::optional<std::string>
+    cacheIdentity(const boost::filesystem::path&) const {
+        return boost::none;
+    }
+
+    virtual bool exists(const boost::filesystem::path &path) const {
+        (void) path;
+        return true;
+    }
+
+    virtual Files list() const;
+
+    virtual DatasetRoots discover(const FileHint &hint) const;
+
+    virtual boost::optional<boost::filesystem::path>
+    findFile(const std::string &filename) const;
+
+    virtual void applyHint(const FileHint &hint);
+
+    virtual const boost::optional<boost::filesystem::path>& usedHint() {
+        return hintedPath_.usedHint;
+    }
+
+    virtual MemoryUsage memoryUsage() const;
+
+    virtual bool handlesSchema(const std::string &schema) const {
+        return ((schema == "http") || (schema == "https"));
+    }
+
+private:
+    const boost::filesystem::path originalPath_;
+    utility::Uri base_;
+    BlockCache::pointer blockCache_;
+    std::size_t rangeWindow_;
+};
+
+} // namespace roarchive
+
+#endif // roarchive_http_hpp_included_
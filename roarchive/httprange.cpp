@@ -0,0 +1,323 @@
+/**
+ * Copyright (c) 2017 Melown Technologies SE
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * *  Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * *  Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <curl/curl.h>
+
+#include <new>
+#include <cstring>
+#include <cstdlib>
+#include <algorithm>
+
+#include <boost/algorithm/string/predicate.hpp>
+#include <boost/algorithm/string/trim.hpp>
+
+#include "dbglog/dbglog.hpp"
+
+#include "httprange.hpp"
+#include "error.hpp"
+
+namespace roarchive { namespace httprange {
+
+namespace {
+
+/** Global libcurl state. curl_global_init() is not thread-safe, it runs
+ *  during static initialization, before any thread can issue a request.
+ *  It is reference counted, other users in the process are not affected.
+ */
+struct GlobalInit {
+    GlobalInit() { ::curl_global_init(CURL_GLOBAL_DEFAULT); }
+    ~GlobalInit() { ::curl_global_cleanup(); }
+} globalInit;
+
+/** Connection must be established within this time.
+ */
+constexpr long ConnectTimeout(10);
+
+/** Transfer is aborted when slower than LowSpeedLimit bytes/s for
+ *  LowSpeedTime seconds (stalled server), whatever its total duration.
+ */
+constexpr long LowSpeedLimit(1);
+constexpr long LowSpeedTime(30);
+
+/** Per-thread easy handle, reset before every request.
+ */
+CURL* handle()
+{
+    struct Handle {
+        CURL *curl;
+        Handle() : curl(::curl_easy_init()) {}
+        ~Handle() { if (curl) { ::curl_easy_cleanup(curl); } }
+    };
+    static thread_local Handle handle;
+
+    if (!handle.curl) {
+        LOGTHROW(err2, IOError) << "Cannot initialize libcurl handle.";
+    }
+    ::curl_easy_reset(handle.curl);
+    ::curl_easy_setopt(handle.curl, CURLOPT_NOSIGNAL, 1L);
+    ::curl_easy_setopt(handle.curl, CURLOPT_FOLLOWLOCATION, 1L);
+    ::curl_easy_setopt(handle.curl, CURLOPT_CONNECTTIMEOUT, ConnectTimeout);
+    ::curl_easy_setopt(handle.curl, CURLOPT_LOW_SPEED_LIMIT, LowSpeedLimit);
+    ::curl_easy_setopt(handle.curl, CURLOPT_LOW_SPEED_TIME, LowSpeedTime);
+    return handle.curl;
+}
+
+/** Response headers of interest.
+ */
+struct Headers {
+    boost::optional<std::uint64_t> rangeTotal;
+    std::string etag;
+    std::string lastModified;
+
+    void parse(const char *data, std::size_t size) {
+        std::string line(data, size);
+        boost::algorithm::trim(line);
+        const auto colon(line.find(':'));
+        if (colon == std::string::npos) {
+            // status line of next response (redirect): start over
+            if (boost::algorithm::istarts_with(line, "HTTP/")) {
+                rangeTotal = boost::none;
+                etag.clear();
+                lastModified.clear();
+            }
+            return;
+        }
+
+        const auto name(line.substr(0, colon));
+        auto value(line.substr(colon + 1));
+        boost::algorithm::trim(value);
+
+        if (boost::algorithm::iequals(name, "Content-Range")) {
+            // bytes <first>-<last>/<total> or bytes */<total>
+            const auto slash(value.rfind('/'));
+            if ((slash != std::string::npos)
+                && (value.compare(slash + 1, std::string::npos, "*")))
+            {
+                rangeTotal = std::strtoull(value.c_str() + slash + 1
+                                           , nullptr, 10);
+            }
+        } else if (boost::algorithm::iequals(name, "ETag")) {
+            etag = value;
+        } else if (boost::algorithm::iequals(name, "Last-Modified")) {
+            lastModified = value;
+        }
+    }
+};
+
+std::size_t onHeader(char *data, std::size_t size, std::size_t count
+                     , void *userdata)
+{
+    static_cast<Headers*>(userdata)->parse(data, size * count);
+    return size * count;
+}
+
+/** Body sink: copies requested window into caller's buffer.
+ */
+struct Sink {
+    CURL *curl;
+    std::uint64_t offset;
+    char *buf;
+    std::size_t size;
+
+    std::size_t got;
+
+    /** Body position (for servers ignoring Range).
+     */
+    std::uint64_t position;
+    bool done;
+
+    Sink(CURL *curl, std::uint64_t offset, char *buf, std::size_t size)
+        : curl(curl), offset(offset), buf(buf), size(size), got()
+        , position(), done(false)
+    {}
+
+    std::size_t write(const char *data, std::size_t length) {
+        long status(0);
+        ::curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &status);
+
+        // error bodies are not of interest
+        if ((status != 200) && (status != 206)) { return length; }
+
+        std::uint64_t skip(0);
+        if (status == 200) {
+            // whole body: skip to offset
+            if ((position + length) <= offset) {
+                position += length;
+                return length;
+            }
+            if (position < offset) { skip = offset - position; }
+            position += length;
+        }
+
+        const auto copy(std::min<std::uint64_t>(length - skip, size - got));
+        std::memcpy(buf + got, data + skip, copy);
+        got += copy;
+
+        // cut the transfer once we have all we want
+        if (got == size) {
+            done = true;
+            return (copy + skip == length) ? length : 0;
+        }
+        return length;
+    }
+};
+
+std::size_t onWrite(char *data, std::size_t size, std::size_t count
+                    , void *userdata)
+{
+    return static_cast<Sink*>(userdata)->write(data, size * count);
+}
+
+/** Request header list, freed after the request.
+ */
+struct HeaderList {
+    ::curl_slist *list;
+
+    HeaderList() : list() {}
+    ~HeaderList() { if (list) { ::curl_slist_free_all(list); } }
+
+    void add(const std::string &header) {
+        auto *l(::curl_slist_append(list, header.c_str()));
+        if (!l) { throw std::bad_alloc(); }
+        list = l;
+    }
+};
+
+void check(CURLcode res, long status, const std::string &url)
+{
+    if (res != CURLE_OK) {
+        LOGTHROW(err1, IOError)
+            << "Failed to fetch <" << url << ">: "
+            << ::curl_easy_strerror(res) << ".";
+    }
+
+    if (status == 404) {
+        LOGTHROW(err2, NoSuchFile)
+            << "File at URL <" << url << "> doesn't exist.";
+    }
+
+    if ((status < 200) || (status >= 300)) {
+        LOGTHROW(err1, IOError)
+            << "Failed to fetch <" << url
+            << ">: Unexpected HTTP status code: <" << status << ">.";
+    }
+}
+
+} // namespace
+
+Head head(const std::string &url)
+{
+    auto *curl(handle());
+    Headers headers;
+    ::curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
+    ::curl_easy_setopt(curl, CURLOPT_NOBODY, 1L);
+    ::curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, &onHeader);
+    ::curl_easy_setopt(curl, CURLOPT_HEADERDATA, &headers);
+
+    const auto res(::curl_easy_perform(curl));
+    long status(0);
+    ::curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &status);
+    check(res, status, url);
+
+    Head head;
+    head.etag = headers.etag;
+    head.lastModified = headers.lastModified;
+
+    curl_off_t length(-1);
+    ::curl_easy_getinfo(curl, CURLINFO_CONTENT_LENGTH_DOWNLOAD_T, &length);
+    if (length >= 0) { head.size = length; }
+    return head;
+}
+
+std::size_t fetch(const std::string &url, std::uint64_t offset, char *buf
+                  , std::size_t size, Head *head, const std::string &etag)
+{
+    if (!size) { return 0; }
+
+    auto *curl(handle());
+    Headers headers;
+    Sink sink(curl, offset, buf, size);
+
+    // weak tags never match If-Match, only the response is checked then
+    HeaderList requestHeaders;
+    if (!etag.empty() && !boost::algorithm::starts_with(etag, "W/")) {
+        requestHeaders.add("If-Match: " + etag);
+        ::curl_easy_setopt(curl, CURLOPT_HTTPHEADER, requestHeaders.list);
+    }
+
+    const auto range(std::to_string(offset) + "-"
+                     + std::to_string(offset + size - 1));
+    ::curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
+    ::curl_easy_setopt(curl, CURLOPT_RANGE, range.c_str());
+    ::curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, &onHeader);
+    ::curl_easy_setopt(curl, CURLOPT_HEADERDATA, &headers);
+    ::curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, &onWrite);
+    ::curl_easy_setopt(curl, CURLOPT_WRITEDATA, &sink);
+
+    auto res(::curl_easy_perform(curl));
+    long status(0);
+    ::curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &status);
+
+    // transfer cut on purpose
+    if ((res == CURLE_WRITE_ERROR) && sink.done) { res = CURLE_OK; }
+
+    if ((status == 412)
+        || ((res == CURLE_OK) && !etag.empty() && !headers.etag.empty()
+            && (headers.etag != etag)))
+    {
+        LOGTHROW(err1, Changed)
+            << "Resource at <" << url << "> has changed (expected "
+            << etag << ").";
+    }
+
+    if (status == 416) {
+        // offset past the end
+        if (head) {
+            head->size = headers.rangeTotal;
+            head->etag = headers.etag;
+            head->lastModified = headers.lastModified;
+        }
+        return 0;
+    }
+    check(res, status, url);
+
+    if (head) {
+        head->etag = headers.etag;
+        head->lastModified = headers.lastModified;
+        if (status == 206) {
+            head->size = headers.rangeTotal;
+        } else {
+            curl_off_t length(-1);
+            ::curl_easy_getinfo(curl, CURLINFO_CONTENT_LENGTH_DOWNLOAD_T
+                                , &length);
+            head->size = boost::none;
+            if (length >= 0) { head->size = length; }
+        }
+    }
+
+    return sink.got;
+}
+
+} } // namespace roarchive::httprange
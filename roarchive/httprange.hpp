@@ -0,0 +1,98 @@
+/**
+ * Copyright (c) 2017 Melown Technologies SE
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * *  Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * *  Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef roarchive_httprange_hpp_included_
+#define roarchive_httprange_hpp_included_
+
+#include <string>
+#include <cstdint>
+
+#include <boost/optional.hpp>
+
+#include "error.hpp"
+
+namespace roarchive { namespace httprange {
+
+/** Internal: HTTP range requests (libcurl).
+ *
+ *  The http module's fetcher has no HEAD, range or conditional requests,
+ *  hence direct libcurl use.
+ *
+ *  Each thread keeps its own easy handle so connections to the same host
+ *  are reused between requests. Servers ignoring Range are handled (body is
+ *  skipped to the requested offset and the transfer is cut), just
+ *  inefficiently.
+ *
+ *  Requests fail (IOError) when connecting takes over 10 seconds or the
+ *  transfer stalls for 30 seconds. libcurl is initialized globally during
+ *  static initialization; the process must not call curl_global_cleanup()
+ *  while requests may run.
+ */
+
+/** Resource metadata from HEAD request.
+ */
+struct Head {
+    /** Resource size if reported.
+     */
+    boost::optional<std::uint64_t> size;
+
+    /** Entity tag, empty if not reported.
+     */
+    std::string etag;
+
+    /** Last-Modified value as sent, empty if not reported.
+     */
+    std::string lastModified;
+};
+
+/** Resource no longer matches expected entity tag.
+ */
+struct Changed : IOError {
+    Changed(const std::string &msg) : IOError(msg) {}
+};
+
+/** Issues HEAD request. Throws NoSuchFile on 404, IOError on other
+ *  failures (some servers or signed URLs do not allow HEAD at all).
+ */
+Head head(const std::string &url);
+
+/** Fetches up to size bytes of resource at given offset. Returns number of
+ *  fetched bytes, less than size only at end of resource.
+ *
+ *  Resource metadata (total size from Content-Range or Content-Length,
+ *  entity tag, last modification) is stored into head if given. Non-empty etag makes the
+ *  request conditional (If-Match for strong tags; entity tag of the
+ *  response is checked as well) and Changed is thrown when the resource
+ *  does not match it anymore.
+ *
+ *  Throws NoSuchFile on 404, IOError on other failures.
+ */
+std::size_t fetch(const std::string &url, std::uint64_t offset, char *buf
+                  , std::size_t size, Head *head = nullptr
+                  , const std::string &etag = std::string());
+
+} } // namespace roarchive::httprange
+
+#endif // roarchive_httprange_hpp_included_
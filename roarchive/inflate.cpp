@@ -0,0 +1,359 @@
+/**
+ * Copyright (c) 2017 Melown Technologies SE
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * *  Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * *  Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <algorithm>
+#include <vector>
+
+#include <boost/iostreams/positioning.hpp>
+
+#include "dbglog/dbglog.hpp"
+
+#include "inflate.hpp"
+#include "codec.hpp"
+#include "error.hpp"
+
+namespace fs = boost::filesystem;
+namespace bio = boost::iostreams;
+
+namespace roarchive {
+
+namespace {
+
+/** Internal inflate state and window, z_stream itself is accounted
+ *  separately.
+ */
+constexpr std::size_t StateSize = 7 * 1024 + (1 << MAX_WBITS);
+
+constexpr std::size_t InputBufferSize = 1 << 16;
+
+} // namespace
+
+InflateCheckpoints::InflateCheckpoints(std::size_t interval
+                                       , const Charge &charge)
+    : interval_(std::max(interval, std::size_t(1))), charge_(charge)
+{}
+
+InflateCheckpoints::~InflateCheckpoints()
+{
+    detach();
+    for (auto &item : checkpoints_) { ::inflateEnd(item.second.strm.get()); }
+}
+
+namespace {
+
+constexpr std::size_t CheckpointSize(std::size_t checkpoint)
+{
+    return checkpoint + sizeof(z_stream) + StateSize;
+}
+
+} // namespace
+
+void InflateCheckpoints::record(const z_stream &strm, std::uint64_t out
+                                , std::uint64_t in)
+{
+    const auto mark(out / interval_);
+    if (!mark) { return; }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (checkpoints_.count(mark)) { return; }
+
+    std::unique_ptr<z_stream> copy(new z_stream());
+    // inflateCopy takes non-const source but does not modify it
+    if (::inflateCopy(copy.get(), const_cast<z_stream*>(&strm)) != Z_OK) {
+        // just no checkpoint
+        return;
+    }
+    copy->next_in = nullptr;
+    copy->avail_in = 0;
+    copy->next_out = nullptr;
+    copy->avail_out = 0;
+
+    checkpoints_.emplace(mark, Checkpoint{ out, in, std::move(copy) });
+    if (charge_) { *charge_ += CheckpointSize(sizeof(Checkpoint)); }
+}
+
+bool InflateCheckpoints::restore(std::uint64_t position, z_stream &strm
+                                 , std::uint64_t &out, std::uint64_t &in)
+    const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    auto icheckpoints(checkpoints_.upper_bound(position / interval_));
+    while (icheckpoints != checkpoints_.begin()) {
+        const auto &checkpoint((--icheckpoints)->second);
+        if (checkpoint.out > position) { continue; }
+        if (checkpoint.out <= out) { return false; }
+
+        // zlib state points back to its z_stream, copy in place
+        ::inflateEnd(&strm);
+        if (::inflateCopy(&strm, checkpoint.strm.get()) != Z_OK) {
+            LOGTHROW(err2, IOError)
+                << "Unable to restore inflate checkpoint.";
+        }
+        out = checkpoint.out;
+        in = checkpoint.in;
+        return true;
+    }
+    return false;
+}
+
+std::size_t InflateCheckpoints::memory() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return checkpoints_.size() * CheckpointSize(sizeof(Checkpoint));
+}
+
+void InflateCheckpoints::detach()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!charge_) { return; }
+    *charge_ -= checkpoints_.size() * CheckpointSize(sizeof(Checkpoint));
+    charge_.reset();
+}
+
+InflateCheckpointCache::InflateCheckpointCache(std::size_t interval
+                                               , std::size_t budget)
+    : interval_(interval), budget_(budget), limit_(budget)
+    , charge_(std::make_shared<std::atomic<std::size_t>>(0))
+{}
+
+InflateCheckpointCache::~InflateCheckpointCache()
+{
+    // streams may still hold some checkpoints
+    for (auto &item : lru_) { item.checkpoints->detach(); }
+}
+
+InflateCheckpoints::pointer InflateCheckpointCache::get(std::uint64_t key)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    auto fmap(map_.find(key));
+    if (fmap != map_.end()) {
+        // move to front
+        lru_.splice(lru_.begin(), lru_, fmap->second);
+    } else {
+        lru_.push_front
+            (Item{ key, std::make_shared<InflateCheckpoints>
+                    (interval_, charge_) });
+        map_.insert(std::make_pair(key, lru_.begin()));
+    }
+
+    // checkpoints grow while being read, budget is checked on access
+    auto checkpoints(lru_.front().checkpoints);
+    trim();
+    return checkpoints;
+}
+
+void InflateCheckpointCache::trim()
+{
+    while ((*charge_ > limit_) && !lru_.empty()) {
+        auto &item(lru_.back());
+        item.checkpoints->detach();
+        map_.erase(item.key);
+        lru_.pop_back();
+    }
+}
+
+void InflateCheckpointCache::scale(double factor)
+{
+    factor = std::min(std::max(factor, 0.0), 1.0);
+    std::lock_guard<std::mutex> lock(mutex_);
+    limit_ = std::size_t(budget_ * factor);
+    trim();
+}
+
+std::size_t InflateCheckpointCache::size() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return lru_.size();
+}
+
+struct SeekableInflate::State {
+    const ZipDirectory &directory;
+    const ZipDirectory::Filedes fd;
+    const std::uint64_t size;
+    const InflateCheckpoints::pointer checkpoints;
+    const fs::path path;
+
+    /** Pooled, restoring a checkpoint replaces its state in place.
+     */
+    codec::InflateContext strm;
+
+    /** Decoded bytes so far.
+     */
+    std::uint64_t out;
+
+    /** Compressed bytes loaded into input buffer so far.
+     */
+    std::uint64_t in;
+
+    /** Requested (read) position.
+     */
+    std::uint64_t position;
+
+    bool finished;
+    std::vector<char> input;
+
+    State(const ZipDirectory &directory, const ZipDirectory::Filedes &fd
+          , std::uint64_t size
+          , const InflateCheckpoints::pointer &checkpoints
+          , const fs::path &path)
+        : directory(directory), fd(fd), size(size), checkpoints(checkpoints)
+        , path(path), strm(codec::inflateContext()), out(), in()
+        , position(), finished(false), input(InputBufferSize)
+    {}
+
+    /** Moves decoder to current position.
+     */
+    void advance();
+
+    /** Decodes at most n bytes.
+     */
+    std::size_t decode(char *s, std::size_t n);
+
+    void reset() {
+        ::inflateReset(strm.get());
+        out = in = 0;
+        finished = false;
+        strm->avail_in = 0;
+    }
+};
+
+void SeekableInflate::State::advance()
+{
+    if (position < out) { reset(); }
+
+    if (checkpoints && ((position - out) >= checkpoints->interval())
+        && checkpoints->restore(position, *strm, out, in))
+    {
+        // restored state has no pending input
+        finished = false;
+        strm->avail_in = 0;
+    }
+
+    // decode through the rest
+    char scratch[1 << 14];
+    while (out < position) {
+        if (!decode(scratch, std::min<std::uint64_t>
+                    (sizeof(scratch), position - out)))
+        {
+            break;
+        }
+    }
+}
+
+std::size_t SeekableInflate::State::decode(char *s, std::size_t n)
+{
+    if (finished) { return 0; }
+
+    const auto compressed(fd.end - fd.start);
+    strm->next_out = reinterpret_cast<Bytef*>(s);
+    strm->avail_out = n;
+
+    while (strm->avail_out) {
+        if (!strm->avail_in) {
+            const auto chunk(std::min<std::uint64_t>
+                             (input.size(), compressed - in));
+            if (!chunk) {
+                LOGTHROW(err2, IOError)
+                    << "Truncated deflate data in " << path << ".";
+            }
+            directory.read(input.data(), chunk, fd.start + in);
+            in += chunk;
+            strm->next_in = reinterpret_cast<Bytef*>(input.data());
+            strm->avail_in = chunk;
+        }
+
+        const auto before(strm->avail_out);
+        const auto res(::inflate(strm.get(), Z_NO_FLUSH));
+        const auto produced(before - strm->avail_out);
+        out += produced;
+
+        if (res == Z_STREAM_END) {
+            finished = true;
+            break;
+        }
+        if ((res != Z_OK) && ((res != Z_BUF_ERROR) || strm->avail_in)) {
+            LOGTHROW(err2, IOError)
+                << "Unable to inflate " << path << ": "
+                << (strm->msg ? strm->msg : "unknown error") << ".";
+        }
+
+        // record only when crossing a mark
+        if (checkpoints && ((out / checkpoints->interval())
+                            != ((out - produced) / checkpoints->interval())))
+        {
+            checkpoints->record(*strm, out, in - strm->avail_in);
+        }
+    }
+
+    return n - strm->avail_out;
+}
+
+SeekableInflate::SeekableInflate(const ZipDirectory &directory
+                                 , const ZipDirectory::Filedes &fd
+                                 , std::uint64_t size
+                                 , const InflateCheckpoints::pointer
+                                 &checkpoints
+                                 , const fs::path &path)
+    : state_(std::make_shared<State>(directory, fd, size, checkpoints, path))
+{}
+
+std::streamsize SeekableInflate::read(char *s, std::streamsize n)
+{
+    auto &state(*state_);
+    if (state.position >= state.size) { return -1; }
+
+    state.advance();
+    const auto got(state.decode(s, std::min<std::uint64_t>
+                                (n, state.size - state.position)));
+    state.position += got;
+    return got ? std::streamsize(got) : -1;
+}
+
+std::streampos SeekableInflate::seek(bio::stream_offset off
+                                     , std::ios_base::seekdir way)
+{
+    auto &state(*state_);
+    bio::stream_offset position;
+    switch (way) {
+    case std::ios_base::beg: position = off; break;
+    case std::ios_base::cur: position = state.position + off; break;
+    case std::ios_base::end: position = state.size + off; break;
+    default:
+        LOGTHROW(err2, std::logic_error) << "Invalid seek direction.";
+        throw;
+    }
+
+    if (position < 0) {
+        LOGTHROW(err2, IOError)
+            << "Seek before start of " << state.path << ".";
+    }
+
+    state.position = std::min<std::uint64_t>(position, state.size);
+    return state.position;
+}
+
+} // namespace roarchive
@@ -0,0 +1,192 @@
+/**
+ * Copyright (c) 2017 Melown Technologies SE
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * *  Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * *  Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef roarchive_inflate_hpp_included_
+#define roarchive_inflate_hpp_included_
+
+#include <zlib.h>
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <map>
+#include <list>
+#include <unordered_map>
+
+#include <boost/filesystem/path.hpp>
+#include <boost/iostreams/categories.hpp>
+
+#include "zipdir.hpp"
+#include "governor.hpp"
+
+namespace roarchive {
+
+/** Internal: decoder checkpoints of one deflate entry.
+ *
+ *  Every interval bytes of output the whole inflate state (including its
+ *  32 KiB window) is copied aside together with input and output
+ *  positions. Seeking then resumes from the nearest checkpoint instead of
+ *  decoding from the entry's start. Shared by all streams of the entry,
+ *  whoever decodes past a mark first records it.
+ */
+class InflateCheckpoints {
+public:
+    typedef std::shared_ptr<InflateCheckpoints> pointer;
+
+    /** Charge counter shared with owning cache.
+     */
+    typedef std::shared_ptr<std::atomic<std::size_t>> Charge;
+
+    /** Memory held by recorded checkpoints is added to charge, if any.
+     */
+    InflateCheckpoints(std::size_t interval, const Charge &charge = {});
+    ~InflateCheckpoints();
+
+    InflateCheckpoints(const InflateCheckpoints&) = delete;
+    InflateCheckpoints& operator=(const InflateCheckpoints&) = delete;
+
+    std::size_t interval() const { return interval_; }
+
+    /** Records checkpoint for given stream state unless mark (out /
+     *  interval) is already recorded.
+     */
+    void record(const z_stream &strm, std::uint64_t out, std::uint64_t in);
+
+    /** Replaces strm (must be initialized) with nearest checkpoint at or
+     *  before position that is past given current output position. Returns
+     *  false (strm is untouched) if there is no such checkpoint. Throws if
+     *  restoration fails (strm is then unusable).
+     */
+    bool restore(std::uint64_t position, z_stream &strm, std::uint64_t &out
+                 , std::uint64_t &in) const;
+
+    /** Approximate memory held by recorded checkpoints.
+     */
+    std::size_t memory() const;
+
+    /** Uncharges held memory, nothing is charged from now on. Called when
+     *  evicted from cache while still in use by some stream.
+     */
+    void detach();
+
+private:
+    struct Checkpoint {
+        std::uint64_t out;
+        std::uint64_t in;
+        std::unique_ptr<z_stream> strm;
+    };
+
+    const std::size_t interval_;
+    mutable std::mutex mutex_;
+    std::map<std::uint64_t, Checkpoint> checkpoints_;
+    Charge charge_;
+};
+
+/** Internal: checkpoints of entries of one archive, keyed by entry's local
+ *  header position.
+ *
+ *  LRU with a byte budget: least recently opened entries lose their
+ *  checkpoints first (streams using them keep them until closed). Can be
+ *  registered with MemoryGovernor.
+ */
+class InflateCheckpointCache : public Shrinkable {
+public:
+    typedef std::shared_ptr<InflateCheckpointCache> pointer;
+
+    InflateCheckpointCache(std::size_t interval, std::size_t budget);
+    virtual ~InflateCheckpointCache();
+
+    /** Checkpoints of given entry, created if not cached.
+     */
+    InflateCheckpoints::pointer get(std::uint64_t key);
+
+    /** Scales budget (see MemoryGovernor).
+     */
+    virtual void scale(double factor);
+
+    /** Memory held by cached checkpoints.
+     */
+    std::size_t memory() const { return *charge_; }
+
+    /** Number of entries with cached checkpoints.
+     */
+    std::size_t size() const;
+
+private:
+    /** Evicts until under limit. Called locked.
+     */
+    void trim();
+
+    struct Item {
+        std::uint64_t key;
+        InflateCheckpoints::pointer checkpoints;
+    };
+    typedef std::list<Item> Lru;
+
+    const std::size_t interval_;
+    const std::size_t budget_;
+    std::size_t limit_;
+    const InflateCheckpoints::Charge charge_;
+
+    mutable std::mutex mutex_;
+    Lru lru_;
+    std::unordered_map<std::uint64_t, Lru::iterator> map_;
+};
+
+/** Internal: seekable raw-deflate input device over zip entry data.
+ *
+ *  Forward seeks within one interval are decoded through, anything else
+ *  restarts from the nearest checkpoint (or from the entry's start).
+ */
+class SeekableInflate {
+public:
+    typedef char char_type;
+    struct category : boost::iostreams::device_tag
+                    , boost::iostreams::input_seekable
+    {};
+
+    SeekableInflate(const ZipDirectory &directory
+                    , const ZipDirectory::Filedes &fd
+                    , std::uint64_t size
+                    , const InflateCheckpoints::pointer &checkpoints
+                    , const boost::filesystem::path &path);
+
+    std::streamsize read(char *s, std::streamsize n);
+
+    std::streampos seek(boost::iostreams::stream_offset off
+                        , std::ios_base::seekdir way);
+
+    struct State;
+
+private:
+    /** Devices are copied when pushed, decoder state is shared.
+     */
+    std::shared_ptr<State> state_;
+};
+
+} // namespace roarchive
+
+#endif // roarchive_inflate_hpp_included_
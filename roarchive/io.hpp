@@ -32,6 +32,8 @@
 #include "utility/streams.hpp"
 
 #include "roarchive.hpp"
+#include "metrics.hpp"
+#include "slowlog.hpp"
 
 namespace roarchive {
 
@@ -43,6 +45,47 @@ operator<<(std::basic_ostream<CharT, Traits> &os, const FileHint &hint)
               << '}';
 }
 
+template<typename CharT, typename Traits>
+inline std::basic_ostream<CharT, Traits>&
+operator<<(std::basic_ostream<CharT, Traits> &os, Backend backend)
+{
+    switch (backend) {
+    case Backend::directory: return os << "directory";
+    case Backend::tarball: return os << "tarball";
+    case Backend::zip: return os << "zip";
+    case Backend::http: return os << "http";
+    }
+    return os << "unknown";
+}
+
+template<typename CharT, typename Traits>
+inline std::basic_ostream<CharT, Traits>&
+operator<<(std::basic_ostream<CharT, Traits> &os, Operation operation)
+{
+    return os << operationName(operation);
+}
+
+template<typename CharT, typename Traits>
+inline std::basic_ostream<CharT, Traits>&
+operator<<(std::basic_ostream<CharT, Traits> &os, const SlowOperation &op)
+{
+    typedef std::chrono::duration<double, std::milli> ms;
+
+    os << op.operation << " took " << ms(op.duration).count()
+       << " ms; archive: " << op.archive << ", backend: " << op.backend;
+    if (!op.path.empty()) { os << ", path: " << op.path; }
+    if (op.bytes) { os << ", bytes: " << *op.bytes; }
+    os << ", thread: " << op.thread << ", phases: {";
+
+    const char *sep("");
+    for (const auto &phase : op.phases) {
+        os << sep << phase.first << ": " << ms(phase.second).count()
+           << " ms";
+        sep = ", ";
+    }
+    return os << '}';
+}
+
 
 } // namespace roarchive
 
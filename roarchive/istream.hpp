@@ -37,6 +37,8 @@
 
 namespace roarchive {
 
+struct Instrumentation;
+
 /** Input stream.
  */
 class IStream {
@@ -50,12 +52,14 @@ public:
             , bool seekable = true
             , std::time_t timestamp = -1)
         : stacked_(false), seekable_(seekable), timestamp_(timestamp)
+        , readsWhole_(false)
     {
         if (filterInit) { filterInit(fis_); }
         if (!fis_.size()) {
             size_ = size;
         } else {
             // stacked: we cannot assume anything, stay on the safe side
+            // until update() checks the whole chain
             stacked_ = true;
             seekable_ = false;
         }
@@ -91,22 +95,52 @@ public:
     std::vector<char> read();
 
 protected:
+    /** Sets size and seekability of underlying data; must be called after
+     *  the source is pushed. Stacked stream has unknown size and is
+     *  seekable only if all its filters are.
+     */
     void update(const boost::optional<std::size_t> &size = boost::none
                 , bool seekable = true)
     {
         if (!stacked_) {
             size_ = size;
             seekable_ = seekable;
+        } else {
+            seekable_ = seekable && chainSeekable();
         }
     }
 
+    /** Marks stream as able to read whole file at once by readWhole(),
+     *  bypassing the stream. Ignored for stacked streams.
+     */
+    void enableReadWhole() { readsWhole_ = true; }
+
+    /** One-shot read of whole file, used by read() when enabled.
+     */
+    virtual std::vector<char> readWhole() { return {}; }
+
     boost::iostreams::filtering_istream fis_;
 
 private:
+    friend struct Instrumentation;
+
+    /** Probes whether complete filter chain can seek.
+     */
+    bool chainSeekable();
+
+    /** Reads whole file, uninstrumented.
+     */
+    std::vector<char> readData();
+
     bool stacked_;
     bool seekable_;
     boost::optional<std::size_t> size_;
     std::time_t timestamp_;
+    bool readsWhole_;
+
+    /** Instrumentation inherited from archive, null if not configured.
+     */
+    std::shared_ptr<const Instrumentation> instrumentation_;
 };
 
 // support operations
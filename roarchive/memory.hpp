@@ -0,0 +1,104 @@
+/**
+ * Copyright (c) 2017 Melown Technologies SE
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * *  Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * *  Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef roarchive_memory_hpp_included_
+#define roarchive_memory_hpp_included_
+
+#include <cstddef>
+#include <memory>
+
+#if defined(__has_include)
+#  if __has_include(<memory_resource>) && (__cplusplus >= 201703L)
+#    include <memory_resource>
+#    define ROARCHIVE_HAS_PMR 1
+#  endif
+#endif
+
+namespace roarchive {
+
+/** Upstream memory source for archive indices, modelled after
+ *  std::pmr::memory_resource (which is not available in C++11).
+ *
+ *  Indices (tarball and zip file tables) are built in monotonic arenas
+ *  that request large chunks from this resource and return them all at
+ *  once when the archive is destroyed. Pass to
+ *  OpenOptions::setMemoryResource(); global new/delete is used by default.
+ *
+ *  Must be thread safe if shared between archives used from different
+ *  threads.
+ */
+class MemoryResource {
+public:
+    typedef std::shared_ptr<MemoryResource> pointer;
+
+    virtual ~MemoryResource() {}
+
+    /** Allocates given number of bytes aligned to given alignment. Throws
+     *  std::bad_alloc on failure.
+     */
+    virtual void* allocate(std::size_t bytes, std::size_t alignment) = 0;
+
+    /** Returns memory previously obtained from allocate() with the same
+     *  size and alignment.
+     */
+    virtual void deallocate(void *p, std::size_t bytes
+                            , std::size_t alignment) = 0;
+
+    /** Global operator new/delete based resource.
+     */
+    static pointer newDelete();
+};
+
+#ifdef ROARCHIVE_HAS_PMR
+
+/** Adapts std::pmr::memory_resource. Wrapped resource must outlive all
+ *  archives using it.
+ */
+class PmrMemoryResource : public MemoryResource {
+public:
+    PmrMemoryResource(std::pmr::memory_resource *resource
+                      = std::pmr::get_default_resource())
+        : resource_(resource)
+    {}
+
+    virtual void* allocate(std::size_t bytes, std::size_t alignment) {
+        return resource_->allocate(bytes, alignment);
+    }
+
+    virtual void deallocate(void *p, std::size_t bytes
+                            , std::size_t alignment)
+    {
+        resource_->deallocate(p, bytes, alignment);
+    }
+
+private:
+    std::pmr::memory_resource *resource_;
+};
+
+#endif // ROARCHIVE_HAS_PMR
+
+} // namespace roarchive
+
+#endif // roarchive_memory_hpp_included_
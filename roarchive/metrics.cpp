@@ -0,0 +1,226 @@
+/**
+ * Copyright (c) 2017 Melown Technologies SE
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * *  Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * *  Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <algorithm>
+#include <limits>
+
+#include "metrics.hpp"
+
+namespace roarchive {
+
+namespace {
+
+const std::uint64_t maxValue
+    ((std::uint64_t(1) << (Histogram::maxBits + 1)) - 1);
+
+inline unsigned int msb(std::uint64_t value)
+{
+    unsigned int bit(0);
+    while (value >>= 1) { ++bit; }
+    return bit;
+}
+
+void atomicMin(std::atomic<std::uint64_t> &target, std::uint64_t value)
+{
+    auto current(target.load(std::memory_order_relaxed));
+    while ((value < current)
+           && !target.compare_exchange_weak(current, value
+                                            , std::memory_order_relaxed))
+    {}
+}
+
+void atomicMax(std::atomic<std::uint64_t> &target, std::uint64_t value)
+{
+    auto current(target.load(std::memory_order_relaxed));
+    while ((value > current)
+           && !target.compare_exchange_weak(current, value
+                                            , std::memory_order_relaxed))
+    {}
+}
+
+} // namespace
+
+const char* operationName(Operation operation)
+{
+    switch (operation) {
+    case Operation::open: return "open";
+    case Operation::lookup: return "lookup";
+    case Operation::stream: return "stream";
+    case Operation::firstByte: return "firstByte";
+    case Operation::read: return "read";
+    case Operation::fetch: return "fetch";
+    case Operation::decodedRead: return "decodedRead";
+    }
+    return "unknown";
+}
+
+constexpr std::size_t Histogram::bucketCount;
+
+Histogram::Histogram()
+    : count_(0), sum_(0)
+    , min_(std::numeric_limits<std::uint64_t>::max()), max_(0)
+{
+    for (auto &c : counts_) { c.store(0, std::memory_order_relaxed); }
+}
+
+std::size_t Histogram::bucket(std::uint64_t value)
+{
+    if (value < subBucketCount) { return value; }
+    if (value > maxValue) { value = maxValue; }
+
+    const auto shift(msb(value) - subBucketBits);
+    return ((shift + 1) * subBucketCount
+            + ((value >> shift) & (subBucketCount - 1)));
+}
+
+std::uint64_t Histogram::lowest(std::size_t bucket)
+{
+    if (bucket < subBucketCount) { return bucket; }
+    const auto shift(bucket / subBucketCount - 1);
+    return ((subBucketCount + bucket % subBucketCount) << shift);
+}
+
+std::uint64_t Histogram::highest(std::size_t bucket)
+{
+    if (bucket < subBucketCount) { return bucket; }
+    const auto shift(bucket / subBucketCount - 1);
+    return lowest(bucket) + (std::uint64_t(1) << shift) - 1;
+}
+
+void Histogram::record(std::uint64_t value)
+{
+    counts_[bucket(value)].fetch_add(1, std::memory_order_relaxed);
+    count_.fetch_add(1, std::memory_order_relaxed);
+    sum_.fetch_add(value, std::memory_order_relaxed);
+    atomicMin(min_, value);
+    atomicMax(max_, value);
+}
+
+Histogram::Snapshot Histogram::snapshot() const
+{
+    Snapshot s;
+    s.counts.resize(bucketCount);
+    for (std::size_t i(0); i < bucketCount; ++i) {
+        s.counts[i] = counts_[i].load(std::memory_order_relaxed);
+    }
+    s.count = count_.load(std::memory_order_relaxed);
+    s.sum = sum_.load(std::memory_order_relaxed);
+    s.min = min_.load(std::memory_order_relaxed);
+    s.max = max_.load(std::memory_order_relaxed);
+    return s;
+}
+
+void Histogram::merge(const Snapshot &snapshot)
+{
+    if (!snapshot.count) { return; }
+
+    for (std::size_t i(0); i < bucketCount; ++i) {
+        if (snapshot.counts[i]) {
+            counts_[i].fetch_add(snapshot.counts[i]
+                                 , std::memory_order_relaxed);
+        }
+    }
+    count_.fetch_add(snapshot.count, std::memory_order_relaxed);
+    sum_.fetch_add(snapshot.sum, std::memory_order_relaxed);
+    atomicMin(min_, snapshot.min);
+    atomicMax(max_, snapshot.max);
+}
+
+Histogram::Snapshot::Snapshot()
+    : counts(bucketCount), count(0), sum(0)
+    , min(std::numeric_limits<std::uint64_t>::max()), max(0)
+{}
+
+Histogram::Snapshot& Histogram::Snapshot::merge(const Snapshot &other)
+{
+    for (std::size_t i(0); i < bucketCount; ++i) {
+        counts[i] += other.counts[i];
+    }
+    count += other.count;
+    sum += other.sum;
+    min = std::min(min, other.min);
+    max = std::max(max, other.max);
+    return *this;
+}
+
+double Histogram::Snapshot::mean() const
+{
+    if (!count) { return 0.0; }
+    return double(sum) / count;
+}
+
+std::uint64_t Histogram::Snapshot::percentile(double quantile) const
+{
+    if (!count) { return 0; }
+
+    quantile = std::max(0.0, std::min(1.0, quantile));
+    const auto rank(std::max<std::uint64_t>
+                    (1, std::uint64_t(quantile * count + 0.5)));
+
+    std::uint64_t seen(0);
+    for (std::size_t i(0); i < bucketCount; ++i) {
+        seen += counts[i];
+        if (seen >= rank) {
+            // middle of the bucket, but never outside observed range
+            const auto value(lowest(i) + (highest(i) - lowest(i)) / 2);
+            return std::max(min, std::min(max, value));
+        }
+    }
+
+    return max;
+}
+
+Metrics::Snapshot::Snapshot()
+    : histograms(backendCount * operationCount)
+{}
+
+Histogram::Snapshot Metrics::Snapshot::get(Operation operation) const
+{
+    Histogram::Snapshot s;
+    for (std::size_t b(0); b < backendCount; ++b) {
+        s.merge(get(static_cast<Backend>(b), operation));
+    }
+    return s;
+}
+
+Metrics::Snapshot& Metrics::Snapshot::merge(const Snapshot &other)
+{
+    for (std::size_t i(0); i < histograms.size(); ++i) {
+        histograms[i].merge(other.histograms[i]);
+    }
+    return *this;
+}
+
+Metrics::Snapshot Metrics::snapshot() const
+{
+    Snapshot s;
+    for (std::size_t i(0); i < histograms_.size(); ++i) {
+        s.histograms[i] = histograms_[i].snapshot();
+    }
+    return s;
+}
+
+} // namespace roarchive
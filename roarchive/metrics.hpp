@@ -0,0 +1,190 @@
+/**
+ * Copyright (c) 2017 Melown Technologies SE
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * *  Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * *  Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef roarchive_metrics_hpp_included_
+#define roarchive_metrics_hpp_included_
+
+#include <atomic>
+#include <array>
+#include <vector>
+#include <memory>
+#include <cstdint>
+
+#include "roarchive.hpp"
+
+namespace roarchive {
+
+/** Measured operations.
+ */
+enum class Operation {
+    open        //!< whole archive open (detection + index build)
+    , lookup    //!< index lookup
+    , stream    //!< input stream construction
+    , firstByte //!< first byte of data available in IStream::read()
+    , read      //!< full IStream::read()
+    , fetch     //!< HTTP fetch
+    , decodedRead //!< full read of non-seekable (decoded) stream,
+                  //!< including underlying I/O
+};
+
+constexpr std::size_t backendCount = 4;
+constexpr std::size_t operationCount = 7;
+
+/** Static operation name.
+ */
+const char* operationName(Operation operation);
+
+/** Lock-free latency histogram with HDR-style log-linear buckets.
+ *
+ *  Values are nanoseconds. Every power of two is split into 16 linear
+ *  sub-buckets, i.e. relative error is bounded by 1/16. Values above
+ *  2^40 ns (~18 minutes) are clamped into the last bucket.
+ *
+ *  Recording is wait-free (except for max/min tracking which uses CAS),
+ *  snapshot is a relaxed read of all counters.
+ */
+class Histogram {
+public:
+    static constexpr unsigned int subBucketBits = 4;
+    static constexpr unsigned int maxBits = 40;
+    static constexpr std::size_t subBucketCount = 1 << subBucketBits;
+    static constexpr std::size_t bucketCount
+        = (maxBits - subBucketBits + 2) * subBucketCount;
+
+    Histogram();
+
+    Histogram(const Histogram&) = delete;
+    Histogram& operator=(const Histogram&) = delete;
+
+    /** Records one value (in nanoseconds).
+     */
+    void record(std::uint64_t value);
+
+    /** Immutable, mergeable copy of histogram content.
+     */
+    struct Snapshot {
+        std::vector<std::uint64_t> counts;
+        std::uint64_t count;
+        std::uint64_t sum;
+        std::uint64_t min;
+        std::uint64_t max;
+
+        Snapshot();
+
+        /** Adds content of other snapshot to this one.
+         */
+        Snapshot& merge(const Snapshot &other);
+
+        /** Mean value, 0 if empty.
+         */
+        double mean() const;
+
+        /** Value at given quantile (0.0 - 1.0), 0 if empty.
+         */
+        std::uint64_t percentile(double quantile) const;
+    };
+
+    Snapshot snapshot() const;
+
+    /** Adds snapshot to this histogram (i.e. merges data from other thread
+     *  local histogram).
+     */
+    void merge(const Snapshot &snapshot);
+
+    /** Bucket index for given value.
+     */
+    static std::size_t bucket(std::uint64_t value);
+
+    /** Lowest value falling into given bucket.
+     */
+    static std::uint64_t lowest(std::size_t bucket);
+
+    /** Highest value falling into given bucket.
+     */
+    static std::uint64_t highest(std::size_t bucket);
+
+private:
+    std::array<std::atomic<std::uint64_t>, bucketCount> counts_;
+    std::atomic<std::uint64_t> count_;
+    std::atomic<std::uint64_t> sum_;
+    std::atomic<std::uint64_t> min_;
+    std::atomic<std::uint64_t> max_;
+};
+
+/** Latency histograms of archive operations, per backend.
+ *
+ *  Pass to OpenOptions::setMetrics() to enable measurement. One instance can
+ *  be shared by any number of archives and threads. When no metrics are
+ *  configured no clock is ever read.
+ */
+class Metrics {
+public:
+    typedef std::shared_ptr<Metrics> pointer;
+
+    Metrics() = default;
+
+    Metrics(const Metrics&) = delete;
+    Metrics& operator=(const Metrics&) = delete;
+
+    Histogram& histogram(Backend backend, Operation operation) {
+        return histograms_[index(backend, operation)];
+    }
+
+    const Histogram& histogram(Backend backend, Operation operation) const {
+        return histograms_[index(backend, operation)];
+    }
+
+    struct Snapshot {
+        std::vector<Histogram::Snapshot> histograms;
+
+        Snapshot();
+
+        const Histogram::Snapshot& get(Backend backend, Operation operation)
+            const
+        {
+            return histograms[index(backend, operation)];
+        }
+
+        /** Merges histograms of given operation over all backends.
+         */
+        Histogram::Snapshot get(Operation operation) const;
+
+        Snapshot& merge(const Snapshot &other);
+    };
+
+    Snapshot snapshot() const;
+
+private:
+    static std::size_t index(Backend backend, Operation operation) {
+        return (static_cast<std::size_t>(backend) * operationCount
+                + static_cast<std::size_t>(operation));
+    }
+
+    std::array<Histogram, backendCount * operationCount> histograms_;
+};
+
+} // namespace roarchive
+
+#endif // roarchive_metrics_hpp_included_
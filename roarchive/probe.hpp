@@ -0,0 +1,230 @@
+/**
+ * Copyright (c) 2017 Melown Technologies SE
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * *  Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * *  Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef roarchive_probe_hpp_included_
+#define roarchive_probe_hpp_included_
+
+#include <chrono>
+#include <memory>
+
+#include "roarchive.hpp"
+#include "metrics.hpp"
+#include "tracer.hpp"
+#include "slowlog.hpp"
+
+namespace roarchive {
+
+/** Internal: instrumentation attached to an open archive and to all streams
+ *  obtained from it.
+ *
+ *  Instance exists only if some instrumentation is configured in
+ *  OpenOptions, otherwise all probes see a null pointer and do nothing.
+ */
+struct Instrumentation {
+    typedef std::shared_ptr<const Instrumentation> pointer;
+    typedef std::chrono::steady_clock clock;
+
+    Backend backend;
+    boost::filesystem::path archive;
+    Metrics::pointer metrics;
+    Tracer::pointer tracer;
+    SlowLog::pointer slowLog;
+
+    Instrumentation(Backend backend, const boost::filesystem::path &archive
+                    , const OpenOptions &openOptions)
+        : backend(backend), archive(archive), metrics(openOptions.metrics)
+        , tracer(openOptions.tracer), slowLog(openOptions.slowLog)
+    {}
+
+    /** Is any instrumentation configured?
+     */
+    static bool enabled(const OpenOptions &openOptions) {
+        return (openOptions.metrics || openOptions.tracer
+                || openOptions.slowLog);
+    }
+
+    /** Returns instrumentation for given backend and options or null if
+     *  nothing is configured.
+     */
+    static pointer create(Backend backend
+                          , const boost::filesystem::path &archive
+                          , const OpenOptions &openOptions)
+    {
+        if (!enabled(openOptions)) { return {}; }
+        return std::make_shared<Instrumentation>
+            (backend, archive, openOptions);
+    }
+
+    /** Attaches instrumentation to stream obtained from archive.
+     */
+    static void attach(IStream &is, const pointer &instrumentation) {
+        is.instrumentation_ = instrumentation;
+    }
+
+    void begin(Operation operation) const {
+        if (tracer) {
+            tracer->begin(operationName(operation), std::string());
+        }
+    }
+
+    void end(Operation operation) const {
+        if (tracer) { tracer->end(operationName(operation)); }
+    }
+
+    void record(Operation operation, clock::duration duration) const {
+        if (metrics) {
+            metrics->histogram(backend, operation).record
+                (std::chrono::duration_cast<std::chrono::nanoseconds>
+                 (duration).count());
+        }
+    }
+};
+
+/** Watches one top-level operation (archive open, istream, read) and
+ *  reports it to the slow log when it exceeds the threshold. Probes and
+ *  phases finished on the same thread meanwhile are recorded as its phase
+ *  timings. No-op when there is no slow log.
+ */
+class Watch {
+public:
+    typedef Instrumentation::clock clock;
+
+    /** Archive open watch. Archive path must outlive the watch.
+     */
+    Watch(SlowLog *slowLog, const char *operation
+          , const boost::filesystem::path &archive);
+
+    /** Entry watch. Path (if any) must outlive the watch.
+     */
+    Watch(const Instrumentation *instrumentation, const char *operation
+          , const boost::filesystem::path *path = nullptr);
+
+    ~Watch();
+
+    Watch(const Watch&) = delete;
+    Watch& operator=(const Watch&) = delete;
+
+    void backend(Backend backend) { backend_ = backend; }
+
+    void bytes(const boost::optional<std::size_t> &bytes) {
+        bytes_ = bytes;
+    }
+
+    void phase(const char *name, clock::duration duration);
+
+    /** Innermost active watch on this thread, if any.
+     */
+    static Watch* current() { return current_; }
+
+private:
+    void start();
+
+    SlowLog *slowLog_;
+    const char *operation_;
+    const boost::filesystem::path *archive_;
+    const boost::filesystem::path *path_;
+    Backend backend_;
+    boost::optional<std::size_t> bytes_;
+    SlowOperation::Phases phases_;
+    clock::time_point start_;
+    Watch *previous_;
+
+    static thread_local Watch *current_;
+};
+
+/** Measures lifetime of this object and records it as given operation; the
+ *  same interval is traced as a span and reported as a phase of current
+ *  watch. No-op when instrumentation is null.
+ */
+class Probe {
+public:
+    Probe(const Instrumentation *instrumentation, Operation operation)
+        : instrumentation_(instrumentation), operation_(operation)
+    {
+        if (instrumentation_) {
+            instrumentation_->begin(operation_);
+            start_ = Instrumentation::clock::now();
+        }
+    }
+
+    Probe(const Instrumentation::pointer &instrumentation
+          , Operation operation)
+        : Probe(instrumentation.get(), operation)
+    {}
+
+    ~Probe() {
+        if (instrumentation_) {
+            const auto duration(Instrumentation::clock::now() - start_);
+            instrumentation_->record(operation_, duration);
+            instrumentation_->end(operation_);
+            if (auto *watch = Watch::current()) {
+                watch->phase(operationName(operation_), duration);
+            }
+        }
+    }
+
+    Probe(const Probe&) = delete;
+    Probe& operator=(const Probe&) = delete;
+
+private:
+    const Instrumentation *instrumentation_;
+    Operation operation_;
+    Instrumentation::clock::time_point start_;
+};
+
+/** Traced span that is reported as a phase of current watch as well. Meant
+ *  for archive open phases (detection, scan, prefix search, index build).
+ */
+class Phase {
+public:
+    Phase(Tracer *tracer, const char *name
+          , const boost::filesystem::path &detail)
+        : span_(tracer, name, detail), name_(name), watch_(Watch::current())
+    {
+        if (watch_) { start_ = Watch::clock::now(); }
+    }
+
+    Phase(const Tracer::pointer &tracer, const char *name
+          , const boost::filesystem::path &detail)
+        : Phase(tracer.get(), name, detail)
+    {}
+
+    ~Phase() {
+        if (watch_) { watch_->phase(name_, Watch::clock::now() - start_); }
+    }
+
+    Phase(const Phase&) = delete;
+    Phase& operator=(const Phase&) = delete;
+
+private:
+    Span span_;
+    const char *name_;
+    Watch *watch_;
+    Watch::clock::time_point start_;
+};
+
+} // namespace roarchive
+
+#endif // roarchive_probe_hpp_included_
@@ -25,6 +25,7 @@
  */
 
 #include <limits>
+#include <algorithm>
 
 #include <boost/iostreams/copy.hpp>
 
@@ -38,6 +39,7 @@
 #include "roarchive.hpp"
 #include "detail.hpp"
 #include "error.hpp"
+#include "footprint.hpp"
 
 namespace fs = boost::filesystem;
 namespace bio = boost::iostreams;
@@ -47,6 +49,13 @@ namespace roarchive {
 RoArchive::dpointer
 RoArchive::factory(fs::path path, OpenOptions openOptions)
 {
+    // measure only when asked to
+    const auto start(Instrumentation::enabled(openOptions)
+                     ? Instrumentation::clock::now()
+                     : Instrumentation::clock::time_point());
+    Span span(openOptions.tracer, "open", path);
+    Watch watch(openOptions.slowLog.get(), "open", path);
+
     if (openOptions.inlineHint) {
         // check for inline hint
         const auto str(path.string());
@@ -69,20 +78,38 @@ RoArchive::factory(fs::path path, OpenOptions openOptions)
     }
 
     // detect MIME type if not provided ahead
-    const auto magic(openOptions.mime.empty()
-                     ? utility::Magic().mime(path)
-                     : openOptions.mime);
-
-    if (magic == "inode/directory") { return directory(path, openOptions); }
-    if (magic == "application/x-tar") { return tarball(path, openOptions); }
-    if (magic == "application/zip") { return zip(path, openOptions); }
+    const auto magic([&]() -> std::string
+    {
+        if (!openOptions.mime.empty()) { return openOptions.mime; }
+        Phase phase(openOptions.tracer, "magic", path);
+        return utility::Magic().mime(path);
+    }());
+
+    auto detail([&]() -> dpointer
+    {
+        if (magic == "inode/directory") {
+            return directory(path, openOptions);
+        }
+        if (magic == "application/x-tar") {
+            return tarball(path, openOptions);
+        }
+        if (magic == "application/zip") { return zip(path, openOptions); }
 #ifdef ROARCHIVE_HAS_HTTP
-    if (magic == "http") { return http(path, openOptions); }
+        if (magic == "http") { return http(path, openOptions); }
 #endif
 
-    LOGTHROW(err2, NotAnArchive)
-        << "Unsupported archive type <" << magic << ">.";
-    return {};
+        LOGTHROW(err2, NotAnArchive)
+            << "Unsupported archive type <" << magic << ">.";
+        return {};
+    }());
+
+    if (const auto &instrumentation = detail->instrumentation()) {
+        instrumentation->record(Operation::open
+                                , Instrumentation::clock::now() - start);
+    }
+    watch.backend(detail->backend());
+
+    return detail;
 }
 
 RoArchive::RoArchive(const fs::path &path)
@@ -115,21 +142,31 @@ RoArchive::RoArchive(const fs::path &path, std::size_t limit
 
 IStream::pointer RoArchive::istream(const fs::path &path) const
 {
-    auto is(detail_->istream(path));
-    // set exceptions
-    is->get().exceptions(std::ios::badbit | std::ios::failbit);
-
-    return is;
+    return openIStream(*detail_, path, {}, std::string());
 }
 
 IStream::pointer RoArchive::istream(const fs::path &path
                                     , const IStream::FilterInit &filterInit)
     const
 {
-    auto is(detail_->istream(path, filterInit));
-    // set exceptions
-    is->get().exceptions(std::ios::badbit | std::ios::failbit);
-    return is;
+    // unknown filter cannot be cached
+    if (filterInit) { return openIStream(*detail_, path, filterInit); }
+    return openIStream(*detail_, path, filterInit, std::string());
+}
+
+IStream::pointer RoArchive::istream(const fs::path &path
+                                    , const IStream::FilterInit &filterInit
+                                    , const std::string &filterKey) const
+{
+    return openIStream(*detail_, path, filterInit, filterKey);
+}
+
+boost::optional<RawFile> RoArchive::openRaw(const fs::path &path) const
+{
+    auto raw(detail_->openRaw(path));
+    // borrowed descriptor lives as long as the archive
+    if (raw && !raw->holder) { raw->holder = detail_; }
+    return raw;
 }
 
 bool RoArchive::exists(const fs::path &path) const
@@ -155,6 +192,47 @@ fs::path RoArchive::path(const fs::path &path) const
 
 std::vector<char> IStream::read()
 {
+    if (!instrumentation_) { return readData(); }
+
+    const auto *instrumentation(instrumentation_.get());
+    const auto index(this->index());
+    Watch watch(instrumentation, "read", &index);
+    Probe probe(instrumentation, Operation::read);
+
+    if ((!readsWhole_ || stacked_) && !(size_ && !*size_)) {
+        // force first buffer fill to measure time to first byte
+        Probe probe(instrumentation, Operation::firstByte);
+        auto &s(get());
+        s.peek();
+        // peek at the end of (unsized) empty entry must not fail the read
+        if (s.eof()) { s.clear(s.rdstate() & ~std::ios_base::eofbit); }
+    }
+
+    // non-seekable stream is decoded on the fly (or at once); decoding
+    // cannot be separated from reading, whole read is measured
+    Probe decode(seekable_ ? nullptr : instrumentation
+                 , Operation::decodedRead);
+    auto data(readData());
+    watch.bytes(data.size());
+    return data;
+}
+
+bool IStream::chainSeekable()
+{
+    // non-seekable filter throws when asked for position
+    try {
+        return (fis_.rdbuf()->pubseekoff(0, std::ios_base::cur
+                                         , std::ios_base::in)
+                == std::streampos(0));
+    } catch (const std::exception&) {
+        return false;
+    }
+}
+
+std::vector<char> IStream::readData()
+{
+    if (readsWhole_ && !stacked_) { return readWhole(); }
+
     auto &s(get());
     if (size_) {
         // we know the size of the file
@@ -189,6 +267,70 @@ RoArchive& RoArchive::applyHint(const FileHint &hint)
     return *this;
 }
 
+DatasetRoots RoArchive::discover(const FileHint &hint) const
+{
+    Phase phase(detail_->tracer(), "discover", detail_->path());
+    return detail_->discover(hint);
+}
+
+void Discovery::operator()(boost::string_ref path)
+{
+    const auto slash(path.rfind('/'));
+    const auto filename((slash == boost::string_ref::npos)
+                        ? path : path.substr(slash + 1));
+
+    for (std::size_t index(0); index < hint_.size(); ++index) {
+        if (filename != hint_[index]) { continue; }
+
+        const auto dir((slash == boost::string_ref::npos)
+                       ? boost::string_ref() : path.substr(0, slash));
+        auto &root(roots_[std::string(dir.begin(), dir.end())]);
+        if (root.hint.empty() || (index < root.hintIndex)) {
+            root.path = fs::path(dir.begin(), dir.end());
+            root.hint = hint_[index];
+            root.hintIndex = index;
+            root.depth = std::distance(root.path.begin(), root.path.end());
+        }
+        return;
+    }
+}
+
+void Discovery::merge(const Discovery &other)
+{
+    for (const auto &item : other.roots_) {
+        auto &root(roots_[item.first]);
+        if (root.hint.empty() || (item.second.hintIndex < root.hintIndex)) {
+            root = item.second;
+        }
+    }
+}
+
+DatasetRoots Discovery::roots() const
+{
+    DatasetRoots roots;
+    roots.reserve(roots_.size());
+    for (const auto &item : roots_) { roots.push_back(item.second); }
+
+    std::sort(roots.begin(), roots.end()
+              , [](const DatasetRoot &l, const DatasetRoot &r) -> bool
+    {
+        // same order as FileHint::Matcher: best hint first, shallowest
+        // directory among equal hints
+        if (l.hintIndex != r.hintIndex) { return l.hintIndex < r.hintIndex; }
+        if (l.depth != r.depth) { return l.depth < r.depth; }
+        return l.path < r.path;
+    });
+    return roots;
+}
+
+std::string RoArchive::Detail::makeIdentity() const
+{
+    std::ostringstream os;
+    os << path_.string() << '@' << stat_.size << ':' << stat_.lastModified
+       << ':' << stat_.ino;
+    return os.str();
+}
+
 bool RoArchive::Detail::changed() const
 {
     return stat_.changed
@@ -200,6 +342,11 @@ bool RoArchive::changed() const
     return detail_->changed();
 }
 
+bool RoArchive::refresh()
+{
+    return detail_->refresh();
+}
+
 
 boost::optional<boost::filesystem::path> RoArchive::usedHint() const
 {
@@ -211,6 +358,28 @@ bool RoArchive::handlesSchema(const std::string &schema) const
     return detail_->handlesSchema(schema);
 }
 
+Backend RoArchive::backend() const
+{
+    return detail_->backend();
+}
+
+MemoryUsage RoArchive::Detail::memoryUsage() const
+{
+    MemoryUsage mu;
+    mu.add("path", footprint::heap(path_));
+    if (instrumentation_) {
+        mu.add("instrumentation"
+               , (footprint::allocated(sizeof(Instrumentation))
+                  + footprint::heap(instrumentation_->archive)));
+    }
+    return mu;
+}
+
+MemoryUsage RoArchive::memoryUsage() const
+{
+    return detail_->memoryUsage();
+}
+
 void copy(const IStream::pointer &in, std::ostream &out)
 {
     bio::copy(in->get(), out);
@@ -239,4 +408,30 @@ bool FileHint::Matcher::operator()(const fs::path &path)
     return !bestIndex_;
 }
 
+void HintNameMatcher::operator()(boost::string_ref name)
+{
+    const auto slash(name.rfind('/'));
+    const auto fname((slash == boost::string_ref::npos)
+                     ? name : name.substr(slash + 1));
+
+    for (std::size_t index(0); index <= bestIndex_; ++index) {
+        if (index == hint_.size()) { break; }
+        if (fname != hint_[index]) { continue; }
+
+        const std::size_t depth(std::count(name.begin(), name.end(), '/'));
+        if ((index < bestIndex_) || (depth < bestDepth_)) {
+            bestIndex_ = index;
+            bestDepth_ = depth;
+            bestMatch_.assign(name.data(), name.size());
+        }
+        break;
+    }
+}
+
+HintedPath HintNameMatcher::match() const
+{
+    const fs::path match(bestMatch_);
+    return HintedPath(match.parent_path(), match.filename());
+}
+
 } // namespace roarchive
@@ -27,10 +27,14 @@
 #define roarchive_roarchive_hpp_included_
 
 #include <iostream>
+#include <cstdint>
 #include <memory>
 #include <functional>
 #include <initializer_list>
 #include <limits>
+#include <string>
+#include <vector>
+#include <utility>
 
 #include <boost/optional.hpp>
 #include <boost/filesystem/path.hpp>
@@ -68,7 +72,98 @@ struct FileHint {
 
 typedef std::vector<boost::filesystem::path> Files;
 
+/** Archive backend.
+ */
+enum class Backend { directory, tarball, zip, http };
+
+/** Estimated memory footprint of an open archive, broken down by
+ *  components.
+ */
+struct MemoryUsage {
+    typedef std::pair<std::string, std::size_t> Component;
+    typedef std::vector<Component> Components;
+
+    Components components;
+
+    MemoryUsage& add(std::string component, std::size_t bytes) {
+        components.emplace_back(std::move(component), bytes);
+        return *this;
+    }
+
+    /** Sum of all components.
+     */
+    std::size_t total() const {
+        std::size_t total(0);
+        for (const auto &component : components) {
+            total += component.second;
+        }
+        return total;
+    }
+};
+
+/** Directory containing a hint file, see RoArchive::discover().
+ */
+struct DatasetRoot {
+    /** Directory, relative to archive's root (regardless of any applied
+     *  hint); empty for the root itself.
+     */
+    boost::filesystem::path path;
+
+    /** Matched hint file name.
+     */
+    std::string hint;
+
+    /** Index of matched hint in FileHint::hint (lower is better).
+     */
+    std::size_t hintIndex;
+
+    /** Number of path components of path.
+     */
+    std::size_t depth;
+
+    DatasetRoot() : hintIndex(), depth() {}
+};
+
+typedef std::vector<DatasetRoot> DatasetRoots;
+
+/** Contiguous uncompressed byte range of a file, see RoArchive::openRaw().
+ *
+ *  Descriptor may be shared with the archive (or other raw files): use
+ *  positional I/O only (pread, sendfile/splice with offset, io_uring), never
+ *  close it. It stays valid as long as holder is alive.
+ */
+struct RawFile {
+    int fd;
+    std::uint64_t offset;
+    std::uint64_t length;
+
+    /** Keeps descriptor open.
+     */
+    std::shared_ptr<void> holder;
+
+    RawFile() : fd(-1), offset(), length() {}
+    RawFile(int fd, std::uint64_t offset, std::uint64_t length
+            , std::shared_ptr<void> holder = nullptr)
+        : fd(fd), offset(offset), length(length), holder(std::move(holder))
+    {}
+};
+
 struct OpenOptions;
+class Metrics;
+class Tracer;
+class SlowLog;
+class MemoryResource;
+class ContentCache;
+class IoScheduler;
+class FdManager;
+class BlockCache;
+class MemoryGovernor;
+
+template <typename Backend> class BasicRoArchive;
+class Directory;
+class Tarball;
+class Zip;
+class Http;
 
 /** Generic read-only archive.
  *  One of plain directory, tarball or zip archive.
@@ -139,6 +234,26 @@ public:
     IStream::pointer istream(const boost::filesystem::path &path
                              , const IStream::FilterInit &filterInit) const;
 
+    /** Get input stream for file at given path.
+     *  Internal filter is initialized by given init function.
+     *
+     *  Filter key identifies what the filter does; output of the filter is
+     *  then cached in the content cache (if configured, see
+     *  OpenOptions::setContentCache()). Other istream() overloads cache
+     *  only unfiltered content.
+     */
+    IStream::pointer istream(const boost::filesystem::path &path
+                             , const IStream::FilterInit &filterInit
+                             , const std::string &filterKey) const;
+
+    /** Exposes file at given path as raw descriptor range for zero-copy
+     *  I/O. Available for plain files in directories, tarball members and
+     *  stored entries of zip archives; returns none otherwise (compressed
+     *  entries, remote archives). Throws when not found.
+     */
+    boost::optional<RawFile>
+    openRaw(const boost::filesystem::path &path) const;
+
     /** Returns true in case of direct access to filesystem.
      *  Only directory "archive" supports this.
      *  Optimalization for direct file access.
@@ -162,10 +277,26 @@ public:
      */
     RoArchive& applyHint(const FileHint &hint = FileHint());
 
+    /** Finds all directories containing any of hint files in one pass over
+     *  the whole archive. Each directory is reported once, with its best
+     *  matching hint. Result is ranked the way hints are applied: by hint
+     *  index, then by depth (then by path).
+     */
+    DatasetRoots discover(const FileHint &hint) const;
+
     /** Check for underlying data change.
      */
     bool changed() const;
 
+    /** Brings archive up to date after underlying data change if it can be
+     *  done in place. Currently only files appended to a tarball are picked
+     *  up. Returns true if the archive is up to date (unchanged or
+     *  refreshed), false if it has to be reopened. Must not run
+     *  concurrently with other access to the archive (same as
+     *  applyHint()).
+     */
+    bool refresh();
+
     /** Used hint filename, if any.
      */
     boost::optional<boost::filesystem::path> usedHint() const;
@@ -174,6 +305,25 @@ public:
      */
     bool handlesSchema(const std::string &schema) const;
 
+    /** Backend used to access this archive.
+     */
+    Backend backend() const;
+
+    /** Estimated memory used by this archive (index, file lists, etc.).
+     */
+    MemoryUsage memoryUsage() const;
+
+    /** Calls visitor with BasicRoArchive<Backend> for concrete backend of
+     *  this archive, i.e. visitor must accept BasicRoArchive<Directory>&,
+     *  BasicRoArchive<Tarball>&, etc. (e.g. generic lambda or templated
+     *  operator()). Code inside the visitor calls the backend directly.
+     *
+     *  Defined in basic.hpp.
+     */
+    template <typename Visitor>
+    auto visit(Visitor &&visitor) const
+        -> decltype(visitor(std::declval<BasicRoArchive<Directory>&>()));
+
     /** Internal implementation.
      */
     struct Detail;
@@ -212,9 +362,105 @@ struct OpenOptions {
     std::size_t fileLimit;
     std::string mime;
 
+    /** Zip: always index mmapped central directory. It is used by default
+     *  too (open time and memory scale with the directory's byte size),
+     *  but an archive whose central directory is too big to map falls back
+     *  to utility::zip::Reader's parsed file list; with this set, opening
+     *  such an archive fails instead.
+     */
+    bool mapZipDirectory;
+
+    /** Zip: resolve entries' data offsets in one sequential background
+     *  pass right after open. Otherwise they are resolved (and cached) on
+     *  first access.
+     */
+    bool resolveZipOffsets;
+
+    /** Zip: makes deflate entries seekable by keeping decoder checkpoints
+     *  every given number of output bytes (roughly 40 KiB each).
+     *  Checkpoints are shared by streams of the same entry and kept after
+     *  its streams are closed, up to zipCheckpointBudget bytes per archive.
+     *  Zero disables checkpoints, such entries are not seekable.
+     */
+    std::size_t zipCheckpointInterval;
+
+    /** Zip: memory budget of decoder checkpoints, least recently opened
+     *  entries lose theirs first.
+     */
+    std::size_t zipCheckpointBudget;
+
+    /** Directory: keep in-memory index of the (hinted) tree, maintained
+     *  from inotify events, so that exists(), list() and findFile() do not
+     *  touch the filesystem.
+     */
+    bool liveDirectoryIndex;
+
+    /** Tarball: number of threads scanning the archive for headers in
+     *  parallel, meant for large tarballs on high latency storage. Zero
+     *  means sequential header-to-header scan.
+     */
+    unsigned int tarScanThreads;
+
+    /** Latency histograms, measurement is disabled if null.
+     */
+    std::shared_ptr<Metrics> metrics;
+
+    /** Operation tracer, tracing is disabled if null.
+     */
+    std::shared_ptr<Tracer> tracer;
+
+    /** Slow operation log, slow operations are not watched if null.
+     */
+    std::shared_ptr<SlowLog> slowLog;
+
+    /** Upstream memory for index arenas, global new/delete if null.
+     */
+    std::shared_ptr<MemoryResource> memoryResource;
+
+    /** Decoded content cache, nothing is cached if null.
+     */
+    std::shared_ptr<ContentCache> contentCache;
+
+    /** I/O admission (priorities, rate limits, queue depth), reads are not
+     *  scheduled if null.
+     */
+    std::shared_ptr<IoScheduler> ioScheduler;
+
+    /** Descriptor budget manager (tarball and zip archives), files are
+     *  kept open by archives if null. Zip archives are then always opened
+     *  over mapped central directory (see mapZipDirectory).
+     */
+    std::shared_ptr<FdManager> fdManager;
+
+    /** HTTP: local disk cache of fetched byte ranges, resources are fetched
+     *  whole (with plain GET) if null. Resources without ETag and
+     *  Last-Modified are never cached.
+     */
+    std::shared_ptr<BlockCache> blockCache;
+
+    /** HTTP: fetch resources lazily by range requests in windows of given
+     *  size (with read-ahead for sequential reads); streams are seekable.
+     *  Zero means whole resources are downloaded when opened.
+     */
+    std::size_t httpRangeWindow;
+
+    /** Archive-owned caches (zip decoder checkpoints) and content cache,
+     *  if it can shrink (MemoryContentCache), are registered with this
+     *  governor, if any. HTTP holds no cache to govern: lazy streams keep
+     *  a bounded number of windows each and the block cache is on disk.
+     */
+    std::shared_ptr<MemoryGovernor> memoryGovernor;
+
     OpenOptions()
         : inlineHint(0)
         , fileLimit(std::numeric_limits<std::size_t>::max())
+        , mapZipDirectory(false)
+        , resolveZipOffsets(false)
+        , zipCheckpointInterval(0)
+        , zipCheckpointBudget(64 << 20)
+        , liveDirectoryIndex(false)
+        , tarScanThreads(0)
+        , httpRangeWindow(0)
     {}
 
     OpenOptions& setHint(FileHint v) {
@@ -232,6 +478,70 @@ struct OpenOptions {
     OpenOptions& setMime(std::string v) {
         mime = std::move(v); return *this;
     }
+
+    OpenOptions& setMapZipDirectory(bool v) {
+        mapZipDirectory = v; return *this;
+    }
+
+    OpenOptions& setResolveZipOffsets(bool v) {
+        resolveZipOffsets = v; return *this;
+    }
+
+    OpenOptions& setZipCheckpointInterval(std::size_t v) {
+        zipCheckpointInterval = v; return *this;
+    }
+
+    OpenOptions& setZipCheckpointBudget(std::size_t v) {
+        zipCheckpointBudget = v; return *this;
+    }
+
+    OpenOptions& setLiveDirectoryIndex(bool v) {
+        liveDirectoryIndex = v; return *this;
+    }
+
+    OpenOptions& setTarScanThreads(unsigned int v) {
+        tarScanThreads = v; return *this;
+    }
+
+    OpenOptions& setMetrics(std::shared_ptr<Metrics> v) {
+        metrics = std::move(v); return *this;
+    }
+
+    OpenOptions& setTracer(std::shared_ptr<Tracer> v) {
+        tracer = std::move(v); return *this;
+    }
+
+    OpenOptions& setSlowLog(std::shared_ptr<SlowLog> v) {
+        slowLog = std::move(v); return *this;
+    }
+
+    OpenOptions& setContentCache(std::shared_ptr<ContentCache> v) {
+        contentCache = std::move(v); return *this;
+    }
+
+    OpenOptions& setMemoryResource(std::shared_ptr<MemoryResource> v) {
+        memoryResource = std::move(v); return *this;
+    }
+
+    OpenOptions& setIoScheduler(std::shared_ptr<IoScheduler> v) {
+        ioScheduler = std::move(v); return *this;
+    }
+
+    OpenOptions& setFdManager(std::shared_ptr<FdManager> v) {
+        fdManager = std::move(v); return *this;
+    }
+
+    OpenOptions& setBlockCache(std::shared_ptr<BlockCache> v) {
+        blockCache = std::move(v); return *this;
+    }
+
+    OpenOptions& setHttpRangeWindow(std::size_t v) {
+        httpRangeWindow = v; return *this;
+    }
+
+    OpenOptions& setMemoryGovernor(std::shared_ptr<MemoryGovernor> v) {
+        memoryGovernor = std::move(v); return *this;
+    }
 };
 
 } // namespace roarchive
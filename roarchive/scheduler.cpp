@@ -0,0 +1,216 @@
+/**
+ * Copyright (c) 2017 Melown Technologies SE
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * *  Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * *  Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <algorithm>
+
+#include "scheduler.hpp"
+
+namespace roarchive {
+
+namespace {
+
+thread_local IoPriority currentPriority(IoPriority::normal);
+
+typedef IoScheduler::clock clock;
+
+/** Token bucket allowing debt: admits when level is non-negative.
+ */
+class TokenBucket {
+public:
+    TokenBucket() : rate_(), capacity_(), level_() {}
+
+    void configure(double rate, double burst) {
+        rate_ = rate;
+        capacity_ = std::max(rate * burst, 1.0);
+        level_ = capacity_;
+        last_ = clock::now();
+    }
+
+    bool unlimited() const { return rate_ <= 0; }
+
+    /** Time until bucket admits, zero if it does right now.
+     */
+    clock::duration wait(clock::time_point now) {
+        if (unlimited()) { return {}; }
+        refill(now);
+        if (level_ >= 0) { return {}; }
+        return std::chrono::duration_cast<clock::duration>
+            (std::chrono::duration<double>(-level_ / rate_));
+    }
+
+    void take(double amount) {
+        if (!unlimited()) { level_ -= amount; }
+    }
+
+private:
+    void refill(clock::time_point now) {
+        const std::chrono::duration<double> elapsed(now - last_);
+        last_ = now;
+        level_ = std::min(capacity_, level_ + elapsed.count() * rate_);
+    }
+
+    double rate_;
+    double capacity_;
+    double level_;
+    clock::time_point last_;
+};
+
+} // namespace
+
+struct IoScheduler::Limiter {
+    TokenBucket bytes;
+    TokenBucket ops;
+
+    void configure(const Rate &rate, double burst) {
+        bytes.configure(rate.bytes, burst);
+        ops.configure(rate.ops, burst);
+    }
+
+    clock::duration wait(clock::time_point now) {
+        return std::max(bytes.wait(now), ops.wait(now));
+    }
+
+    void take(std::size_t b, unsigned int o) {
+        bytes.take(b);
+        ops.take(o);
+    }
+};
+
+IoScheduler::IoScheduler(const Config &config)
+    : config_(config), global_(new Limiter[3]), inFlight_(), waiting_()
+{
+    for (int i(0); i < 3; ++i) {
+        global_[i].configure(config_.global[i], config_.burst);
+    }
+}
+
+IoScheduler::~IoScheduler() {}
+
+IoScheduler::Scope::Scope(IoPriority priority)
+    : previous_(currentPriority)
+{
+    currentPriority = priority;
+}
+
+IoScheduler::Scope::~Scope()
+{
+    currentPriority = previous_;
+}
+
+IoPriority IoScheduler::priority()
+{
+    return currentPriority;
+}
+
+IoScheduler::Grant IoScheduler::acquire(Channel &channel, std::size_t bytes)
+{
+    const auto p(static_cast<int>(priority()));
+    auto &global(global_[p]);
+    auto &archive(channel.limits_[p]);
+
+    const auto start(clock::now());
+    std::unique_lock<std::mutex> lock(mutex_);
+
+    // rate: wait until both global and archive buckets admit
+    for (;;) {
+        const auto now(clock::now());
+        const auto wait(std::max(global.wait(now), archive.wait(now)));
+        if (wait == clock::duration::zero()) { break; }
+        cv_.wait_for(lock, wait);
+    }
+
+    // queue depth: lower classes wait while higher ones are queued
+    const auto admissible([&]() -> bool
+    {
+        for (int i(0); i < p; ++i) {
+            if (waiting_[i]) { return false; }
+        }
+        if (!config_.queueDepth) { return true; }
+        const auto depth((p == int(IoPriority::interactive))
+                         ? config_.queueDepth
+                         : (config_.queueDepth
+                            - std::min(config_.reserved
+                                       , config_.queueDepth - 1)));
+        return inFlight_ < depth;
+    });
+
+    if (!admissible()) {
+        ++waiting_[p];
+        cv_.wait(lock, admissible);
+        --waiting_[p];
+        // lower classes might be admissible now
+        cv_.notify_all();
+    }
+
+    ++inFlight_;
+    global.take(bytes, 1);
+    archive.take(bytes, 1);
+
+    ++stats_.ops[p];
+    stats_.bytes[p] += bytes;
+    stats_.waited[p] += clock::now() - start;
+
+    return Grant(this);
+}
+
+void IoScheduler::charge(Channel &channel, std::size_t bytes)
+{
+    const auto p(static_cast<int>(priority()));
+    std::unique_lock<std::mutex> lock(mutex_);
+    global_[p].take(bytes, 0);
+    channel.limits_[p].take(bytes, 0);
+    stats_.bytes[p] += bytes;
+}
+
+void IoScheduler::release()
+{
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        --inFlight_;
+    }
+    cv_.notify_all();
+}
+
+IoScheduler::Stats IoScheduler::stats() const
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    auto stats(stats_);
+    stats.inFlight = inFlight_;
+    return stats;
+}
+
+IoScheduler::Channel::Channel(const IoScheduler::pointer &scheduler
+                              , const boost::filesystem::path &archive)
+    : scheduler_(scheduler), archive_(archive), limits_(new Limiter[3])
+{
+    for (int i(0); i < 3; ++i) {
+        limits_[i].configure(scheduler_->config_.archive[i]
+                             , scheduler_->config_.burst);
+    }
+}
+
+IoScheduler::Channel::~Channel() {}
+
+} // namespace roarchive
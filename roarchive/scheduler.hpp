@@ -0,0 +1,232 @@
+/**
+ * Copyright (c) 2017 Melown Technologies SE
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * *  Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * *  Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef roarchive_scheduler_hpp_included_
+#define roarchive_scheduler_hpp_included_
+
+#include <cstddef>
+#include <cstdint>
+#include <chrono>
+#include <memory>
+#include <utility>
+#include <mutex>
+#include <condition_variable>
+
+#include <boost/filesystem/path.hpp>
+
+namespace roarchive {
+
+/** I/O priority class. Set per thread by IoScheduler::Scope.
+ */
+enum class IoPriority { interactive = 0, normal = 1, background = 2 };
+
+/** Arbitrates archive I/O between priority classes.
+ *
+ *  Every file stream of archives opened with this scheduler (see
+ *  OpenOptions::setIoScheduler()) and every HTTP fetch is an I/O operation
+ *  that has to be admitted first; streams are charged by bytes actually
+ *  read:
+ *
+ *  * rate: per class token buckets (bytes/s and operations/s), both global
+ *    and per archive; a request waits until all its buckets are
+ *    non-negative and then takes its cost (buckets may go into debt);
+ *
+ *  * queue depth: number of operations in flight is bounded; free slots
+ *    are handed out in strict priority order and some of them can be
+ *    reserved for interactive requests only.
+ *
+ *  Priority is taken from the calling thread, normal by default.
+ */
+class IoScheduler {
+public:
+    typedef std::shared_ptr<IoScheduler> pointer;
+    typedef std::chrono::steady_clock clock;
+
+    /** Rate limit, zero means unlimited.
+     */
+    struct Rate {
+        double bytes;
+        double ops;
+
+        Rate(double bytes = 0, double ops = 0) : bytes(bytes), ops(ops) {}
+    };
+
+    struct Config {
+        /** Maximum number of operations in flight, zero means unlimited.
+         */
+        unsigned int queueDepth;
+
+        /** Slots (out of queueDepth) usable only by interactive requests.
+         */
+        unsigned int reserved;
+
+        /** Bucket capacity, in seconds' worth of rate.
+         */
+        double burst;
+
+        /** Per class global limits.
+         */
+        Rate global[3];
+
+        /** Per class limits of each archive.
+         */
+        Rate archive[3];
+
+        Config() : queueDepth(0), reserved(0), burst(1.0) {}
+
+        Config& setQueueDepth(unsigned int v, unsigned int r = 0) {
+            queueDepth = v; reserved = r; return *this;
+        }
+
+        Config& setBurst(double v) {
+            burst = v; return *this;
+        }
+
+        Config& setGlobalRate(IoPriority p, const Rate &v) {
+            global[int(p)] = v; return *this;
+        }
+
+        Config& setArchiveRate(IoPriority p, const Rate &v) {
+            archive[int(p)] = v; return *this;
+        }
+    };
+
+    struct Stats {
+        /** Per class admitted operations, bytes and total time spent
+         *  waiting for admission.
+         */
+        std::uint64_t ops[3];
+        std::uint64_t bytes[3];
+        clock::duration waited[3];
+
+        /** Operations in flight right now.
+         */
+        unsigned int inFlight;
+
+        Stats() : ops(), bytes(), waited(), inFlight() {}
+    };
+
+    IoScheduler(const Config &config = Config());
+    ~IoScheduler();
+
+    /** Sets calling thread's priority for the lifetime of this object.
+     */
+    class Scope {
+    public:
+        Scope(IoPriority priority);
+        ~Scope();
+
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+
+    private:
+        IoPriority previous_;
+    };
+
+    /** Calling thread's priority.
+     */
+    static IoPriority priority();
+
+    /** Admitted operation, holds a queue slot until destroyed.
+     */
+    class Grant {
+    public:
+        Grant(IoScheduler *scheduler = nullptr) : scheduler_(scheduler) {}
+        Grant(Grant &&o) : scheduler_(o.scheduler_) { o.scheduler_ = {}; }
+        ~Grant() { if (scheduler_) { scheduler_->release(); } }
+
+        Grant& operator=(Grant &&o) {
+            std::swap(scheduler_, o.scheduler_); return *this;
+        }
+
+        Grant(const Grant&) = delete;
+        Grant& operator=(const Grant&) = delete;
+
+        /** Holds a queue slot.
+         */
+        explicit operator bool() const { return scheduler_ != nullptr; }
+
+    private:
+        IoScheduler *scheduler_;
+    };
+
+    class Channel;
+
+    Stats stats() const;
+
+private:
+    Grant acquire(Channel &channel, std::size_t bytes);
+    void charge(Channel &channel, std::size_t bytes);
+    void release();
+
+    struct Limiter;
+
+    const Config config_;
+    std::unique_ptr<Limiter[]> global_;
+
+    mutable std::mutex mutex_;
+    std::condition_variable cv_;
+    unsigned int inFlight_;
+
+    /** Number of requests waiting for a slot, per class.
+     */
+    unsigned int waiting_[3];
+
+    Stats stats_;
+};
+
+/** Per archive admission channel.
+ */
+class IoScheduler::Channel {
+public:
+    typedef std::shared_ptr<Channel> pointer;
+
+    Channel(const IoScheduler::pointer &scheduler
+            , const boost::filesystem::path &archive);
+    ~Channel();
+
+    /** Admits one operation reading given number of bytes. Blocks.
+     */
+    Grant acquire(std::size_t bytes) {
+        return scheduler_->acquire(*this, bytes);
+    }
+
+    /** Charges bytes not known at admission time (e.g. HTTP body).
+     */
+    void charge(std::size_t bytes) { scheduler_->charge(*this, bytes); }
+
+    const boost::filesystem::path& archive() const { return archive_; }
+
+private:
+    friend class IoScheduler;
+
+    IoScheduler::pointer scheduler_;
+    boost::filesystem::path archive_;
+    std::unique_ptr<Limiter[]> limits_;
+};
+
+} // namespace roarchive
+
+#endif // roarchive_scheduler_hpp_included_
@@ -0,0 +1,921 @@
+/**
+ * Copyright (c) 2017 Melown Technologies SE
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * *  Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * *  Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <cerrno>
+#include <cstring>
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <system_error>
+
+#include "dbglog/dbglog.hpp"
+
+#include "shmcache.hpp"
+#include "error.hpp"
+
+namespace roarchive {
+
+namespace {
+
+const std::uint64_t Magic(0x6568636163726f72ull); // "rorcache"
+const std::uint32_t Version(2);
+
+const std::uint32_t LiveEntry(0x6576696c);
+const std::uint32_t SkipEntry(0x70696b73);
+const std::uint32_t PendingEntry(0x646e6570);
+const std::uint32_t OrphanEntry(0x6870726f);
+
+/** Max number of evicted entries still in use per shard.
+ */
+const std::uint32_t MaxOrphans(64);
+
+/** Max number of (process, entry) pins per shard.
+ */
+const std::uint32_t MaxPins(256);
+
+const std::uint64_t Align(64);
+const std::uint64_t PageSize(4096);
+
+enum : std::uint32_t { uninitialized = 0, initializing = 1, ready = 2 };
+
+inline std::uint64_t align(std::uint64_t value, std::uint64_t alignment)
+{
+    return (value + alignment - 1) & ~(alignment - 1);
+}
+
+inline std::uint64_t pow2ceil(std::uint64_t value)
+{
+    std::uint64_t result(1);
+    while (result < value) { result <<= 1; }
+    return result;
+}
+
+/** FNV-1a, stable across processes and builds.
+ */
+std::uint64_t keyHash(const std::string &key)
+{
+    std::uint64_t h(0xcbf29ce484222325ull);
+    for (const auto c : key) {
+        h ^= static_cast<unsigned char>(c);
+        h *= 0x100000001b3ull;
+    }
+    return h;
+}
+
+struct SegmentHeader {
+    std::uint64_t magic;
+    std::uint32_t version;
+    std::atomic<std::uint32_t> state;
+    std::uint64_t size;
+    std::uint64_t shardSize;
+    std::uint32_t shardCount;
+};
+
+struct Slot {
+    std::uint64_t hash;
+
+    /** Entry offset in ring + 1, zero marks empty slot.
+     */
+    std::uint64_t entry;
+};
+
+struct Entry {
+    std::uint32_t magic;
+    std::atomic<std::uint32_t> refs;
+
+    /** Whole allocation, header included.
+     */
+    std::uint64_t size;
+    std::uint64_t hash;
+    std::uint32_t keyLength;
+    std::uint32_t pathLength;
+    std::uint32_t indexLength;
+    std::uint32_t reserved;
+    std::int64_t timestamp;
+    std::uint64_t dataLength;
+
+    char* payload() { return reinterpret_cast<char*>(this) + Align; }
+    const char* key() { return payload(); }
+    const char* path() { return key() + keyLength; }
+    const char* index() { return path() + pathLength; }
+    const char* data() { return index() + indexLength; }
+};
+
+static_assert(sizeof(Entry) <= Align, "Entry header too big.");
+
+/** Evicted entry still in use, left in place outside the ring.
+ */
+struct Orphan {
+    std::uint64_t offset;
+    std::uint64_t size;
+};
+
+/** Entry pinned by a process; free when pid is zero.
+ */
+struct Pin {
+    std::int32_t pid;
+    std::uint32_t count;
+    std::uint64_t offset;
+};
+
+struct ShardHeader {
+    ::pthread_mutex_t mutex;
+
+    std::uint64_t tableOffset;
+    std::uint64_t capacity;
+    std::uint64_t ringOffset;
+    std::uint64_t ringSize;
+
+    // ring state
+    std::uint64_t head;
+    std::uint64_t tail;
+    std::uint64_t used;
+
+    // content
+    std::uint64_t entries;
+    std::uint64_t bytes;
+
+    // stats
+    std::uint64_t hits;
+    std::uint64_t misses;
+    std::uint64_t insertions;
+    std::uint64_t evictions;
+
+    // allocation goes around these
+    std::uint32_t orphanCount;
+    Orphan orphans[MaxOrphans];
+
+    // who uses what, entry refs are sums of pin counts
+    Pin pins[MaxPins];
+};
+
+/** Keeps order of stores into the segment so that a process dying
+ *  mid-operation leaves state repair() can make sense of.
+ */
+inline void ordered() { std::atomic_thread_fence(std::memory_order_release); }
+
+/** Shard view, valid in this process.
+ */
+class Shard {
+public:
+    Shard(char *base) : base_(base), h_(reinterpret_cast<ShardHeader*>(base))
+    {}
+
+    /** Initializes fresh shard occupying given number of bytes.
+     */
+    void init(std::uint64_t size) {
+        ::pthread_mutexattr_t attr;
+        ::pthread_mutexattr_init(&attr);
+        ::pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+        ::pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+        ::pthread_mutex_init(&h_->mutex, &attr);
+        ::pthread_mutexattr_destroy(&attr);
+
+        // table sized for average entry of 2 KiB
+        h_->tableOffset = align(sizeof(ShardHeader), Align);
+        h_->capacity = pow2ceil(std::max<std::uint64_t>(64, size / 2048));
+        h_->ringOffset = align(h_->tableOffset
+                               + h_->capacity * sizeof(Slot), Align);
+        h_->ringSize = ((size - h_->ringOffset) / Align) * Align;
+        reset();
+    }
+
+    /** Locks shard; repairs it when previous owner died inside.
+     */
+    void lock() {
+        const auto res(::pthread_mutex_lock(&h_->mutex));
+        if (res == EOWNERDEAD) {
+            LOG(warn2) << "Content cache shard owner died, repairing shard.";
+            repair();
+            ::pthread_mutex_consistent(&h_->mutex);
+        } else if (res) {
+            std::system_error e(res, std::system_category());
+            LOGTHROW(err2, IOError)
+                << "Cannot lock content cache shard: <" << e.code()
+                << ", " << e.what() << ">.";
+        }
+    }
+
+    void unlock() { ::pthread_mutex_unlock(&h_->mutex); }
+
+    void reset() {
+        std::memset(table(), 0, h_->capacity * sizeof(Slot));
+        h_->head = h_->tail = h_->used = 0;
+        h_->entries = h_->bytes = 0;
+        h_->orphanCount = 0;
+        std::memset(h_->pins, 0, sizeof(h_->pins));
+    }
+
+    /** Finds entry, returns null if not found.
+     */
+    Entry* find(std::uint64_t hash, const std::string &key) {
+        const auto mask(h_->capacity - 1);
+        for (auto i(hash & mask); ; i = (i + 1) & mask) {
+            const auto &slot(table()[i]);
+            if (!slot.entry) { return nullptr; }
+            if (slot.hash != hash) { continue; }
+            auto *e(entry(slot.entry - 1));
+            if ((e->keyLength == key.size())
+                && !std::memcmp(e->key(), key.data(), key.size()))
+            {
+                return e;
+            }
+        }
+    }
+
+    /** Allocates and links new pending entry, evicting old ones. Returns
+     *  null if there is no room. Caller fills the entry and publishes it.
+     */
+    Entry* insert(std::uint64_t hash, const std::string &key
+                  , std::uint64_t size)
+    {
+        size = align(size, Align);
+        if (size > h_->ringSize) { return nullptr; }
+
+        // keep table load under 3/4
+        while (((h_->entries + 1) * 4) > (h_->capacity * 3)) {
+            if (!evictTail()) { return nullptr; }
+        }
+
+        const auto offset(allocate(size));
+        if (offset == std::uint64_t(-1)) { return nullptr; }
+
+        auto *e(entry(offset));
+        new (&e->refs) std::atomic<std::uint32_t>(0);
+        e->hash = hash;
+        e->keyLength = key.size();
+        std::memcpy(e->payload(), key.data(), key.size());
+
+        link(hash, offset);
+        ++h_->entries;
+        return e;
+    }
+
+    /** Pins entry for given process. Fails when pin table is full even
+     *  after reclaiming pins of dead processes.
+     */
+    bool pin(Entry *e, ::pid_t pid) {
+        const auto offset(offsetOf(e));
+        for (int attempt(0); attempt < 2; ++attempt) {
+            Pin *free(nullptr);
+            for (auto &p : h_->pins) {
+                if ((p.pid == pid) && (p.offset == offset)) {
+                    ++p.count;
+                    e->refs.fetch_add(1);
+                    return true;
+                }
+                if (!p.pid && !free) { free = &p; }
+            }
+
+            if (free) {
+                free->offset = offset;
+                free->count = 1;
+                ordered();
+                free->pid = pid;
+                e->refs.fetch_add(1);
+                return true;
+            }
+
+            reap();
+        }
+        return false;
+    }
+
+    /** Releases one pin of given process.
+     */
+    void unpin(Entry *e, ::pid_t pid) {
+        const auto offset(offsetOf(e));
+        for (auto &p : h_->pins) {
+            if ((p.pid != pid) || (p.offset != offset)) { continue; }
+            e->refs.fetch_sub(1);
+            if (!--p.count) { p.pid = 0; }
+            return;
+        }
+    }
+
+    /** Makes filled entry visible to repair().
+     */
+    void publish(Entry *e) {
+        ordered();
+        e->magic = LiveEntry;
+    }
+
+    /** Evicts all entries; entries in use are left in place until
+     *  released (as long as there is room to track them).
+     */
+    void drain() { while (evictTail()) {} }
+
+    ShardHeader& header() { return *h_; }
+
+    std::uint64_t maxEntry() const { return h_->ringSize / 8; }
+
+private:
+    Slot* table() {
+        return reinterpret_cast<Slot*>(base_ + h_->tableOffset);
+    }
+
+    Entry* entry(std::uint64_t offset) {
+        return reinterpret_cast<Entry*>(base_ + h_->ringOffset + offset);
+    }
+
+    std::uint64_t offsetOf(const Entry *e) const {
+        return reinterpret_cast<const char*>(e) - (base_ + h_->ringOffset);
+    }
+
+    /** Drops pins held by processes that no longer exist, either all of
+     *  them or only those of entry at given offset.
+     */
+    void reap(std::uint64_t offset = std::uint64_t(-1)) {
+        for (auto &p : h_->pins) {
+            if (!p.pid) { continue; }
+            if ((offset != std::uint64_t(-1)) && (p.offset != offset)) {
+                continue;
+            }
+            if ((::kill(p.pid, 0) < 0) && (errno == ESRCH)) {
+                entry(p.offset)->refs.fetch_sub(p.count);
+                p.pid = 0;
+            }
+        }
+    }
+
+    /** Checks whether entry is in use by a living process.
+     */
+    bool inUse(std::uint64_t offset) {
+        auto *e(entry(offset));
+        if (!e->refs.load()) { return false; }
+        reap(offset);
+        return e->refs.load();
+    }
+
+    void link(std::uint64_t hash, std::uint64_t offset) {
+        const auto mask(h_->capacity - 1);
+        auto i(hash & mask);
+        while (table()[i].entry) { i = (i + 1) & mask; }
+        table()[i] = { hash, offset + 1 };
+    }
+
+    /** Ring space is [tail, head) modulo ring size; head == tail means
+     *  empty or full ring, told apart by used.
+     *
+     *  To stay repairable, head moves before used grows and used shrinks
+     *  before tail moves.
+     */
+    std::uint64_t allocate(std::uint64_t size) {
+        // bytes stepped over; whole ring means everything is in use
+        std::uint64_t skipped(0);
+
+        for (;;) {
+            const bool wrapped(h_->used && (h_->head <= h_->tail));
+
+            // contiguous free space at head
+            const auto space((wrapped ? h_->tail : h_->ringSize)
+                             - h_->head);
+
+            // step around orphans in the way
+            if (auto *o = orphan(h_->head, std::min(size, space))) {
+                if (!inUse(o->offset)) {
+                    // released meanwhile, its space is free
+                    dropOrphan(o);
+                    continue;
+                }
+                skipped += adoptOrphan(o);
+                if (skipped > h_->ringSize) { return std::uint64_t(-1); }
+                continue;
+            }
+
+            if (!wrapped) {
+                // free space: [head, end) and [0, tail)
+                if (space >= size) { return take(size); }
+
+                // pad the end and wrap around
+                auto *skip(entry(h_->head));
+                skip->magic = SkipEntry;
+                skip->size = space;
+                ordered();
+                h_->head = 0;
+                h_->used += space;
+                continue;
+            }
+
+            // free space: [head, tail)
+            if (space >= size) { return take(size); }
+            if (!evictTail()) { return std::uint64_t(-1); }
+        }
+    }
+
+    std::uint64_t take(std::uint64_t size) {
+        const auto offset(h_->head);
+
+        // entry is pending until published by the caller
+        auto *e(entry(offset));
+        e->magic = PendingEntry;
+        e->size = size;
+        ordered();
+
+        h_->head = (offset + size) % h_->ringSize;
+        h_->used += size;
+        return offset;
+    }
+
+    /** Evicts oldest entry. Entry in use is unlinked and left in place as
+     *  an orphan; fails only when there is no room to track it.
+     */
+    bool evictTail() {
+        if (!h_->used) { return false; }
+
+        const auto offset(h_->tail);
+        auto *e(entry(offset));
+        if ((e->magic == LiveEntry) || (e->magic == OrphanEntry)) {
+            const bool pinned(inUse(offset));
+            if (pinned && (h_->orphanCount == MaxOrphans)) { return false; }
+
+            if (e->magic == LiveEntry) {
+                unlink(offset);
+                --h_->entries;
+                h_->bytes -= e->dataLength;
+                ++h_->evictions;
+            }
+
+            if (pinned) {
+                e->magic = OrphanEntry;
+                h_->orphans[h_->orphanCount] = { offset, e->size };
+                ordered();
+                ++h_->orphanCount;
+            }
+        }
+
+        const auto size(e->size);
+        h_->used -= size;
+        ordered();
+        h_->tail = (offset + size) % h_->ringSize;
+        return true;
+    }
+
+    /** First orphan intersecting [offset, offset + size).
+     */
+    Orphan* orphan(std::uint64_t offset, std::uint64_t size) {
+        Orphan *first(nullptr);
+        for (std::uint32_t i(0); i < h_->orphanCount; ++i) {
+            auto &o(h_->orphans[i]);
+            if ((o.offset + o.size) <= offset) { continue; }
+            if (o.offset >= (offset + size)) { continue; }
+            if (!first || (o.offset < first->offset)) { first = &o; }
+        }
+        return first;
+    }
+
+    void dropOrphan(Orphan *o) {
+        *o = h_->orphans[h_->orphanCount - 1];
+        ordered();
+        --h_->orphanCount;
+    }
+
+    /** Puts orphan at head back to the ring (padding the gap before it);
+     *  it is evicted again when it reaches the tail. Returns number of
+     *  bytes the head moved by.
+     */
+    std::uint64_t adoptOrphan(Orphan *o) {
+        const auto offset(o->offset), size(o->size);
+        const auto pad(offset - h_->head);
+        if (pad) {
+            auto *skip(entry(h_->head));
+            skip->magic = SkipEntry;
+            skip->size = pad;
+            ordered();
+        }
+
+        h_->head = (offset + size) % h_->ringSize;
+        h_->used += pad + size;
+        dropOrphan(o);
+        return pad + size;
+    }
+
+    /** Makes shard consistent after its lock owner died mid-operation.
+     *
+     *  Ring is walked from the tail; hash table is rebuilt from live
+     *  entries, pending (half-written) entries become padding and the ring
+     *  is cut at the first broken entry. Nothing is moved or overwritten,
+     *  content pinned by other processes stays intact.
+     */
+    void repair() {
+        const auto ringSize(h_->ringSize);
+
+        auto distance((h_->head + ringSize - h_->tail) % ringSize);
+        if (!distance && h_->used) { distance = ringSize; }
+
+        std::memset(table(), 0, h_->capacity * sizeof(Slot));
+        h_->entries = h_->bytes = 0;
+
+        std::uint64_t walked(0);
+        for (auto offset(h_->tail); walked < distance; ) {
+            auto *e(entry(offset));
+            const bool known((e->magic == LiveEntry)
+                             || (e->magic == SkipEntry)
+                             || (e->magic == PendingEntry)
+                             || (e->magic == OrphanEntry));
+            if (!known || (e->size < Align) || (e->size % Align)
+                || (e->size > (ringSize - offset))
+                || (e->size > (distance - walked)))
+            {
+                h_->head = offset;
+                break;
+            }
+
+            e->refs.store(0);
+            if (e->magic == PendingEntry) {
+                e->magic = SkipEntry;
+            } else if (e->magic == LiveEntry) {
+                link(e->hash, offset);
+                ++h_->entries;
+                h_->bytes += e->dataLength;
+            }
+
+            walked += e->size;
+            offset = (offset + e->size) % ringSize;
+        }
+        h_->used = walked;
+
+        // keep only valid orphans outside the ring, once
+        h_->orphanCount = std::min(h_->orphanCount, MaxOrphans);
+        for (std::uint32_t i(0); i < h_->orphanCount; ) {
+            const auto &o(h_->orphans[i]);
+            bool valid((o.offset < ringSize) && !(o.offset % Align)
+                       && (o.size <= (ringSize - o.offset))
+                       && (entry(o.offset)->magic == OrphanEntry)
+                       && (((o.offset + ringSize - h_->tail) % ringSize)
+                           >= h_->used));
+            for (std::uint32_t j(0); valid && (j < i); ++j) {
+                valid = (h_->orphans[j].offset != o.offset);
+            }
+            if (valid) {
+                entry(o.offset)->refs.store(0);
+                ++i;
+            } else {
+                dropOrphan(&h_->orphans[i]);
+            }
+        }
+
+        // entry refs are recounted from valid pins
+        for (auto &p : h_->pins) {
+            if (!p.pid) { continue; }
+            if ((p.offset >= ringSize) || (p.offset % Align) || !p.count
+                || ((entry(p.offset)->magic != LiveEntry)
+                    && (entry(p.offset)->magic != OrphanEntry)))
+            {
+                p.pid = 0;
+                continue;
+            }
+            entry(p.offset)->refs.fetch_add(p.count);
+        }
+    }
+
+    /** Removes table slot of entry at given offset (backward shift).
+     */
+    void unlink(std::uint64_t offset) {
+        const auto mask(h_->capacity - 1);
+        auto *t(table());
+
+        auto i(entry(offset)->hash & mask);
+        while (t[i].entry != (offset + 1)) { i = (i + 1) & mask; }
+
+        t[i] = {};
+        for (auto j((i + 1) & mask); t[j].entry; j = (j + 1) & mask) {
+            const auto home(t[j].hash & mask);
+            // move j into hole at i if its home is not in (i, j]
+            const bool move((i <= j)
+                            ? ((home <= i) || (home > j))
+                            : ((home <= i) && (home > j)));
+            if (move) {
+                t[i] = t[j];
+                t[j] = {};
+                i = j;
+            }
+        }
+    }
+
+    char *base_;
+    ShardHeader *h_;
+};
+
+class ShardLock {
+public:
+    ShardLock(Shard &shard) : shard_(shard) { shard_.lock(); }
+    ~ShardLock() { shard_.unlock(); }
+
+private:
+    Shard &shard_;
+};
+
+[[noreturn]] void systemError(const std::string &what)
+{
+    std::system_error e(errno, std::system_category());
+    LOGTHROW(err2, IOError)
+        << what << ": <" << e.code() << ", " << e.what() << ">.";
+    throw;
+}
+
+/** Size of a single shard. Checked before the segment is created.
+ */
+std::uint64_t shardSize(std::uint64_t size, unsigned int shards)
+{
+    shards = std::max(shards, 1u);
+    const auto shardSize
+        (size > PageSize ? (((size - PageSize) / shards) / PageSize)
+         * PageSize : 0);
+    if (shardSize < (16 * PageSize)) {
+        LOGTHROW(err2, Error)
+            << "Content cache of " << size << " bytes is too small for "
+            << shards << " shards.";
+    }
+    return shardSize;
+}
+
+} // namespace
+
+struct SharedContentCache::Segment {
+    int fd;
+    char *base;
+    std::size_t size;
+
+    Segment() : fd(-1), base(), size() {}
+
+    ~Segment() {
+        if (base) { ::munmap(base, size); }
+        if (fd >= 0) { ::close(fd); }
+    }
+
+    SegmentHeader& header() {
+        return *reinterpret_cast<SegmentHeader*>(base);
+    }
+
+    unsigned int shardCount() { return header().shardCount; }
+
+    Shard shard(unsigned int index) {
+        return Shard(base + PageSize + index * header().shardSize);
+    }
+
+    Shard shard(std::uint64_t hash) {
+        return shard(static_cast<unsigned int>
+                     ((hash >> 32) % header().shardCount));
+    }
+
+    void map(std::size_t size) {
+        this->size = size;
+        void *mem(::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED
+                         , fd, 0));
+        if (mem == MAP_FAILED) { systemError("Cannot map content cache"); }
+        base = static_cast<char*>(mem);
+    }
+
+    /** Lays out fresh segment.
+     */
+    void init(unsigned int shards) {
+        auto &h(header());
+        h.magic = Magic;
+        h.version = Version;
+        h.size = size;
+        h.shardCount = std::max(shards, 1u);
+        h.shardSize = shardSize(size, h.shardCount);
+
+        for (unsigned int i(0); i < h.shardCount; ++i) {
+            shard(i).init(h.shardSize);
+        }
+        h.state.store(ready);
+    }
+};
+
+SharedContentCache::SharedContentCache(const std::string &name
+                                       , std::size_t size
+                                       , unsigned int shards)
+    : segment_(std::make_shared<Segment>())
+{
+    auto &segment(*segment_);
+    size = align(size, PageSize);
+
+    segment.fd = ::shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (segment.fd >= 0) {
+        // we are the creator; do not leave half-made segment behind
+        try {
+            shardSize(size, shards);
+            if (::ftruncate(segment.fd, size) < 0) {
+                systemError("Cannot size content cache segment " + name);
+            }
+            segment.map(size);
+            new (&segment.header().state) std::atomic<std::uint32_t>
+                (initializing);
+            segment.init(shards);
+        } catch (...) {
+            ::shm_unlink(name.c_str());
+            throw;
+        }
+        return;
+    }
+
+    if (errno != EEXIST) {
+        systemError("Cannot create content cache segment " + name);
+    }
+
+    segment.fd = ::shm_open(name.c_str(), O_RDWR, 0600);
+    if (segment.fd < 0) {
+        systemError("Cannot open content cache segment " + name);
+    }
+
+    // wait for creator to size and initialize the segment
+    const auto deadline(std::chrono::steady_clock::now()
+                        + std::chrono::seconds(10));
+    const auto wait([&]() {
+            if (std::chrono::steady_clock::now() > deadline) {
+                LOGTHROW(err2, Error)
+                    << "Content cache segment " << name
+                    << " has not been initialized in time.";
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        });
+
+    struct ::stat st;
+    for (;;) {
+        if (::fstat(segment.fd, &st) < 0) {
+            systemError("Cannot stat content cache segment " + name);
+        }
+        if (st.st_size) { break; }
+        wait();
+    }
+
+    segment.map(st.st_size);
+    while (segment.header().state.load() != ready) { wait(); }
+
+    if ((segment.header().magic != Magic)
+        || (segment.header().version != Version))
+    {
+        LOGTHROW(err2, Error)
+            << "Shared memory segment " << name
+            << " is not a compatible content cache.";
+    }
+}
+
+SharedContentCache::SharedContentCache(std::size_t size
+                                       , unsigned int shards)
+    : segment_(std::make_shared<Segment>())
+{
+    auto &segment(*segment_);
+    size = align(size, PageSize);
+    shardSize(size, shards);
+
+    segment.fd = ::memfd_create("roarchive-cache", MFD_CLOEXEC);
+    if (segment.fd < 0) { systemError("Cannot create content cache"); }
+    if (::ftruncate(segment.fd, size) < 0) {
+        systemError("Cannot size content cache");
+    }
+    segment.map(size);
+    segment.init(shards);
+}
+
+SharedContentCache::~SharedContentCache() {}
+
+void SharedContentCache::unlink(const std::string &name)
+{
+    if ((::shm_unlink(name.c_str()) < 0) && (errno != ENOENT)) {
+        systemError("Cannot remove content cache segment " + name);
+    }
+}
+
+ContentCache::Content::pointer SharedContentCache::get(const Key &key)
+{
+    const auto flat(key.flat());
+    const auto h(keyHash(flat));
+    auto shard(segment_->shard(h));
+    const auto pid(::getpid());
+
+    Entry *e;
+    {
+        ShardLock lock(shard);
+        e = shard.find(h, flat);
+        if (!e) {
+            ++shard.header().misses;
+            return {};
+        }
+        // pin; released when content is dropped
+        if (!shard.pin(e, pid)) {
+            ++shard.header().misses;
+            return {};
+        }
+        ++shard.header().hits;
+    }
+
+    auto content(std::make_shared<Content>());
+    content->data = e->data();
+    content->size = e->dataLength;
+    content->path.assign(e->path(), e->path() + e->pathLength);
+    content->index.assign(e->index(), e->index() + e->indexLength);
+    content->timestamp = e->timestamp;
+    // unpins entry, keeps mapping alive as long as content is used
+    auto segment(segment_);
+    content->storage = std::shared_ptr<const void>
+        (e, [segment, shard, pid](Entry *e) mutable {
+            // pins belong to the pinning process, not to its forks
+            if (::getpid() != pid) { return; }
+            try {
+                ShardLock lock(shard);
+                shard.unpin(e, pid);
+            } catch (...) {}
+        });
+    return content;
+}
+
+void SharedContentCache::put(const Key &key, const Content::pointer &content)
+{
+    if (!content || (content->size > maxEntry())) { return; }
+
+    const auto flat(key.flat());
+    const auto h(keyHash(flat));
+    auto shard(segment_->shard(h));
+
+    const auto &path(content->path.native());
+    const auto &index(content->index.native());
+
+    ShardLock lock(shard);
+
+    // already cached (likely by another process)
+    if (shard.find(h, flat)) { return; }
+
+    auto *e(shard.insert(h, flat, (Align + flat.size() + path.size()
+                                   + index.size() + content->size)));
+    if (!e) { return; }
+
+    e->pathLength = path.size();
+    e->indexLength = index.size();
+    e->timestamp = content->timestamp;
+    e->dataLength = content->size;
+    std::memcpy(const_cast<char*>(e->path()), path.data(), path.size());
+    std::memcpy(const_cast<char*>(e->index()), index.data(), index.size());
+    if (content->size) {
+        std::memcpy(const_cast<char*>(e->data()), content->data
+                    , content->size);
+    }
+
+    shard.publish(e);
+    ++shard.header().insertions;
+    shard.header().bytes += content->size;
+}
+
+void SharedContentCache::clear()
+{
+    for (unsigned int i(0), e(segment_->shardCount()); i < e; ++i) {
+        auto shard(segment_->shard(i));
+        ShardLock lock(shard);
+        shard.drain();
+    }
+}
+
+ContentCache::Stats SharedContentCache::stats() const
+{
+    Stats stats;
+    for (unsigned int i(0), e(segment_->shardCount()); i < e; ++i) {
+        auto shard(segment_->shard(i));
+        ShardLock lock(shard);
+        const auto &h(shard.header());
+        stats.hits += h.hits;
+        stats.misses += h.misses;
+        stats.insertions += h.insertions;
+        stats.evictions += h.evictions;
+        stats.bytes += h.bytes;
+        stats.entries += h.entries;
+    }
+    return stats;
+}
+
+std::size_t SharedContentCache::maxEntry() const
+{
+    return segment_->shard(0u).maxEntry();
+}
+
+} // namespace roarchive
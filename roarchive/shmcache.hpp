@@ -0,0 +1,92 @@
+/**
+ * Copyright (c) 2017 Melown Technologies SE
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * *  Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * *  Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef roarchive_shmcache_hpp_included_
+#define roarchive_shmcache_hpp_included_
+
+#include <memory>
+#include <string>
+
+#include "cache.hpp"
+
+namespace roarchive {
+
+/** Content cache living in a shared memory segment.
+ *
+ *  Meant for pre-forked workers: all processes attached to the same segment
+ *  share one decoded copy of every cached file. The segment is split into
+ *  shards, each guarded by a process-shared robust mutex and holding an
+ *  open-addressing hash table and a FIFO ring of refcounted entries. Hits
+ *  are served directly from the segment (no copy). Entries in use by any
+ *  process are never overwritten: when evicted they are left in place and
+ *  allocation goes around them until released (up to 64 such entries per
+ *  shard, then the shard stops accepting new content).
+ *
+ *  Every pin records the pinning process; pins of processes that died
+ *  without releasing them are reclaimed. All attached processes must
+ *  therefore live in the same PID namespace.
+ *
+ *  If a process dies while holding a shard's lock, the next locker repairs
+ *  that shard: the hash table is rebuilt from the ring and only a
+ *  half-written entry is dropped.
+ */
+class SharedContentCache : public ContentCache {
+public:
+    /** Attaches to named POSIX shared memory segment (e.g.
+     *  "/roarchive-cache"), creating it with given size if it does not
+     *  exist. Existing segment is used with its own size and layout.
+     */
+    SharedContentCache(const std::string &name, std::size_t size
+                       , unsigned int shards = 16);
+
+    /** Creates anonymous segment (memfd) of given size. Shared with
+     *  processes forked after creation.
+     */
+    SharedContentCache(std::size_t size, unsigned int shards = 16);
+
+    virtual ~SharedContentCache();
+
+    virtual Content::pointer get(const Key &key);
+    virtual void put(const Key &key, const Content::pointer &content);
+    /** Drops content; entries currently in use stay in memory until
+     *  released.
+     */
+    virtual void clear();
+    virtual Stats stats() const;
+    virtual std::size_t maxEntry() const;
+
+    /** Removes named segment. Attached processes keep using it.
+     */
+    static void unlink(const std::string &name);
+
+    struct Segment;
+
+private:
+    std::shared_ptr<Segment> segment_;
+};
+
+} // namespace roarchive
+
+#endif // roarchive_shmcache_hpp_included_
@@ -0,0 +1,143 @@
+/**
+ * Copyright (c) 2017 Melown Technologies SE
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * *  Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * *  Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "dbglog/dbglog.hpp"
+
+#include "slowlog.hpp"
+#include "probe.hpp"
+#include "io.hpp"
+
+namespace roarchive {
+
+SlowLog::SlowLog(std::chrono::nanoseconds threshold
+                 , std::size_t capacity, std::size_t sampling)
+    : threshold_(threshold), capacity_(capacity)
+    , sampling_(sampling ? sampling : 1)
+    , count_(0), next_(0)
+{
+    ring_.reserve(capacity_);
+}
+
+void SlowLog::report(SlowOperation operation)
+{
+    LOG(warn2) << "Slow operation: " << operation << ".";
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    if ((count_++ % sampling_) || !capacity_) { return; }
+
+    if (ring_.size() < capacity_) {
+        ring_.push_back(std::move(operation));
+    } else {
+        ring_[next_] = std::move(operation);
+    }
+    next_ = (next_ + 1) % capacity_;
+}
+
+SlowLog::Stats SlowLog::stats() const
+{
+    Stats stats;
+    std::lock_guard<std::mutex> lock(mutex_);
+    stats.count = count_;
+
+    // unwind the ring, oldest first
+    stats.recent.reserve(ring_.size());
+    if (ring_.size() < capacity_) {
+        stats.recent = ring_;
+    } else {
+        stats.recent.insert(stats.recent.end(), ring_.begin() + next_
+                            , ring_.end());
+        stats.recent.insert(stats.recent.end(), ring_.begin()
+                            , ring_.begin() + next_);
+    }
+
+    return stats;
+}
+
+thread_local Watch *Watch::current_(nullptr);
+
+Watch::Watch(SlowLog *slowLog, const char *operation
+             , const boost::filesystem::path &archive)
+    : slowLog_(slowLog), operation_(operation), archive_(&archive)
+    , path_(nullptr), backend_(), previous_(nullptr)
+{
+    start();
+}
+
+Watch::Watch(const Instrumentation *instrumentation, const char *operation
+             , const boost::filesystem::path *path)
+    : slowLog_(instrumentation ? instrumentation->slowLog.get() : nullptr)
+    , operation_(operation)
+    , archive_(instrumentation ? &instrumentation->archive : nullptr)
+    , path_(path)
+    , backend_(instrumentation ? instrumentation->backend : Backend())
+    , previous_(nullptr)
+{
+    start();
+}
+
+void Watch::start()
+{
+    if (!slowLog_) { return; }
+    previous_ = current_;
+    current_ = this;
+    start_ = clock::now();
+}
+
+void Watch::phase(const char *name, clock::duration duration)
+{
+    phases_.emplace_back
+        (name, std::chrono::duration_cast<SlowOperation::Duration>
+         (duration));
+}
+
+Watch::~Watch()
+{
+    if (!slowLog_) { return; }
+    current_ = previous_;
+
+    const auto duration(std::chrono::duration_cast<SlowOperation::Duration>
+                        (clock::now() - start_));
+    if (duration < slowLog_->threshold()) { return; }
+
+    SlowOperation op;
+    op.operation = operation_;
+    if (archive_) { op.archive = *archive_; }
+    if (path_) { op.path = *path_; }
+    op.backend = backend_;
+    op.bytes = bytes_;
+    op.phases = std::move(phases_);
+    op.duration = duration;
+    op.thread = std::this_thread::get_id();
+    op.when = std::chrono::system_clock::now();
+
+    try {
+        slowLog_->report(std::move(op));
+    } catch (...) {
+        // never throw from destructor
+    }
+}
+
+} // namespace roarchive
@@ -0,0 +1,137 @@
+/**
+ * Copyright (c) 2017 Melown Technologies SE
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * *  Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * *  Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef roarchive_slowlog_hpp_included_
+#define roarchive_slowlog_hpp_included_
+
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <memory>
+#include <vector>
+#include <string>
+#include <utility>
+#include <cstdint>
+
+#include <boost/optional.hpp>
+#include <boost/filesystem/path.hpp>
+
+#include "roarchive.hpp"
+
+namespace roarchive {
+
+/** Record of operation that took longer than configured threshold.
+ */
+struct SlowOperation {
+    typedef std::chrono::nanoseconds Duration;
+    typedef std::vector<std::pair<const char*, Duration>> Phases;
+
+    /** Operation name (open, istream, read).
+     */
+    const char *operation;
+
+    /** Path to the archive.
+     */
+    boost::filesystem::path archive;
+
+    /** Path to the entry inside the archive, empty for archive open.
+     */
+    boost::filesystem::path path;
+
+    Backend backend;
+
+    /** Number of bytes involved, if known.
+     */
+    boost::optional<std::size_t> bytes;
+
+    /** Timings of individual phases, in order of completion.
+     */
+    Phases phases;
+
+    /** Total duration.
+     */
+    Duration duration;
+
+    std::thread::id thread;
+
+    /** Wall-clock time of operation end.
+     */
+    std::chrono::system_clock::time_point when;
+
+    SlowOperation()
+        : operation(""), backend(), duration(), thread()
+    {}
+};
+
+/** Slow operation log.
+ *
+ *  Every archive operation (open, istream, read) that exceeds the threshold
+ *  is logged via dbglog and every n-th one (sampling) is kept in a small ring
+ *  of recent slow operations that can be queried by stats().
+ *
+ *  Pass to OpenOptions::setSlowLog(); can be shared by any number of
+ *  archives.
+ */
+class SlowLog {
+public:
+    typedef std::shared_ptr<SlowLog> pointer;
+
+    SlowLog(std::chrono::nanoseconds threshold
+            , std::size_t capacity = 32, std::size_t sampling = 1);
+
+    std::chrono::nanoseconds threshold() const { return threshold_; }
+
+    /** Reports slow operation. Called internally.
+     */
+    void report(SlowOperation operation);
+
+    struct Stats {
+        /** Number of all reported slow operations.
+         */
+        std::uint64_t count;
+
+        /** Sampled recent slow operations, oldest first.
+         */
+        std::vector<SlowOperation> recent;
+
+        Stats() : count() {}
+    };
+
+    Stats stats() const;
+
+private:
+    const std::chrono::nanoseconds threshold_;
+    const std::size_t capacity_;
+    const std::size_t sampling_;
+
+    mutable std::mutex mutex_;
+    std::uint64_t count_;
+    std::vector<SlowOperation> ring_;
+    std::size_t next_;
+};
+
+} // namespace roarchive
+
+#endif // roarchive_slowlog_hpp_included_
@@ -23,18 +23,16 @@
  * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
  * POSSIBILITY OF SUCH DAMAGE.
  */
-#include <map>
+#include <algorithm>
 
 #include "dbglog/dbglog.hpp"
 
-#include "utility/cppversion.hpp"
-#include "utility/tar.hpp"
-#include "utility/path.hpp"
-#include "utility/substream.hpp"
 #include "utility/streams.hpp"
 
-#include "detail.hpp"
+#include "tarball.hpp"
 #include "io.hpp"
+#include "footprint.hpp"
+#include "tarscan.hpp"
 
 namespace fs = boost::filesystem;
 
@@ -42,54 +40,16 @@ namespace roarchive {
 
 namespace {
 
-class TarIStream : public IStream {
-public:
-    typedef utility::io::SubStreamDevice::Filedes Filedes;
-
-    TarIStream(const fs::path &path, const Filedes &fd
-               , const IStream::FilterInit &filterInit)
-        : IStream(filterInit, (fd.end - fd.start)), path_(path)
-    {
-        fis_.push(utility::io::SubStreamDevice(path, fd));
-    }
-
-    virtual fs::path path() const { return path_; }
-    virtual fs::path index() const { return path_; }
-    virtual void close() {}
-
-private:
-    const fs::path path_;
-};
-
 HintedPath
 findPrefix(const fs::path &path, const FileHint &hint
-           , const utility::tar::Reader::File::list &files)
+           , const TarIndex::Records &records, Tracer *tracer)
 {
     if (!hint) { return {}; }
 
-    // sort paths by depth
-    struct Path {
-        const fs::path *path;
-        std::size_t depth;
-
-        Path(const utility::tar::Reader::File &record)
-            : path(&record.path)
-            , depth(std::distance(path->begin(), path->end())) {}
-        bool operator<(const Path &o) const { return depth < o.depth; }
-    };
-
-    std::vector<Path> paths;
-    paths.reserve(files.size());
-    for (const auto &file : files) { paths.emplace_back(file); }
-    std::sort(paths.begin(), paths.end());
-
-    // match all files
-    FileHint::Matcher matcher(hint);
-    for (const auto &path : paths) {
-        if (matcher(*path.path)) {
-            return HintedPath(path.path->parent_path(), path.path->filename());
-        }
-    }
+    Phase phase(tracer, "findPrefix", path);
+
+    HintNameMatcher matcher(hint);
+    for (const auto &record : records) { matcher(record.path); }
 
     if (!matcher) {
         LOGTHROW(err2, std::runtime_error)
@@ -97,135 +57,262 @@ findPrefix(const fs::path &path, const FileHint &hint
             << path << ".";
     }
 
-    return HintedPath(matcher.match().parent_path()
-                      , matcher.match().filename());
+    return matcher.match();
 }
 
-class TarIndex {
-public:
-    typedef utility::io::SubStreamDevice::Filedes Filedes;
+/** Filename part of generic path.
+ */
+boost::string_ref filename(boost::string_ref path)
+{
+    const auto slash(path.rfind('/'));
+    if (slash == boost::string_ref::npos) { return path; }
+    return path.substr(slash + 1);
+}
 
-    TarIndex(utility::tar::Reader &reader, const OpenOptions &openOptions)
-        : path_(reader.path()), files_(reader.files(openOptions.fileLimit))
-        , fd_(reader.filedes())
-        , prefix_(findPrefix(path_, openOptions.hint, files_))
-    {
-        for (const auto &file : files_) {
-            if (!utility::isPathPrefix(file.path, prefix_.path)) { continue; }
+} // namespace
 
-            const auto path(utility::cutPathPrefix(file.path, prefix_.path));
-            index_.insert(map::value_type
-                              (path.string()
-                               , { fd_, file.start, file.end() }));
+TarIndex::TarIndex(utility::tar::Reader &reader
+                   , const OpenOptions &openOptions)
+    : path_(reader.path()), fd_(reader.filedes())
+    , fileLimit_(openOptions.fileLimit)
+    , tracer_(openOptions.tracer)
+    , memoryResource_(openOptions.memoryResource)
+    , arena_(memoryResource_)
+    , records_(ArenaAllocator<Record>(arena_))
+{
+    load(reader, openOptions);
+    prefix_ = findPrefix(path_, openOptions.hint, records_, tracer_.get());
+    index_ = build();
+}
+
+void TarIndex::load(utility::tar::Reader &reader
+                    , const OpenOptions &openOptions)
+{
+    if (openOptions.tarScanThreads) {
+        // scan into temporary (arena never sees an abandoned scan), then
+        // move records into the arena at once
+        struct Scanned {
+            std::size_t name;
+            std::size_t nameLength;
+            std::uint64_t start;
+            std::uint64_t end;
+        };
+        std::vector<Scanned> scanned;
+        std::string names;
+
+        bool ok;
+        {
+            Phase phase(openOptions.tracer, "scan", reader.path());
+            TarScanner scanner(fd_, path_, openOptions.tarScanThreads);
+            ok = scanner.scan(openOptions.fileLimit
+                              , [&](boost::string_ref path
+                                    , std::uint64_t start
+                                    , std::uint64_t end)
+                              {
+                                  scanned.push_back
+                                      ({ names.size(), path.size()
+                                         , start, end });
+                                  names.append(path.data(), path.size());
+                              });
         }
-    }
 
-    const Filedes& file(const std::string &path) const {
-        auto findex(index_.find(path));
-        if (findex == index_.end()) {
-            LOGTHROW(err2, NoSuchFile)
-                << "File \"" << path << "\" not found in the archive at "
-                << path_ << ".";
+        if (ok) {
+            arena_.reserve(scanned.size() * sizeof(Record) + alignof(Record)
+                           + names.size());
+            records_.reserve(scanned.size());
+            for (const auto &s : scanned) {
+                records_.emplace_back
+                    (arena_.copy(boost::string_ref
+                                 (names.data() + s.name, s.nameLength))
+                     , s.start, s.end);
+            }
+            return;
         }
-        return findex->second;
-    }
 
-    bool exists(const std::string &path) const {
-        return (index_.find(path) != index_.end());
+        // not scannable in parallel, fall back to sequential scan
     }
 
-    Files list() const {
-        std::vector<boost::filesystem::path> list;
-        for (const auto &pair : index_) {
-            list.push_back(pair.first);
-        }
-        return list;
-    }
+    // reader's file list is temporary, records are moved into the arena
+    const auto files([&]() -> utility::tar::Reader::File::list {
+            Phase phase(openOptions.tracer, "scan", reader.path());
+            return reader.files(openOptions.fileLimit);
+        }());
 
-    boost::optional<fs::path> findFile(const std::string &filename) const {
-        for (const auto &pair : index_) {
-            const fs::path path(pair.first);
-            if (path.filename() == filename) { return path; }
-        }
-        return boost::none;
+    std::size_t names(0);
+    for (const auto &file : files) { names += file.path.native().size(); }
+    arena_.reserve(files.size() * sizeof(Record) + alignof(Record) + names);
+    records_.reserve(files.size());
+
+    for (const auto &file : files) {
+        records_.emplace_back(arena_.copy(file.path.native())
+                              , file.start, file.end());
     }
+}
+
+std::unique_ptr<TarIndex::Index> TarIndex::build() const
+{
+    Phase phase(tracer_, "index", path_);
 
-    void applyHint(const FileHint &hint) {
-        if (!hint) { return; }
-        // regenerate
-        prefix_ = findPrefix(path_, hint, files_);
-        index_.clear();
+    std::size_t names(0);
+    for (const auto &record : records_) { names += record.path.size(); }
 
-        for (const auto &file : files_) {
-            if (!utility::isPathPrefix(file.path, prefix_.path)) { continue; }
+    auto index(std::make_unique<Index>(memoryResource_));
+    index->reserve(records_.size(), names);
+
+    for (const auto &record : records_) { add(*index, record); }
+
+    index->finish();
+    return index;
+}
 
-            const auto path(utility::cutPathPrefix(file.path, prefix_.path));
-            index_.insert(map::value_type
-                              (path.string()
-                               , { fd_, file.start, file.end() }));
+void TarIndex::add(Index &index, const Record &record) const
+{
+    auto path(record.path);
+    if (!prefix_.cut(path)) { return; }
+    index.add(path, record.extent);
+}
+
+bool TarIndex::append(int fd)
+{
+    if (records_.size() >= fileLimit_) { return true; }
+
+    Phase phase(tracer_, "append", path_);
+
+    TarScanner scanner(fd, path_, 1);
+
+    // resume after last known file; anything after it (directories, links)
+    // is walked again
+    std::uint64_t start(0);
+    if (!records_.empty()) {
+        const auto &record(records_.back());
+        const auto &last(record.extent);
+        if (!scanner.matches(last.start - 512, record.path
+                             , last.end - last.start))
+        {
+            LOG(info1) << "Tarball at " << path_
+                       << " has been rewritten, cannot append.";
+            return false;
         }
+        start = last.end + ((512 - (last.end % 512)) % 512);
     }
 
-    const boost::optional<fs::path>& usedHint() const {
-        return prefix_.usedHint;
+    const auto known(records_.size());
+    if (!scanner.walk(start, fileLimit_ - known
+                      , [this](boost::string_ref path, std::uint64_t start
+                               , std::uint64_t end)
+                      {
+                          records_.emplace_back(arena_.copy(path)
+                                                , start, end);
+                      }))
+    {
+        records_.erase(records_.begin() + known, records_.end());
+        return false;
     }
 
-private:
-    const fs::path path_;
-    utility::tar::Reader::File::list files_;
-    int fd_;
-    typedef std::map<std::string, Filedes> map;
-    map index_;
-    HintedPath prefix_;
-};
-
-class Tarball : public RoArchive::Detail {
-public:
-    Tarball(const boost::filesystem::path &path
-            , const OpenOptions &openOptions)
-        : Detail(path), reader_(path), index_(reader_, openOptions)
-    {}
-
-    /** Get (wrapped) input stream for given file.
-     *  Throws when not found.
-     */
-    virtual IStream::pointer istream(const boost::filesystem::path &path
-                                     , const IStream::FilterInit &filterInit)
-        const
+    for (auto irecords(records_.begin() + known);
+         irecords != records_.end(); ++irecords)
     {
-        return std::make_unique<TarIStream>(path, index_.file(path.string())
-                                            , filterInit);
+        add(*index_, *irecords);
     }
+    index_->finish();
 
-    virtual bool exists(const boost::filesystem::path &path) const {
+    LOG(info1) << "Tarball at " << path_ << ": "
+               << (records_.size() - known) << " appended files indexed.";
+    return true;
+}
 
-        return index_.exists(path.string());
+Files TarIndex::list() const
+{
+    Files list;
+    list.reserve(index_->size());
+    for (const auto &item : *index_) {
+        list.emplace_back(item.key.begin(), item.key.end());
     }
+    return list;
+}
 
-    virtual Files list() const {
-        return index_.list();
+boost::optional<fs::path> TarIndex::findFile(const std::string &filename)
+    const
+{
+    for (const auto &item : *index_) {
+        if (roarchive::filename(item.key) == filename) {
+            return fs::path(item.key.begin(), item.key.end());
+        }
     }
+    return boost::none;
+}
 
-    virtual boost::optional<fs::path> findFile(const std::string &filename)
-        const
-    {
-        return index_.findFile(filename);
+void TarIndex::applyHint(const FileHint &hint)
+{
+    if (!hint) { return; }
+    // regenerate, old index (and its arena) is dropped as a whole
+    prefix_ = findPrefix(path_, hint, records_, tracer_.get());
+    index_ = build();
+}
+
+DatasetRoots TarIndex::discover(const FileHint &hint) const
+{
+    Discovery discovery(hint);
+    for (const auto &record : records_) { discovery(record.path); }
+    return discovery.roots();
+}
+
+void TarIndex::memoryUsage(MemoryUsage &mu) const
+{
+    mu.add("records", arena_.reserved());
+    mu.add("index", (footprint::allocated(sizeof(Index))
+                     + index_->arena().reserved()));
+    mu.add("prefix", (footprint::heap(prefix_.path)
+                      + footprint::heap(prefix_.prefix)
+                      + (prefix_.usedHint
+                         ? footprint::heap(*prefix_.usedHint) : 0)));
+}
+
+Tarball::Tarball(const fs::path &path, const OpenOptions &openOptions)
+    : Detail(path, Backend::tarball, openOptions)
+    , reader_(std::make_unique<utility::tar::Reader>(path))
+    , index_(*reader_, openOptions)
+{
+    if (openOptions.fdManager) {
+        // index holds no reference to the reader
+        file_ = openOptions.fdManager->open(path);
+        reader_.reset();
     }
+}
 
-    virtual void applyHint(const FileHint &hint) {
-        index_.applyHint(hint);
+bool Tarball::refresh()
+{
+    const auto stat(utility::FileStat::from(path_, std::nothrow));
+    if (!stat_.changed(stat)) { return true; }
+
+    // only growth of the very same file can be an append
+    if ((stat.dev != stat_.dev) || (stat.ino != stat_.ino)
+        || (stat.size <= stat_.size))
+    {
+        return false;
     }
 
-    virtual const boost::optional<boost::filesystem::path>& usedHint() {
-        return index_.usedHint();
+    FdManager::Lease lease;
+    int fd;
+    if (file_) {
+        lease = file_->lease();
+        fd = lease.fd();
+    } else {
+        fd = reader_->filedes();
     }
 
-private:
-    utility::tar::Reader reader_;
-    TarIndex index_;
-};
+    if (!index_.append(fd)) { return false; }
+    updated(stat);
+    return true;
+}
 
-} // namespace
+MemoryUsage Tarball::memoryUsage() const
+{
+    auto mu(Detail::memoryUsage());
+    mu.add("object", footprint::allocated(sizeof(*this)));
+    index_.memoryUsage(mu);
+    return mu;
+}
 
 RoArchive::dpointer
 RoArchive::tarball(const boost::filesystem::path &path
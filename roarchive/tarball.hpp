@@ -0,0 +1,265 @@
+/**
+ * Copyright (c) 2017 Melown Technologies SE
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * *  Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * *  Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef roarchive_tarball_hpp_included_
+#define roarchive_tarball_hpp_included_
+
+#include <string>
+#include <vector>
+#include <memory>
+
+#include "dbglog/dbglog.hpp"
+
+#include "utility/cppversion.hpp"
+#include "utility/tar.hpp"
+#include "utility/substream.hpp"
+
+#include "detail.hpp"
+#include "arena.hpp"
+#include "throttle.hpp"
+#include "fdmanager.hpp"
+
+namespace roarchive {
+
+class TarIStream : public IStream {
+public:
+    typedef utility::io::SubStreamDevice::Filedes Filedes;
+
+    TarIStream(const boost::filesystem::path &path, const Filedes &fd
+               , const IStream::FilterInit &filterInit
+               , const IoScheduler::Channel::pointer &ioChannel
+               , FdManager::Lease lease = FdManager::Lease())
+        : IStream(filterInit, (fd.end - fd.start)), path_(path)
+        , lease_(std::move(lease))
+    {
+        push(fis_, utility::io::SubStreamDevice(path, fd), ioChannel);
+    }
+
+    virtual boost::filesystem::path path() const { return path_; }
+    virtual boost::filesystem::path index() const { return path_; }
+    virtual void close() {}
+
+private:
+    const boost::filesystem::path path_;
+
+    /** Keeps managed descriptor open.
+     */
+    FdManager::Lease lease_;
+};
+
+class TarIndex {
+public:
+    typedef utility::io::SubStreamDevice::Filedes Filedes;
+
+    TarIndex(utility::tar::Reader &reader, const OpenOptions &openOptions);
+
+    Filedes file(const std::string &path) const {
+        const auto *extent(index_->find(path));
+        if (!extent) {
+            LOGTHROW(err2, NoSuchFile)
+                << "File \"" << path << "\" not found in the archive at "
+                << path_ << ".";
+        }
+        return { fd_, extent->start, extent->end };
+    }
+
+    bool exists(const std::string &path) const {
+        return index_->find(path);
+    }
+
+    Files list() const;
+
+    boost::optional<boost::filesystem::path>
+    findFile(const std::string &filename) const;
+
+    void applyHint(const FileHint &hint);
+
+    /** Picks up files appended to the archive since it has been indexed:
+     *  walks headers from the end of the last known file using given
+     *  descriptor and merges new files into the index. Returns false if
+     *  the known part does not look intact or the appended part cannot be
+     *  walked; the index is left untouched then.
+     */
+    bool append(int fd);
+
+    DatasetRoots discover(const FileHint &hint) const;
+
+    const boost::optional<boost::filesystem::path>& usedHint() const {
+        return prefix_.usedHint;
+    }
+
+    /** Hinted prefix, generic form with trailing slash.
+     */
+    const std::string& prefix() const { return prefix_.prefix; }
+
+    void memoryUsage(MemoryUsage &mu) const;
+
+    /** File data extent inside the tarball.
+     */
+    struct Extent {
+        std::size_t start;
+        std::size_t end;
+    };
+
+    /** Tarball member, path lives in the records arena.
+     */
+    struct Record {
+        boost::string_ref path;
+        Extent extent;
+
+        Record(boost::string_ref path, std::size_t start, std::size_t end)
+            : path(path), extent{start, end} {}
+    };
+
+    typedef std::vector<Record, ArenaAllocator<Record> > Records;
+    typedef ArenaIndex<Extent> Index;
+
+private:
+    void load(utility::tar::Reader &reader, const OpenOptions &openOptions);
+    std::unique_ptr<Index> build() const;
+
+    /** Adds record to index if it lives under prefix.
+     */
+    void add(Index &index, const Record &record) const;
+
+    const boost::filesystem::path path_;
+    int fd_;
+    std::size_t fileLimit_;
+    Tracer::pointer tracer_;
+    MemoryResource::pointer memoryResource_;
+
+    /** All records, in archive order.
+     */
+    Arena arena_;
+    Records records_;
+
+    HintedPath prefix_;
+    std::unique_ptr<Index> index_;
+};
+
+/** Tarball backend.
+ */
+class Tarball final : public RoArchive::Detail {
+public:
+    Tarball(const boost::filesystem::path &path
+            , const OpenOptions &openOptions);
+
+    /** Get (wrapped) input stream for given file.
+     *  Throws when not found.
+     */
+    virtual IStream::pointer istream(const boost::filesystem::path &path
+                                     , const IStream::FilterInit &filterInit)
+        const
+    {
+        TarIndex::Filedes fd;
+        {
+            Probe probe(instrumentation_, Operation::lookup);
+            fd = index_.file(path.string());
+        }
+
+        FdManager::Lease lease;
+        if (file_) {
+            lease = file_->lease();
+            fd.fd = lease.fd();
+        }
+        return std::make_unique<TarIStream>
+            (path, fd, filterInit, ioChannel_, std::move(lease));
+    }
+
+    using Detail::istream;
+
+    /** Paths are relative to hinted prefix that can be changed by
+     *  applyHint().
+     */
+    virtual boost::optional<std::string>
+    cacheIdentity(const boost::filesystem::path&) const {
+        return '/' + index_.prefix();
+    }
+
+    /** Member's data inside the tarball.
+     */
+    virtual boost::optional<RawFile>
+    openRaw(const boost::filesystem::path &path) const
+    {
+        TarIndex::Filedes fd;
+        {
+            Probe probe(instrumentation_, Operation::lookup);
+            fd = index_.file(path.string());
+        }
+
+        if (!file_) { return RawFile(fd.fd, fd.start, fd.end - fd.start); }
+
+        auto lease(file_->lease());
+        const auto raw(lease.fd());
+        return RawFile(raw, fd.start, fd.end - fd.start
+                       , std::make_shared<FdManager::Lease>
+                       (std::move(lease)));
+    }
+
+    virtual bool exists(const boost::filesystem::path &path) const {
+        return index_.exists(path.string());
+    }
+
+    virtual Files list() const {
+        return index_.list();
+    }
+
+    virtual boost::optional<boost::filesystem::path>
+    findFile(const std::string &filename) const
+    {
+        return index_.findFile(filename);
+    }
+
+    virtual void applyHint(const FileHint &hint) {
+        index_.applyHint(hint);
+    }
+
+    virtual DatasetRoots discover(const FileHint &hint) const {
+        return index_.discover(hint);
+    }
+
+    virtual const boost::optional<boost::filesystem::path>& usedHint() {
+        return index_.usedHint();
+    }
+
+    virtual MemoryUsage memoryUsage() const;
+
+    /** Append-only growth (same file, old data intact) is merged into the
+     *  index, see TarIndex::append().
+     */
+    virtual bool refresh();
+
+private:
+    /** Used to build the index; dropped afterwards if descriptors are
+     *  managed.
+     */
+    std::unique_ptr<utility::tar::Reader> reader_;
+    TarIndex index_;
+    FdManager::File::pointer file_;
+};
+
+} // namespace roarchive
+
+#endif // roarchive_tarball_hpp_included_
@@ -0,0 +1,450 @@
+/**
+ * Copyright (c) 2017 Melown Technologies SE
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * *  Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * *  Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include <cstring>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <string>
+#include <system_error>
+#include <algorithm>
+
+#include "dbglog/dbglog.hpp"
+
+#include "tarscan.hpp"
+#include "error.hpp"
+
+namespace fs = boost::filesystem;
+
+namespace roarchive {
+
+namespace {
+
+const std::size_t BlockSize(512);
+
+/** Chunk read by one worker at a time.
+ */
+const std::uint64_t MinChunkSize(8 << 20);
+
+/** Read buffer of a worker.
+ */
+const std::size_t ReadSize(1 << 20);
+
+/** Parses numeric field: octal text or base-256 (GNU) binary.
+ */
+std::uint64_t number(const char *field, std::size_t size)
+{
+    const auto *u(reinterpret_cast<const unsigned char*>(field));
+    if (u[0] & 0x80) {
+        // base-256, ignore sign bit
+        std::uint64_t value(u[0] & 0x7f);
+        for (std::size_t i(1); i < size; ++i) {
+            value = (value << 8) | u[i];
+        }
+        return value;
+    }
+
+    std::uint64_t value(0);
+    std::size_t i(0);
+    while ((i < size) && (field[i] == ' ')) { ++i; }
+    for (; (i < size) && (field[i] >= '0') && (field[i] <= '7'); ++i) {
+        value = (value << 3) | (field[i] - '0');
+    }
+    return value;
+}
+
+/** Length of NUL terminated string in fixed size field.
+ */
+std::size_t fieldLength(const char *field, std::size_t size)
+{
+    const auto *end(static_cast<const char*>(std::memchr(field, 0, size)));
+    return end ? (end - field) : size;
+}
+
+/** Checks ustar magic and header checksum.
+ */
+bool validHeader(const char *block)
+{
+    if (std::memcmp(block + 257, "ustar", 5)) { return false; }
+
+    const auto expected(number(block + 148, 8));
+    std::uint64_t usum(0);
+    std::int64_t ssum(0);
+    for (std::size_t i(0); i < BlockSize; ++i) {
+        const bool chksum((i >= 148) && (i < 156));
+        usum += chksum ? ' ' : static_cast<unsigned char>(block[i]);
+        ssum += chksum ? ' ' : static_cast<signed char>(block[i]);
+    }
+    return (usum == expected) || (std::uint64_t(ssum) == expected);
+}
+
+bool zeroBlock(const char *block)
+{
+    return std::all_of(block, block + BlockSize
+                       , [](char c) { return !c; });
+}
+
+/** Candidate header.
+ */
+struct Header {
+    std::uint64_t offset;
+    std::uint64_t size;
+    std::uint32_t name;
+    std::uint16_t nameLength;
+    char type;
+};
+
+/** Candidates found in one chunk, names stored in shared pool.
+ */
+struct Chunk {
+    std::uint64_t start;
+    std::uint64_t end;
+    std::vector<Header> headers;
+    std::string names;
+};
+
+/** Parses header block into candidate, name is appended to names.
+ */
+Header parse(const char *block, std::uint64_t offset, std::string &names)
+{
+    Header header;
+    header.offset = offset;
+    header.size = number(block + 124, 12);
+    header.type = block[156];
+    header.name = names.size();
+
+    // POSIX ustar has prefix field, GNU has other data there
+    if (!std::memcmp(block + 257, "ustar\0", 6)) {
+        const auto prefixLength(fieldLength(block + 345, 155));
+        if (prefixLength) {
+            names.append(block + 345, prefixLength);
+            names.push_back('/');
+        }
+    }
+    names.append(block, fieldLength(block, 100));
+    header.nameLength = names.size() - header.name;
+    return header;
+}
+
+void preadAll(int fd, const fs::path &path, char *buf, std::size_t size
+              , std::uint64_t offset)
+{
+    while (size) {
+        const auto r(::pread(fd, buf, size, offset));
+        if (r < 0) {
+            if (errno == EINTR) { continue; }
+            std::system_error e(errno, std::system_category());
+            LOGTHROW(err2, IOError)
+                << "Cannot read from tarball at " << path
+                << ": <" << e.code() << ", " << e.what() << ">.";
+        }
+        if (!r) {
+            LOGTHROW(err2, NotAnArchive)
+                << "Unexpected end of tarball at " << path << ".";
+        }
+        buf += r;
+        size -= r;
+        offset += r;
+    }
+}
+
+void scanChunk(int fd, const fs::path &path, Chunk &chunk)
+{
+    std::vector<char> buffer(ReadSize);
+    for (auto offset(chunk.start); offset < chunk.end; ) {
+        const std::size_t size
+            (std::min<std::uint64_t>(ReadSize, chunk.end - offset));
+        preadAll(fd, path, buffer.data(), size, offset);
+
+        for (std::size_t i(0); (i + BlockSize) <= size; i += BlockSize) {
+            const char *block(buffer.data() + i);
+            if (validHeader(block)) {
+                chunk.headers.push_back(parse(block, offset + i
+                                              , chunk.names));
+            }
+        }
+        offset += size;
+    }
+}
+
+/** Parses pax extended header records, returns path and size overrides.
+ */
+void parsePax(const std::string &data, std::string &path
+              , std::uint64_t &size, bool &hasSize)
+{
+    std::size_t pos(0);
+    while (pos < data.size()) {
+        // "<length> <key>=<value>\n"
+        const auto space(data.find(' ', pos));
+        if (space == std::string::npos) { break; }
+        const auto length(std::strtoull(data.c_str() + pos, nullptr, 10));
+        if (!length || ((pos + length) > data.size())) { break; }
+
+        const auto record(data.substr(space + 1, pos + length - space - 2));
+        const auto eq(record.find('='));
+        if (eq != std::string::npos) {
+            const auto key(record.substr(0, eq));
+            if (key == "path") {
+                path = record.substr(eq + 1);
+            } else if (key == "size") {
+                size = std::strtoull(record.c_str() + eq + 1, nullptr, 10);
+                hasSize = true;
+            }
+        }
+        pos += length;
+    }
+}
+
+/** Header-to-header stitching: applies GNU long name and pax overrides to
+ *  the entry they precede and reports regular files.
+ */
+class Entries {
+public:
+    Entries(int fd, const fs::path &path)
+        : fd_(fd), path_(path), paxSize_(0), paxHasSize_(false)
+    {}
+
+    /** Processes header, returns position of the next one.
+     */
+    std::uint64_t operator()(const Header &header, const std::string &names
+                             , const TarScanner::Callback &callback
+                             , std::size_t &files)
+    {
+        const bool regular((header.type == '0') || (header.type == '\0')
+                           || (header.type == '7'));
+
+        const auto dataStart(header.offset + BlockSize);
+        const auto size((regular && paxHasSize_) ? paxSize_ : header.size);
+        const auto next(dataStart + size
+                        + ((BlockSize - (size % BlockSize)) % BlockSize));
+
+        if (header.type == 'L') {
+            // GNU long name of the next entry
+            longName_.resize(size);
+            preadAll(fd_, path_, &longName_[0], size, dataStart);
+            longName_.resize(fieldLength(longName_.data()
+                                         , longName_.size()));
+        } else if (header.type == 'x') {
+            // pax extended header of the next entry
+            std::string data(size, '\0');
+            preadAll(fd_, path_, &data[0], size, dataStart);
+            parsePax(data, paxPath_, paxSize_, paxHasSize_);
+        } else {
+            if (regular) {
+                boost::string_ref name(names.data() + header.name
+                                       , header.nameLength);
+                if (!longName_.empty()) { name = longName_; }
+                if (!paxPath_.empty()) { name = paxPath_; }
+
+                callback(name, dataStart, dataStart + size);
+                ++files;
+            }
+
+            // overrides apply to single entry only
+            longName_.clear();
+            paxPath_.clear();
+            paxHasSize_ = false;
+        }
+
+        return next;
+    }
+
+private:
+    int fd_;
+    const fs::path &path_;
+    std::string longName_;
+    std::string paxPath_;
+    std::uint64_t paxSize_;
+    bool paxHasSize_;
+};
+
+} // namespace
+
+TarScanner::TarScanner(int fd, const fs::path &path, unsigned int threads)
+    : fd_(fd), path_(path), threads_(std::max(threads, 1u))
+{}
+
+bool TarScanner::scan(std::size_t fileLimit, const Callback &callback)
+{
+    struct ::stat st;
+    if (::fstat(fd_, &st) < 0) {
+        std::system_error e(errno, std::system_category());
+        LOGTHROW(err2, IOError)
+            << "Cannot stat tarball at " << path_
+            << ": <" << e.code() << ", " << e.what() << ">.";
+    }
+    const std::uint64_t fileSize(st.st_size - (st.st_size % BlockSize));
+
+    // split into block-aligned chunks, few per thread for load balancing
+    auto chunkSize(std::max(MinChunkSize, fileSize / (4 * threads_)));
+    chunkSize += (BlockSize - (chunkSize % BlockSize)) % BlockSize;
+
+    std::vector<Chunk> chunks;
+    for (std::uint64_t start(0); start < fileSize; start += chunkSize) {
+        chunks.push_back
+            ({ start, std::min(start + chunkSize, fileSize), {}, {} });
+    }
+
+    // scan chunks in parallel
+    {
+        std::atomic<std::size_t> next(0);
+        std::exception_ptr error;
+        std::atomic<bool> failed(false);
+
+        const auto worker([&]() {
+                try {
+                    for (;;) {
+                        const auto index(next++);
+                        if ((index >= chunks.size()) || failed) { return; }
+                        scanChunk(fd_, path_, chunks[index]);
+                    }
+                } catch (...) {
+                    if (!failed.exchange(true)) {
+                        error = std::current_exception();
+                    }
+                }
+            });
+
+        const auto count(std::min<std::size_t>(threads_, chunks.size()));
+        std::vector<std::thread> workers;
+        for (std::size_t i(1); i < count; ++i) {
+            workers.emplace_back(worker);
+        }
+        worker();
+        for (auto &thread : workers) { thread.join(); }
+
+        if (error) { std::rethrow_exception(error); }
+    }
+
+    // stitch: hop from header to header through candidates
+    std::uint64_t pos(0);
+    std::size_t chunkIndex(0), headerIndex(0);
+    std::size_t files(0);
+    Entries entries(fd_, path_);
+
+    while ((pos < fileSize) && (files < fileLimit)) {
+        // advance to candidate at pos
+        const Chunk *chunk(nullptr);
+        const Header *header(nullptr);
+        while (chunkIndex < chunks.size()) {
+            const auto &c(chunks[chunkIndex]);
+            if (pos >= c.end) { ++chunkIndex; headerIndex = 0; continue; }
+            while ((headerIndex < c.headers.size())
+                   && (c.headers[headerIndex].offset < pos))
+            {
+                ++headerIndex;
+            }
+            if ((headerIndex < c.headers.size())
+                && (c.headers[headerIndex].offset == pos))
+            {
+                chunk = &c;
+                header = &c.headers[headerIndex];
+            }
+            break;
+        }
+
+        if (!header) {
+            // not a ustar header: either end of archive or something we
+            // do not understand
+            char block[BlockSize];
+            preadAll(fd_, path_, block, sizeof(block), pos);
+            if (zeroBlock(block)) { return true; }
+
+            LOG(info1) << "Tarball at " << path_ << " has no ustar header at "
+                       << pos << ", cannot scan it in parallel.";
+            return false;
+        }
+
+        pos = entries(*header, chunk->names, callback, files);
+    }
+
+    return true;
+}
+
+bool TarScanner::matches(std::uint64_t offset, boost::string_ref name
+                         , std::uint64_t size) const
+{
+    char block[BlockSize];
+    preadAll(fd_, path_, block, sizeof(block), offset);
+    if (!validHeader(block)) { return false; }
+
+    std::string names;
+    const auto header(parse(block, offset, names));
+    const bool regular((header.type == '0') || (header.type == '\0')
+                       || (header.type == '7'));
+    if (!regular || (header.size != size)) { return false; }
+
+    const boost::string_ref stored(names);
+    if (stored == name) { return true; }
+
+    // GNU long name: header keeps truncated name
+    return ((name.size() > 100) && (stored.size() >= 99)
+            && name.starts_with(stored));
+}
+
+bool TarScanner::walk(std::uint64_t start, std::size_t fileLimit
+                      , const Callback &callback) const
+{
+    struct ::stat st;
+    if (::fstat(fd_, &st) < 0) {
+        std::system_error e(errno, std::system_category());
+        LOGTHROW(err2, IOError)
+            << "Cannot stat tarball at " << path_
+            << ": <" << e.code() << ", " << e.what() << ">.";
+    }
+    const std::uint64_t fileSize(st.st_size);
+
+    std::size_t files(0);
+    Entries entries(fd_, path_);
+    std::string names;
+
+    // archive being written may lack end marker or even end mid-entry,
+    // stop before anything incomplete
+    for (auto pos(start); ((pos + BlockSize) <= fileSize)
+             && (files < fileLimit); )
+    {
+        char block[BlockSize];
+        preadAll(fd_, path_, block, sizeof(block), pos);
+        if (zeroBlock(block)) { return true; }
+
+        if (!validHeader(block)) {
+            LOG(info1) << "Tarball at " << path_ << " has no ustar header at "
+                       << pos << ", cannot walk it.";
+            return false;
+        }
+
+        names.clear();
+        const auto header(parse(block, pos, names));
+        if ((pos + BlockSize + header.size) > fileSize) { return true; }
+        pos = entries(header, names, callback, files);
+    }
+
+    return true;
+}
+
+} // namespace roarchive
@@ -0,0 +1,90 @@
+/**
+ * Copyright (c) 2017 Melown Technologies SE
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * *  Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * *  Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef roarchive_tarscan_hpp_included_
+#define roarchive_tarscan_hpp_included_
+
+#include <cstdint>
+#include <functional>
+
+#include <boost/utility/string_ref.hpp>
+#include <boost/filesystem/path.hpp>
+
+namespace roarchive {
+
+/** Internal: parallel tarball scanner.
+ *
+ *  Tarball is split into chunks that are read by worker threads which look
+ *  for 512-byte aligned blocks with valid ustar magic and checksum
+ *  (candidate headers). Candidates are then stitched together by a cheap
+ *  sequential pass hopping from header to header; candidates found inside
+ *  file data are skipped naturally. GNU long names ('L') and pax extended
+ *  headers ('x') are honoured.
+ *
+ *  Only regular files are reported.
+ */
+class TarScanner {
+public:
+    /** Called for every file: path, data start and data end.
+     */
+    typedef std::function<void(boost::string_ref, std::uint64_t
+                               , std::uint64_t)> Callback;
+
+    /** Scans tarball open as given fd using given number of threads.
+     */
+    TarScanner(int fd, const boost::filesystem::path &path
+               , unsigned int threads);
+
+    /** Runs scan. Returns false if the archive cannot be scanned in
+     *  parallel (not ustar, unexpected structure); files already reported
+     *  must be dropped in such case and the archive read sequentially.
+     */
+    bool scan(std::size_t fileLimit, const Callback &callback);
+
+    /** Sequential header-to-header walk (single thread) from given header
+     *  position, used to pick up entries appended to a known archive. Stops
+     *  at end of archive or before an incomplete trailing entry. Returns
+     *  false on non-ustar header.
+     */
+    bool walk(std::uint64_t start, std::size_t fileLimit
+              , const Callback &callback) const;
+
+    /** Checks for valid ustar header of regular file with given name and
+     *  data size at given position. Name longer than the header's name
+     *  field (GNU long name) is matched by prefix; file renamed or resized
+     *  by pax header never matches.
+     */
+    bool matches(std::uint64_t offset, boost::string_ref name
+                 , std::uint64_t size) const;
+
+private:
+    int fd_;
+    boost::filesystem::path path_;
+    unsigned int threads_;
+};
+
+} // namespace roarchive
+
+#endif // roarchive_tarscan_hpp_included_
@@ -0,0 +1,250 @@
+/**
+ * Copyright (c) 2017 Melown Technologies SE
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * *  Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * *  Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef roarchive_test_roarchive_generate_hpp_included_
+#define roarchive_test_roarchive_generate_hpp_included_
+
+/** Test archive generators shared by test tools and benchmarks.
+ */
+
+#include <zlib.h>
+
+#include <cstring>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <stdexcept>
+
+#include <boost/filesystem/path.hpp>
+
+namespace generate {
+
+struct Entry {
+    std::string name;
+    std::string content;
+
+    Entry(std::string name = std::string()
+          , std::string content = std::string())
+        : name(std::move(name)), content(std::move(content))
+    {}
+};
+
+namespace detail {
+
+inline void octal(char *dst, std::size_t size, std::uint64_t value)
+{
+    // zero padded, NUL terminated
+    dst[size - 1] = '\0';
+    for (std::size_t i(size - 1); i--; ) {
+        dst[i] = char('0' + (value & 7));
+        value >>= 3;
+    }
+}
+
+struct LE {
+    std::string data;
+
+    LE& u16(std::uint16_t v) {
+        data.push_back(char(v & 0xff)); data.push_back(char(v >> 8));
+        return *this;
+    }
+
+    LE& u32(std::uint32_t v) {
+        u16(std::uint16_t(v & 0xffff)); return u16(std::uint16_t(v >> 16));
+    }
+
+    LE& u64(std::uint64_t v) {
+        u32(std::uint32_t(v & 0xffffffff));
+        return u32(std::uint32_t(v >> 32));
+    }
+
+    LE& str(const std::string &s) { data += s; return *this; }
+};
+
+inline std::string deflate(const std::string &data)
+{
+    z_stream zs;
+    std::memset(&zs, 0, sizeof(zs));
+    if (::deflateInit2(&zs, Z_BEST_SPEED, Z_DEFLATED, -MAX_WBITS, 8
+                       , Z_DEFAULT_STRATEGY) != Z_OK)
+    {
+        throw std::runtime_error("deflateInit2 failed");
+    }
+
+    std::string out(::deflateBound(&zs, data.size()), '\0');
+    zs.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data.data()));
+    zs.avail_in = uInt(data.size());
+    zs.next_out = reinterpret_cast<Bytef*>(&out[0]);
+    zs.avail_out = uInt(out.size());
+    const auto res(::deflate(&zs, Z_FINISH));
+    out.resize(zs.total_out);
+    ::deflateEnd(&zs);
+
+    if (res != Z_STREAM_END) {
+        throw std::runtime_error("deflate failed");
+    }
+    return out;
+}
+
+} // namespace detail
+
+/** Writes ustar tarball with count entries produced by generator(index).
+ *  Names longer than 100 characters are stored in GNU long name entries.
+ */
+template <typename Generator>
+void tar(const boost::filesystem::path &path, std::size_t count
+         , Generator generator)
+{
+    std::ofstream f(path.string(), std::ios::binary | std::ios::trunc);
+    f.exceptions(std::ios::badbit | std::ios::failbit);
+    char header[512];
+
+    const auto write([&](const std::string &name, const std::string &content
+                         , char type)
+    {
+        std::memset(header, 0, sizeof(header));
+        std::memcpy(header, name.data()
+                    , std::min<std::size_t>(name.size(), 100));
+        detail::octal(header + 100, 8, 0644);
+        detail::octal(header + 108, 8, 0);
+        detail::octal(header + 116, 8, 0);
+        detail::octal(header + 124, 12, content.size());
+        detail::octal(header + 136, 12, 0);
+        header[156] = type;
+        std::memcpy(header + 257, "ustar", 6);
+        std::memcpy(header + 263, "00", 2);
+
+        std::memset(header + 148, ' ', 8);
+        unsigned int sum(0);
+        for (const auto c : header) { sum += static_cast<unsigned char>(c); }
+        detail::octal(header + 148, 7, sum);
+
+        f.write(header, sizeof(header));
+
+        // content padded to block size
+        f.write(content.data(), content.size());
+        const auto pad((512 - content.size() % 512) % 512);
+        std::memset(header, 0, sizeof(header));
+        f.write(header, pad);
+    });
+
+    for (std::size_t i(0); i < count; ++i) {
+        const Entry entry(generator(i));
+        if (entry.name.size() > 100) {
+            write("././@LongLink", entry.name + '\0', 'L');
+        }
+        write(entry.name, entry.content, '0');
+    }
+
+    // end of archive
+    std::memset(header, 0, sizeof(header));
+    f.write(header, sizeof(header));
+    f.write(header, sizeof(header));
+}
+
+/** Writes zip archive with count entries produced by generator(index).
+ *  Entries are stored or deflated. Zip64 end of central directory is used
+ *  when there are too many entries.
+ */
+template <typename Generator>
+void zip(const boost::filesystem::path &path, std::size_t count
+         , Generator generator, bool deflate = false)
+{
+    std::ofstream f(path.string(), std::ios::binary | std::ios::trunc);
+    f.exceptions(std::ios::badbit | std::ios::failbit);
+
+    struct Record {
+        std::uint32_t crc;
+        std::uint32_t size;
+        std::uint32_t usize;
+        std::uint64_t offset;
+    };
+    std::vector<Record> records;
+    records.reserve(count);
+
+    const std::uint16_t method(deflate ? 8 : 0);
+    std::uint64_t offset(0);
+
+    for (std::size_t i(0); i < count; ++i) {
+        const Entry entry(generator(i));
+        const auto crc(::crc32(0, reinterpret_cast<const Bytef*>
+                               (entry.content.data())
+                               , uInt(entry.content.size())));
+        const auto data(deflate ? detail::deflate(entry.content)
+                        : entry.content);
+
+        records.push_back({ std::uint32_t(crc), std::uint32_t(data.size())
+                    , std::uint32_t(entry.content.size()), offset });
+
+        detail::LE h;
+        h.u32(0x04034b50).u16(20).u16(0).u16(method).u16(0).u16(0)
+            .u32(records.back().crc).u32(records.back().size)
+            .u32(records.back().usize)
+            .u16(std::uint16_t(entry.name.size())).u16(0)
+            .str(entry.name);
+        f.write(h.data.data(), h.data.size());
+        f.write(data.data(), data.size());
+
+        offset += h.data.size() + data.size();
+    }
+
+    // central directory, names are generated again to save memory
+    const auto cdOffset(offset);
+    for (std::size_t i(0); i < count; ++i) {
+        const auto name(generator(i).name);
+        const auto &r(records[i]);
+
+        detail::LE h;
+        h.u32(0x02014b50).u16(20).u16(20).u16(0).u16(method).u16(0).u16(0)
+            .u32(r.crc).u32(r.size).u32(r.usize)
+            .u16(std::uint16_t(name.size())).u16(0).u16(0).u16(0).u16(0)
+            .u32(0).u32(std::uint32_t(r.offset))
+            .str(name);
+        f.write(h.data.data(), h.data.size());
+        offset += h.data.size();
+    }
+    const auto cdSize(offset - cdOffset);
+
+    detail::LE e;
+    if (count >= 0xffff) {
+        // zip64 end of central directory record + locator
+        e.u32(0x06064b50).u64(44).u16(45).u16(45).u32(0).u32(0)
+            .u64(count).u64(count).u64(cdSize).u64(cdOffset);
+        e.u32(0x07064b50).u32(0).u64(offset).u32(1);
+    }
+    e.u32(0x06054b50).u16(0).u16(0)
+        .u16(std::uint16_t(std::min<std::size_t>(count, 0xffff)))
+        .u16(std::uint16_t(std::min<std::size_t>(count, 0xffff)))
+        .u32(std::uint32_t(std::min<std::uint64_t>(cdSize, 0xffffffff)))
+        .u32(std::uint32_t(std::min<std::uint64_t>(cdOffset, 0xffffffff)))
+        .u16(0);
+    f.write(e.data.data(), e.data.size());
+}
+
+} // namespace generate
+
+#endif // roarchive_test_roarchive_generate_hpp_included_
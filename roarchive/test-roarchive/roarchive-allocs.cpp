@@ -0,0 +1,212 @@
+/**
+ * Copyright (c) 2017 Melown Technologies SE
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * *  Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * *  Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+/** Allocation budget test.
+ *
+ * Counts heap allocations done by hot-path operations (istream() + read()
+ * of a 4 KiB entry) through interposed global operator new and fails when
+ * any operation exceeds its budget. Measured numbers are always printed so
+ * that budgets can be tightened after optimizations.
+ *
+ * usage: roarchive-allocs WORKDIR
+ */
+
+#include <cstdlib>
+#include <new>
+#include <atomic>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <boost/filesystem.hpp>
+
+#include "dbglog/dbglog.hpp"
+#include "roarchive/roarchive.hpp"
+
+#include "generate.hpp"
+
+namespace fs = boost::filesystem;
+
+namespace {
+
+std::atomic<bool> counting(false);
+std::atomic<std::size_t> allocations(0);
+std::atomic<std::size_t> allocated(0);
+
+void* allocate(std::size_t size)
+{
+    if (counting.load(std::memory_order_relaxed)) {
+        allocations.fetch_add(1, std::memory_order_relaxed);
+        allocated.fetch_add(size, std::memory_order_relaxed);
+    }
+    return std::malloc(size ? size : 1);
+}
+
+} // namespace
+
+void* operator new(std::size_t size)
+{
+    if (auto *p = allocate(size)) { return p; }
+    throw std::bad_alloc();
+}
+
+void* operator new[](std::size_t size)
+{
+    if (auto *p = allocate(size)) { return p; }
+    throw std::bad_alloc();
+}
+
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept
+{
+    return allocate(size);
+}
+
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept
+{
+    return allocate(size);
+}
+
+void operator delete(void *p) noexcept { std::free(p); }
+void operator delete[](void *p) noexcept { std::free(p); }
+void operator delete(void *p, const std::nothrow_t&) noexcept
+{
+    std::free(p);
+}
+void operator delete[](void *p, const std::nothrow_t&) noexcept
+{
+    std::free(p);
+}
+#ifdef __cpp_sized_deallocation
+void operator delete(void *p, std::size_t) noexcept { std::free(p); }
+void operator delete[](void *p, std::size_t) noexcept { std::free(p); }
+#endif
+
+namespace {
+
+struct Case {
+    const char *name;
+    fs::path archive;
+    std::string mime;
+    fs::path entry;
+
+    /** Maximum allowed allocations per istream() + read().
+     */
+    std::size_t budget;
+};
+
+const std::size_t iterations(100);
+
+bool run(const Case &c)
+{
+    roarchive::RoArchive archive
+        (c.archive, roarchive::OpenOptions().setMime(c.mime));
+
+    // warm up: lazy initialization is not part of the budget
+    archive.istream(c.entry)->read();
+
+    allocations = 0;
+    allocated = 0;
+    counting = true;
+    std::size_t size(0);
+    for (std::size_t i(0); i < iterations; ++i) {
+        size += archive.istream(c.entry)->read().size();
+    }
+    counting = false;
+
+    const auto perOp((allocations + iterations - 1) / iterations);
+    const bool ok(perOp <= c.budget);
+
+    std::cout << std::setw(30) << std::left << c.name << std::right
+              << std::setw(8) << perOp << " allocs/op"
+              << std::setw(10) << (allocated / iterations) << " bytes/op"
+              << "  (budget " << c.budget << ")"
+              << (ok ? "" : "  OVER BUDGET") << std::endl;
+
+    if (size != iterations * 4096) {
+        LOG(fatal) << c.name << ": read " << size << " bytes instead of "
+                   << (iterations * 4096) << ".";
+        return false;
+    }
+
+    return ok;
+}
+
+generate::Entry entry(std::size_t i)
+{
+    return { "data/entry-" + std::to_string(i)
+            , std::string(4096, char('a' + i % 26)) };
+}
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    if (argc < 2) {
+        LOG(fatal) << "Missing parameters.";
+        return EXIT_FAILURE;
+    }
+
+    const fs::path workdir(argv[1]);
+    fs::create_directories(workdir);
+
+    const auto tar(workdir / "allocs.tar");
+    generate::tar(tar, 16, entry);
+
+    const auto zipStored(workdir / "allocs-stored.zip");
+    generate::zip(zipStored, 16, entry);
+
+    const auto zipDeflated(workdir / "allocs-deflated.zip");
+    generate::zip(zipDeflated, 16, entry, true);
+
+    const auto dir(workdir / "allocs-dir");
+    fs::create_directories(dir / "data");
+    {
+        const auto e(entry(7));
+        std::ofstream f((dir / e.name).string(), std::ios::binary);
+        f.write(e.content.data(), e.content.size());
+    }
+
+    const std::vector<Case> cases = {
+        { "tar open+read 4KiB", tar, "application/x-tar"
+          , "data/entry-7", 16 }
+        , { "zip stored open+read 4KiB", zipStored, "application/zip"
+            , "data/entry-7", 20 }
+        , { "zip deflated open+read 4KiB", zipDeflated, "application/zip"
+            , "data/entry-7", 32 }
+        , { "directory open+read 4KiB", dir, "inode/directory"
+            , "data/entry-7", 16 }
+    };
+
+    bool ok(true);
+    for (const auto &c : cases) { ok = run(c) && ok; }
+
+    fs::remove(tar);
+    fs::remove(zipStored);
+    fs::remove(zipDeflated);
+    fs::remove_all(dir);
+
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,301 @@
+/**
+ * Copyright (c) 2017 Melown Technologies SE
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * *  Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * *  Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+/** Block cache test.
+ *
+ * Reads in-memory resources through a small BlockCache and checks the
+ * bytes, hit/miss/eviction accounting, short last block, separation of
+ * resources, invalidation, failed fetches and concurrent readers.
+ *
+ * usage: roarchive-blockcache WORKDIR
+ */
+
+#include <cstdlib>
+#include <atomic>
+#include <random>
+#include <thread>
+#include <string>
+#include <vector>
+#include <stdexcept>
+
+#include <boost/filesystem.hpp>
+
+#include "dbglog/dbglog.hpp"
+#include "roarchive/blockcache.hpp"
+
+namespace fs = boost::filesystem;
+
+namespace {
+
+const std::size_t BlockSize(4096);
+const std::size_t Blocks(4);
+
+/** Remote resource: 10 whole blocks and a short one.
+ */
+struct Remote {
+    std::string data;
+    std::atomic<std::size_t> fetches;
+
+    Remote(char seed) : data(10 * BlockSize + 123, '\0'), fetches() {
+        for (std::size_t i(0); i < data.size(); ++i) {
+            data[i] = char(seed + (i * 7 + i / 251) % 61);
+        }
+    }
+
+    roarchive::BlockCache::Fetch fetch() {
+        return [this](std::uint64_t offset, char *buf, std::size_t size)
+            -> std::size_t
+        {
+            ++fetches;
+            if (offset >= data.size()) { return 0; }
+            const auto n(std::min<std::size_t>(size, data.size() - offset));
+            std::copy(data.begin() + offset, data.begin() + offset + n, buf);
+            return n;
+        };
+    }
+};
+
+bool read(roarchive::BlockCache &cache, const std::string &resource
+          , Remote &remote, std::uint64_t offset, std::size_t size)
+{
+    std::string buf(size, '\0');
+    const auto got(cache.read(resource, offset, &buf[0], size
+                              , remote.fetch()));
+
+    const auto expected((offset >= remote.data.size())
+                        ? std::string()
+                        : remote.data.substr(offset, size));
+    if ((got != expected.size()) || (buf.substr(0, got) != expected)) {
+        LOG(fatal) << "Wrong data read from " << resource << " at "
+                   << offset << " (" << size << " bytes, got " << got
+                   << ").";
+        return false;
+    }
+    return true;
+}
+
+roarchive::BlockCache::Config config(const fs::path &workdir)
+{
+    return roarchive::BlockCache::Config()
+        .setFile(workdir / "blockcache").setBlockSize(BlockSize)
+        .setBudget(Blocks * BlockSize);
+}
+
+bool sequential(const fs::path &workdir)
+{
+    LOG(info3) << "Sequential read.";
+
+    roarchive::BlockCache cache(config(workdir));
+    Remote remote('a');
+
+    // unaligned chunks, every block is fetched exactly once
+    for (std::size_t offset(0); offset < remote.data.size(); offset += 1000)
+    {
+        if (!read(cache, "r", remote, offset, 1000)) { return false; }
+    }
+
+    auto stats(cache.stats());
+    if ((remote.fetches != 11) || (stats.misses != 11)
+        || (stats.blocks != Blocks) || (stats.evictions != 11 - Blocks))
+    {
+        LOG(fatal) << "Unexpected stats: fetches " << remote.fetches
+                   << ", misses " << stats.misses << ", blocks "
+                   << stats.blocks << ", evictions " << stats.evictions
+                   << ".";
+        return false;
+    }
+
+    // last (short) block is cached with its valid length only
+    if (stats.bytes != (Blocks - 1) * BlockSize + 123) {
+        LOG(fatal) << "Wrong cached byte count " << stats.bytes << ".";
+        return false;
+    }
+
+    // short read at the end, nothing past it; no fetches needed
+    remote.fetches = 0;
+    if (!read(cache, "r", remote, remote.data.size() - 100, 500)
+        || !read(cache, "r", remote, remote.data.size() + 10, 500)
+        || !read(cache, "r", remote, 8 * BlockSize + 10, 2 * BlockSize))
+    {
+        return false;
+    }
+    if (remote.fetches) {
+        LOG(fatal) << "Cached blocks fetched again.";
+        return false;
+    }
+
+    // evicted block is fetched again
+    if (!read(cache, "r", remote, 0, 10)) { return false; }
+    if (remote.fetches != 1) {
+        LOG(fatal) << "Evicted block not fetched.";
+        return false;
+    }
+
+    return true;
+}
+
+bool resources(const fs::path &workdir)
+{
+    LOG(info3) << "Resources and invalidation.";
+
+    roarchive::BlockCache cache(config(workdir));
+    Remote a('a'), b('A');
+
+    // same offsets of different resources do not mix
+    if (!read(cache, "a", a, 0, 100) || !read(cache, "b", b, 0, 100)
+        || !read(cache, "a", a, 50, 100) || !read(cache, "b", b, 50, 100))
+    {
+        return false;
+    }
+    if ((a.fetches != 1) || (b.fetches != 1)) {
+        LOG(fatal) << "Resources share cached blocks.";
+        return false;
+    }
+
+    // changed resource is served stale until invalidated
+    Remote changed('0');
+    std::string buf(100, '\0');
+    cache.read("a", 0, &buf[0], buf.size(), changed.fetch());
+    if (buf != a.data.substr(0, 100)) {
+        LOG(fatal) << "Cached block not used.";
+        return false;
+    }
+
+    cache.invalidate("a");
+    if (!read(cache, "a", changed, 0, 100)) { return false; }
+    if (changed.fetches != 1) {
+        LOG(fatal) << "Invalidated block not fetched.";
+        return false;
+    }
+
+    // other resource untouched
+    if (!read(cache, "b", b, 0, 100) || (b.fetches != 1)) {
+        LOG(fatal) << "Invalidation dropped other resource.";
+        return false;
+    }
+
+    return true;
+}
+
+bool failures(const fs::path &workdir)
+{
+    LOG(info3) << "Failed fetch.";
+
+    roarchive::BlockCache cache(config(workdir));
+    Remote remote('a');
+
+    // every slot is released after a failure
+    for (std::size_t i(0); i < 2 * Blocks; ++i) {
+        char buf[10];
+        try {
+            cache.read("r", i * BlockSize, buf, sizeof(buf)
+                       , [](std::uint64_t, char*, std::size_t)
+                       -> std::size_t
+                       {
+                           throw std::runtime_error("fetch failed");
+                       });
+            LOG(fatal) << "Fetch failure not reported.";
+            return false;
+        } catch (const std::runtime_error&) {}
+    }
+
+    if (cache.stats().blocks) {
+        LOG(fatal) << "Failed fetch cached.";
+        return false;
+    }
+
+    for (std::size_t i(0); i < Blocks; ++i) {
+        if (!read(cache, "r", remote, i * BlockSize, 10)) { return false; }
+    }
+
+    const auto stats(cache.stats());
+    if ((stats.blocks != Blocks) || stats.bypasses) {
+        LOG(fatal) << "Slots leaked by failed fetches: blocks "
+                   << stats.blocks << ", bypasses " << stats.bypasses
+                   << ".";
+        return false;
+    }
+    return true;
+}
+
+bool concurrent(const fs::path &workdir)
+{
+    LOG(info3) << "Concurrent readers.";
+
+    roarchive::BlockCache cache(config(workdir));
+    Remote remote('a');
+
+    std::atomic<bool> ok(true);
+    std::vector<std::thread> threads;
+    for (unsigned int t(0); t < 8; ++t) {
+        threads.emplace_back([&, t]() {
+                std::mt19937 rng(t);
+                std::uniform_int_distribution<std::size_t>
+                    offset(0, remote.data.size());
+                std::uniform_int_distribution<std::size_t>
+                    size(1, 3 * BlockSize);
+                for (int i(0); ok && (i < 2000); ++i) {
+                    if (!read(cache, "r", remote, offset(rng), size(rng))) {
+                        ok = false;
+                    }
+                }
+            });
+    }
+    for (auto &thread : threads) { thread.join(); }
+
+    const auto stats(cache.stats());
+    if (stats.blocks > Blocks) {
+        LOG(fatal) << "Budget exceeded: " << stats.blocks << " blocks.";
+        return false;
+    }
+    return ok;
+}
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    if (argc < 2) {
+        LOG(fatal) << "Missing parameters.";
+        return EXIT_FAILURE;
+    }
+
+    const fs::path workdir(argv[1]);
+    fs::create_directories(workdir);
+
+    bool ok(true);
+    ok = sequential(workdir) && ok;
+    ok = resources(workdir) && ok;
+    ok = failures(workdir) && ok;
+    ok = concurrent(workdir) && ok;
+
+    // cache file is removed with the cache
+    if (fs::exists(workdir / "blockcache")) {
+        LOG(fatal) << "Block cache file left behind.";
+        ok = false;
+    }
+
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
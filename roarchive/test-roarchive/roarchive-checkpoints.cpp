@@ -0,0 +1,177 @@
+/**
+ * Copyright (c) 2017 Melown Technologies SE
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * *  Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * *  Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+/** Deflate checkpoint seek test.
+ *
+ * Generates zip archive with a big deflated entry, opens it with decoder
+ * checkpoints and compares bytes read after forward, backward and random
+ * seeks with the original content. Checks that checkpoints survive closing
+ * the entry's last stream. Runs with default and mapped directory index
+ * and with a budget too small to keep any checkpoint.
+ *
+ * usage: roarchive-checkpoints WORKDIR
+ */
+
+#include <cstdlib>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <random>
+
+#include <boost/filesystem.hpp>
+
+#include "dbglog/dbglog.hpp"
+#include "roarchive/roarchive.hpp"
+
+#include "generate.hpp"
+
+namespace fs = boost::filesystem;
+
+namespace {
+
+const std::size_t EntrySize(8 << 20);
+const std::size_t Interval(256 << 10);
+
+/** Compressible but not trivial content.
+ */
+std::string content()
+{
+    std::string data(EntrySize, '\0');
+    std::uint32_t x(12345);
+    for (auto &c : data) {
+        x = x * 1103515245 + 12345;
+        c = char('a' + ((x >> 16) % 16));
+    }
+    return data;
+}
+
+std::size_t checkpoints(const roarchive::RoArchive &archive)
+{
+    for (const auto &component : archive.memoryUsage().components) {
+        if (component.first == "checkpoints") { return component.second; }
+    }
+    return 0;
+}
+
+bool compare(roarchive::IStream &is, const std::string &data
+             , std::uint64_t position, std::size_t size)
+{
+    auto &s(is.get());
+    s.seekg(position);
+    std::vector<char> buf(std::min<std::uint64_t>(size
+                                                  , data.size() - position));
+    s.read(buf.data(), buf.size());
+    if (std::string(buf.begin(), buf.end())
+        != data.substr(position, buf.size()))
+    {
+        LOG(fatal) << "Wrong data at position " << position << ".";
+        return false;
+    }
+    return true;
+}
+
+bool run(const fs::path &zip, const std::string &data, bool mapped
+         , std::size_t budget)
+{
+    LOG(info3) << "Checkpoints, mapped: " << mapped
+               << ", budget: " << budget << ".";
+
+    roarchive::RoArchive archive
+        (zip, roarchive::OpenOptions().setMime("application/zip")
+         .setMapZipDirectory(mapped)
+         .setZipCheckpointInterval(Interval)
+         .setZipCheckpointBudget(budget));
+
+    {
+        auto is(archive.istream("big.bin"));
+        if (!is->seekable()) {
+            LOG(fatal) << "Checkpointed deflate entry is not seekable.";
+            return false;
+        }
+
+        // first pass records checkpoints
+        if (!compare(*is, data, 0, data.size())) { return false; }
+
+        // backward and forward jumps
+        for (const std::uint64_t position
+                 : { std::uint64_t(5 << 20), std::uint64_t(100)
+                     , std::uint64_t(Interval - 1), std::uint64_t(Interval)
+                     , std::uint64_t(7 << 20) + 12345
+                     , std::uint64_t(3 << 20) + 1 })
+        {
+            if (!compare(*is, data, position, 4096)) { return false; }
+        }
+    }
+
+    const auto recorded(checkpoints(archive));
+
+    // reopen: checkpoints are kept
+    std::mt19937 rng(42);
+    std::uniform_int_distribution<std::uint64_t> where(0, data.size() - 1);
+    {
+        auto is(archive.istream("big.bin"));
+        for (int i(0); i < 64; ++i) {
+            if (!compare(*is, data, where(rng), 1000)) { return false; }
+        }
+    }
+
+    if ((budget > EntrySize) && (recorded < (EntrySize / Interval) * 32768))
+    {
+        LOG(fatal) << "Checkpoints were not kept (" << recorded
+                   << " bytes).";
+        return false;
+    }
+
+    return true;
+}
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    if (argc < 2) {
+        LOG(fatal) << "Missing parameters.";
+        return EXIT_FAILURE;
+    }
+
+    const fs::path workdir(argv[1]);
+    fs::create_directories(workdir);
+    const auto zip(workdir / "checkpoints.zip");
+
+    const auto data(content());
+    generate::zip(zip, 1, [&](std::size_t)
+                  {
+                      return generate::Entry("big.bin", data);
+                  }, true);
+
+    bool ok(true);
+    for (const auto mapped : { false, true }) {
+        ok = run(zip, data, mapped, 64 << 20) && ok;
+    }
+    ok = run(zip, data, false, 1) && ok;
+
+    fs::remove(zip);
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
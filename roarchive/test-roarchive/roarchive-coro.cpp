@@ -0,0 +1,274 @@
+/**
+ * Copyright (c) 2017 Melown Technologies SE
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * *  Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * *  Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+/** Coroutine interface test (C++20).
+ *
+ * Awaits read(), readRange(), stat() and exists() of coro::Archive over
+ * tarball and zip archives through a thread pool executor, many coroutines
+ * at once. Checks the data, resumption on executor threads and that
+ * failures are rethrown from co_await and out of the coroutine.
+ *
+ * usage: roarchive-coro WORKDIR
+ */
+
+#include "roarchive/coro.hpp"
+
+#ifndef ROARCHIVE_HAS_COROUTINES
+#  error "roarchive-coro must be compiled with coroutine support (C++20)."
+#endif
+
+#include <cstdlib>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <future>
+#include <string>
+#include <vector>
+#include <stdexcept>
+
+#include <boost/filesystem.hpp>
+
+#include "dbglog/dbglog.hpp"
+#include "roarchive/roarchive.hpp"
+
+#include "generate.hpp"
+
+namespace fs = boost::filesystem;
+namespace coro = roarchive::coro;
+
+namespace {
+
+const std::size_t Count(32);
+
+/** Fire and forget coroutine; completion (or failure) is reported through
+ *  a future.
+ */
+struct Task {
+    struct promise_type {
+        std::promise<void> done;
+
+        Task get_return_object() { return { done.get_future() }; }
+        std::suspend_never initial_suspend() noexcept { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void() { done.set_value(); }
+        void unhandled_exception() {
+            done.set_exception(std::current_exception());
+        }
+    };
+
+    std::future<void> done;
+};
+
+class Pool {
+public:
+    Pool(unsigned int threads) : stop_(false) {
+        for (unsigned int i(0); i < threads; ++i) {
+            threads_.emplace_back([this]() { run(); });
+        }
+    }
+
+    ~Pool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stop_ = true;
+        }
+        cv_.notify_all();
+        for (auto &thread : threads_) { thread.join(); }
+    }
+
+    coro::Executor executor() {
+        return [this](std::function<void()> job) {
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                jobs_.push_back(std::move(job));
+            }
+            cv_.notify_one();
+        };
+    }
+
+private:
+    void run() {
+        for (;;) {
+            std::function<void()> job;
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                cv_.wait(lock, [this]() { return stop_ || !jobs_.empty(); });
+                if (jobs_.empty()) { return; }
+                job = std::move(jobs_.front());
+                jobs_.pop_front();
+            }
+            job();
+        }
+    }
+
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    std::deque<std::function<void()>> jobs_;
+    bool stop_;
+    std::vector<std::thread> threads_;
+};
+
+generate::Entry entry(std::size_t i)
+{
+    std::string content(1000 + 311 * i, '\0');
+    for (std::size_t j(0); j < content.size(); ++j) {
+        content[j] = char('a' + (i + j) % 26);
+    }
+    return { "data/entry-" + std::to_string(i), content };
+}
+
+std::string str(const std::vector<char> &data)
+{
+    return { data.begin(), data.end() };
+}
+
+void check(bool condition, const std::string &what)
+{
+    if (!condition) { throw std::runtime_error(what); }
+}
+
+/** Exercises all operations on one entry; throws on mismatch.
+ */
+Task file(const coro::Archive &archive, std::size_t i, bool rawSize
+          , std::thread::id main)
+{
+    const auto e(entry(i));
+
+    const auto data(co_await archive.read(e.name));
+    check(str(data) == e.content, e.name + ": wrong content");
+    check(std::this_thread::get_id() != main
+          , e.name + ": not resumed on executor");
+
+    const auto range(co_await archive.readRange(e.name, 100, 50));
+    check(str(range) == e.content.substr(100, 50)
+          , e.name + ": wrong range");
+
+    // ranges reaching past the end are short, not errors
+    const auto tail(co_await archive.readRange
+                    (e.name, e.content.size() - 10, 100));
+    check(str(tail) == e.content.substr(e.content.size() - 10)
+          , e.name + ": wrong tail");
+    const auto past(co_await archive.readRange
+                    (e.name, e.content.size() + 10, 100));
+    check(past.empty(), e.name + ": data past the end");
+
+    const auto stat(co_await archive.stat(e.name));
+    check(!rawSize || (stat.size && (*stat.size == e.content.size()))
+          , e.name + ": wrong stat size");
+
+    check(co_await archive.exists(e.name), e.name + ": does not exist");
+    check(!co_await archive.exists(e.name + ".missing")
+          , e.name + ": missing file exists");
+
+    // failures surface from co_await
+    bool thrown(false);
+    try {
+        co_await archive.read(e.name + ".missing");
+    } catch (const roarchive::NoSuchFile&) {
+        thrown = true;
+    }
+    check(thrown, e.name + ": read of missing file did not throw");
+
+    thrown = false;
+    try {
+        co_await archive.stat(e.name + ".missing");
+    } catch (const roarchive::NoSuchFile&) {
+        thrown = true;
+    }
+    check(thrown, e.name + ": stat of missing file did not throw");
+}
+
+/** Failure not caught inside the coroutine.
+ */
+Task failing(const coro::Archive &archive)
+{
+    co_await archive.read("no/such/file");
+}
+
+bool run(const roarchive::RoArchive &roarchive, Pool &pool, bool rawSize
+         , const std::string &what)
+{
+    LOG(info3) << what << ".";
+
+    const coro::Archive archive(roarchive, pool.executor());
+    const auto main(std::this_thread::get_id());
+
+    std::vector<Task> tasks;
+    for (std::size_t i(0); i < Count; ++i) {
+        tasks.push_back(file(archive, i, rawSize, main));
+    }
+
+    bool ok(true);
+    for (auto &task : tasks) {
+        try {
+            task.done.get();
+        } catch (const std::exception &e) {
+            LOG(fatal) << what << ": " << e.what() << ".";
+            ok = false;
+        }
+    }
+
+    try {
+        failing(archive).done.get();
+        LOG(fatal) << what << ": failure did not leave the coroutine.";
+        ok = false;
+    } catch (const roarchive::NoSuchFile&) {}
+
+    return ok;
+}
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    if (argc < 2) {
+        LOG(fatal) << "Missing parameters.";
+        return EXIT_FAILURE;
+    }
+
+    const fs::path workdir(argv[1]);
+    fs::create_directories(workdir);
+    const auto tar(workdir / "coro.tar");
+    const auto zip(workdir / "coro.zip");
+    generate::tar(tar, Count, entry);
+    generate::zip(zip, Count, entry, true);
+
+    bool ok(true);
+    {
+        Pool pool(4);
+        ok = run(roarchive::RoArchive
+                 (tar, roarchive::OpenOptions().setMime("application/x-tar"))
+                 , pool, true, "Tarball") && ok;
+        ok = run(roarchive::RoArchive
+                 (zip, roarchive::OpenOptions().setMime("application/zip"))
+                 , pool, false, "Deflated zip") && ok;
+    }
+
+    fs::remove(tar);
+    fs::remove(zip);
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
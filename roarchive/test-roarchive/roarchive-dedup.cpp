@@ -0,0 +1,174 @@
+/**
+ * Copyright (c) 2017 Melown Technologies SE
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * *  Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * *  Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+/** Content cache deduplication test.
+ *
+ * Puts entries with equal payloads under different keys into a
+ * MemoryContentCache and checks that the payload is shared and charged
+ * once, that replacing, evicting and clearing entries keeps the charged
+ * bytes exact, and that shared payloads stay valid while in use.
+ *
+ * usage: roarchive-dedup
+ */
+
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include "dbglog/dbglog.hpp"
+#include "roarchive/cache.hpp"
+
+namespace {
+
+typedef roarchive::ContentCache ContentCache;
+
+ContentCache::Key key(const std::string &name)
+{
+    return { "archive", name, "" };
+}
+
+ContentCache::Content::pointer content(std::size_t size, char fill)
+{
+    return ContentCache::Content::make
+        (std::vector<char>(size, fill), "path", "index", 0);
+}
+
+bool expect(bool condition, const std::string &what)
+{
+    if (!condition) { LOG(fatal) << what; }
+    return condition;
+}
+
+bool bytes(const roarchive::MemoryContentCache &cache, std::size_t expected
+           , const std::string &when)
+{
+    const auto stats(cache.stats());
+    return expect(stats.bytes == expected
+                  , "Charged " + std::to_string(stats.bytes)
+                  + " bytes instead of " + std::to_string(expected)
+                  + " " + when + ".");
+}
+
+bool same(const ContentCache::Content::pointer &c, std::size_t size
+          , char fill)
+{
+    return (c && (c->size == size)
+            && (std::string(c->data, c->size) == std::string(size, fill)));
+}
+
+} // namespace
+
+int main(int, char *[])
+{
+    roarchive::MemoryContentCache cache(64 << 20, 4);
+
+    // per entry bookkeeping charge
+    cache.put(key("empty"), content(0, 'x'));
+    const auto overhead(cache.stats().bytes);
+    cache.clear();
+
+    bool ok(bytes(cache, 0, "after clear"));
+
+    LOG(info3) << "Shared payload.";
+    cache.put(key("a"), content(10000, 'a'));
+    ok = bytes(cache, 10000 + overhead, "for single entry") && ok;
+
+    cache.put(key("b"), content(10000, 'a'));
+    ok = bytes(cache, 10000 + 2 * overhead, "for duplicate entry") && ok;
+    ok = expect(cache.stats().deduplicated == 1
+                , "Duplicate not detected.") && ok;
+
+    {
+        const auto a(cache.get(key("a"))), b(cache.get(key("b")));
+        ok = expect(same(a, 10000, 'a') && same(b, 10000, 'a')
+                    && (a->data == b->data), "Payload not shared.") && ok;
+    }
+
+    // same size, different payload
+    cache.put(key("c"), content(10000, 'c'));
+    ok = bytes(cache, 2 * 10000 + 3 * overhead, "for distinct entry") && ok;
+    ok = expect(cache.stats().deduplicated == 1
+                , "Distinct payload deduplicated.") && ok;
+
+    LOG(info3) << "Replacement.";
+    {
+        // payload owner replaced while in use: other entry and user keep it
+        const auto held(cache.get(key("a")));
+        cache.put(key("a"), content(10000, 'c'));
+        ok = bytes(cache, 2 * 10000 + 3 * overhead
+                   , "after replacing owner by duplicate") && ok;
+        ok = expect(same(cache.get(key("a")), 10000, 'c')
+                    && same(cache.get(key("b")), 10000, 'a')
+                    && same(held, 10000, 'a')
+                    , "Wrong content after replacement.") && ok;
+    }
+
+    // last reference dropped: payload uncharged
+    cache.put(key("b"), content(5000, 'b'));
+    ok = bytes(cache, 10000 + 5000 + 3 * overhead
+               , "after replacing last reference") && ok;
+
+    LOG(info3) << "Eviction.";
+    {
+        const auto held(cache.get(key("c")));
+        cache.scale(0);
+        ok = bytes(cache, 0, "after eviction") && ok;
+        ok = expect(!cache.stats().entries, "Entries left after eviction.")
+            && ok;
+        ok = expect(same(held, 10000, 'c'), "Held payload damaged.") && ok;
+        cache.scale(1);
+    }
+
+    // evicted payload is charged again when it comes back
+    cache.put(key("a"), content(10000, 'a'));
+    cache.put(key("b"), content(10000, 'a'));
+    ok = bytes(cache, 10000 + 2 * overhead, "after refill") && ok;
+
+    LOG(info3) << "Budget.";
+    {
+        // many duplicates fit where distinct payloads would not
+        roarchive::MemoryContentCache small(1 << 20, 1, 64 << 10);
+        for (int i(0); i < 100; ++i) {
+            small.put(key("dup-" + std::to_string(i)), content(60000, 'd'));
+        }
+        const auto stats(small.stats());
+        ok = expect(!stats.evictions && (stats.entries == 100)
+                    && (stats.deduplicated == 99)
+                    && (stats.bytes == 60000 + 100 * overhead)
+                    , "Duplicates charged separately.") && ok;
+
+        for (int i(0); i < 100; ++i) {
+            small.put(key("dup-" + std::to_string(i)), content(60000, char(i)));
+        }
+        ok = expect(small.stats().evictions
+                    && (small.stats().bytes <= (1 << 20))
+                    , "Distinct payloads over budget.") && ok;
+    }
+
+    cache.clear();
+    ok = bytes(cache, 0, "after final clear") && ok;
+
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
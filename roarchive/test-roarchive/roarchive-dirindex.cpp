@@ -0,0 +1,248 @@
+/**
+ * Copyright (c) 2017 Melown Technologies SE
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * *  Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * *  Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+/** Live directory index test.
+ *
+ * Mutates a watched tree (files and directories added, removed, moved in,
+ * out and within) and checks that the inotify maintained index converges
+ * to the filesystem. Event queue overflow is provoked by pausing the
+ * watcher thread while more files than the queue holds are created; the
+ * index must rescan and converge again.
+ *
+ * usage: roarchive-dirindex WORKDIR
+ */
+
+#include <unistd.h>
+#include <signal.h>
+#include <dirent.h>
+#include <semaphore.h>
+#include <sys/syscall.h>
+
+#include <cstdlib>
+#include <chrono>
+#include <thread>
+#include <fstream>
+#include <set>
+#include <string>
+
+#include <boost/filesystem.hpp>
+
+#include "dbglog/dbglog.hpp"
+#include "roarchive/dirindex.hpp"
+
+namespace fs = boost::filesystem;
+
+namespace {
+
+typedef std::set<std::string> Entries;
+
+void touch(const fs::path &path)
+{
+    std::ofstream f(path.string());
+    f.exceptions(std::ios::badbit | std::ios::failbit);
+    f << path.filename().string();
+}
+
+/** Filesystem truth: all entries under root, symlinks not followed.
+ */
+Entries walk(const fs::path &root)
+{
+    Entries entries;
+    const auto prefix(root.generic_string().size() + 1);
+    for (fs::recursive_directory_iterator i(root), e; i != e; ++i) {
+        entries.insert(i->path().generic_string().substr(prefix));
+    }
+    return entries;
+}
+
+Entries indexed(const roarchive::LiveDirectoryIndex &index)
+{
+    Entries entries;
+    for (const auto &path : index.list()) {
+        entries.insert(path.generic_string());
+    }
+    return entries;
+}
+
+/** Waits for the index to catch up with the filesystem.
+ */
+bool converges(const roarchive::LiveDirectoryIndex &index
+               , const fs::path &root, const std::string &what)
+{
+    const auto expected(walk(root));
+    const auto deadline(std::chrono::steady_clock::now()
+                        + std::chrono::seconds(10));
+    for (;;) {
+        const auto current(indexed(index));
+        if (current == expected) { return true; }
+        if (std::chrono::steady_clock::now() > deadline) {
+            LOG(fatal) << what << ": index has " << current.size()
+                       << " entries, filesystem " << expected.size() << ".";
+            return false;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+}
+
+bool expect(bool condition, const std::string &what)
+{
+    if (!condition) { LOG(fatal) << what; }
+    return condition;
+}
+
+/** Pauses all other threads of this process (i.e. the watcher) in a signal
+ *  handler until resumed.
+ */
+class Pause {
+public:
+    Pause() : paused_(0) {
+        ::sem_init(&resume_, 0, 0);
+        ::sem_init(&stopped_, 0, 0);
+        self_ = this;
+
+        struct ::sigaction sa = {};
+        sa.sa_handler = &Pause::handler;
+        ::sigaction(SIGUSR1, &sa, nullptr);
+
+        const auto pid(::getpid());
+        const auto me(::syscall(SYS_gettid));
+        auto *dir(::opendir("/proc/self/task"));
+        while (auto *d = ::readdir(dir)) {
+            const auto tid(std::atol(d->d_name));
+            if (!tid || (tid == me)) { continue; }
+            ::syscall(SYS_tgkill, pid, tid, SIGUSR1);
+            ++paused_;
+        }
+        ::closedir(dir);
+
+        for (int i(0); i < paused_; ++i) { ::sem_wait(&stopped_); }
+    }
+
+    ~Pause() {
+        for (int i(0); i < paused_; ++i) { ::sem_post(&resume_); }
+    }
+
+private:
+    static void handler(int) {
+        ::sem_post(&self_->stopped_);
+        while (::sem_wait(&self_->resume_) < 0) {}
+    }
+
+    static Pause *self_;
+    int paused_;
+    ::sem_t resume_;
+    ::sem_t stopped_;
+};
+
+Pause *Pause::self_(nullptr);
+
+std::size_t maxQueuedEvents()
+{
+    std::ifstream f("/proc/sys/fs/inotify/max_queued_events");
+    std::size_t value(16384);
+    f >> value;
+    return value;
+}
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    if (argc < 2) {
+        LOG(fatal) << "Missing parameters.";
+        return EXIT_FAILURE;
+    }
+
+    const fs::path workdir(argv[1]);
+    const auto root(workdir / "tree");
+    const auto outside(workdir / "outside");
+    fs::remove_all(root);
+    fs::remove_all(outside);
+    fs::create_directories(root / "a/b/c");
+    fs::create_directories(outside / "moved/x");
+    touch(root / "top");
+    touch(root / "a/b/c/deep");
+    touch(outside / "moved/x/file");
+    touch(outside / "single");
+
+    bool ok(true);
+    {
+        roarchive::LiveDirectoryIndex index(root);
+        ok = converges(index, root, "Initial scan") && ok;
+
+        LOG(info3) << "Additions.";
+        touch(root / "a/new");
+        fs::create_directories(root / "d/e");
+        touch(root / "d/e/inside");
+        ok = converges(index, root, "Additions") && ok;
+        ok = expect(index.exists("d/e/inside") && index.exists("./a//new")
+                    && !index.exists("a/missing")
+                    , "Wrong existence answers.") && ok;
+
+        LOG(info3) << "Moves.";
+        fs::rename(outside / "moved", root / "a/moved");
+        fs::rename(outside / "single", root / "single");
+        fs::rename(root / "a/b", root / "d/b");
+        fs::rename(root / "top", root / "d/top");
+        ok = converges(index, root, "Moves in and within") && ok;
+        ok = expect(index.exists("a/moved/x/file")
+                    && index.exists("d/b/c/deep") && !index.exists("a/b")
+                    , "Moved subtree not reindexed.") && ok;
+
+        // moved subtree is watched under its new name
+        touch(root / "d/b/c/later");
+        ok = converges(index, root, "Addition to moved subtree") && ok;
+
+        fs::rename(root / "d/b", outside / "b");
+        ok = converges(index, root, "Move out") && ok;
+
+        LOG(info3) << "Removals.";
+        fs::remove(root / "single");
+        fs::remove_all(root / "a");
+        ok = converges(index, root, "Removals") && ok;
+
+        LOG(info3) << "Overflow.";
+        fs::create_directories(root / "burst");
+        ok = converges(index, root, "Burst directory") && ok;
+        {
+            // queue overflows while the watcher sleeps
+            Pause pause;
+            for (std::size_t i(0), e(maxQueuedEvents() + 1000); i < e; ++i) {
+                touch(root / "burst" / ("f" + std::to_string(i)));
+            }
+        }
+        ok = converges(index, root, "Overflow") && ok;
+        ok = expect(index.rescans() >= 1, "Overflow did not rescan.") && ok;
+
+        // index keeps following changes after rescan
+        fs::remove_all(root / "burst");
+        touch(root / "after");
+        ok = converges(index, root, "After rescan") && ok;
+    }
+
+    fs::remove_all(root);
+    fs::remove_all(outside);
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
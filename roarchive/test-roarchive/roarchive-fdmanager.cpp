@@ -0,0 +1,218 @@
+/**
+ * Copyright (c) 2017 Melown Technologies SE
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * *  Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * *  Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+/** File descriptor budget test.
+ *
+ * Opens more files and archives than the FdManager budget allows and
+ * checks that descriptors are closed to fit the budget, that reopened
+ * descriptors read correct data, that a lease keeps its descriptor alive
+ * after the file is dropped and that a replaced file is not reopened.
+ *
+ * usage: roarchive-fdmanager WORKDIR
+ */
+
+#include <unistd.h>
+
+#include <cstdlib>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <memory>
+
+#include <boost/filesystem.hpp>
+
+#include "dbglog/dbglog.hpp"
+#include "roarchive/roarchive.hpp"
+#include "roarchive/fdmanager.hpp"
+
+#include "generate.hpp"
+
+namespace fs = boost::filesystem;
+
+namespace {
+
+const std::size_t Budget(4);
+const std::size_t Count(16);
+
+std::string content(std::size_t i)
+{
+    return std::string(5000 + i, char('a' + i % 26));
+}
+
+void write(const fs::path &path, const std::string &data)
+{
+    std::ofstream f(path.string(), std::ios::binary | std::ios::trunc);
+    f.exceptions(std::ios::badbit | std::ios::failbit);
+    f.write(data.data(), data.size());
+}
+
+bool readBack(int fd, const std::string &expected, const fs::path &path)
+{
+    std::string data(expected.size(), '\0');
+    const auto r(::pread(fd, &data[0], data.size(), 0));
+    if ((r != ssize_t(data.size())) || (data != expected)) {
+        LOG(fatal) << "Wrong data read from " << path << ".";
+        return false;
+    }
+    return true;
+}
+
+bool files(const fs::path &workdir)
+{
+    LOG(info3) << "Managed files.";
+
+    auto manager(std::make_shared<roarchive::FdManager>(Budget));
+
+    std::vector<fs::path> paths;
+    std::vector<roarchive::FdManager::File::pointer> files;
+    for (std::size_t i(0); i < Count; ++i) {
+        paths.push_back(workdir / ("file-" + std::to_string(i)));
+        write(paths.back(), content(i));
+        files.push_back(manager->open(paths.back()));
+    }
+
+    if (manager->stats().open > Budget) {
+        LOG(fatal) << "Budget exceeded: " << manager->stats().open
+                   << " open descriptors.";
+        return false;
+    }
+
+    // two rounds: every lease in the second one needs a reopen
+    for (int round(0); round < 2; ++round) {
+        for (std::size_t i(0); i < Count; ++i) {
+            const auto lease(files[i]->lease());
+            if (!readBack(lease.fd(), content(i), paths[i])) { return false; }
+        }
+    }
+
+    const auto stats(manager->stats());
+    if (!stats.reopens || !stats.closes || (stats.open > Budget)) {
+        LOG(fatal) << "Unexpected stats: reopens " << stats.reopens
+                   << ", closes " << stats.closes << ", open "
+                   << stats.open << ".";
+        return false;
+    }
+
+    // lease outlives its file
+    {
+        auto lease(files[0]->lease());
+        files[0].reset();
+        if (!readBack(lease.fd(), content(0), paths[0])) { return false; }
+    }
+
+    // replaced file: push it out of budget, replace it, lease must fail
+    const auto replacement(workdir / "replacement");
+    write(replacement, content(1));
+    for (std::size_t i(2); i < Count; ++i) { files[i]->lease(); }
+    fs::rename(replacement, paths[1]);
+    try {
+        files[1]->lease();
+        LOG(fatal) << "Replaced file " << paths[1] << " has been reopened.";
+        return false;
+    } catch (const roarchive::IOError&) {}
+
+    files.clear();
+    for (const auto &path : paths) { fs::remove(path); }
+    return true;
+}
+
+generate::Entry entry(std::size_t i)
+{
+    return { "data/entry-" + std::to_string(i), content(i) };
+}
+
+bool archives(const fs::path &workdir)
+{
+    LOG(info3) << "Managed archives.";
+
+    auto manager(std::make_shared<roarchive::FdManager>(Budget));
+
+    struct Archive {
+        fs::path path;
+        roarchive::RoArchive archive;
+    };
+    std::vector<std::unique_ptr<Archive>> open;
+
+    for (std::size_t i(0); i < Count; ++i) {
+        const bool tar(i % 2);
+        const auto path(workdir / ("archive-" + std::to_string(i)
+                                   + (tar ? ".tar" : ".zip")));
+        if (tar) {
+            generate::tar(path, 8, entry);
+        } else {
+            generate::zip(path, 8, entry, true);
+        }
+
+        open.emplace_back(new Archive{
+                path, roarchive::RoArchive
+                    (path, roarchive::OpenOptions()
+                     .setMime(tar ? "application/x-tar" : "application/zip")
+                     .setFdManager(manager)) });
+    }
+
+    for (int round(0); round < 2; ++round) {
+        for (const auto &a : open) {
+            for (std::size_t i(0); i < 8; ++i) {
+                const auto e(entry(i));
+                const auto data(a->archive.istream(e.name)->read());
+                if (std::string(data.begin(), data.end()) != e.content) {
+                    LOG(fatal) << "Wrong content of " << e.name << " in "
+                               << a->path << ".";
+                    return false;
+                }
+            }
+        }
+    }
+
+    const auto stats(manager->stats());
+    if (!stats.reopens || (stats.open > Budget)) {
+        LOG(fatal) << "Unexpected stats: reopens " << stats.reopens
+                   << ", open " << stats.open << ".";
+        return false;
+    }
+
+    for (const auto &a : open) { fs::remove(a->path); }
+    return true;
+}
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    if (argc < 2) {
+        LOG(fatal) << "Missing parameters.";
+        return EXIT_FAILURE;
+    }
+
+    const fs::path workdir(argv[1] / fs::path("fdmanager"));
+    fs::create_directories(workdir);
+
+    bool ok(true);
+    ok = files(workdir) && ok;
+    ok = archives(workdir) && ok;
+
+    fs::remove_all(workdir);
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
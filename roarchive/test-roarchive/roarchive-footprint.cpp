@@ -0,0 +1,159 @@
+/**
+ * Copyright (c) 2017 Melown Technologies SE
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * *  Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * *  Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+/** Memory footprint benchmark.
+ *
+ * Generates tarballs and zip archives with given number of (empty) entries,
+ * opens each one in a separate child process and reports RSS growth and
+ * RoArchive::memoryUsage() breakdown per archive and per entry. Zip archives
+ * are measured with both default and mapped central directory index.
+ *
+ * usage: roarchive-footprint WORKDIR [COUNT...]
+ */
+
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <boost/filesystem.hpp>
+
+#include "dbglog/dbglog.hpp"
+#include "roarchive/roarchive.hpp"
+
+#include "generate.hpp"
+
+namespace fs = boost::filesystem;
+
+namespace {
+
+generate::Entry entry(std::size_t i)
+{
+    // tileset-like layout: few thousands empty entries per directory
+    return { "tiles/" + std::to_string(i / 4096) + "/"
+            + std::to_string(i) + ".bin" };
+}
+
+std::size_t rss()
+{
+    std::ifstream f("/proc/self/statm");
+    std::size_t size(0), resident(0);
+    f >> size >> resident;
+    return resident * ::sysconf(_SC_PAGESIZE);
+}
+
+/** Opens archive in child process, prints one result line.
+ */
+void measure(const fs::path &path, const std::string &mime
+             , std::size_t count, bool mapped = false)
+{
+    std::cout.flush();
+    const auto pid(::fork());
+    if (pid < 0) {
+        LOG(fatal) << "Cannot fork: " << std::strerror(errno) << ".";
+        std::exit(EXIT_FAILURE);
+    }
+
+    if (pid) {
+        int status(0);
+        ::waitpid(pid, &status, 0);
+        return;
+    }
+
+    const auto before(rss());
+    roarchive::RoArchive archive
+        (path, roarchive::OpenOptions().setMime(mime)
+         .setMapZipDirectory(mapped));
+    const auto after(rss());
+    const auto mu(archive.memoryUsage());
+
+    const auto perEntry([&](std::size_t bytes) {
+        return double(bytes) / count;
+    });
+
+    std::cout << std::setw(8)
+              << (mime == "application/zip"
+                  ? (mapped ? "zip-map" : "zip") : "tar")
+              << std::setw(10) << count
+              << std::setw(14) << fs::file_size(path)
+              << std::setw(14) << (after - before)
+              << std::setw(10) << std::fixed << std::setprecision(1)
+              << perEntry(after - before)
+              << std::setw(14) << mu.total()
+              << std::setw(10) << perEntry(mu.total())
+              << "  ";
+    for (const auto &component : mu.components) {
+        std::cout << ' ' << component.first << '=' << component.second;
+    }
+    std::cout << std::endl;
+    ::_exit(EXIT_SUCCESS);
+}
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    if (argc < 2) {
+        LOG(fatal) << "Missing parameters.";
+        return EXIT_FAILURE;
+    }
+
+    const fs::path workdir(argv[1]);
+    fs::create_directories(workdir);
+
+    std::vector<std::size_t> counts;
+    for (int i(2); i < argc; ++i) { counts.push_back(std::stoul(argv[i])); }
+    if (counts.empty()) { counts = { 1000, 10000, 100000, 1000000 }; }
+
+    std::cout << std::setw(8) << "format" << std::setw(10) << "entries"
+              << std::setw(14) << "file" << std::setw(14) << "rss"
+              << std::setw(10) << "rss/e" << std::setw(14) << "estimate"
+              << std::setw(10) << "est/e" << "   components\n";
+
+    for (const auto count : counts) {
+        const auto tar(workdir / ("footprint-" + std::to_string(count)
+                                  + ".tar"));
+        generate::tar(tar, count, entry);
+        measure(tar, "application/x-tar", count);
+        fs::remove(tar);
+
+        const auto zip(workdir / ("footprint-" + std::to_string(count)
+                                  + ".zip"));
+        generate::zip(zip, count, entry);
+        measure(zip, "application/zip", count);
+        measure(zip, "application/zip", count, true);
+        fs::remove(zip);
+    }
+
+    return EXIT_SUCCESS;
+}
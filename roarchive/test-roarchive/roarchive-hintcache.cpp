@@ -0,0 +1,132 @@
+/**
+ * Copyright (c) 2017 Melown Technologies SE
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * *  Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * *  Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+/** Content cache and hinted prefix test.
+ *
+ * Opens one archive twice with different hints, sharing one content
+ * cache, and checks that equally named files under different prefixes do
+ * not get each other's cached content, also after applyHint() moves one
+ * archive to the other prefix. Runs over tarball and zip.
+ *
+ * usage: roarchive-hintcache WORKDIR
+ */
+
+#include <cstdlib>
+#include <string>
+#include <memory>
+
+#include <boost/filesystem.hpp>
+
+#include "dbglog/dbglog.hpp"
+#include "roarchive/roarchive.hpp"
+#include "roarchive/cache.hpp"
+
+#include "generate.hpp"
+
+namespace fs = boost::filesystem;
+
+namespace {
+
+generate::Entry entry(std::size_t i)
+{
+    switch (i) {
+    case 0: return { "one/one.conf", "1" };
+    case 1: return { "one/data", "data of one" };
+    case 2: return { "two/two.conf", "2" };
+    default: return { "two/data", "data of second prefix" };
+    }
+}
+
+bool expect(const roarchive::RoArchive &archive, const std::string &content
+            , const std::string &what)
+{
+    const auto data(archive.istream("data")->read());
+    if (std::string(data.begin(), data.end()) != content) {
+        LOG(fatal) << what << ": got \""
+                   << std::string(data.begin(), data.end())
+                   << "\" instead of \"" << content << "\".";
+        return false;
+    }
+    return true;
+}
+
+bool run(const fs::path &path, const std::string &mime)
+{
+    LOG(info3) << "Hinted cache, " << mime << ".";
+
+    const auto cache(std::make_shared<roarchive::MemoryContentCache>
+                     (1 << 20));
+    const auto open([&](const std::string &hint) {
+            return roarchive::RoArchive
+                (path, roarchive::OpenOptions().setMime(mime)
+                 .setHint(roarchive::FileHint(hint)).setContentCache(cache));
+        });
+
+    auto one(open("one.conf"));
+    const auto two(open("two.conf"));
+
+    // fill cache from both, then read again from the cache
+    for (int pass(0); pass < 2; ++pass) {
+        if (!expect(one, "data of one", "First archive")
+            || !expect(two, "data of second prefix", "Second archive"))
+        {
+            return false;
+        }
+    }
+
+    if (!cache->stats().hits) {
+        LOG(fatal) << "Content cache not used.";
+        return false;
+    }
+
+    one.applyHint(roarchive::FileHint("two.conf"));
+    return expect(one, "data of second prefix", "Re-hinted archive");
+}
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    if (argc < 2) {
+        LOG(fatal) << "Missing parameters.";
+        return EXIT_FAILURE;
+    }
+
+    const fs::path workdir(argv[1]);
+    fs::create_directories(workdir);
+
+    bool ok(true);
+
+    const auto tar(workdir / "hinted.tar");
+    generate::tar(tar, 4, entry);
+    ok = run(tar, "application/x-tar") && ok;
+    fs::remove(tar);
+
+    const auto zip(workdir / "hinted.zip");
+    generate::zip(zip, 4, entry);
+    ok = run(zip, "application/zip") && ok;
+    fs::remove(zip);
+
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,527 @@
+/**
+ * Copyright (c) 2017 Melown Technologies SE
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * *  Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * *  Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+/** Lazy HTTP stream test.
+ *
+ * Runs a minimal in-process HTTP server (HEAD, byte ranges, If-Match) and
+ * reads resources through an HTTP archive: seeks inside a lazily fetched
+ * resource and compares the bytes, checks that only the needed ranges are
+ * downloaded, reads empty resources and resources without HEAD support,
+ * checks the block cache (reuse, resources without validators) and that a
+ * resource replaced under an open stream fails the stream.
+ *
+ * usage: roarchive-httplazy
+ */
+
+#include <cstdlib>
+
+#include "dbglog/dbglog.hpp"
+
+#ifdef ROARCHIVE_HAS_HTTP
+
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include <map>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <string>
+#include <vector>
+#include <sstream>
+
+#include <boost/algorithm/string/predicate.hpp>
+#include <boost/algorithm/string/trim.hpp>
+
+#include "roarchive/roarchive.hpp"
+#include "roarchive/blockcache.hpp"
+
+namespace {
+
+/** Served resource.
+ */
+struct Resource {
+    std::string data;
+    std::string etag;
+    std::string lastModified;
+
+    /** HEAD answered with 405.
+     */
+    bool noHead;
+
+    Resource(std::string data = std::string()
+             , std::string etag = std::string()
+             , std::string lastModified = std::string()
+             , bool noHead = false)
+        : data(std::move(data)), etag(std::move(etag))
+        , lastModified(std::move(lastModified)), noHead(noHead)
+    {}
+};
+
+/** Single threaded HTTP/1.1 server on loopback, one request per
+ *  connection.
+ */
+class Server {
+public:
+    Server()
+        : fd_(::socket(AF_INET, SOCK_STREAM, 0)), port_(), running_(true)
+        , heads_(), gets_(), bytes_()
+    {
+        ::sockaddr_in addr{};
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        ::socklen_t len(sizeof(addr));
+        if ((fd_ < 0)
+            || ::bind(fd_, reinterpret_cast<::sockaddr*>(&addr), len)
+            || ::listen(fd_, 16)
+            || ::getsockname(fd_, reinterpret_cast<::sockaddr*>(&addr)
+                             , &len))
+        {
+            LOGTHROW(err2, std::runtime_error)
+                << "Cannot start HTTP server.";
+        }
+        port_ = ntohs(addr.sin_port);
+        thread_ = std::thread([this]() { run(); });
+    }
+
+    ~Server() {
+        running_ = false;
+        ::shutdown(fd_, SHUT_RDWR);
+        thread_.join();
+        ::close(fd_);
+    }
+
+    std::string url(const std::string &path) const {
+        return "http://127.0.0.1:" + std::to_string(port_) + "/" + path;
+    }
+
+    void set(const std::string &path, const Resource &resource) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        resources_[path] = resource;
+    }
+
+    /** Served requests and body bytes.
+     */
+    std::size_t heads() const { return heads_; }
+    std::size_t gets() const { return gets_; }
+    std::size_t bytes() const { return bytes_; }
+
+    void resetStats() { heads_ = gets_ = bytes_ = 0; }
+
+private:
+    void run() {
+        while (running_) {
+            const auto client(::accept(fd_, nullptr, nullptr));
+            if (client < 0) { continue; }
+            try { serve(client); } catch (const std::exception&) {}
+            ::close(client);
+        }
+    }
+
+    void serve(int client) {
+        std::string request;
+        char buf[4096];
+        while (request.find("\r\n\r\n") == std::string::npos) {
+            const auto r(::recv(client, buf, sizeof(buf), 0));
+            if (r <= 0) { return; }
+            request.append(buf, r);
+        }
+
+        std::istringstream is(request);
+        std::string method, target, line;
+        is >> method >> target;
+        std::getline(is, line);
+
+        std::string range, ifMatch;
+        while (std::getline(is, line)) {
+            boost::algorithm::trim(line);
+            const auto colon(line.find(':'));
+            if (colon == std::string::npos) { continue; }
+            const auto name(line.substr(0, colon));
+            auto value(line.substr(colon + 1));
+            boost::algorithm::trim(value);
+            if (boost::algorithm::iequals(name, "Range")) {
+                range = value;
+            } else if (boost::algorithm::iequals(name, "If-Match")) {
+                ifMatch = value;
+            }
+        }
+
+        Resource resource;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            auto fresources(resources_.find(target.substr(1)));
+            if (fresources == resources_.end()) {
+                return respond(client, "404 Not Found", {}, {});
+            }
+            resource = fresources->second;
+        }
+
+        std::vector<std::string> headers;
+        if (!resource.etag.empty()) {
+            headers.push_back("ETag: " + resource.etag);
+        }
+        if (!resource.lastModified.empty()) {
+            headers.push_back("Last-Modified: " + resource.lastModified);
+        }
+
+        const auto total(resource.data.size());
+        if (method == "HEAD") {
+            if (resource.noHead) {
+                return respond(client, "405 Method Not Allowed", {}, {});
+            }
+            ++heads_;
+            headers.push_back("Content-Length: " + std::to_string(total));
+            return respond(client, "200 OK", headers, {}, false);
+        }
+
+        ++gets_;
+        if (!ifMatch.empty() && (ifMatch != resource.etag)) {
+            return respond(client, "412 Precondition Failed", {}, {});
+        }
+
+        if (!boost::algorithm::starts_with(range, "bytes=")) {
+            return respond(client, "200 OK", headers, resource.data);
+        }
+
+        std::uint64_t first(0), last(0);
+        char dash;
+        std::istringstream rs(range.substr(6));
+        rs >> first >> dash >> last;
+        if (first >= total) {
+            headers.push_back("Content-Range: bytes */"
+                              + std::to_string(total));
+            return respond(client, "416 Range Not Satisfiable", headers
+                           , {});
+        }
+
+        last = std::min<std::uint64_t>(last, total - 1);
+        headers.push_back("Content-Range: bytes " + std::to_string(first)
+                          + "-" + std::to_string(last) + "/"
+                          + std::to_string(total));
+        respond(client, "206 Partial Content", headers
+                , resource.data.substr(first, last - first + 1));
+    }
+
+    void respond(int client, const std::string &status
+                 , const std::vector<std::string> &headers
+                 , const std::string &body, bool length = true)
+    {
+        std::string response("HTTP/1.1 " + status + "\r\n");
+        for (const auto &header : headers) { response += header + "\r\n"; }
+        if (length) {
+            response += ("Content-Length: " + std::to_string(body.size())
+                         + "\r\n");
+        }
+        response += "Connection: close\r\n\r\n";
+        const auto headerSize(response.size());
+        response += body;
+
+        // client may cut the transfer once it has what it wants
+        std::size_t sent(0);
+        while (sent < response.size()) {
+            const auto r(::send(client, response.data() + sent
+                                , response.size() - sent, MSG_NOSIGNAL));
+            if (r <= 0) { break; }
+            sent += r;
+        }
+        if (sent > headerSize) { bytes_ += sent - headerSize; }
+    }
+
+    int fd_;
+    unsigned short port_;
+    std::atomic<bool> running_;
+    std::thread thread_;
+
+    std::mutex mutex_;
+    std::map<std::string, Resource> resources_;
+
+    std::atomic<std::size_t> heads_;
+    std::atomic<std::size_t> gets_;
+    std::atomic<std::size_t> bytes_;
+};
+
+const std::size_t Window(64 << 10);
+
+std::string content(std::size_t size, char seed)
+{
+    std::string data(size, '\0');
+    for (std::size_t i(0); i < size; ++i) {
+        data[i] = char(seed + (i * 13 + i / 4093) % 83);
+    }
+    return data;
+}
+
+roarchive::RoArchive openArchive(const Server &server
+                          , roarchive::OpenOptions options
+                          = roarchive::OpenOptions())
+{
+    return roarchive::RoArchive(server.url(""), options);
+}
+
+/** Reads size bytes at offset, seeking first.
+ */
+bool readAt(std::istream &is, std::uint64_t offset, std::size_t size
+            , const std::string &expected, const std::string &what)
+{
+    std::string buf(size, '\0');
+    is.seekg(offset);
+    is.read(&buf[0], size);
+    buf.resize(is.gcount());
+    is.clear();
+
+    if (buf != expected.substr(offset, size)) {
+        LOG(fatal) << what << ": wrong data at " << offset << ".";
+        return false;
+    }
+    return true;
+}
+
+bool seeks(Server &server)
+{
+    LOG(info3) << "Seeks.";
+
+    const auto data(content(4 << 20, 'a'));
+    server.set("seek.bin", Resource(data, "\"seek\""));
+    server.resetStats();
+
+    auto archive(openArchive(server, roarchive::OpenOptions()
+                      .setHttpRangeWindow(Window)));
+    auto is(archive.istream(server.url("seek.bin")));
+
+    if (!is->seekable() || !is->size() || (*is->size() != data.size())) {
+        LOG(fatal) << "Lazy stream not seekable or of wrong size.";
+        return false;
+    }
+
+    auto &s(is->get());
+    const std::uint64_t offsets[] = {
+        3 << 20, 100, Window - 10, (2 << 20) + 12345, data.size() - 500
+        , 3 << 20
+    };
+    for (const auto offset : offsets) {
+        if (!readAt(s, offset, 1000, data, "seek.bin")) { return false; }
+    }
+
+    // short read at the end
+    if (!readAt(s, data.size() - 10, 1000, data, "seek.bin")) {
+        return false;
+    }
+
+    // random access fetches single windows, nowhere near the whole resource
+    if (server.bytes() > (data.size() / 4)) {
+        LOG(fatal) << "Lazy stream downloaded " << server.bytes()
+                   << " bytes for a few seeks.";
+        return false;
+    }
+
+    // sequential read of the rest of the resource, with read-ahead
+    server.resetStats();
+    s.seekg(1 << 20);
+    std::string rest((data.size() - (1 << 20)), '\0');
+    s.read(&rest[0], rest.size());
+    if ((std::size_t(s.gcount()) != rest.size())
+        || (rest != data.substr(1 << 20)))
+    {
+        LOG(fatal) << "Wrong data read sequentially.";
+        return false;
+    }
+    if (server.gets() >= (rest.size() / Window)) {
+        LOG(fatal) << "No read-ahead: " << server.gets()
+                   << " requests for " << rest.size() << " bytes.";
+        return false;
+    }
+
+    // whole resource in one go
+    const auto whole(archive.istream(server.url("seek.bin"))->read());
+    if (std::string(whole.begin(), whole.end()) != data) {
+        LOG(fatal) << "Wrong data read whole.";
+        return false;
+    }
+
+    return true;
+}
+
+bool special(Server &server)
+{
+    LOG(info3) << "Empty resource and no HEAD.";
+
+    server.set("empty.bin", Resource({}, "\"empty\""));
+    const auto data(content(300000, 'A'));
+    server.set("nohead.bin", Resource(data, "\"nohead\"", {}, true));
+
+    auto archive(openArchive(server, roarchive::OpenOptions()
+                      .setHttpRangeWindow(Window)));
+
+    {
+        auto is(archive.istream(server.url("empty.bin")));
+        if (!is->size() || *is->size() || !is->read().empty()) {
+            LOG(fatal) << "Empty resource not read as empty.";
+            return false;
+        }
+    }
+
+    {
+        auto is(archive.istream(server.url("nohead.bin")));
+        if (!is->size() || (*is->size() != data.size())) {
+            LOG(fatal) << "Size not learned without HEAD.";
+            return false;
+        }
+        if (!readAt(is->get(), 250000, 20000, data, "nohead.bin")
+            || !readAt(is->get(), 10, 100, data, "nohead.bin"))
+        {
+            return false;
+        }
+    }
+
+    try {
+        archive.istream(server.url("missing.bin"));
+        LOG(fatal) << "Missing resource opened.";
+        return false;
+    } catch (const roarchive::NoSuchFile&) {}
+
+    return true;
+}
+
+bool blockCache(Server &server)
+{
+    LOG(info3) << "Block cache.";
+
+    const auto data(content(1 << 20, '0'));
+    server.set("cached.bin", Resource(data, "\"cached\""));
+    server.set("dated.bin", Resource(data, {}, "Sat, 17 Oct 2026 "
+                                     "10:00:00 GMT"));
+    server.set("plain.bin", Resource(data));
+
+    auto cache(std::make_shared<roarchive::BlockCache>
+               (roarchive::BlockCache::Config().setBlockSize(16 << 10)
+                .setBudget(4 << 20)));
+
+    for (const bool lazy : { true, false }) {
+        auto options(roarchive::OpenOptions().setBlockCache(cache));
+        if (lazy) { options.setHttpRangeWindow(Window); }
+        auto archive(openArchive(server, options));
+
+        // second pass (and second stream) served from cache
+        for (const auto &name : { "cached.bin", "dated.bin" }) {
+            std::size_t gets(0);
+            for (int pass(0); pass < 2; ++pass) {
+                server.resetStats();
+                auto is(archive.istream(server.url(name)));
+                if (lazy) {
+                    if (!readAt(is->get(), 500000, 70000, data, name)) {
+                        return false;
+                    }
+                } else {
+                    const auto got(is->read());
+                    if (std::string(got.begin(), got.end()) != data) {
+                        LOG(fatal) << name << ": wrong data.";
+                        return false;
+                    }
+                }
+                if (!pass) {
+                    gets = server.gets();
+                } else if (server.gets()) {
+                    LOG(fatal) << name << ": cached blocks fetched again ("
+                               << server.gets() << " of " << gets
+                               << " requests).";
+                    return false;
+                }
+            }
+        }
+
+        // no validator: never cached
+        for (int pass(0); pass < 2; ++pass) {
+            server.resetStats();
+            auto is(archive.istream(server.url("plain.bin")));
+            const auto got(is->read());
+            if (std::string(got.begin(), got.end()) != data) {
+                LOG(fatal) << "plain.bin: wrong data.";
+                return false;
+            }
+            if (!server.gets()) {
+                LOG(fatal) << "Resource without validators cached.";
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+bool changed(Server &server)
+{
+    LOG(info3) << "Changed resource.";
+
+    const auto data(content(1 << 20, 'a'));
+    server.set("changing.bin", Resource(data, "\"v1\""));
+
+    auto archive(openArchive(server, roarchive::OpenOptions()
+                      .setHttpRangeWindow(Window)));
+    auto is(archive.istream(server.url("changing.bin")));
+    if (!readAt(is->get(), 0, 1000, data, "changing.bin")) { return false; }
+
+    server.set("changing.bin", Resource(content(1 << 20, 'A'), "\"v2\""));
+
+    // far away window must not come from the new version
+    auto &s(is->get());
+    std::string buf(1000, '\0');
+    try {
+        s.seekg(800000);
+        s.read(&buf[0], buf.size());
+        if (!s) { return true; }
+        LOG(fatal) << "Read from replaced resource did not fail.";
+        return false;
+    } catch (const std::exception&) {}
+
+    return true;
+}
+
+} // namespace
+
+int main(int, char *[])
+{
+    Server server;
+
+    bool ok(true);
+    ok = seeks(server) && ok;
+    ok = special(server) && ok;
+    ok = blockCache(server) && ok;
+    ok = changed(server) && ok;
+
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+#else // ROARCHIVE_HAS_HTTP
+
+int main(int, char *[])
+{
+    LOG(info3) << "Compiled without HTTP support, nothing to test.";
+    return EXIT_SUCCESS;
+}
+
+#endif // ROARCHIVE_HAS_HTTP
@@ -0,0 +1,158 @@
+/**
+ * Copyright (c) 2017 Melown Technologies SE
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * *  Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * *  Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+/** Raw file access test.
+ *
+ * Opens files of directory, tarball and zip archives (stored entries,
+ * default and mapped index) by RoArchive::openRaw() and compares bytes
+ * read by pread() at the returned offset with the original content.
+ * Checks that deflated entries are not exposed and missing files throw.
+ *
+ * usage: roarchive-openraw WORKDIR
+ */
+
+#include <unistd.h>
+
+#include <cstdlib>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include <boost/filesystem.hpp>
+
+#include "dbglog/dbglog.hpp"
+#include "roarchive/roarchive.hpp"
+
+#include "generate.hpp"
+
+namespace fs = boost::filesystem;
+
+namespace {
+
+const std::size_t Count(16);
+
+generate::Entry entry(std::size_t i)
+{
+    // odd sizes and an empty file
+    return { "data/entry-" + std::to_string(i)
+            , std::string(i ? (333 * i + 7) : 0, char('a' + i % 26)) };
+}
+
+bool check(const roarchive::RoArchive &archive, bool raw
+           , const std::string &what)
+{
+    for (std::size_t i(0); i < Count; ++i) {
+        const auto e(entry(i));
+        const auto file(archive.openRaw(e.name));
+        if (!raw) {
+            if (file) {
+                LOG(fatal) << what << ": compressed " << e.name
+                           << " exposed as raw file.";
+                return false;
+            }
+            continue;
+        }
+
+        if (!file) {
+            LOG(fatal) << what << ": " << e.name << " not available.";
+            return false;
+        }
+        if (file->length != e.content.size()) {
+            LOG(fatal) << what << ": " << e.name << " has length "
+                       << file->length << " instead of "
+                       << e.content.size() << ".";
+            return false;
+        }
+
+        std::vector<char> data(file->length);
+        if (::pread(file->fd, data.data(), data.size(), file->offset)
+            != ssize_t(data.size()))
+        {
+            LOG(fatal) << what << ": cannot read " << e.name << ".";
+            return false;
+        }
+        if (std::string(data.begin(), data.end()) != e.content) {
+            LOG(fatal) << what << ": " << e.name << " has wrong content.";
+            return false;
+        }
+    }
+
+    try {
+        archive.openRaw("data/missing");
+        LOG(fatal) << what << ": missing file did not throw.";
+        return false;
+    } catch (const roarchive::NoSuchFile&) {}
+
+    return true;
+}
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    if (argc < 2) {
+        LOG(fatal) << "Missing parameters.";
+        return EXIT_FAILURE;
+    }
+
+    const fs::path workdir(argv[1]);
+    fs::create_directories(workdir);
+
+    bool ok(true);
+
+    const auto dir(workdir / "raw");
+    fs::create_directories(dir / "data");
+    for (std::size_t i(0); i < Count; ++i) {
+        const auto e(entry(i));
+        std::ofstream f((dir / e.name).string()
+                        , std::ios::binary | std::ios::trunc);
+        f << e.content;
+    }
+    ok = check(roarchive::RoArchive(dir), true, "Directory") && ok;
+    fs::remove_all(dir);
+
+    const auto tar(workdir / "raw.tar");
+    generate::tar(tar, Count, entry);
+    ok = check(roarchive::RoArchive
+               (tar, roarchive::OpenOptions().setMime("application/x-tar"))
+               , true, "Tarball") && ok;
+    fs::remove(tar);
+
+    const auto zip(workdir / "raw.zip");
+    for (const auto deflate : { false, true }) {
+        generate::zip(zip, Count, entry, deflate);
+        for (const auto mapped : { false, true }) {
+            ok = check(roarchive::RoArchive
+                       (zip, roarchive::OpenOptions()
+                        .setMime("application/zip")
+                        .setMapZipDirectory(mapped))
+                       , !deflate
+                       , std::string(deflate ? "Deflated" : "Stored")
+                       + " zip" + (mapped ? " (mapped)" : "")) && ok;
+        }
+    }
+    fs::remove(zip);
+
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,239 @@
+/**
+ * Copyright (c) 2017 Melown Technologies SE
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * *  Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * *  Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+/** I/O scheduler test.
+ *
+ * Checks global and per-archive token buckets (operations and bytes),
+ * independence of priority classes, queue depth limit and admission of
+ * archive streams (one operation each, charged by bytes read). Timing
+ * checks use lower bounds only.
+ *
+ * usage: roarchive-scheduler WORKDIR
+ */
+
+#include <cstdlib>
+#include <chrono>
+#include <thread>
+#include <atomic>
+#include <string>
+#include <memory>
+
+#include <boost/filesystem.hpp>
+
+#include "dbglog/dbglog.hpp"
+#include "roarchive/roarchive.hpp"
+#include "roarchive/scheduler.hpp"
+
+#include "generate.hpp"
+
+namespace fs = boost::filesystem;
+
+namespace {
+
+typedef roarchive::IoScheduler IoScheduler;
+typedef IoScheduler::clock Clock;
+
+double seconds(Clock::duration d)
+{
+    return std::chrono::duration<double>(d).count();
+}
+
+/** Time spent by given call.
+ */
+template <typename Call>
+double measure(Call call)
+{
+    const auto start(Clock::now());
+    call();
+    return seconds(Clock::now() - start);
+}
+
+bool expect(bool condition, const std::string &what)
+{
+    if (!condition) { LOG(fatal) << what; }
+    return condition;
+}
+
+bool opsRate()
+{
+    LOG(info3) << "Global operation rate.";
+
+    // 200 ops/s, burst of 10 ops
+    auto scheduler(std::make_shared<IoScheduler>
+                   (IoScheduler::Config().setBurst(0.05)
+                    .setGlobalRate(roarchive::IoPriority::normal
+                                   , IoScheduler::Rate(0, 200))));
+    IoScheduler::Channel channel(scheduler, "a");
+
+    const auto elapsed(measure([&]() {
+                for (int i(0); i < 50; ++i) { channel.acquire(0); }
+            }));
+
+    // 11 admitted from the burst, the rest at 200 ops/s
+    return expect(elapsed >= 0.15, "50 operations at 200 ops/s took only "
+                  + std::to_string(elapsed) + " s.");
+}
+
+bool archiveRate()
+{
+    LOG(info3) << "Per-archive byte rate.";
+
+    // 1 MiB/s per archive, burst of 512 KiB
+    auto scheduler(std::make_shared<IoScheduler>
+                   (IoScheduler::Config().setBurst(0.5)
+                    .setArchiveRate(roarchive::IoPriority::normal
+                                    , IoScheduler::Rate(1 << 20))));
+    IoScheduler::Channel a(scheduler, "a");
+    IoScheduler::Channel b(scheduler, "b");
+
+    // first request is admitted and puts the bucket into debt
+    const auto first(measure([&]() { a.acquire(1 << 20); }));
+    const auto other(measure([&]() { b.acquire(256 << 10); }));
+    const auto second(measure([&]() { a.acquire(1); }));
+
+    return (expect(first < 0.1, "Full bucket did not admit at once.")
+            && expect(other < 0.1, "Other archive's bucket was affected.")
+            && expect(second >= 0.4, "Debt of 512 KiB at 1 MiB/s paid in "
+                      + std::to_string(second) + " s."));
+}
+
+bool classes()
+{
+    LOG(info3) << "Priority classes.";
+
+    // background: 1 op/s (bucket of 1 op); interactive unlimited
+    auto scheduler(std::make_shared<IoScheduler>
+                   (IoScheduler::Config()
+                    .setGlobalRate(roarchive::IoPriority::background
+                                   , IoScheduler::Rate(0, 1))));
+    IoScheduler::Channel channel(scheduler, "a");
+
+    {
+        IoScheduler::Scope scope(roarchive::IoPriority::background);
+        channel.acquire(0);
+        channel.acquire(0);
+    }
+
+    const auto interactive(measure([&]() {
+                IoScheduler::Scope scope
+                    (roarchive::IoPriority::interactive);
+                channel.acquire(0);
+            }));
+
+    const auto stats(scheduler->stats());
+    return (expect(interactive < 0.1, "Interactive request waited for "
+                   "background bucket.")
+            && expect((stats.ops[int(roarchive::IoPriority::background)]
+                       == 2)
+                      && (stats.ops[int(roarchive::IoPriority::interactive)]
+                          == 1), "Wrong per class operation counts."));
+}
+
+bool queueDepth()
+{
+    LOG(info3) << "Queue depth.";
+
+    auto scheduler(std::make_shared<IoScheduler>
+                   (IoScheduler::Config().setQueueDepth(1)));
+    IoScheduler::Channel channel(scheduler, "a");
+
+    auto grant(channel.acquire(0));
+    std::atomic<bool> admitted(false);
+    std::thread waiter([&]() {
+            channel.acquire(0);
+            admitted = true;
+        });
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    const bool blocked(!admitted);
+    grant = IoScheduler::Grant();
+    waiter.join();
+
+    return (expect(blocked, "Request admitted over queue depth.")
+            && expect(!scheduler->stats().inFlight
+                      , "Operations left in flight."));
+}
+
+generate::Entry entry(std::size_t i)
+{
+    return { "data/entry-" + std::to_string(i)
+            , std::string(4096, char('a' + i % 26)) };
+}
+
+bool archive(const fs::path &workdir)
+{
+    LOG(info3) << "Archive reads.";
+
+    const auto tar(workdir / "scheduler.tar");
+    generate::tar(tar, 16, entry);
+
+    auto scheduler(std::make_shared<IoScheduler>());
+    bool ok(true);
+    {
+        roarchive::RoArchive archive
+            (tar, roarchive::OpenOptions().setMime("application/x-tar")
+             .setIoScheduler(scheduler));
+        for (std::size_t i(0); i < 16; ++i) {
+            const auto e(entry(i));
+            const auto data(archive.istream(e.name)->read());
+            ok = expect(std::string(data.begin(), data.end()) == e.content
+                        , "Wrong content of " + e.name + ".") && ok;
+        }
+    }
+
+    const auto stats(scheduler->stats());
+    const auto normal(int(roarchive::IoPriority::normal));
+    ok = (expect(stats.ops[normal] == 16
+                 , "Streams were not admitted once each.")
+          && expect(stats.bytes[normal] == 16 * 4096
+                    , "Charged bytes differ from bytes read.")
+          && expect(!stats.inFlight, "Operations left in flight.")
+          && ok);
+
+    fs::remove(tar);
+    return ok;
+}
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    if (argc < 2) {
+        LOG(fatal) << "Missing parameters.";
+        return EXIT_FAILURE;
+    }
+
+    const fs::path workdir(argv[1]);
+    fs::create_directories(workdir);
+
+    bool ok(true);
+    ok = opsRate() && ok;
+    ok = archiveRate() && ok;
+    ok = classes() && ok;
+    ok = queueDepth() && ok;
+    ok = archive(workdir) && ok;
+
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,289 @@
+/**
+ * Copyright (c) 2017 Melown Technologies SE
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * *  Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * *  Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+/** Shared memory content cache test.
+ *
+ * Checks put/get round trip, eviction under a small segment, that a
+ * pinned entry survives eviction intact, sharing with a forked process,
+ * reclaiming pins of a dead process and shard repair after a process is
+ * killed while writing into the cache.
+ *
+ * usage: roarchive-shmcache
+ */
+
+#include <unistd.h>
+#include <signal.h>
+#include <sys/wait.h>
+
+#include <cstdlib>
+#include <chrono>
+#include <thread>
+#include <string>
+#include <vector>
+
+#include "dbglog/dbglog.hpp"
+#include "roarchive/shmcache.hpp"
+
+namespace {
+
+typedef roarchive::ContentCache ContentCache;
+
+/** Single shard with a ring of roughly 120 KiB.
+ */
+const std::size_t SegmentSize(4096 + (32 << 12));
+const std::size_t EntrySize(4000);
+
+ContentCache::Key key(std::size_t i)
+{
+    return { "archive", "entry-" + std::to_string(i), "" };
+}
+
+std::string content(std::size_t i, std::size_t size = EntrySize)
+{
+    std::string data(size, '\0');
+    for (std::size_t j(0); j < size; ++j) {
+        data[j] = char('a' + (i + j) % 26);
+    }
+    return data;
+}
+
+void put(ContentCache &cache, std::size_t i, std::size_t size = EntrySize)
+{
+    const auto data(content(i, size));
+    cache.put(key(i), ContentCache::Content::make
+              ({ data.begin(), data.end() }, "entry-" + std::to_string(i)
+               , "index", std::time_t(i)));
+}
+
+/** Checks cached entry. Missing entry is fine unless required.
+ */
+bool check(ContentCache &cache, std::size_t i, bool required
+           , std::size_t size = EntrySize)
+{
+    const auto c(cache.get(key(i)));
+    if (!c) {
+        if (required) { LOG(fatal) << "Entry " << i << " not cached."; }
+        return !required;
+    }
+
+    if ((std::string(c->data, c->size) != content(i, size))
+        || (c->path != ("entry-" + std::to_string(i)))
+        || (c->index != "index") || (c->timestamp != std::time_t(i)))
+    {
+        LOG(fatal) << "Wrong content of entry " << i << ".";
+        return false;
+    }
+    return true;
+}
+
+bool roundTrip()
+{
+    LOG(info3) << "Round trip.";
+
+    roarchive::SharedContentCache cache(SegmentSize, 1);
+
+    for (std::size_t i(0); i < 4; ++i) { put(cache, i); }
+    for (std::size_t i(0); i < 4; ++i) {
+        if (!check(cache, i, true)) { return false; }
+    }
+
+    if (cache.get(key(100))) {
+        LOG(fatal) << "Unknown key found.";
+        return false;
+    }
+
+    // too big to be cached
+    put(cache, 200, cache.maxEntry() + 1);
+    if (cache.get(key(200))) {
+        LOG(fatal) << "Entry bigger than maxEntry() cached.";
+        return false;
+    }
+
+    // empty content is valid content
+    put(cache, 300, 0);
+    if (!check(cache, 300, true, 0)) { return false; }
+
+    const auto stats(cache.stats());
+    if ((stats.entries != 5) || (stats.insertions != 5)
+        || (stats.hits != 5) || (stats.misses != 2)
+        || (stats.bytes != 4 * EntrySize))
+    {
+        LOG(fatal) << "Unexpected stats: entries " << stats.entries
+                   << ", insertions " << stats.insertions << ", hits "
+                   << stats.hits << ", misses " << stats.misses
+                   << ", bytes " << stats.bytes << ".";
+        return false;
+    }
+    return true;
+}
+
+bool eviction()
+{
+    LOG(info3) << "Eviction.";
+
+    roarchive::SharedContentCache cache(SegmentSize, 1);
+
+    const std::size_t count(128);
+    for (std::size_t i(0); i < count; ++i) { put(cache, i); }
+
+    if (!cache.stats().evictions) {
+        LOG(fatal) << "Nothing evicted.";
+        return false;
+    }
+    if (cache.get(key(0))) {
+        LOG(fatal) << "Oldest entry not evicted.";
+        return false;
+    }
+    if (!check(cache, count - 1, true)) { return false; }
+    for (std::size_t i(0); i < count; ++i) {
+        if (!check(cache, i, false)) { return false; }
+    }
+
+    // pinned entry stays intact while the ring goes round several times
+    auto pinned(cache.get(key(count - 1)));
+    if (!pinned) {
+        LOG(fatal) << "Newest entry not cached.";
+        return false;
+    }
+    for (std::size_t i(count); i < 4 * count; ++i) { put(cache, i); }
+    if (std::string(pinned->data, pinned->size) != content(count - 1)) {
+        LOG(fatal) << "Pinned entry overwritten.";
+        return false;
+    }
+
+    // clear leaves pinned entry in place as well
+    cache.clear();
+    if (cache.stats().entries || cache.get(key(count - 1))) {
+        LOG(fatal) << "Cache not cleared.";
+        return false;
+    }
+    for (std::size_t i(0); i < count; ++i) { put(cache, i); }
+    if (std::string(pinned->data, pinned->size) != content(count - 1)) {
+        LOG(fatal) << "Pinned entry overwritten after clear.";
+        return false;
+    }
+
+    // released orphan space is reused
+    pinned.reset();
+    for (std::size_t i(count); i < 2 * count; ++i) { put(cache, i); }
+    return check(cache, 2 * count - 1, true);
+}
+
+/** Runs function in a forked child, returns its exit status.
+ */
+template <typename Function>
+int forked(Function function)
+{
+    const auto pid(::fork());
+    if (!pid) { ::_exit(function() ? EXIT_SUCCESS : EXIT_FAILURE); }
+
+    int status;
+    ::waitpid(pid, &status, 0);
+    return (WIFEXITED(status) ? WEXITSTATUS(status) : EXIT_FAILURE);
+}
+
+bool processes()
+{
+    LOG(info3) << "Processes.";
+
+    roarchive::SharedContentCache cache(SegmentSize, 1);
+
+    // child's content is seen by parent and vice versa
+    put(cache, 0);
+    if (forked([&]() { put(cache, 1); return check(cache, 0, true); })) {
+        LOG(fatal) << "Child did not see parent's entry.";
+        return false;
+    }
+    if (!check(cache, 1, true)) { return false; }
+
+    // child dies holding pins (no destructors run on _exit)
+    forked([&]() {
+            static std::vector<ContentCache::Content::pointer> held;
+            for (std::size_t i(0); i < 2; ++i) {
+                held.push_back(cache.get(key(i)));
+            }
+            return true;
+        });
+
+    // dead child's pins must not keep entries alive forever
+    cache.clear();
+    for (std::size_t i(2); i < 256; ++i) { put(cache, i); }
+    if (!check(cache, 255, true)) { return false; }
+
+    return true;
+}
+
+bool repair()
+{
+    LOG(info3) << "Repair.";
+
+    roarchive::SharedContentCache cache(SegmentSize, 1);
+
+    // kill writers at random points; some die holding the shard lock
+    for (int round(0); round < 20; ++round) {
+        const auto pid(::fork());
+        if (!pid) {
+            for (std::size_t i(round * 100000); ; ++i) {
+                put(cache, i);
+                check(cache, i, false);
+            }
+        }
+
+        std::this_thread::sleep_for(std::chrono::milliseconds(5 + round));
+        ::kill(pid, SIGKILL);
+        ::waitpid(pid, nullptr, 0);
+
+        // cache must stay usable and consistent
+        put(cache, 1 << 30);
+        if (!check(cache, 1 << 30, true)) { return false; }
+
+        const auto stats(cache.stats());
+        if (stats.bytes != stats.entries * EntrySize) {
+            LOG(fatal) << "Inconsistent cache after repair: "
+                       << stats.entries << " entries, " << stats.bytes
+                       << " bytes.";
+            return false;
+        }
+
+        for (std::size_t i(round * 100000), e(i + 1000); i < e; ++i) {
+            if (!check(cache, i, false)) { return false; }
+        }
+    }
+
+    return true;
+}
+
+} // namespace
+
+int main(int, char *[])
+{
+    bool ok(true);
+    ok = roundTrip() && ok;
+    ok = eviction() && ok;
+    ok = processes() && ok;
+    ok = repair() && ok;
+
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
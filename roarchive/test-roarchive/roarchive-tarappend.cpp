@@ -0,0 +1,142 @@
+/**
+ * Copyright (c) 2017 Melown Technologies SE
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * *  Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * *  Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+/** Tarball append test.
+ *
+ * Opens a tarball, appends entries to it (rewriting the file in place with
+ * the same leading entries, as tar -r does) and checks that refresh()
+ * picks up the new entries with correct content. Then rewrites the
+ * tarball with different entries and checks that refresh() refuses to
+ * append to the stale index. Runs with both sequential and parallel
+ * header scan.
+ *
+ * usage: roarchive-tarappend WORKDIR
+ */
+
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include <boost/filesystem.hpp>
+
+#include "dbglog/dbglog.hpp"
+#include "roarchive/roarchive.hpp"
+
+#include "generate.hpp"
+
+namespace fs = boost::filesystem;
+
+namespace {
+
+generate::Entry entry(std::size_t i)
+{
+    // sizes not aligned to tar blocks
+    return { "data/entry-" + std::to_string(i)
+            , std::string(1000 + 37 * i, char('a' + i % 26)) };
+}
+
+generate::Entry rewritten(std::size_t i)
+{
+    return { "other/entry-" + std::to_string(i)
+            , std::string(700 + 13 * i, char('z' - i % 26)) };
+}
+
+bool check(const roarchive::RoArchive &archive, std::size_t count)
+{
+    for (std::size_t i(0); i < count; ++i) {
+        const auto e(entry(i));
+        if (!archive.exists(e.name)) {
+            LOG(fatal) << "Entry " << e.name << " not found.";
+            return false;
+        }
+        const auto data(archive.istream(e.name)->read());
+        if (std::string(data.begin(), data.end()) != e.content) {
+            LOG(fatal) << "Entry " << e.name << " has wrong content.";
+            return false;
+        }
+    }
+
+    if (archive.list().size() != count) {
+        LOG(fatal) << "Archive lists " << archive.list().size()
+                   << " entries instead of " << count << ".";
+        return false;
+    }
+    return true;
+}
+
+bool run(const fs::path &tar, unsigned int scanThreads)
+{
+    LOG(info3) << "Tar append, " << scanThreads << " scan thread(s).";
+
+    generate::tar(tar, 8, entry);
+    roarchive::RoArchive archive
+        (tar, roarchive::OpenOptions().setMime("application/x-tar")
+         .setTarScanThreads(scanThreads));
+    if (!check(archive, 8)) { return false; }
+
+    // unchanged archive refreshes trivially
+    if (!archive.refresh()) {
+        LOG(fatal) << "Refresh of unchanged tarball failed.";
+        return false;
+    }
+
+    // append
+    generate::tar(tar, 20, entry);
+    if (!archive.refresh()) {
+        LOG(fatal) << "Refresh after append failed.";
+        return false;
+    }
+    if (!check(archive, 20)) { return false; }
+
+    // rewrite with different (and more) content: stale index must not be
+    // appended to
+    generate::tar(tar, 40, rewritten);
+    if (archive.refresh()) {
+        LOG(fatal) << "Refresh after rewrite appended to stale index.";
+        return false;
+    }
+
+    return true;
+}
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    if (argc < 2) {
+        LOG(fatal) << "Missing parameters.";
+        return EXIT_FAILURE;
+    }
+
+    const fs::path workdir(argv[1]);
+    fs::create_directories(workdir);
+    const auto tar(workdir / "append.tar");
+
+    bool ok(true);
+    for (const auto threads : { 0u, 4u }) { ok = run(tar, threads) && ok; }
+
+    fs::remove(tar);
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,166 @@
+/**
+ * Copyright (c) 2017 Melown Technologies SE
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * *  Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * *  Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+/** Parallel tarball scan test.
+ *
+ * Builds a tarball spanning several scan chunks with entries of odd sizes,
+ * GNU long names and nested tarballs as content (valid ustar headers inside
+ * file data) and checks that parallel and sequential scans index the very
+ * same files with the same content.
+ *
+ * usage: roarchive-tarscan WORKDIR
+ */
+
+#include <cstdlib>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#include <boost/filesystem.hpp>
+
+#include "dbglog/dbglog.hpp"
+#include "roarchive/roarchive.hpp"
+
+#include "generate.hpp"
+
+namespace fs = boost::filesystem;
+
+namespace {
+
+const std::size_t Count(3000);
+
+/** Small tarball used as file content: its headers are block aligned inside
+ *  the outer tarball and look like real ones to the chunk scanners.
+ */
+std::string decoy;
+
+generate::Entry inner(std::size_t i)
+{
+    return { "decoy/entry-" + std::to_string(i)
+            , std::string(100 + 600 * i, char('0' + i % 10)) };
+}
+
+generate::Entry entry(std::size_t i)
+{
+    std::string name("data/" + std::to_string(i % 17) + "/entry-"
+                     + std::to_string(i));
+    if (!(i % 11)) {
+        // GNU long name
+        name = "long/" + std::string(120 + i % 50, char('a' + i % 26))
+            + "-" + std::to_string(i);
+    }
+
+    if (!(i % 5)) { return { name, decoy }; }
+
+    // odd sizes, about 45 MiB in total
+    std::string content(((i * 7919) % 30011) + i % 3, '\0');
+    for (std::size_t j(0); j < content.size(); j += 61) {
+        content[j] = char(i + j);
+    }
+    return { name, content };
+}
+
+std::string read(const fs::path &path)
+{
+    std::ifstream f(path.string(), std::ios::binary);
+    return { std::istreambuf_iterator<char>(f)
+            , std::istreambuf_iterator<char>() };
+}
+
+roarchive::Files sorted(roarchive::Files files)
+{
+    std::sort(files.begin(), files.end());
+    return files;
+}
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    if (argc < 2) {
+        LOG(fatal) << "Missing parameters.";
+        return EXIT_FAILURE;
+    }
+
+    const fs::path workdir(argv[1]);
+    fs::create_directories(workdir);
+    const auto decoyPath(workdir / "decoy.tar");
+    const auto tar(workdir / "scan.tar");
+
+    generate::tar(decoyPath, 8, inner);
+    decoy = read(decoyPath);
+    fs::remove(decoyPath);
+
+    generate::tar(tar, Count, entry);
+
+    const auto open([&](unsigned int threads)
+    {
+        return roarchive::RoArchive
+            (tar, roarchive::OpenOptions().setMime("application/x-tar")
+             .setTarScanThreads(threads));
+    });
+
+    LOG(info3) << "Sequential scan.";
+    const auto sequential(open(0));
+    LOG(info3) << "Parallel scan.";
+    const auto parallel(open(4));
+
+    bool ok(true);
+    const auto list(sorted(sequential.list()));
+    if (list.size() != Count) {
+        LOG(fatal) << "Sequential scan found " << list.size()
+                   << " files instead of " << Count << ".";
+        ok = false;
+    }
+    if (sorted(parallel.list()) != list) {
+        LOG(fatal) << "Parallel scan differs from sequential one ("
+                   << parallel.list().size() << " vs. " << list.size()
+                   << " files).";
+        ok = false;
+    }
+
+    LOG(info3) << "Content.";
+    for (std::size_t i(0); ok && (i < Count); ++i) {
+        const auto e(entry(i));
+        for (const auto *archive : { &sequential, &parallel }) {
+            if (!archive->exists(e.name)) {
+                LOG(fatal) << "Entry " << e.name << " not found.";
+                ok = false;
+                break;
+            }
+            const auto data(archive->istream(e.name)->read());
+            if (std::string(data.begin(), data.end()) != e.content) {
+                LOG(fatal) << "Entry " << e.name << " has wrong content.";
+                ok = false;
+                break;
+            }
+        }
+    }
+
+    fs::remove(tar);
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,108 @@
+/**
+ * Copyright (c) 2017 Melown Technologies SE
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * *  Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * *  Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef roarchive_throttle_hpp_included_
+#define roarchive_throttle_hpp_included_
+
+#include <memory>
+#include <utility>
+
+#include <boost/iostreams/categories.hpp>
+#include <boost/iostreams/operations.hpp>
+#include <boost/iostreams/filtering_stream.hpp>
+
+#include "scheduler.hpp"
+
+namespace roarchive {
+
+/** Seekable input device wrapper that admits the stream through I/O
+ *  scheduler channel.
+ *
+ *  First read admits one operation that holds its queue slot until end of
+ *  data, close() or destruction; bytes actually read are charged after
+ *  each read.
+ */
+template <typename Device>
+class Throttled {
+public:
+    typedef char char_type;
+    struct category : boost::iostreams::device_tag
+                    , boost::iostreams::input_seekable
+                    , boost::iostreams::closable_tag
+    {};
+
+    Throttled(Device device, const IoScheduler::Channel::pointer &channel)
+        : device_(std::move(device)), channel_(channel)
+        , grant_(std::make_shared<IoScheduler::Grant>())
+    {}
+
+    std::streamsize read(char *s, std::streamsize n) {
+        if (!*grant_) { *grant_ = channel_->acquire(0); }
+        const auto r(boost::iostreams::read(device_, s, n));
+        if (r > 0) {
+            channel_->charge(r);
+        } else if (r < 0) {
+            *grant_ = IoScheduler::Grant();
+        }
+        return r;
+    }
+
+    std::streampos seek(boost::iostreams::stream_offset off
+                        , std::ios_base::seekdir way)
+    {
+        return boost::iostreams::seek(device_, off, way);
+    }
+
+    void close() {
+        *grant_ = IoScheduler::Grant();
+        boost::iostreams::close(device_);
+    }
+
+private:
+    Device device_;
+    IoScheduler::Channel::pointer channel_;
+
+    /** Devices are copied when pushed, the grant is shared.
+     */
+    std::shared_ptr<IoScheduler::Grant> grant_;
+};
+
+/** Pushes device to stream, throttled if there is a channel.
+ */
+template <typename Device>
+void push(boost::iostreams::filtering_istream &fis, Device &&device
+          , const IoScheduler::Channel::pointer &channel)
+{
+    typedef typename std::decay<Device>::type Type;
+    if (channel) {
+        fis.push(Throttled<Type>(std::forward<Device>(device), channel));
+    } else {
+        fis.push(std::forward<Device>(device));
+    }
+}
+
+} // namespace roarchive
+
+#endif // roarchive_throttle_hpp_included_
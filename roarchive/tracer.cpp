@@ -0,0 +1,129 @@
+/**
+ * Copyright (c) 2017 Melown Technologies SE
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * *  Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * *  Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <unistd.h>
+
+#include <thread>
+#include <functional>
+
+#include "dbglog/dbglog.hpp"
+
+#include "tracer.hpp"
+#include "error.hpp"
+
+namespace roarchive {
+
+namespace {
+
+void escape(std::ostream &os, const std::string &str)
+{
+    for (const char c : str) {
+        switch (c) {
+        case '"': os << "\\\""; break;
+        case '\\': os << "\\\\"; break;
+        case '\n': os << "\\n"; break;
+        case '\r': os << "\\r"; break;
+        case '\t': os << "\\t"; break;
+        default:
+            if (static_cast<unsigned char>(c) < 0x20) {
+                const char *hex("0123456789abcdef");
+                os << "\\u00" << hex[(c >> 4) & 0xf] << hex[c & 0xf];
+            } else {
+                os << c;
+            }
+        }
+    }
+}
+
+} // namespace
+
+ChromeTracer::ChromeTracer(std::ostream &os)
+    : os_(os), start_(std::chrono::steady_clock::now())
+    , pid_(::getpid()), first_(true)
+{
+    os_ << "[\n";
+}
+
+ChromeTracer::ChromeTracer(const boost::filesystem::path &path)
+    : file_(path.string(), std::ios_base::out | std::ios_base::trunc)
+    , os_(file_), start_(std::chrono::steady_clock::now())
+    , pid_(::getpid()), first_(true)
+{
+    if (!file_) {
+        LOGTHROW(err2, IOError)
+            << "Cannot open trace file " << path << ".";
+    }
+    os_ << "[\n";
+}
+
+ChromeTracer::~ChromeTracer()
+{
+    // closing bracket is optional in the array format but be nice
+    std::lock_guard<std::mutex> lock(mutex_);
+    os_ << "\n]\n";
+    os_.flush();
+}
+
+void ChromeTracer::begin(const char *name, const std::string &detail)
+{
+    event('B', name, detail.empty() ? nullptr : &detail);
+}
+
+void ChromeTracer::end(const char *name)
+{
+    event('E', name, nullptr);
+}
+
+void ChromeTracer::flush()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    os_.flush();
+}
+
+void ChromeTracer::event(char phase, const char *name
+                         , const std::string *detail)
+{
+    const auto ts(std::chrono::duration_cast<std::chrono::microseconds>
+                  (std::chrono::steady_clock::now() - start_).count());
+    const auto tid(std::hash<std::thread::id>()
+                   (std::this_thread::get_id()) & 0x7fffffff);
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!first_) { os_ << ",\n"; }
+    first_ = false;
+
+    os_ << "{\"name\":\"" << name << "\",\"cat\":\"roarchive\",\"ph\":\""
+        << phase << "\",\"ts\":" << ts << ",\"pid\":" << pid_
+        << ",\"tid\":" << tid;
+    if (detail) {
+        os_ << ",\"args\":{\"detail\":\"";
+        escape(os_, *detail);
+        os_ << "\"}";
+    }
+    os_ << '}';
+}
+
+} // namespace roarchive
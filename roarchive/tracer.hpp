@@ -0,0 +1,131 @@
+/**
+ * Copyright (c) 2017 Melown Technologies SE
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * *  Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * *  Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef roarchive_tracer_hpp_included_
+#define roarchive_tracer_hpp_included_
+
+#include <string>
+#include <memory>
+#include <mutex>
+#include <chrono>
+#include <fstream>
+
+#include <boost/filesystem/path.hpp>
+
+namespace roarchive {
+
+/** Tracing interface. Receives begin/end of spans of archive operations
+ *  (archive open, format detection, hint resolution, index build, lookup,
+ *  stream construction, read, decoded read, HTTP fetch).
+ *
+ *  Pass to OpenOptions::setTracer(). Calls come from any thread using the
+ *  archive, spans on one thread are properly nested. Name is always a
+ *  static string.
+ */
+class Tracer {
+public:
+    typedef std::shared_ptr<Tracer> pointer;
+
+    virtual ~Tracer() {}
+
+    /** Span start. Detail is span argument (usually path), may be empty.
+     */
+    virtual void begin(const char *name, const std::string &detail) = 0;
+
+    /** Span end.
+     */
+    virtual void end(const char *name) = 0;
+};
+
+/** Writes spans in Chrome trace_event JSON array format, viewable in
+ *  chrome://tracing or Perfetto.
+ */
+class ChromeTracer : public Tracer {
+public:
+    /** Writes trace to given stream. Stream must outlive the tracer.
+     */
+    ChromeTracer(std::ostream &os);
+
+    /** Writes trace to given file.
+     */
+    ChromeTracer(const boost::filesystem::path &path);
+
+    virtual ~ChromeTracer();
+
+    virtual void begin(const char *name, const std::string &detail);
+    virtual void end(const char *name);
+
+    void flush();
+
+private:
+    void event(char phase, const char *name, const std::string *detail);
+
+    std::ofstream file_;
+    std::ostream &os_;
+    std::mutex mutex_;
+    const std::chrono::steady_clock::time_point start_;
+    const long pid_;
+    bool first_;
+};
+
+/** Traces lifetime of this object as a span. No-op when tracer is null.
+ */
+class Span {
+public:
+    Span(Tracer *tracer, const char *name)
+        : tracer_(tracer), name_(name)
+    {
+        if (tracer_) { tracer_->begin(name_, std::string()); }
+    }
+
+    Span(Tracer *tracer, const char *name
+         , const boost::filesystem::path &detail)
+        : tracer_(tracer), name_(name)
+    {
+        if (tracer_) { tracer_->begin(name_, detail.string()); }
+    }
+
+    Span(const Tracer::pointer &tracer, const char *name)
+        : Span(tracer.get(), name)
+    {}
+
+    Span(const Tracer::pointer &tracer, const char *name
+         , const boost::filesystem::path &detail)
+        : Span(tracer.get(), name, detail)
+    {}
+
+    ~Span() { if (tracer_) { tracer_->end(name_); } }
+
+    Span(const Span&) = delete;
+    Span& operator=(const Span&) = delete;
+
+private:
+    Tracer *tracer_;
+    const char *name_;
+};
+
+} // namespace roarchive
+
+#endif // roarchive_tracer_hpp_included_
@@ -23,17 +23,18 @@
  * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
  * POSSIBILITY OF SUCH DAMAGE.
  */
-#include <map>
+#include <algorithm>
 
 #include "dbglog/dbglog.hpp"
 
-#include "utility/cppversion.hpp"
 #include "utility/streams.hpp"
-#include "utility/path.hpp"
-#include "utility/zip.hpp"
 
-#include "detail.hpp"
+#include "zip.hpp"
 #include "io.hpp"
+#include "footprint.hpp"
+#include "codec.hpp"
+#include "throttle.hpp"
+#include "governor.hpp"
 
 namespace fs = boost::filesystem;
 namespace bio = boost::iostreams;
@@ -42,55 +43,46 @@ namespace roarchive {
 
 namespace {
 
-class ZipIStream : public IStream {
-public:
-    ZipIStream(const utility::zip::Reader &reader, std::size_t zipIndex
-               , const IStream::FilterInit &filterInit
-               , const fs::path &index)
-        : IStream(filterInit), pf_(reader.plug(zipIndex, fis_))
-        , index_(index)
-    {
-        update(pf_.uncompressedSize, pf_.seekable);
+/** Filename part of generic path.
+ */
+boost::string_ref filename(boost::string_ref path)
+{
+    const auto slash(path.rfind('/'));
+    if (slash == boost::string_ref::npos) { return path; }
+    return path.substr(slash + 1);
+}
+
+/** Finds prefix directly in mapped central directory, without materializing
+ *  entry paths.
+ */
+HintedPath findPrefix(const fs::path &path, const FileHint &hint
+                      , const ZipDirectory &directory, Tracer *tracer)
+{
+    Phase phase(tracer, "findPrefix", path);
+
+    HintNameMatcher matcher(hint);
+    for (const auto &entry : directory.entries()) {
+        matcher(directory.name(entry));
     }
 
-    virtual fs::path path() const { return pf_.path; }
-    virtual fs::path index() const { return index_; }
-    virtual void close() {}
+    if (!matcher) {
+        LOGTHROW(err2, std::runtime_error)
+            << "No \"" << hint << "\" found in the zip archive at "
+            << path << ".";
+    }
 
-private:
-    utility::zip::PluggedFile pf_;
-    const fs::path index_;
-};
+    return matcher.match();
+}
 
-HintedPath
-findPrefix(const fs::path &path, const FileHint &hint
-           , const utility::zip::Reader::Record::list &files)
+/** Same over reader's file list.
+ */
+HintedPath findPrefix(const fs::path &path, const FileHint &hint
+                      , const utility::zip::Reader &reader, Tracer *tracer)
 {
-    if (!hint) { return {}; }
+    Phase phase(tracer, "findPrefix", path);
 
-    // sort paths by depth
-    struct Path {
-        const fs::path *path;
-        std::size_t depth;
-
-        Path(const utility::zip::Reader::Record &record)
-            : path(&record.path)
-            , depth(std::distance(path->begin(), path->end())) {}
-        bool operator<(const Path &o) const { return depth < o.depth; }
-    };
-
-    std::vector<Path> paths;
-    paths.reserve(files.size());
-    for (const auto &file : files) { paths.emplace_back(file); }
-    std::sort(paths.begin(), paths.end());
-
-    // match all files
-    FileHint::Matcher matcher(hint);
-    for (const auto &path : paths) {
-        if (matcher(*path.path)) {
-            return HintedPath(path.path->parent_path(), path.path->filename());
-        }
-    }
+    HintNameMatcher matcher(hint);
+    for (const auto &file : reader.files()) { matcher(file.path.native()); }
 
     if (!matcher) {
         LOGTHROW(err2, std::runtime_error)
@@ -98,93 +90,367 @@ findPrefix(const fs::path &path, const FileHint &hint
             << path << ".";
     }
 
-    return HintedPath(matcher.match().parent_path()
-                      , matcher.match().filename());
+    return matcher.match();
 }
 
-class Zip : public RoArchive::Detail {
-public:
-    Zip(const boost::filesystem::path &path, const OpenOptions &openOptions)
-        : Detail(path), reader_(path, openOptions.fileLimit)
-        , prefix_(findPrefix(path, openOptions.hint, reader_.files()))
-    {
-        for (const auto &file : reader_.files()) {
-            if (!utility::isPathPrefix(file.path, prefix_.path)) { continue; }
+/** Maps central directory. Returns null if it is beyond the mapped index
+ *  (central directory over 4 GiB) and the reader is allowed to take over;
+ *  not with managed descriptors, the reader keeps its own.
+ */
+std::unique_ptr<ZipDirectory> mapDirectory(const fs::path &path
+                                           , const OpenOptions &openOptions)
+{
+    try {
+        return std::make_unique<ZipDirectory>
+            (path, openOptions.fileLimit, openOptions.fdManager);
+    } catch (const NotImplemented &e) {
+        if (openOptions.mapZipDirectory || openOptions.fdManager) { throw; }
+        LOG(info2) << "Falling back to zip reader: " << e.what();
+    }
+    return {};
+}
+
+HintedPath findPrefix(const fs::path &path, const FileHint &hint
+                      , const utility::zip::Reader *reader
+                      , const ZipDirectory *directory
+                      , Tracer *tracer)
+{
+    if (!hint) { return {}; }
+    if (reader) { return findPrefix(path, hint, *reader, tracer); }
+    return findPrefix(path, hint, *directory, tracer);
+}
+
+} // namespace
+
+MappedZipIStream::MappedZipIStream(const ZipDirectory &directory
+                                   , const ZipDirectory::Entry &entry
+                                   , const ZipDirectory::Filedes &fd
+                                   , const IStream::FilterInit &filterInit
+                                   , const fs::path &path
+                                   , const fs::path &index
+                                   , const IoScheduler::Channel::pointer
+                                   &ioChannel
+                                   , FdManager::Lease lease
+                                   , const InflateCheckpoints::pointer
+                                   &checkpoints)
+    : IStream(filterInit), path_(path), index_(index)
+    , directory_(directory), entry_(entry), fd_(fd), ioChannel_(ioChannel)
+    , lease_(std::move(lease))
+{
+    if (checkpoints && (entry.method == codec::Method::deflate)) {
+        push(fis_, SeekableInflate(directory, fd, entry.uncompressedSize
+                                   , checkpoints, path)
+             , ioChannel);
+        update(std::size_t(entry.uncompressedSize), true);
+        enableReadWhole();
+        return;
+    }
+
+    codec::push(entry.method, entry.uncompressedSize, fis_, path);
+    push(fis_, utility::io::SubStreamDevice(directory.path(), fd)
+         , ioChannel);
+    update(std::size_t(entry.uncompressedSize)
+           , (entry.method == codec::Method::stored));
+    enableReadWhole();
+}
+
+std::vector<char> MappedZipIStream::readWhole()
+{
+    IoScheduler::Grant grant;
+    if (ioChannel_) { grant = ioChannel_->acquire(fd_.end - fd_.start); }
+
+    std::vector<char> data(entry_.uncompressedSize);
+    if (entry_.method == codec::Method::stored) {
+        directory_.read(data.data(), data.size(), fd_.start);
+        return data;
+    }
+
+    // compressed data go through per-thread scratch buffer
+    static thread_local std::vector<char> buffer;
+    buffer.resize(fd_.end - fd_.start);
+    directory_.read(buffer.data(), buffer.size(), fd_.start);
+    codec::decode(entry_.method, buffer.data(), buffer.size()
+                  , data.data(), data.size(), path_);
+
+    // do not keep huge buffers around
+    if (buffer.capacity() > (16 << 20)) { std::vector<char>().swap(buffer); }
+    return data;
+}
+
+Zip::Zip(const fs::path &path, const OpenOptions &openOptions)
+    : Detail(path, Backend::zip, openOptions)
+    , directory_(mapDirectory(path, openOptions))
+    , reader_(directory_
+              ? nullptr
+              : std::make_unique<utility::zip::Reader>
+              (path, openOptions.fileLimit))
+    , memoryResource_(openOptions.memoryResource)
+    , prefix_(findPrefix(path, openOptions.hint, reader_.get()
+                         , directory_.get(), openOptions.tracer.get()))
+    , resolveOffsets_(openOptions.resolveZipOffsets)
+{
+    if (openOptions.zipCheckpointInterval) {
+        checkpoints_ = std::make_shared<InflateCheckpointCache>
+            (openOptions.zipCheckpointInterval
+             , openOptions.zipCheckpointBudget);
+        if (openOptions.memoryGovernor) {
+            openOptions.memoryGovernor->add(checkpoints_);
+        }
+    }
+
+    if (directory_) {
+        buildMappedIndex();
+    } else {
+        index_ = build();
+    }
+}
+
+std::unique_ptr<Zip::Index> Zip::build() const
+{
+    Phase phase(tracer(), "index", path_);
+
+    const auto &files(reader_->files());
+    std::size_t names(0);
+    for (const auto &file : files) { names += file.path.native().size(); }
+
+    auto index(std::make_unique<Index>(memoryResource_));
+    index->reserve(files.size(), names);
+
+    for (const auto &file : files) {
+        boost::string_ref path(file.path.native());
+        if (!prefix_.cut(path)) { continue; }
+        index->add(path, file.index);
+    }
+
+    index->finish();
+    return index;
+}
 
-            const auto path(utility::cutPathPrefix(file.path, prefix_.path));
-            index_.insert(map::value_type(path.string(), file));
+ZipDirectory::Entries Zip::buildMapped() const
+{
+    Phase phase(tracer(), "index", path_);
+
+    auto entries(directory_->entries());
+
+    if (!prefix_.path.empty()) {
+        // keep only entries under prefix, cut prefix from their names
+        const auto cut(prefix_.prefix.size());
+        auto out(entries.begin());
+        for (const auto &entry : entries) {
+            if (!directory_->name(entry).starts_with(prefix_.prefix)) {
+                continue;
+            }
+            *out = entry;
+            out->name += cut;
+            out->nameLength -= cut;
+            ++out;
         }
+        entries.erase(out, entries.end());
+        entries.shrink_to_fit();
     }
 
-    /** Get (wrapped) input stream for given file.
-     *  Throws when not found.
-     */
-    virtual IStream::pointer istream(const boost::filesystem::path &path
-                                     , const IStream::FilterInit &filterInit)
-        const
+    // sort by name, first occurrence of duplicate name wins
+    const auto &directory(*directory_);
+    std::stable_sort(entries.begin(), entries.end()
+                     , [&directory](const ZipDirectory::Entry &l
+                                    , const ZipDirectory::Entry &r)
+                     {
+                         return directory.name(l) < directory.name(r);
+                     });
+    entries.erase(std::unique(entries.begin(), entries.end()
+                              , [&directory](const ZipDirectory::Entry &l
+                                             , const ZipDirectory::Entry &r)
+                              {
+                                  return directory.name(l)
+                                      == directory.name(r);
+                              })
+                  , entries.end());
+    return entries;
+}
+
+void Zip::buildMappedIndex()
+{
+    // offsets refer to current entries, drop them first
+    offsets_.reset();
+    entries_ = buildMapped();
+    offsets_ = std::make_unique<ZipDataOffsets>(*directory_, entries_);
+    if (resolveOffsets_) { offsets_->resolveInBackground(); }
+}
+
+IStream::pointer Zip::mappedIStream(const fs::path &path
+                                    , const IStream::FilterInit &filterInit)
+    const
+{
+    const ZipDirectory::Entry *entry;
     {
-        auto findex(index_.find(path.string()));
-        if (findex == index_.end()) {
+        Probe probe(instrumentation_, Operation::lookup);
+        entry = findMapped(path.string());
+    }
+    if (!entry) {
+        LOGTHROW(err2, NoSuchFile)
+            << "File " << path << " not found in the zip archive at "
+            << path_ << ".";
+    }
+
+    auto fd(offsets_->data(entry - entries_.data()));
+    auto lease(directory_->lease());
+    if (lease) { fd.fd = lease.fd(); }
+
+    return std::make_unique<MappedZipIStream>
+        (*directory_, *entry, fd, filterInit, prefix_.path / path, path
+         , ioChannel_, std::move(lease), checkpoints(*entry));
+}
+
+boost::optional<RawFile> Zip::openRaw(const fs::path &path) const
+{
+    if (!directory_) {
+        if (!exists(path)) {
             LOGTHROW(err2, NoSuchFile)
                 << "File " << path << " not found in the zip archive at "
                 << path_ << ".";
         }
+        return boost::none;
+    }
 
-        return std::make_unique<ZipIStream>
-            (reader_, findex->second.index, filterInit, path);
+    const ZipDirectory::Entry *entry;
+    {
+        Probe probe(instrumentation_, Operation::lookup);
+        entry = findMapped(path.string());
+    }
+    if (!entry) {
+        LOGTHROW(err2, NoSuchFile)
+            << "File " << path << " not found in the zip archive at "
+            << path_ << ".";
     }
+    if (entry->method != codec::Method::stored) { return boost::none; }
+
+    const auto fd(offsets_->data(entry - entries_.data()));
+    auto lease(directory_->lease());
+    if (!lease) { return RawFile(fd.fd, fd.start, fd.end - fd.start); }
+
+    const auto raw(lease.fd());
+    return RawFile(raw, fd.start, fd.end - fd.start
+                   , std::make_shared<FdManager::Lease>(std::move(lease)));
+}
 
-    virtual bool exists(const boost::filesystem::path &path) const {
-        return (index_.find(path.string()) != index_.end());
+InflateCheckpoints::pointer
+Zip::checkpoints(const ZipDirectory::Entry &entry) const
+{
+    if (!checkpoints_ || (entry.method != codec::Method::deflate)) {
+        return {};
     }
+    return checkpoints_->get(entry.localHeader);
+}
 
-    virtual Files list() const {
-        Files list;
-        for (const auto &pair : index_) {
-            list.push_back(pair.first);
+Files Zip::list() const
+{
+    Files list;
+    if (directory_) {
+        list.reserve(entries_.size());
+        for (const auto &entry : entries_) {
+            const auto name(directory_->name(entry));
+            list.emplace_back(name.begin(), name.end());
         }
         return list;
     }
 
-    virtual boost::optional<fs::path> findFile(const std::string &filename)
-        const
-    {
-        for (const auto &pair : index_) {
-            if (pair.second.path.filename() == filename) {
-                return fs::path(pair.first);
+    list.reserve(index_->size());
+    for (const auto &item : *index_) {
+        list.emplace_back(item.key.begin(), item.key.end());
+    }
+    return list;
+}
+
+DatasetRoots Zip::discover(const FileHint &hint) const
+{
+    Discovery discovery(hint);
+    if (directory_) {
+        // whole directory, mapped index is cut to prefix
+        for (const auto &entry : directory_->entries()) {
+            discovery(directory_->name(entry));
+        }
+    } else {
+        for (const auto &record : reader_->files()) {
+            discovery(pathOf(record).generic_string());
+        }
+    }
+    return discovery.roots();
+}
+
+boost::optional<fs::path> Zip::findFile(const std::string &filename) const
+{
+    if (directory_) {
+        for (const auto &entry : entries_) {
+            const auto name(directory_->name(entry));
+            if (roarchive::filename(name) == filename) {
+                return fs::path(name.begin(), name.end());
             }
         }
         return boost::none;
     }
 
-    virtual void applyHint(const FileHint &hint) {
-        if (!hint) { return; }
-
-        // regenerate
-        prefix_ = findPrefix(path_, hint, reader_.files());
-        index_.clear();
-
-        for (const auto &file : reader_.files()) {
-            if (!utility::isPathPrefix(file.path, prefix_.path)) { continue; }
-
-            const auto path(utility::cutPathPrefix(file.path, prefix_.path));
-            index_.insert(map::value_type(path.string(), file));
+    for (const auto &item : *index_) {
+        if (roarchive::filename(item.key) == filename) {
+            return fs::path(item.key.begin(), item.key.end());
         }
     }
+    return boost::none;
+}
 
-    virtual const boost::optional<boost::filesystem::path>& usedHint() {
-        return prefix_.usedHint;
+void Zip::applyHint(const FileHint &hint)
+{
+    if (!hint) { return; }
+
+    // regenerate, old index (and its arena) is dropped as a whole
+    prefix_ = findPrefix(path_, hint, reader_.get(), directory_.get()
+                         , tracer());
+    if (directory_) {
+        buildMappedIndex();
+    } else {
+        index_ = build();
     }
+}
 
-private:
-    utility::zip::Reader reader_;
-    HintedPath prefix_;
+MemoryUsage Zip::memoryUsage() const
+{
+    auto mu(Detail::memoryUsage());
+    mu.add("object", footprint::allocated(sizeof(*this)));
+
+    if (directory_) {
+        // mapping is backed by page cache, reported separately
+        mu.add("directory", directory_->size());
+        mu.add("index", (footprint::allocated(sizeof(ZipDirectory))
+                         + footprint::heap(entries_)));
+        mu.add("offsets", (footprint::allocated(sizeof(ZipDataOffsets))
+                           + footprint::allocated
+                           (entries_.size()
+                            * sizeof(std::atomic<std::uint64_t>))));
+
+        if (checkpoints_) {
+            mu.add("checkpoints"
+                   , (footprint::allocated(sizeof(InflateCheckpointCache))
+                      + (checkpoints_->size()
+                         * footprint::allocated(sizeof(InflateCheckpoints)))
+                      + checkpoints_->memory()));
+        }
+    } else {
+        const auto &files(reader_->files());
+        std::size_t records(footprint::heap(files));
+        for (const auto &file : files) {
+            records += footprint::heap(file.path);
+        }
+        mu.add("records", records);
 
-    typedef std::map<std::string, utility::zip::Reader::Record> map;
-    map index_;
-};
+        mu.add("index", (footprint::allocated(sizeof(Index))
+                         + index_->arena().reserved()));
+    }
 
-} // namespace
+    mu.add("prefix", (footprint::heap(prefix_.path)
+                      + footprint::heap(prefix_.prefix)
+                      + (prefix_.usedHint
+                         ? footprint::heap(*prefix_.usedHint) : 0)));
+    return mu;
+}
 
 RoArchive::dpointer RoArchive::zip(const boost::filesystem::path &path
                                    , const OpenOptions &openOptions)
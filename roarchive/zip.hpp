@@ -0,0 +1,258 @@
+/**
+ * Copyright (c) 2017 Melown Technologies SE
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * *  Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * *  Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef roarchive_zip_hpp_included_
+#define roarchive_zip_hpp_included_
+
+#include <string>
+#include <memory>
+#include <algorithm>
+
+#include "dbglog/dbglog.hpp"
+
+#include "utility/cppversion.hpp"
+#include "utility/zip.hpp"
+
+#include "detail.hpp"
+#include "arena.hpp"
+#include "zipdir.hpp"
+#include "inflate.hpp"
+#include "scheduler.hpp"
+
+namespace roarchive {
+
+class ZipIStream : public IStream {
+public:
+    ZipIStream(const utility::zip::Reader &reader, std::size_t zipIndex
+               , const IStream::FilterInit &filterInit
+               , const boost::filesystem::path &index
+               , const IoScheduler::Channel::pointer &ioChannel)
+        : IStream(filterInit), pf_(plug(reader, zipIndex, ioChannel))
+        , index_(index)
+    {
+        update(pf_.uncompressedSize, pf_.seekable);
+    }
+
+    virtual boost::filesystem::path path() const { return pf_.path; }
+    virtual boost::filesystem::path index() const { return index_; }
+    virtual void close() {}
+
+private:
+    /** Reader's device cannot be wrapped, whole entry is admitted as one
+     *  operation when opened.
+     */
+    utility::zip::PluggedFile plug(const utility::zip::Reader &reader
+                                   , std::size_t zipIndex
+                                   , const IoScheduler::Channel::pointer
+                                   &ioChannel)
+    {
+        if (!ioChannel) { return reader.plug(zipIndex, fis_); }
+        const auto grant(ioChannel->acquire(0));
+        auto pf(reader.plug(zipIndex, fis_));
+        if (pf.uncompressedSize) { ioChannel->charge(*pf.uncompressedSize); }
+        return pf;
+    }
+
+    utility::zip::PluggedFile pf_;
+    const boost::filesystem::path index_;
+};
+
+/** Stream over zip entry located via mapped central directory. Supports
+ *  stored, deflate, zstd and LZMA entries (the latter two if compiled in).
+ *  Deflate entries are seekable when given decoder checkpoints.
+ */
+class MappedZipIStream : public IStream {
+public:
+    MappedZipIStream(const ZipDirectory &directory
+                     , const ZipDirectory::Entry &entry
+                     , const ZipDirectory::Filedes &fd
+                     , const IStream::FilterInit &filterInit
+                     , const boost::filesystem::path &path
+                     , const boost::filesystem::path &index
+                     , const IoScheduler::Channel::pointer &ioChannel
+                     , FdManager::Lease lease
+                     , const InflateCheckpoints::pointer &checkpoints
+                     = nullptr);
+
+    virtual boost::filesystem::path path() const { return path_; }
+    virtual boost::filesystem::path index() const { return index_; }
+    virtual void close() {}
+
+private:
+    /** Reads (and decodes) whole entry at once into the result.
+     */
+    virtual std::vector<char> readWhole();
+
+    const boost::filesystem::path path_;
+    const boost::filesystem::path index_;
+    const ZipDirectory &directory_;
+    const ZipDirectory::Entry entry_;
+    const ZipDirectory::Filedes fd_;
+    const IoScheduler::Channel::pointer ioChannel_;
+
+    /** Keeps managed descriptor open.
+     */
+    FdManager::Lease lease_;
+};
+
+/** Zip archive backend.
+ *
+ *  Works directly over mmapped central directory. Archives with central
+ *  directory too big to map fall back to utility::zip::Reader's parsed
+ *  file list (stored and deflate entries only, no decoder checkpoints)
+ *  unless OpenOptions::mapZipDirectory or OpenOptions::fdManager is set.
+ */
+class Zip final : public RoArchive::Detail {
+public:
+    Zip(const boost::filesystem::path &path, const OpenOptions &openOptions);
+
+    /** Get (wrapped) input stream for given file.
+     *  Throws when not found.
+     */
+    virtual IStream::pointer istream(const boost::filesystem::path &path
+                                     , const IStream::FilterInit &filterInit)
+        const
+    {
+        if (directory_) { return mappedIStream(path, filterInit); }
+
+        const std::size_t *zipIndex;
+        {
+            Probe probe(instrumentation_, Operation::lookup);
+            zipIndex = index_->find(path.string());
+        }
+        if (!zipIndex) {
+            LOGTHROW(err2, NoSuchFile)
+                << "File " << path << " not found in the zip archive at "
+                << path_ << ".";
+        }
+
+        return std::make_unique<ZipIStream>
+            (*reader_, *zipIndex, filterInit, path, ioChannel_);
+    }
+
+    using Detail::istream;
+
+    /** Paths are relative to hinted prefix that can be changed by
+     *  applyHint().
+     */
+    virtual boost::optional<std::string>
+    cacheIdentity(const boost::filesystem::path&) const {
+        return '/' + prefix_.prefix;
+    }
+
+    /** Stored entries only. Not available when opened by the reader
+     *  fallback, it does not expose data offsets.
+     */
+    virtual boost::optional<RawFile>
+    openRaw(const boost::filesystem::path &path) const;
+
+    virtual bool exists(const boost::filesystem::path &path) const {
+        if (directory_) { return findMapped(path.string()); }
+        return index_->find(path.string());
+    }
+
+    virtual Files list() const;
+
+    virtual DatasetRoots discover(const FileHint &hint) const;
+
+    virtual boost::optional<boost::filesystem::path>
+    findFile(const std::string &filename) const;
+
+    virtual void applyHint(const FileHint &hint);
+
+    virtual const boost::optional<boost::filesystem::path>& usedHint() {
+        return prefix_.usedHint;
+    }
+
+    virtual MemoryUsage memoryUsage() const;
+
+private:
+    /** Maps path to zip entry index.
+     */
+    typedef ArenaIndex<std::size_t> Index;
+
+    std::unique_ptr<Index> build() const;
+
+    /** Builds sorted entries with names cut to index keys.
+     */
+    ZipDirectory::Entries buildMapped() const;
+
+    /** (Re)creates mapped index.
+     */
+    void buildMappedIndex();
+
+    const ZipDirectory::Entry* findMapped(const std::string &path) const {
+        const boost::string_ref key(path);
+        auto fentries(std::lower_bound
+                      (entries_.begin(), entries_.end(), key
+                       , [this](const ZipDirectory::Entry &entry
+                                , boost::string_ref key)
+                       {
+                           return directory_->name(entry) < key;
+                       }));
+        if ((fentries == entries_.end())
+            || (directory_->name(*fentries) != key))
+        {
+            return nullptr;
+        }
+        return &*fentries;
+    }
+
+    IStream::pointer mappedIStream(const boost::filesystem::path &path
+                                   , const IStream::FilterInit &filterInit)
+        const;
+
+    /** Checkpoints of given entry, null if disabled or not deflated.
+     */
+    InflateCheckpoints::pointer checkpoints(const ZipDirectory::Entry &entry)
+        const;
+
+    std::unique_ptr<ZipDirectory> directory_;
+    std::unique_ptr<utility::zip::Reader> reader_;
+    MemoryResource::pointer memoryResource_;
+    HintedPath prefix_;
+
+    /** Reader mode index.
+     */
+    std::unique_ptr<Index> index_;
+
+    /** Mapped mode index: entries sorted by (prefix-less) name.
+     */
+    ZipDirectory::Entries entries_;
+
+    /** Mapped mode: data offsets of entries_.
+     */
+    std::unique_ptr<ZipDataOffsets> offsets_;
+    bool resolveOffsets_;
+
+    /** Mapped mode: decoder checkpoints of deflate entries, keyed by local
+     *  header position (survives index regeneration). Null if disabled.
+     */
+    InflateCheckpointCache::pointer checkpoints_;
+};
+
+} // namespace roarchive
+
+#endif // roarchive_zip_hpp_included_
@@ -0,0 +1,441 @@
+/**
+ * Copyright (c) 2017 Melown Technologies SE
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * *  Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * *  Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include <cstring>
+#include <system_error>
+#include <algorithm>
+#include <limits>
+
+#include "dbglog/dbglog.hpp"
+
+#include "zipdir.hpp"
+#include "error.hpp"
+
+namespace fs = boost::filesystem;
+
+namespace roarchive {
+
+namespace {
+
+const std::uint32_t EocdSignature(0x06054b50);
+const std::uint32_t Zip64LocatorSignature(0x07064b50);
+const std::uint32_t Zip64EocdSignature(0x06064b50);
+const std::uint32_t CentralSignature(0x02014b50);
+const std::uint32_t LocalSignature(0x04034b50);
+
+const std::size_t EocdSize(22);
+const std::size_t Zip64LocatorSize(20);
+const std::size_t Zip64EocdSize(56);
+const std::size_t CentralSize(46);
+const std::size_t LocalSize(30);
+const std::size_t MaxComment(0xffff);
+
+const std::uint16_t Zip64ExtraId(0x0001);
+
+// little endian readers
+
+inline std::uint16_t le16(const char *p)
+{
+    const auto *u(reinterpret_cast<const unsigned char*>(p));
+    return std::uint16_t(u[0] | (u[1] << 8));
+}
+
+inline std::uint32_t le32(const char *p)
+{
+    return std::uint32_t(le16(p)) | (std::uint32_t(le16(p + 2)) << 16);
+}
+
+inline std::uint64_t le64(const char *p)
+{
+    return std::uint64_t(le32(p)) | (std::uint64_t(le32(p + 4)) << 32);
+}
+
+void preadAll(int fd, const fs::path &path, char *buf, std::size_t size
+              , std::uint64_t offset)
+{
+    while (size) {
+        const auto r(::pread(fd, buf, size, offset));
+        if (r < 0) {
+            if (errno == EINTR) { continue; }
+            std::system_error e(errno, std::system_category());
+            LOGTHROW(err2, IOError)
+                << "Cannot read from zip archive at " << path
+                << ": <" << e.code() << ", " << e.what() << ">.";
+        }
+        if (!r) {
+            LOGTHROW(err2, NotAnArchive)
+                << "Unexpected end of zip archive at " << path << ".";
+        }
+        buf += r;
+        size -= r;
+        offset += r;
+    }
+}
+
+} // namespace
+
+ZipDirectory::ZipDirectory(const fs::path &path, std::size_t fileLimit
+                           , const FdManager::pointer &fdManager)
+    : path_(path), fileLimit_(fileLimit), fd_(-1), fileSize_()
+    , map_(MAP_FAILED), mapSize_(), data_(), size_(), count_()
+{
+    fd_ = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd_ < 0) {
+        std::system_error e(errno, std::system_category());
+        LOGTHROW(err2, IOError)
+            << "Cannot open zip archive at " << path
+            << ": <" << e.code() << ", " << e.what() << ">.";
+    }
+
+    // from now on, close file on error
+    try {
+        struct ::stat st;
+        if (::fstat(fd_, &st) < 0) {
+            std::system_error e(errno, std::system_category());
+            LOGTHROW(err2, IOError)
+                << "Cannot stat zip archive at " << path
+                << ": <" << e.code() << ", " << e.what() << ">.";
+        }
+        fileSize_ = st.st_size;
+
+        if (fileSize_ < EocdSize) {
+            LOGTHROW(err2, NotAnArchive)
+                << "File at " << path << " is not a zip archive.";
+        }
+
+        // read tail and find end of central directory record
+        const std::size_t tailSize
+            (std::min<std::uint64_t>(fileSize_, EocdSize + MaxComment));
+        const std::uint64_t tailStart(fileSize_ - tailSize);
+        std::vector<char> tail(tailSize);
+        preadAll(fd_, path, tail.data(), tailSize, tailStart);
+
+        // EOCD's comment must reach exactly to the end of file, otherwise
+        // the signature is just part of some comment
+        const char *eocd(nullptr);
+        for (std::size_t i(tailSize - EocdSize + 1); i-- > 0; ) {
+            const auto *p(tail.data() + i);
+            if ((le32(p) == EocdSignature)
+                && ((i + EocdSize + le16(p + 20)) == tailSize))
+            {
+                eocd = p; break;
+            }
+        }
+
+        if (!eocd) {
+            LOGTHROW(err2, NotAnArchive)
+                << "No end of central directory found in zip archive at "
+                << path << ".";
+        }
+
+        count_ = le16(eocd + 10);
+        std::uint64_t cdSize(le32(eocd + 12));
+        std::uint64_t cdOffset(le32(eocd + 16));
+
+        // zip64 locator precedes EOCD
+        const std::uint64_t eocdPos(tailStart + (eocd - tail.data()));
+        if (eocdPos >= Zip64LocatorSize) {
+            char locator[Zip64LocatorSize];
+            preadAll(fd_, path, locator, sizeof(locator)
+                     , eocdPos - Zip64LocatorSize);
+            if (le32(locator) == Zip64LocatorSignature) {
+                char record[Zip64EocdSize];
+                preadAll(fd_, path, record, sizeof(record)
+                         , le64(locator + 8));
+                if (le32(record) != Zip64EocdSignature) {
+                    LOGTHROW(err2, NotAnArchive)
+                        << "Invalid zip64 end of central directory in zip "
+                        "archive at " << path << ".";
+                }
+                count_ = le64(record + 32);
+                cdSize = le64(record + 40);
+                cdOffset = le64(record + 48);
+            }
+        }
+
+        if ((cdOffset + cdSize) > fileSize_) {
+            LOGTHROW(err2, NotAnArchive)
+                << "Central directory out of file bounds in zip archive at "
+                << path << ".";
+        }
+
+        if (cdSize > std::numeric_limits<std::uint32_t>::max()) {
+            LOGTHROW(err2, NotImplemented)
+                << "Central directory larger than 4 GiB in zip archive at "
+                << path << " cannot be mapped.";
+        }
+
+        size_ = cdSize;
+        if (size_) {
+            // map central directory, mapping must start at page boundary
+            const std::uint64_t page(::sysconf(_SC_PAGESIZE));
+            const std::uint64_t mapStart(cdOffset - (cdOffset % page));
+            mapSize_ = (cdOffset + cdSize) - mapStart;
+
+            map_ = ::mmap(nullptr, mapSize_, PROT_READ, MAP_SHARED, fd_
+                          , mapStart);
+            if (map_ == MAP_FAILED) {
+                std::system_error e(errno, std::system_category());
+                LOGTHROW(err2, IOError)
+                    << "Cannot map central directory of zip archive at "
+                    << path << ": <" << e.code() << ", " << e.what() << ">.";
+            }
+
+            // we are going to parse it all
+            ::madvise(map_, mapSize_, MADV_WILLNEED);
+            data_ = static_cast<const char*>(map_) + (cdOffset - mapStart);
+        }
+    } catch (...) {
+        ::close(fd_);
+        throw;
+    }
+
+    if (fdManager) {
+        // mapping does not need the descriptor, manager owns it now
+        const auto fd(fd_);
+        fd_ = -1;
+        try {
+            file_ = fdManager->adopt(path, fd);
+        } catch (...) {
+            if (map_ != MAP_FAILED) { ::munmap(map_, mapSize_); }
+            throw;
+        }
+    }
+}
+
+ZipDirectory::~ZipDirectory()
+{
+    if (map_ != MAP_FAILED) { ::munmap(map_, mapSize_); }
+    if (fd_ >= 0) { ::close(fd_); }
+}
+
+ZipDirectory::Entries ZipDirectory::entries() const
+{
+    Entries entries;
+    entries.reserve(std::min<std::uint64_t>(count_, fileLimit_));
+
+    const char *p(data_);
+    const char *end(data_ + size_);
+
+    for (std::uint64_t i(0); (i < count_) && (entries.size() < fileLimit_);
+         ++i)
+    {
+        if (((end - p) < std::ptrdiff_t(CentralSize))
+            || (le32(p) != CentralSignature))
+        {
+            LOGTHROW(err2, NotAnArchive)
+                << "Invalid central directory entry #" << i
+                << " in zip archive at " << path_ << ".";
+        }
+
+        const auto nameLength(le16(p + 28));
+        const auto extraLength(le16(p + 30));
+        const auto commentLength(le16(p + 32));
+        const char *name(p + CentralSize);
+        const char *next(name + nameLength + extraLength + commentLength);
+        if (next > end) {
+            LOGTHROW(err2, NotAnArchive)
+                << "Truncated central directory entry #" << i
+                << " in zip archive at " << path_ << ".";
+        }
+
+        Entry entry;
+        entry.localHeader = le32(p + 42);
+        entry.compressedSize = le32(p + 20);
+        entry.uncompressedSize = le32(p + 24);
+        entry.name = name - data_;
+        entry.nameLength = nameLength;
+        entry.method = le16(p + 10);
+
+        // zip64 extended information: present values replace saturated ones
+        const char *extra(name + nameLength);
+        const char *extraEnd(extra + extraLength);
+        while ((extraEnd - extra) >= 4) {
+            const auto id(le16(extra));
+            const auto size(le16(extra + 2));
+            const char *field(extra + 4);
+            const char *fieldEnd(field + size);
+            if (fieldEnd > extraEnd) { break; }
+
+            if (id == Zip64ExtraId) {
+                const auto take([&](std::uint64_t &value) {
+                        if (value != 0xffffffff) { return; }
+                        if ((fieldEnd - field) < 8) { return; }
+                        value = le64(field);
+                        field += 8;
+                    });
+                take(entry.uncompressedSize);
+                take(entry.compressedSize);
+                take(entry.localHeader);
+                break;
+            }
+            extra = fieldEnd;
+        }
+
+        p = next;
+
+        // skip directories
+        if (nameLength && (name[nameLength - 1] == '/')) { continue; }
+
+        entries.push_back(entry);
+    }
+
+    return entries;
+}
+
+constexpr std::size_t ZipDirectory::LocalHeaderSize;
+
+void ZipDirectory::read(char *buf, std::size_t size, std::uint64_t offset)
+    const
+{
+    if (file_) {
+        const auto lease(file_->lease());
+        preadAll(lease.fd(), path_, buf, size, offset);
+        return;
+    }
+    preadAll(fd_, path_, buf, size, offset);
+}
+
+std::uint64_t ZipDirectory::dataStart(const Entry &entry) const
+{
+    char header[LocalSize];
+    read(header, sizeof(header), entry.localHeader);
+    return dataStart(entry, header);
+}
+
+std::uint64_t ZipDirectory::dataStart(const Entry &entry
+                                      , const char *header) const
+{
+    if (le32(header) != LocalSignature) {
+        LOGTHROW(err2, NotAnArchive)
+            << "Invalid local header of \"" << name(entry)
+            << "\" in zip archive at " << path_ << ".";
+    }
+
+    return (entry.localHeader + LocalSize
+            + le16(header + 26) + le16(header + 28));
+}
+
+ZipDirectory::Filedes ZipDirectory::extent(const Entry &entry
+                                           , std::uint64_t start) const
+{
+    const std::uint64_t end(start + entry.compressedSize);
+    if (end > fileSize_) {
+        LOGTHROW(err2, NotAnArchive)
+            << "Data of \"" << name(entry)
+            << "\" out of file bounds in zip archive at " << path_ << ".";
+    }
+
+    return { fd_, std::size_t(start), std::size_t(end) };
+}
+
+ZipDataOffsets::ZipDataOffsets(const ZipDirectory &directory
+                               , const ZipDirectory::Entries &entries)
+    : directory_(directory), entries_(entries)
+    , offsets_(new std::atomic<std::uint64_t>[entries.size()])
+    , stop_(false)
+{
+    for (std::size_t i(0), e(entries.size()); i != e; ++i) {
+        offsets_[i].store(0, std::memory_order_relaxed);
+    }
+}
+
+ZipDataOffsets::~ZipDataOffsets()
+{
+    stop_ = true;
+    if (resolver_.joinable()) { resolver_.join(); }
+}
+
+void ZipDataOffsets::resolveInBackground()
+{
+    if (resolver_.joinable() || entries_.empty()) { return; }
+    resolver_ = std::thread(&ZipDataOffsets::resolveAll, this);
+}
+
+std::size_t ZipDataOffsets::resolved() const
+{
+    std::size_t count(0);
+    for (std::size_t i(0), e(entries_.size()); i != e; ++i) {
+        if (offsets_[i].load(std::memory_order_relaxed)) { ++count; }
+    }
+    return count;
+}
+
+void ZipDataOffsets::resolveAll()
+{
+    dbglog::thread_id("zip-offsets");
+
+    // visit entries in archive order
+    std::vector<std::size_t> order(entries_.size());
+    for (std::size_t i(0), e(order.size()); i != e; ++i) { order[i] = i; }
+    std::sort(order.begin(), order.end()
+              , [this](std::size_t l, std::size_t r) {
+                  return (entries_[l].localHeader
+                          < entries_[r].localHeader);
+              });
+
+    // read archive through sliding window
+    const std::size_t WindowSize(1 << 20);
+    std::vector<char> window(WindowSize);
+    std::uint64_t windowStart(0), windowEnd(0);
+
+    try {
+        for (const auto index : order) {
+            if (stop_) { return; }
+            if (offsets_[index].load(std::memory_order_relaxed)) {
+                continue;
+            }
+
+            const auto &entry(entries_[index]);
+            const auto header(entry.localHeader);
+            if ((header < windowStart) || ((header + LocalSize) > windowEnd))
+            {
+                const std::size_t size
+                    (std::min<std::uint64_t>
+                     (WindowSize, directory_.fileSize() - header));
+                if (size < LocalSize) { break; }
+                directory_.read(window.data(), size, header);
+                windowStart = header;
+                windowEnd = header + size;
+            }
+
+            offsets_[index].store
+                (directory_.dataStart
+                 (entry, window.data() + (header - windowStart))
+                 , std::memory_order_relaxed);
+        }
+    } catch (const std::exception &e) {
+        // leave the rest to lazy resolution that reports errors properly
+        LOG(warn2) << "Background resolution of data offsets in zip archive "
+                   << directory_.path() << " failed: " << e.what() << ".";
+    }
+}
+
+} // namespace roarchive
@@ -0,0 +1,210 @@
+/**
+ * Copyright (c) 2017 Melown Technologies SE
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * *  Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * *  Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef roarchive_zipdir_hpp_included_
+#define roarchive_zipdir_hpp_included_
+
+#include <cstdint>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <thread>
+
+#include <boost/utility/string_ref.hpp>
+#include <boost/filesystem/path.hpp>
+
+#include "utility/substream.hpp"
+
+#include "fdmanager.hpp"
+
+namespace roarchive {
+
+/** Internal: zip central directory mapped into memory.
+ *
+ *  Only the central directory (not the whole archive) is mapped. Entries
+ *  are fixed-size records referencing their names inside the mapping, so
+ *  no per-entry allocation is needed.
+ */
+class ZipDirectory {
+public:
+    /** Packed central directory entry.
+     */
+    struct Entry {
+        /** Local file header position.
+         */
+        std::uint64_t localHeader;
+        std::uint64_t compressedSize;
+        std::uint64_t uncompressedSize;
+
+        /** Name position inside central directory.
+         */
+        std::uint32_t name;
+        std::uint16_t nameLength;
+
+        /** Compression method (0 = stored, 8 = deflate, ...)
+         */
+        std::uint16_t method;
+    };
+
+    typedef std::vector<Entry> Entries;
+    typedef utility::io::SubStreamDevice::Filedes Filedes;
+
+    /** Maps central directory of zip archive at given path.
+     */
+    ZipDirectory(const boost::filesystem::path &path, std::size_t fileLimit
+                 , const FdManager::pointer &fdManager = nullptr);
+    ~ZipDirectory();
+
+    ZipDirectory(const ZipDirectory&) = delete;
+    ZipDirectory& operator=(const ZipDirectory&) = delete;
+
+    /** Parses all file entries (directories are skipped), in archive order,
+     *  at most fileLimit entries.
+     */
+    Entries entries() const;
+
+    /** Entry name, points inside the mapping.
+     */
+    boost::string_ref name(const Entry &entry) const {
+        return { data_ + entry.name, entry.nameLength };
+    }
+
+    /** Location of entry's (possibly compressed) data. Reads local header.
+     */
+    Filedes data(const Entry &entry) const {
+        return extent(entry, dataStart(entry));
+    }
+
+    /** Data start of given entry. Reads local header.
+     */
+    std::uint64_t dataStart(const Entry &entry) const;
+
+    /** Data start of given entry from its already read local header.
+     */
+    std::uint64_t dataStart(const Entry &entry, const char *header) const;
+
+    /** Data location given entry's data start. Descriptor is -1 if
+     *  managed, see lease().
+     */
+    Filedes extent(const Entry &entry, std::uint64_t start) const;
+
+    /** Reads exactly size bytes at given archive offset.
+     */
+    void read(char *buf, std::size_t size, std::uint64_t offset) const;
+
+    /** Lends archive descriptor if managed, empty lease otherwise.
+     */
+    FdManager::Lease lease() const {
+        return file_ ? file_->lease() : FdManager::Lease();
+    }
+
+    /** Size of local file header without variable fields.
+     */
+    static constexpr std::size_t LocalHeaderSize = 30;
+
+    std::uint64_t fileSize() const { return fileSize_; }
+
+    const boost::filesystem::path& path() const { return path_; }
+
+    /** Size of mapped central directory.
+     */
+    std::size_t size() const { return size_; }
+
+private:
+    boost::filesystem::path path_;
+    std::size_t fileLimit_;
+    int fd_;
+    FdManager::File::pointer file_;
+    std::uint64_t fileSize_;
+
+    void *map_;
+    std::size_t mapSize_;
+
+    const char *data_;
+    std::size_t size_;
+    std::uint64_t count_;
+};
+
+/** Lazily resolved data offsets of mapped zip entries.
+ *
+ *  Offset of entry data is resolved from its local header on first access
+ *  and cached (atomically, lookups come from any thread). All offsets can
+ *  be resolved ahead in one sequential pass over the archive by a
+ *  background thread.
+ */
+class ZipDataOffsets {
+public:
+    typedef ZipDirectory::Filedes Filedes;
+
+    /** Entries must stay untouched for the lifetime of this object.
+     */
+    ZipDataOffsets(const ZipDirectory &directory
+                   , const ZipDirectory::Entries &entries);
+
+    /** Stops background resolution if running.
+     */
+    ~ZipDataOffsets();
+
+    ZipDataOffsets(const ZipDataOffsets&) = delete;
+    ZipDataOffsets& operator=(const ZipDataOffsets&) = delete;
+
+    /** Data location of entry at given position in entries.
+     */
+    Filedes data(std::size_t index) const {
+        const auto &entry(entries_[index]);
+        auto start(offsets_[index].load(std::memory_order_relaxed));
+        if (!start) {
+            start = directory_.dataStart(entry);
+            offsets_[index].store(start, std::memory_order_relaxed);
+        }
+        return directory_.extent(entry, start);
+    }
+
+    /** Starts resolving all offsets in background.
+     */
+    void resolveInBackground();
+
+    /** Number of resolved offsets.
+     */
+    std::size_t resolved() const;
+
+private:
+    void resolveAll();
+
+    const ZipDirectory &directory_;
+    const ZipDirectory::Entries &entries_;
+
+    /** Data start of each entry, 0 when not resolved yet (data never start
+     *  at 0 since they are always preceded by local header).
+     */
+    std::unique_ptr<std::atomic<std::uint64_t>[]> offsets_;
+
+    std::atomic<bool> stop_;
+    std::thread resolver_;
+};
+
+} // namespace roarchive
+
+#endif // roarchive_zipdir_hpp_included_